@@ -19,6 +19,7 @@
 #include <ayla/utf8.h>
 #include <ayla/timer.h>
 #include <ayla/tlv_access.h>
+#include <ayla/ayla_proto_mcu.h>
 #include <ada/err.h>
 #include <ada/ada_conf.h>
 #include <adb/adb.h>
@@ -28,6 +29,7 @@
 #include <libapp/libapp_ota.h>
 #include <host_proto/mcu_dev.h>
 #include "conf_tlv.h"
+#include "data_tlv.h"
 #include "hp_buf.h"
 #include "hp_buf_cb.h"
 #include "hp_buf_tlv.h"
@@ -77,7 +79,7 @@ static void conf_tlv_nak(struct hp_buf *bp, be16 req_id, u8 err)
 {
 	conf_tlv_cmd_set(bp, ACMD_NAK, req_id);
 	hp_buf_tlv_append_u8(bp, ATLV_ERR, err);
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -87,7 +89,7 @@ static void conf_tlv_nak_alloc(be16 req_id, u8 err)
 {
 	struct hp_buf *bp;
 
-	bp = hp_buf_alloc(0);
+	bp = hp_buf_alloc(HP_BUF_SMALL_LEN);
 	if (!bp) {
 		return;
 	}
@@ -103,6 +105,8 @@ static void conf_tlv_nak_alloc(be16 req_id, u8 err)
 static const struct ayla_tlv *conf_tlv_swap(const struct ayla_tlv *tlv,
 	struct ayla_tlv *new_tlv)
 {
+	s32 val;
+
 	switch (tlv->type) {
 	case ATLV_INT:
 	case ATLV_CENTS:
@@ -114,7 +118,9 @@ static const struct ayla_tlv *conf_tlv_swap(const struct ayla_tlv *tlv,
 			return new_tlv;
 		case sizeof(u32):
 			*new_tlv = *tlv;	/* struct copy type and len */
-			*(s32 *)TLV_VAL(new_tlv) = get_ua_be32(TLV_VAL(tlv));
+			/* the value after the 2-byte TLV header is unaligned */
+			val = get_ua_be32(TLV_VAL(tlv));
+			memcpy(TLV_VAL(new_tlv), &val, sizeof(val));
 			return new_tlv;
 		default:
 			break;
@@ -140,8 +146,7 @@ static int conf_tlv_name_to_tokens(enum conf_token *tk, unsigned int max_tokens,
 	if (plen < 0) {
 		return -1;
 	}
-	ASSERT(plen < ARRAY_LEN(wchar));
-	if (plen > max_tokens) {
+	if (plen >= ARRAY_LEN(wchar) || plen > max_tokens) {
 		return -1;
 	}
 	for (i = 0; i < plen; i++) {
@@ -231,7 +236,7 @@ static int conf_tlv_get(u16 req_id, const struct ayla_tlv *tlv)
 	/*
 	 * Send response.
 	 */
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 	return 0;
 }
 
@@ -327,7 +332,7 @@ void conf_send_mcu_time_info(void)
 		conf_get_state_path_val(state);
 	}
 	bp->len = length_estimate - state->rlen;
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -596,12 +601,13 @@ static void conf_tlv_reset_timeout(struct timer *tm)
 static void conf_tlv_reset_cb(struct hp_buf *bp)
 {
 	conf_tlv_cmd_req_set(bp, ACMD_HOST_RESET);
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 void host_proto_reset_send(void)
 {
-	hp_buf_callback_pend(conf_tlv_reset_cb);
+	hp_buf_callback_pend_pri(conf_tlv_reset_cb, HP_BUF_SMALL_LEN,
+	    HBCP_CTRL);
 }
 
 /*
@@ -610,12 +616,12 @@ void host_proto_reset_send(void)
 static void conf_tlv_ota_ready_cb(struct hp_buf *bp)
 {
 	conf_tlv_cmd_req_set(bp, ACMD_OTA_STAT);
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 static void conf_tlv_ota_ready(void)
 {
-	hp_buf_callback_pend(conf_tlv_ota_ready_cb);
+	hp_buf_callback_pend_size(conf_tlv_ota_ready_cb, HP_BUF_SMALL_LEN);
 }
 
 void conf_tlv_msg_init(void)
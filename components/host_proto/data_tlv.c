@@ -14,39 +14,60 @@
 #include <ayla/clock.h>
 #include <ayla/conf.h>
 #include <ayla/nameval.h>
+#include <ayla/timer.h>
 #include <ayla/ayla_spi_mcu.h>
 #include <ayla/ayla_proto_mcu.h>
 #include <ada/err.h>
 #include <ada/client.h>
 #include <ada/prop.h>
 #include <ada/ada_conf.h>
+#include <net/net.h>
 #include <host_proto/mcu_dev.h>
 
 #include "conf_tlv.h"
 #include "data_tlv.h"
 #include "host_prop.h"
+#include "host_proto_int.h"
 #include "prop_req.h"
+#include "prop_cache.h"
 #include "hp_buf.h"
 #include "hp_buf_cb.h"
 #include "hp_buf_tlv.h"
+#include "host_tlv.h"
 
 /*
  * The mcu_feature_mask is the set of features given by the MCU
- * ORed with those required by the agent or the transport.
+ * ORed with those required by the agent or the transport,
+ * less those the transport cannot do.
  * For example, UART requires MCU_DATAPOINT_CONFIRM.
  */
 u8 mcu_feature_mask;
 u8 mcu_feature_mask_min;
+u8 mcu_feature_mask_unsup;
+u8 mcu_feature_mask_ext;
 
-static u8 data_tlv_pkt[TLV_MAX_STR_LEN + 1];
-static u32 data_tlv_next_off;
-static size_t data_tlv_tot_size;
+/*
+ * Reassembly of a property value from the MCU sent in several packets.
+ */
+struct data_tlv_recv {
+	u8	active;		/* value in progress, offsets valid */
+	u16	req_id;
+	u32	next_off;
+	size_t	tot_size;
+	char	name[(PROP_LOC_LEN > PROP_NAME_LEN) ?
+		    PROP_LOC_LEN : PROP_NAME_LEN];
+	u8	pkt[TLV_MAX_STR_LEN + 1];
+};
+
+/*
+ * Sends from the MCU come one at a time, under ADS busy, and share one
+ * reassembly.  Replies to GETs may be interleaved when several GETs are
+ * outstanding, so each has its own, found by request ID.
+ */
+static struct data_tlv_recv data_tlv_mcu_recv;
+static struct data_tlv_recv data_tlv_resp[DATA_TLV_RESP_SLOTS];
 static u16 data_tlv_req_id;
-static u16 data_tlv_recv_req_id;
-static char data_tlv_recv_name[(PROP_LOC_LEN > PROP_NAME_LEN) ?
-    PROP_LOC_LEN : PROP_NAME_LEN];
 static char nak_prop_name[PROP_NAME_LEN];
-static u8 data_tlv_next_off_val;
 static struct prop_dp_meta dp_metadata[PROP_MAX_DPMETA];
 static struct prop_dp_meta *dp_meta_off = dp_metadata;
 #ifdef AYLA_HOST_PROP_ACK_SUPPORT
@@ -66,6 +87,70 @@ static u8 confirm_needed;
 static u8 dp_evt_notified;
 static u8 data_tlv_last_connect_mask;
 
+#define DATA_TLV_PACK_WAIT	5	/* ms to hold a packet for more props */
+#define DATA_TLV_PACK_MIN	8	/* send when less space is left */
+
+/*
+ * Most properties in a packed packet from the MCU: each needs at least
+ * a name and a value TLV of one byte.
+ */
+#define DATA_TLV_PACK_MAX \
+	(MCU_UART_JUMBO_LEN / (2 * (sizeof(struct ayla_tlv) + 1)))
+
+/*
+ * Properties to the MCU being gathered into one packet.
+ */
+struct data_tlv_pack_tx {
+	struct hp_buf *bp;	/* packet being filled, or NULL */
+	u16	req_id;
+	u8	use_req_id;
+	struct timer timer;	/* send the packet if no more props come */
+};
+static struct data_tlv_pack_tx data_tlv_pack_tx;
+
+/*
+ * Property in a packed packet from the MCU.
+ */
+struct data_tlv_pack_grp {
+	u16	off;		/* offset of first TLV */
+	u16	name;		/* offset of ATLV_NAME or ATLV_PROP_ID */
+	u8	err;		/* error for the NAK or 0 */
+};
+
+/*
+ * Packed packet from the MCU being sent one property at a time.
+ */
+struct data_tlv_pack_rx {
+	u8	active;
+	u8	waiting;	/* waiting for the service to finish a prop */
+	u16	req_id;
+	u16	count;		/* properties in the packet */
+	u16	cur;		/* property being sent */
+	size_t	len;
+	struct net_callback next_cb;
+	struct data_tlv_pack_grp grp[DATA_TLV_PACK_MAX];
+	u8	buf[MCU_UART_JUMBO_LEN];	/* TLVs of the packet */
+};
+static struct data_tlv_pack_rx data_tlv_pack_rx;
+
+/*
+ * Property name bound to an ID by the MCU.
+ * Bound IDs are chained by a hash of the name, so a send finds its ID
+ * without comparing every bound name.
+ */
+#define DATA_TLV_PROP_ID_HASH	16	/* hash chains, a power of 2 */
+
+struct data_tlv_prop_id {
+	u8	len;		/* name length, 0 if the ID is not bound */
+	u16	next;		/* next ID on the hash chain, or 0 */
+	char	name[PROP_NAME_LEN];
+};
+static struct data_tlv_prop_id data_tlv_prop_ids[DATA_TLV_PROP_IDS + 1];
+static u16 data_tlv_prop_id_hash[DATA_TLV_PROP_ID_HASH]; /* chain heads */
+static u16 data_tlv_prop_id_max;	/* highest ID bound */
+
+static int data_tlv_pack_rx_done(u16 req_id, u8 err);
+
 /*
  * Driver set ADS_BUSY
  */
@@ -86,6 +171,13 @@ static void data_tlv_set_dev_ads_busy(void)
  */
 static void data_tlv_clear_dev_ads_busy(void)
 {
+	/*
+	 * A GET reply may finish while the service still has a send or
+	 * get from the MCU.  ADS stays busy until that is done.
+	 */
+	if (host_prop_is_busy(NULL, NULL)) {
+		return;
+	}
 	if (mcu_dev->clear_ads) {
 		mcu_dev->clear_ads();
 	}
@@ -97,6 +189,118 @@ static void data_tlv_clear_dev_ads_busy(void)
 	prop_req_timeout_restart();
 }
 
+/*
+ * Forget the property IDs, at the start of a session with the MCU.
+ */
+static void data_tlv_prop_id_reset(void)
+{
+	memset(data_tlv_prop_ids, 0, sizeof(data_tlv_prop_ids));
+	memset(data_tlv_prop_id_hash, 0, sizeof(data_tlv_prop_id_hash));
+	data_tlv_prop_id_max = 0;
+}
+
+/*
+ * Return the hash chain for a property name, and set its length.
+ */
+static u16 *data_tlv_prop_id_chain(const char *name, size_t *lenp)
+{
+	const char *cp;
+	unsigned int hash = 0;
+
+	for (cp = name; *cp; cp++) {
+		hash = hash * 31 + (u8)*cp;
+	}
+	*lenp = cp - name;
+	return &data_tlv_prop_id_hash[hash & (DATA_TLV_PROP_ID_HASH - 1)];
+}
+
+/*
+ * Return the ID bound to a property name, or 0 if none.
+ */
+static u16 data_tlv_prop_id_find(const char *name)
+{
+	struct data_tlv_prop_id *pid;
+	size_t len;
+	u16 id;
+
+	if (!data_tlv_prop_id_max) {
+		return 0;
+	}
+	for (id = *data_tlv_prop_id_chain(name, &len); id; id = pid->next) {
+		pid = &data_tlv_prop_ids[id];
+		if (pid->len == len && !memcmp(pid->name, name, len)) {
+			return id;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Unbind a property ID, if bound.
+ */
+static void data_tlv_prop_id_unbind(u16 id)
+{
+	struct data_tlv_prop_id *pid = &data_tlv_prop_ids[id];
+	u16 *prev;
+	size_t len;
+
+	if (!pid->len) {
+		return;
+	}
+	prev = data_tlv_prop_id_chain(pid->name, &len);
+	while (*prev != id) {
+		prev = &data_tlv_prop_ids[*prev].next;
+	}
+	*prev = pid->next;
+	pid->next = 0;
+	pid->len = 0;
+}
+
+/*
+ * Bind a property ID to a name, replacing any earlier ID for the name.
+ * Returns 0 or the error for the NAK.
+ */
+static u8 data_tlv_prop_id_bind(u16 id, const char *name)
+{
+	struct data_tlv_prop_id *pid;
+	u16 *chain;
+	size_t len;
+
+	chain = data_tlv_prop_id_chain(name, &len);
+	if (!id || id > DATA_TLV_PROP_IDS || len >= sizeof(pid->name)) {
+		log_put(LOG_WARN "%s: prop \"%s\" id %u not bound",
+		    __func__, name, id);
+		return AERR_BAD_VAL;
+	}
+	data_tlv_prop_id_unbind(data_tlv_prop_id_find(name));
+	data_tlv_prop_id_unbind(id);
+	pid = &data_tlv_prop_ids[id];
+	memcpy(pid->name, name, len + 1);
+	pid->len = len;
+	pid->next = *chain;
+	*chain = id;
+	if (id > data_tlv_prop_id_max) {
+		data_tlv_prop_id_max = id;
+	}
+	return 0;
+}
+
+/*
+ * Append the ID the MCU bound to a property, or else its name.
+ */
+static void data_tlv_append_name(struct hp_buf *bp, const char *name)
+{
+	u16 id = data_tlv_prop_id_find(name);
+
+	if (!id) {
+		hp_buf_tlv_append_str(bp, ATLV_NAME, name);
+	} else if (id <= MAX_U8) {
+		hp_buf_tlv_append_u8(bp, ATLV_PROP_ID, id);
+	} else {
+		hp_buf_tlv_append_be16(bp, ATLV_PROP_ID, id);
+	}
+}
+
 /*
  * Set command fields in the buffer.
  * The buffer is guaranteed to be large enough to hold a command.
@@ -130,9 +334,12 @@ u16 data_tlv_prop_req_send(struct hp_buf *bp, const char *name)
 
 	req_id = data_tlv_cmd_req_set(bp, AD_SEND_PROP);
 	if (name) {
-		hp_buf_tlv_append(bp, ATLV_NAME, name, strlen(name));
+		data_tlv_append_name(bp, name);
+	} else {
+		/* a feature request starts a new session */
+		data_tlv_prop_id_reset();
 	}
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 	return req_id;
 }
 
@@ -143,20 +350,228 @@ void data_tlv_req_next(struct hp_buf *bp, u32 continuation, u16 *req_id)
 {
 	*req_id = data_tlv_cmd_req_set(bp, AD_SEND_NEXT_PROP);
 	hp_buf_tlv_append_be32(bp, ATLV_CONT, continuation);
+	data_tlv_enq_tx(bp);
+}
+
+/*
+ * Return non-zero if a property send may share a packet with others.
+ * Only whole values without metadata are packed.
+ */
+static int data_tlv_send_packable(enum ayla_tlv_type type, size_t val_len,
+	u32 offset, const struct data_tlv_meta *meta)
+{
+	if (!(mcu_feature_mask & MCU_PROP_PACK) || offset || meta) {
+		return 0;
+	}
+	switch (type) {
+	case ATLV_INT:
+	case ATLV_UINT:
+	case ATLV_CENTS:
+	case ATLV_BOOL:
+		return 1;
+	case ATLV_UTF8:
+	case ATLV_BIN:
+	case ATLV_SCHED:
+		return val_len <= TLV_MAX_LEN;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Send the packet of gathered properties, if any.
+ */
+void data_tlv_pack_flush(void)
+{
+	struct data_tlv_pack_tx *tx = &data_tlv_pack_tx;
+	struct hp_buf *bp = tx->bp;
+
+	if (!bp) {
+		return;
+	}
+	tx->bp = NULL;
+	host_proto_timer_cancel(&tx->timer);
+	mcu_dev->enq_tx(bp);
+}
+
+/*
+ * Queue a packet for the MCU.
+ * Properties being gathered go first, so nothing passes an update.
+ */
+void data_tlv_enq_tx(struct hp_buf *bp)
+{
+	data_tlv_pack_flush();
 	mcu_dev->enq_tx(bp);
 }
 
+static void data_tlv_pack_tx_timeout(struct timer *tm)
+{
+	data_tlv_pack_flush();
+}
+
+/*
+ * Add a property to the packet being gathered for the MCU.
+ * The buffer given starts a new packet or is freed.
+ * The packet is sent when full, ahead of any other packet for the MCU,
+ * once prop_req has no more sends queued, or after DATA_TLV_PACK_WAIT.
+ */
+static void data_tlv_send_pack(struct hp_buf *bp, const char *name,
+	const void *val, size_t val_len, enum ayla_tlv_type type,
+	u8 src, u16 req_id, u8 use_req_id, const char *ack_id)
+{
+	struct data_tlv_pack_tx *tx = &data_tlv_pack_tx;
+	size_t len;
+
+	/* space needed, not counting one TLV header */
+	len = sizeof(struct ayla_tlv) + strlen(name) + val_len;
+	if (src > 1) {
+		len += sizeof(struct ayla_tlv) + sizeof(u8);
+	}
+#ifdef AYLA_HOST_PROP_ACK_SUPPORT
+	if (ack_id && ack_id[0] != '\0') {
+		len += sizeof(struct ayla_tlv) + strlen(ack_id);
+	}
+#endif
+	if (tx->bp && (tx->use_req_id != use_req_id ||
+	    (use_req_id && tx->req_id != req_id) ||
+	    hp_buf_tlv_space(tx->bp) < len)) {
+		data_tlv_pack_flush();
+	}
+	if (tx->bp) {
+		hp_buf_free(bp);
+	} else {
+		if (use_req_id) {
+			data_tlv_cmd_set(bp, AD_RECV_TLV, req_id);
+		} else {
+			req_id = data_tlv_cmd_req_set(bp, AD_RECV_TLV);
+		}
+		tx->bp = bp;
+		tx->req_id = req_id;
+		tx->use_req_id = use_req_id;
+		host_proto_timer_set(&tx->timer, DATA_TLV_PACK_WAIT);
+	}
+	bp = tx->bp;
+
+	data_tlv_append_name(bp, name);
+	if (src > 1) {
+		hp_buf_tlv_append_u8(bp, ATLV_NODES, src);
+	}
+#ifdef AYLA_HOST_PROP_ACK_SUPPORT
+	if (ack_id && ack_id[0] != '\0') {
+		hp_buf_tlv_append_str(bp, ATLV_ACK_ID, ack_id);
+	}
+#endif
+	switch (type) {
+	case ATLV_INT:
+	case ATLV_UINT:
+	case ATLV_CENTS:
+		hp_buf_tlv_append_be32(bp, type, *(u32 *)val);
+		break;
+	case ATLV_BOOL:
+		hp_buf_tlv_append_u8(bp, type, *(u8 *)val);
+		break;
+	default:
+		hp_buf_tlv_append(bp, type, val, val_len);
+		break;
+	}
+	if (hp_buf_tlv_space(bp) < DATA_TLV_PACK_MIN) {
+		data_tlv_pack_flush();
+	}
+}
+
+/*
+ * Return the buffer size needed for the first packet of a property send,
+ * or 0 if the value may need a full-size buffer.
+ * This follows the TLVs appended by data_tlv_send().
+ */
+size_t data_tlv_send_size(const char *name, size_t val_len,
+	enum ayla_tlv_type type, const char *ack_id,
+	const struct data_tlv_meta *meta)
+{
+	size_t len;
+
+	if (data_tlv_send_packable(type, val_len, 0, meta)) {
+		return 0;	/* the packet may gather more props */
+	}
+	switch (type) {
+	case ATLV_INT:
+	case ATLV_UINT:
+	case ATLV_CENTS:
+		val_len = 4;
+		break;
+	case ATLV_BOOL:
+		val_len = 1;
+		break;
+	default:
+		break;
+	}
+	if (val_len > TLV_MAX_LEN) {
+		return 0;	/* partials fill the packet */
+	}
+	len = sizeof(struct ayla_cmd) +
+	    sizeof(struct ayla_tlv) + sizeof(u8) +		/* nodes */
+	    sizeof(struct ayla_tlv) + strlen(name) +
+	    sizeof(struct ayla_tlv) + sizeof(u32) +		/* len/off */
+	    sizeof(struct ayla_tlv) + sizeof(u8) +		/* msg type */
+	    sizeof(struct ayla_tlv) + val_len;
+	if (ack_id) {
+		len += sizeof(struct ayla_tlv) + strlen(ack_id);
+	}
+	if (meta) {
+		len += meta->len;
+	}
+	return len;
+}
+
+struct data_tlv_meta *data_tlv_meta_alloc(const struct prop_dp_meta *dp_meta)
+{
+	const struct prop_dp_meta *meta;
+	struct data_tlv_meta *tm;
+	struct ayla_tlv *tlv;
+	size_t len = 0;
+	size_t klen;
+	size_t vlen;
+	int i;
+
+	for (i = 0, meta = dp_meta; i < PROP_MAX_DPMETA &&
+	    meta->key[0] != '\0' && meta->value[0] != '\0'; i++, meta++) {
+		len += 2 * sizeof(struct ayla_tlv) +
+		    strlen(meta->key) + strlen(meta->value);
+	}
+	tm = malloc(sizeof(*tm) + len);
+	if (!tm) {
+		return NULL;
+	}
+	tm->len = len;
+	tlv = (struct ayla_tlv *)tm->tlvs;
+	for (i = 0, meta = dp_meta; len; i++, meta++) {
+		klen = strlen(meta->key);
+		vlen = strlen(meta->value);
+		ASSERT(klen <= TLV_MAX_LEN && vlen <= TLV_MAX_LEN);
+		tlv->type = ATLV_DPMETA;
+		tlv->len = klen;
+		memcpy(TLV_VAL(tlv), meta->key, klen);
+		tlv = TLV_NEXT(tlv);
+		tlv->type = ATLV_UTF8;
+		tlv->len = vlen;
+		memcpy(TLV_VAL(tlv), meta->value, vlen);
+		tlv = TLV_NEXT(tlv);
+		len -= 2 * sizeof(struct ayla_tlv) + klen + vlen;
+	}
+	return tm;
+}
+
 /*
  * Send property change to MCU.
  */
 enum ada_err data_tlv_send(struct hp_buf *bp, const char *name, const void *val,
 	size_t val_len, enum ayla_tlv_type type, u32 *offset,
 	u8 src, u16 req_id, u8 use_req_id,
-	const char *ack_id, const struct prop_dp_meta *dp_meta)
+	const char *ack_id, const struct data_tlv_meta *meta)
 {
 	u8 send_partials = 0;
 	size_t curr_val_len;
-	const struct prop_dp_meta *meta = dp_meta;
 	enum ayla_tlv_type msg_type = 0;
 
 	/*
@@ -180,6 +595,13 @@ enum ada_err data_tlv_send(struct hp_buf *bp, const char *name, const void *val,
 	default:
 		break;
 	}
+	if (data_tlv_send_packable(type, val_len, *offset, meta)) {
+		data_tlv_send_pack(bp, name, val, val_len, type,
+		    src, req_id, use_req_id, ack_id);
+		*offset = val_len;
+		return AE_OK;
+	}
+	data_tlv_pack_flush();
 	if (val_len > TLV_MAX_LEN) {
 		if (type != ATLV_UTF8 && type != ATLV_BIN) {
 			/* no support for > 255 size for non-strs and */
@@ -203,20 +625,17 @@ enum ada_err data_tlv_send(struct hp_buf *bp, const char *name, const void *val,
 		if (src > 1) {
 			hp_buf_tlv_append_u8(bp, ATLV_NODES, src);
 		}
-		meta = dp_meta;
-		while (meta && meta->key[0] != '\0' &&
-		    meta->value[0] != '\0') {
+		if (meta && (!*offset ||
+		    !(mcu_feature_mask_ext & MCU_DPMETA_ONCE))) {
 			/*
-			 * Metadata must be sent before prop name/val
-			 * because property value can be split over multiple
-			 * packets
+			 * Metadata must be sent before prop name/val.
+			 * With MCU_DPMETA_ONCE, the later packets of a
+			 * split value refer to it by their offset.
 			 */
-			hp_buf_tlv_append_str(bp, ATLV_DPMETA, meta->key);
-			hp_buf_tlv_append_str(bp, ATLV_UTF8, meta->value);
-			meta++;
+			hp_buf_tlv_append_tlvs(bp, meta->tlvs, meta->len);
 		}
 
-		hp_buf_tlv_append_str(bp, ATLV_NAME, name);
+		data_tlv_append_name(bp, name);
 
 #ifdef AYLA_HOST_PROP_ACK_SUPPORT
 		if (ack_id && ack_id[0] != '\0' && type != ATLV_FILE) {
@@ -253,6 +672,14 @@ enum ada_err data_tlv_send(struct hp_buf *bp, const char *name, const void *val,
 		case ATLV_SCHED:
 		case ATLV_UTF8:
 		case ATLV_LOC:
+			if (send_partials &&
+			    (mcu_feature_mask & MCU_UART_JUMBO)) {
+				/* fill the packet, the MCU joins the TLVs */
+				curr_val_len = hp_buf_tlv_append_split(bp,
+				    type, val, val_len);
+				ASSERT(curr_val_len);
+				break;
+			}
 			hp_buf_tlv_append(bp, type, val, curr_val_len);
 			break;
 		default:
@@ -261,13 +688,14 @@ enum ada_err data_tlv_send(struct hp_buf *bp, const char *name, const void *val,
 			hp_buf_free(bp);
 			return AE_INVAL_VAL;
 		}
-		mcu_dev->enq_tx(bp);
+		data_tlv_enq_tx(bp);
 		*offset += curr_val_len;
 		val_len -= curr_val_len;
 		val = (char *)val + curr_val_len;
 
 		if (val_len) {
-			bp = hp_buf_alloc(0);
+			/* a chain of smaller buffers can hold a full packet */
+			bp = hp_buf_alloc_chain(0);
 			if (!bp) {
 				return AE_BUF;
 			}
@@ -285,10 +713,10 @@ static void data_tlv_nak_req_cb(struct hp_buf *bp)
 {
 	data_tlv_cmd_set(bp, AD_NAK, nak_req_id);
 	hp_buf_tlv_append_u8(bp, ATLV_ERR, nak_err);
-	hp_buf_tlv_append_str(bp, ATLV_NAME, nak_prop_name);
+	data_tlv_append_name(bp, nak_prop_name);
 	hp_buf_tlv_append_u8(bp, ATLV_NODES, nak_fail_mask);
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 
 	if (nak_clear_ads) {
 		data_tlv_clear_dev_ads_busy();
@@ -302,6 +730,10 @@ static void data_tlv_nak_req_cb(struct hp_buf *bp)
 void data_tlv_nak_req(u16 req_id, u8 err,
 		const char *name, u8 failed_dests)
 {
+	if (data_tlv_pack_rx_done(req_id, err)) {
+		return;
+	}
+	data_tlv_pack_flush();
 	nak_req_id = req_id;
 	nak_err = err;
 	strncpy(nak_prop_name, name, sizeof(nak_prop_name) - 1);
@@ -310,7 +742,9 @@ void data_tlv_nak_req(u16 req_id, u8 err,
 
 	log_put(LOG_DEBUG "%s: prop '%s' req %#x err %#x",
 	    __func__, name, req_id, err);
-	hp_buf_callback_pend(data_tlv_nak_req_cb);
+	hp_buf_callback_pend_pri(data_tlv_nak_req_cb,
+	    sizeof(struct ayla_cmd) + 3 * sizeof(struct ayla_tlv) +
+	    2 * sizeof(u8) + strlen(nak_prop_name), HBCP_CTRL);
 }
 
 /*
@@ -322,7 +756,7 @@ static void data_tlv_internal_nak(u16 req_id, u8 err)
 {
 	struct hp_buf *bp;
 
-	bp = hp_buf_alloc(0);
+	bp = hp_buf_alloc(HP_BUF_SMALL_LEN);
 	if (!bp) {
 		log_put(LOG_WARN "%s: req %#x err %#x (not sent)",
 		    __func__, req_id, err);
@@ -334,7 +768,7 @@ static void data_tlv_internal_nak(u16 req_id, u8 err)
 
 	log_put(LOG_DEBUG "%s: req %#x err %#x", __func__, req_id, err);
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -353,7 +787,7 @@ static void data_tlv_nak_cb(struct hp_buf *bp)
 		    host_prop_backoff_time_remaining());
 	}
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 
 	if (nak_clear_ads) {
 		data_tlv_clear_dev_ads_busy();
@@ -368,7 +802,7 @@ static void data_tlv_error_cb(struct hp_buf *bp)
 	data_tlv_cmd_req_set(bp, AD_ERROR);
 	hp_buf_tlv_append_u8(bp, ATLV_ERR, notify_err);
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -382,7 +816,7 @@ static void data_tlv_confirmation_cb(struct hp_buf *bp)
 	}
 	data_tlv_cmd_set(bp, AD_CONFIRM, confirm_req_id);
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 	confirm_needed = 0;
 	data_tlv_clear_dev_ads_busy();
 }
@@ -392,12 +826,16 @@ static void data_tlv_confirmation_cb(struct hp_buf *bp)
  */
 void data_tlv_nak(u16 req_id, u8 err, u8 clear_ads)
 {
+	if (clear_ads && data_tlv_pack_rx_done(req_id, err)) {
+		return;
+	}
+	data_tlv_pack_flush();
 	nak_req_id = req_id;
 	nak_err = err;
 	nak_clear_ads = clear_ads;
 
 	log_put(LOG_DEBUG "%s: req %#x err %#x", __func__, req_id, err);
-	hp_buf_callback_pend(data_tlv_nak_cb);
+	hp_buf_callback_pend_pri(data_tlv_nak_cb, HP_BUF_SMALL_LEN, HBCP_CTRL);
 }
 
 static void data_tlv_batch_final(struct hp_buf *bp)
@@ -412,7 +850,7 @@ static void data_tlv_batch_final(struct hp_buf *bp)
 
 static void data_tlv_batch_status_send(struct hp_buf *bp)
 {
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 	data_tlv_nak_buf = NULL;
 }
 
@@ -436,8 +874,8 @@ void data_tlv_batch_status(u16 batch_id, u8 status, u8 final,
 		if (!bp) {
 			bp = hp_buf_alloc(ASPI_LEN_MAX);
 			if (!bp) {
-				hp_buf_callback_pend(callback ? callback :
-				    data_tlv_batch_final);
+				hp_buf_callback_pend_pri(callback ? callback :
+				    data_tlv_batch_final, 0, HBCP_CTRL);
 				return;
 			}
 
@@ -489,7 +927,8 @@ void data_tlv_batch_status(u16 batch_id, u8 status, u8 final,
 void data_tlv_error(u8 err)
 {
 	notify_err = err;
-	hp_buf_callback_pend(data_tlv_error_cb);
+	hp_buf_callback_pend_pri(data_tlv_error_cb, HP_BUF_SMALL_LEN,
+	    HBCP_CTRL);
 }
 
 /*
@@ -499,65 +938,65 @@ enum ada_err data_tlv_dp_create(u16 req_id, const char *location)
 {
 	struct hp_buf *bp;
 
-	bp = hp_buf_alloc(0);
+	bp = hp_buf_alloc(sizeof(struct ayla_cmd) + sizeof(struct ayla_tlv) +
+	    strlen(location));
 	if (!bp) {
 		return AE_BUF;
 	}
 
 	data_tlv_cmd_set(bp, AD_DP_RESP, req_id);
 	hp_buf_tlv_append_str(bp, ATLV_LOC, location);
-	data_tlv_next_off = 0;
-	mcu_dev->enq_tx(bp);
+	data_tlv_mcu_recv.next_off = 0;
+	data_tlv_enq_tx(bp);
 
 	return AE_OK;
 }
 
-static int data_tlv_check_offsets(u16 req_id, struct ayla_tlv *off_tlv,
-	struct ayla_tlv *len_tlv, const char *loc_or_name)
+static int data_tlv_check_offsets(struct data_tlv_recv *recv, u16 req_id,
+	const struct host_tlv *off_tlv, const struct host_tlv *len_tlv,
+	const char *loc_or_name)
 {
 	u32 off = 0;
 	u32 tot_tlv_len;
 
-	if (off_tlv) {
-		if (get_ua_with_len(off_tlv + 1, off_tlv->len, &off)) {
+	if (off_tlv->val) {
+		if (get_ua_with_len(off_tlv->val, off_tlv->len, &off)) {
 			return AERR_INVAL_OFF;
 		}
 	}
-	if (!data_tlv_next_off_val) {
+	if (!recv->active) {
 		if (off) {
 			return AERR_INVAL_OFF;
 		}
-		data_tlv_next_off = off;
-		data_tlv_next_off_val = 1;
-		data_tlv_recv_req_id = req_id;
-		strncpy(data_tlv_recv_name, loc_or_name,
-		    sizeof(data_tlv_recv_name) - 1);
-		if (len_tlv) {
-			if (get_ua_with_len(len_tlv + 1, len_tlv->len,
+		recv->next_off = off;
+		recv->active = 1;
+		recv->req_id = req_id;
+		strncpy(recv->name, loc_or_name, sizeof(recv->name) - 1);
+		if (len_tlv->val) {
+			if (get_ua_with_len(len_tlv->val, len_tlv->len,
 			    &tot_tlv_len)) {
 				return AERR_LEN_ERR;
 			}
 			if (tot_tlv_len > TLV_MAX_STR_LEN) {
 				return AERR_PROP_LEN;
 			}
-			data_tlv_tot_size = tot_tlv_len;
-		} else if (!data_tlv_next_off) {
-			data_tlv_tot_size = TLV_MAX_STR_LEN;
+			recv->tot_size = tot_tlv_len;
+		} else if (!recv->next_off) {
+			recv->tot_size = TLV_MAX_STR_LEN;
 		}
-	} else if (data_tlv_recv_req_id != req_id ||
-	    strcmp(data_tlv_recv_name, loc_or_name)) {
+	} else if (recv->req_id != req_id || strcmp(recv->name, loc_or_name)) {
 		return AERR_INVAL_REQ;
 	}
 	/*
 	* Check that transfer is contiguous with previous transfers.
 	* Generate NAK if needed.
 	*/
-	if (off != data_tlv_next_off) {
+	if (off != recv->next_off) {
 		log_put(LOG_WARN "%s: req_id=%x bad offset",
 		    __func__, req_id);
 		return AERR_INVAL_OFF;
 	}
-	if (off && len_tlv) {
+	if (off && len_tlv->val) {
 		log_put(LOG_WARN "%s: req_id=%x bad len TLV",
 		    __func__, req_id);
 		return AERR_INVAL_REQ;
@@ -567,27 +1006,74 @@ static int data_tlv_check_offsets(u16 req_id, struct ayla_tlv *off_tlv,
 }
 
 /*
- * Receive property update from mcu
+ * Add a portion of a property value to its reassembly.
  */
-int data_tlv_recv_tlv(u16 req_id, struct prop *prop, struct ayla_tlv *off_tlv,
-		struct ayla_tlv *len_tlv)
+static int data_tlv_recv_val(struct data_tlv_recv *recv, u16 req_id,
+	struct prop *prop, const struct host_tlv *off_tlv,
+	const struct host_tlv *len_tlv)
 {
-	u8 err = AE_OK;
+	u8 err;
 
-	if (host_prop_is_busy(__func__, prop->name)) {
-		return AERR_ADS_BUSY;
-	}
-	err = data_tlv_check_offsets(req_id, off_tlv, len_tlv, prop->name);
+	err = data_tlv_check_offsets(recv, req_id, off_tlv, len_tlv,
+	    prop->name);
 	if (err) {
 		return err;
 	}
-	if (data_tlv_next_off + prop->len > data_tlv_tot_size) {
+	if (recv->next_off + prop->len > recv->tot_size) {
 		return AERR_PROP_LEN;
 	}
-	memcpy(data_tlv_pkt + data_tlv_next_off, prop->val, prop->len);
-	data_tlv_next_off += prop->len;
+	memcpy(recv->pkt + recv->next_off, prop->val, prop->len);
+	recv->next_off += prop->len;
+	return 0;
+}
 
-	return err;
+/*
+ * Receive property update from mcu
+ */
+int data_tlv_recv_tlv(u16 req_id, struct prop *prop,
+		const struct host_tlv *off_tlv, const struct host_tlv *len_tlv)
+{
+	if (host_prop_is_busy(__func__, prop->name)) {
+		return AERR_ADS_BUSY;
+	}
+	return data_tlv_recv_val(&data_tlv_mcu_recv, req_id, prop, off_tlv,
+	    len_tlv);
+}
+
+/*
+ * Find the reassembly of a GET reply, or a free one for a new reply.
+ * Returns NULL if all are taken by other replies.
+ */
+static struct data_tlv_recv *data_tlv_resp_find(u16 req_id)
+{
+	struct data_tlv_recv *recv;
+	struct data_tlv_recv *unused = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LEN(data_tlv_resp); i++) {
+		recv = &data_tlv_resp[i];
+		if (!recv->active) {
+			if (!unused) {
+				unused = recv;
+			}
+		} else if (recv->req_id == req_id) {
+			return recv;
+		}
+	}
+	return unused;
+}
+
+/*
+ * Drop any part of a GET reply received, as the GET has ended.
+ */
+void data_tlv_resp_end(u16 req_id)
+{
+	struct data_tlv_recv *recv;
+
+	recv = data_tlv_resp_find(req_id);
+	if (recv && recv->req_id == req_id) {
+		recv->active = 0;
+	}
 }
 
 #ifdef AYLA_HOST_PROP_FILE_SUPPORT
@@ -595,39 +1081,41 @@ int data_tlv_recv_tlv(u16 req_id, struct prop *prop, struct ayla_tlv *off_tlv,
  * Receive a data point value portion from the MCU.
  */
 static int data_tlv_dp_rx(u16 req_id, struct prop *prop,
-	struct ayla_tlv *loc_tlv, struct ayla_tlv *off_tlv,
-	struct ayla_tlv *len_tlv, u8 eof)
+	const struct host_tlv *loc_tlv, const struct host_tlv *off_tlv,
+	const struct host_tlv *len_tlv, u8 eof)
 {
+	static const struct host_tlv no_tlv;
 	u8 err;
 	char loc[PROP_LOC_LEN];
 
-	if (!loc_tlv) {
+	if (!loc_tlv->val) {
 		log_put(LOG_WARN "data_tlv_dp_rx: missing or bad loc TLV");
 		return AERR_INVAL_DP;
 	}
 	if (loc_tlv->len >= sizeof(loc)) {
 		return AERR_INVAL_DP;
 	}
-	strncpy(loc, (char *)(loc_tlv + 1), loc_tlv->len);
+	strncpy(loc, (const char *)loc_tlv->val, loc_tlv->len);
 	loc[loc_tlv->len] = '\0';
 	if (host_prop_is_busy(__func__, loc)) {
 		return AERR_ADS_BUSY;
 	}
-	err = data_tlv_check_offsets(req_id, off_tlv, NULL, loc);
+	err = data_tlv_check_offsets(&data_tlv_mcu_recv, req_id, off_tlv,
+	    &no_tlv, loc);
 	if (err) {
 		return err;
 	}
-	if (len_tlv && get_ua_with_len(len_tlv + 1, len_tlv->len,
-	    (u32 *)&data_tlv_tot_size)) {
+	if (len_tlv->val && get_ua_with_len(len_tlv->val, len_tlv->len,
+	    (u32 *)&data_tlv_mcu_recv.tot_size)) {
 		return AERR_LEN_ERR;
 	}
-	memcpy(data_tlv_pkt, prop->val, prop->len);
+	memcpy(data_tlv_mcu_recv.pkt, prop->val, prop->len);
 	data_tlv_set_dev_ads_busy();
-	prop->val = data_tlv_pkt;
-	err = prop_dp_put_data(req_id, prop, loc, data_tlv_next_off,
-	    data_tlv_tot_size, eof);
+	prop->val = data_tlv_mcu_recv.pkt;
+	err = prop_dp_put_data(req_id, prop, loc, data_tlv_mcu_recv.next_off,
+	    data_tlv_mcu_recv.tot_size, eof);
 	if (!err) {
-		data_tlv_next_off += prop->len;
+		data_tlv_mcu_recv.next_off += prop->len;
 	} else if (err != AERR_ADS_BUSY) {
 		data_tlv_clear_dev_ads_busy();
 	}
@@ -670,7 +1158,7 @@ enum ada_err data_tlv_dp_stream_resp(u16 req_id, enum ayla_tlv_type type,
 		hp_buf_tlv_append(bp, ATLV_EOF, NULL, 0);
 	}
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 	return AE_OK;
 }
 #endif /* AYLA_FILE_PROP_SUPPORT */
@@ -687,7 +1175,7 @@ static void data_tlv_send_connect_mask(struct hp_buf *bp)
 	connect_mask = client_get_connectivity_mask();
 	hp_buf_tlv_append_u8(bp, ATLV_NODES, connect_mask);
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 
 	data_tlv_last_connect_mask = connect_mask;
 }
@@ -698,7 +1186,7 @@ static void data_tlv_send_connect_mask(struct hp_buf *bp)
 static void data_tlv_send_prop_notify(struct hp_buf *bp)
 {
 	data_tlv_cmd_req_set(bp, AD_PROP_NOTIFY);
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -728,7 +1216,7 @@ static void data_tlv_send_client_notify(struct hp_buf *bp)
 	if (tlv_ev_mask & CLIENT_EVENT_REG) {
 		hp_buf_tlv_append_u8(bp, ATLV_REGINFO, 1);
 	}
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -743,7 +1231,8 @@ void data_tlv_send_connectivity(u8 mask)
 	if ((mask & data_tlv_last_connect_mask & NODES_ADS) != 0) {
 		host_prop_enable_listen();
 	}
-	hp_buf_callback_pend(data_tlv_send_connect_mask);
+	hp_buf_callback_pend_size(data_tlv_send_connect_mask,
+	    HP_BUF_SMALL_LEN);
 }
 
 /*
@@ -752,7 +1241,7 @@ void data_tlv_send_connectivity(u8 mask)
 void data_tlv_send_prop_notification(void)
 {
 	dp_evt_notified = 1;
-	hp_buf_callback_pend(data_tlv_send_prop_notify);
+	hp_buf_callback_pend_size(data_tlv_send_prop_notify, HP_BUF_SMALL_LEN);
 }
 
 /*
@@ -764,7 +1253,8 @@ void adap_conf_reg_changed(void)
 	struct ada_conf *cf = &ada_conf;
 
 	log_put(LOG_INFO "data_tlv: user reg %u", cf->reg_user);
-	hp_buf_callback_pend(data_tlv_send_client_notify);
+	hp_buf_callback_pend_size(data_tlv_send_client_notify,
+	    HP_BUF_SMALL_LEN);
 }
 
 /*
@@ -774,14 +1264,14 @@ enum ada_err data_tlv_send_eof(u16 req_id)
 {
 	struct hp_buf *bp;
 
-	bp = hp_buf_alloc(0);
+	bp = hp_buf_alloc(HP_BUF_SMALL_LEN);
 	if (!bp) {
 		return AE_BUF;
 	}
 	data_tlv_cmd_set(bp, AD_RECV_TLV, req_id);
 	hp_buf_tlv_append(bp, ATLV_EOF, NULL, 0);
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 
 	return AE_OK;
 }
@@ -792,8 +1282,8 @@ enum ada_err data_tlv_send_eof(u16 req_id)
 static void data_tlv_send_echo_failure(struct hp_buf *bp)
 {
 	data_tlv_cmd_req_set(bp, AD_ECHO_FAIL);
-	hp_buf_tlv_append_str(bp, ATLV_NAME, echo_fail_name);
-	mcu_dev->enq_tx(bp);
+	data_tlv_append_name(bp, echo_fail_name);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -802,7 +1292,9 @@ static void data_tlv_send_echo_failure(struct hp_buf *bp)
 void data_tlv_send_echofail(char *prop_name)
 {
 	strncpy(echo_fail_name, prop_name, sizeof(echo_fail_name) - 1);
-	hp_buf_callback_pend(data_tlv_send_echo_failure);
+	hp_buf_callback_pend_pri(data_tlv_send_echo_failure,
+	    sizeof(struct ayla_cmd) + sizeof(struct ayla_tlv) +
+	    strlen(echo_fail_name), HBCP_CTRL);
 }
 
 static int data_tlv_check_dp_metadata(struct prop *prop)
@@ -828,68 +1320,848 @@ static int data_tlv_check_dp_metadata(struct prop *prop)
 	return 0;
 }
 
-#ifdef AYLA_HOST_PROP_ACK_SUPPORT
 /*
- * Process ack TLV to find out ack_id, ack_status
- * and ack_message.
+ * State for one data packet from the MCU, filled in by the TLV handlers.
  */
-static int data_tlv_process_ack(struct ayla_tlv *tlv)
-{
-	size_t rlen = tlv->len;
-	size_t tlen = 0;
-	u8 err = 0;
-	void *vp;
+struct data_tlv_rx {
+	struct prop prop;
+	union {
+		u32	uval;
+		s32	sval;
+	} val;			/* integer and boolean values */
+	u32	continuation;
+	u16	req_id;
+	u8	nak;
+	u8	eof;
+	u8	node_mask;
+	u8	features_given;
+	u8	features;
+	u8	features_ext;
+	u8	dp_meta_recvd;
+	const u8 *val_end;	/* end of a value that may be continued */
+	const u8 *name_end;	/* end of the last ATLV_NAME */
+	struct host_tlv off;
+	struct host_tlv len;
+#ifdef AYLA_HOST_PROP_FILE_SUPPORT
+	struct host_tlv loc;
+#endif
+#ifdef AYLA_HOST_PROP_BATCH_SUPPORT
+	struct host_tlv batch_id;
+	u8	batch_end;
+	unsigned long long timestamp;
+#endif
+#ifdef AYLA_HOST_PROP_MSG_SUPPORT
+	enum ayla_tlv_type msg_type;
+#endif
+	char	name[PROP_NAME_LEN];
+};
 
-	tlv = (struct ayla_tlv *)((char *)(tlv + 1));
+/*
+ * Get a signed value sent in 1, 2 or 4 bytes.
+ */
+static int data_tlv_rx_s32(const struct host_tlv *tlv, s32 *valp)
+{
+	switch (tlv->len) {
+	case 1:
+		*valp = (s8)tlv->val[0];
+		break;
+	case 2:
+		*valp = (s16)get_ua_be16(tlv->val);
+		break;
+	case 4:
+		*valp = (s32)get_ua_be32(tlv->val);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
 
-	while (rlen > 0) {
-		if (rlen < sizeof(*tlv)) {
-			log_put("tlv_rx TLV len err rlen %u", rlen);
-			err = AERR_LEN_ERR;
-			break;
-		}
-		rlen -= sizeof(*tlv);
-		tlen = tlv->len;
-		if (rlen < tlen) {
-			log_put("tlv_rx TLV len err type %d tlen %u rlen %u",
-			    tlv->type, tlen, rlen);
-			err = AERR_LEN_ERR;
-			break;
-		}
-		vp = tlv + 1;
-		rlen -= tlen;
+static u8 data_tlv_rx_name(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	size_t len = tlv->len;
 
-		switch (tlv->type) {
+	if (len > sizeof(rx->name) - 1) {
+		len = sizeof(rx->name) - 1;
+	}
+	memcpy(rx->name, tlv->val, len);
+	rx->name[len] = '\0';
+	if (!prop_name_valid(rx->name)) {
+		return AERR_INVAL_NAME;
+	}
+	rx->prop.name = rx->name;
+	rx->name_end = tlv->val + tlv->len;
+	rx->prop.fmt_flags = 0;
+	rx->prop.type = ATLV_INVALID;
+	rx->prop.val = NULL;
+	return 0;
+}
+
+/*
+ * A property ID right after a name binds the ID to it.
+ * Otherwise it stands for the name bound to it, which the property
+ * points to rather than copying.
+ */
+static u8 data_tlv_rx_prop_id(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	struct data_tlv_prop_id *pid;
+	u16 id;
+
+	id = tlv->len == sizeof(u8) ? tlv->val[0] : get_ua_be16(tlv->val);
+	if (rx->name_end &&
+	    tlv->val == rx->name_end + sizeof(struct ayla_tlv)) {
+		return data_tlv_prop_id_bind(id, rx->name);
+	}
+	if (!id || id > data_tlv_prop_id_max) {
+		return AERR_UNK_PROP;
+	}
+	pid = &data_tlv_prop_ids[id];
+	if (!pid->len) {
+		return AERR_UNK_PROP;
+	}
+	rx->prop.name = pid->name;
+	rx->prop.fmt_flags = 0;
+	rx->prop.type = ATLV_INVALID;
+	rx->prop.val = NULL;
+	return 0;
+}
+
+static u8 data_tlv_rx_format(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	rx->prop.fmt_flags = tlv->val[0];
+	return 0;
+}
+
+static u8 data_tlv_rx_int(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	if (data_tlv_rx_s32(tlv, &rx->val.sval)) {
+		return AERR_LEN_ERR;
+	}
+	rx->prop.type = tlv->type;
+	rx->prop.val = &rx->val.sval;
+	rx->prop.len = sizeof(rx->val.sval);
+	return 0;
+}
+
+static u8 data_tlv_rx_uint(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	if (get_ua_with_len(tlv->val, tlv->len, &rx->val.uval)) {
+		return AERR_LEN_ERR;
+	}
+	rx->prop.type = tlv->type;
+	rx->prop.val = &rx->val.uval;
+	rx->prop.len = sizeof(rx->val.uval);
+	return 0;
+}
+
+static u8 data_tlv_rx_bool(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	if (tlv->val[0] > 1) {
+		return AERR_INVAL_TLV;
+	}
+	rx->val.uval = tlv->val[0];
+	rx->prop.type = tlv->type;
+	rx->prop.val = &rx->val.uval;
+	rx->prop.len = sizeof(rx->val.uval);
+	return 0;
+}
+
+static u8 data_tlv_rx_cont(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	rx->continuation = get_ua_be32(tlv->val);
+	return 0;
+}
+
+/*
+ * String or binary value, or the value of a datapoint metadata pair.
+ */
+static u8 data_tlv_rx_str(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	struct prop *prop = &rx->prop;
+
+	if (rx->dp_meta_recvd) {
+		rx->dp_meta_recvd = 0;
+		if (!tlv->len || tlv->len > PROP_DPMETA_VAL_LEN) {
+			return AERR_DPMETA;
+		}
+		memcpy(dp_meta_off->value, tlv->val, tlv->len);
+		dp_meta_off->value[tlv->len] = '\0';
+		dp_meta_off++;
+		return 0;
+	}
+	if ((mcu_feature_mask & MCU_UART_JUMBO) && prop->type == tlv->type &&
+	    tlv->val == rx->val_end + sizeof(struct ayla_tlv)) {
+		/* rest of a long value, join it in place */
+		memmove((u8 *)prop->val + prop->len, tlv->val, tlv->len);
+		prop->len += tlv->len;
+		rx->val_end = tlv->val + tlv->len;
+		return 0;
+	}
+	prop->type = tlv->type;
+	prop->val = (void *)tlv->val;
+	prop->len = tlv->len;
+	rx->val_end = tlv->val + tlv->len;
+	return 0;
+}
+
+#ifdef AYLA_HOST_PROP_FILE_SUPPORT
+static u8 data_tlv_rx_loc(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	rx->loc = *tlv;
+	return 0;
+}
+#endif
+
+static u8 data_tlv_rx_len(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	rx->len = *tlv;
+	return 0;
+}
+
+static u8 data_tlv_rx_off(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	rx->off = *tlv;
+	return 0;
+}
+
+static u8 data_tlv_rx_nodes(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	rx->node_mask = tlv->val[0];
+	if (!rx->node_mask) {
+		return AERR_INVAL_TLV;	/* dest mask can't be 0 */
+	}
+	return 0;
+}
+
+static u8 data_tlv_rx_eof(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	rx->eof = 1;
+	return 0;
+}
+
+static u8 data_tlv_rx_echo(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	rx->prop.echo = 1;
+	return 0;
+}
+
+static u8 data_tlv_rx_err(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	if (rx->nak && tlv->len == 1) {
+		/* received nak from MCU */
+		log_put(LOG_DEBUG "rx nak %#x for req_id %#x",
+		    tlv->val[0], rx->req_id);
+	}
+	rx->nak = 1;	/* received AD_PROP_RESP err (feat mask) */
+	return 0;
+}
+
+static u8 data_tlv_rx_features(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	rx->features_given = 1;
+	rx->features = tlv->val[0];
+	rx->features_ext = tlv->len > 1 ? tlv->val[1] : 0;
+	return 0;
+}
+
+/*
+ * Datapoint metadata key.  The value follows in a UTF-8 TLV.
+ */
+static u8 data_tlv_rx_dpmeta(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	if (dp_meta_off >= dp_metadata + PROP_MAX_DPMETA ||
+	    rx->prop.name[0] != '\0') {
+		return AERR_DPMETA;
+	}
+	memcpy(dp_meta_off->key, tlv->val, tlv->len);
+	dp_meta_off->key[tlv->len] = '\0';
+	rx->dp_meta_recvd = 1;
+	return 0;
+}
+
+#ifdef AYLA_HOST_PROP_ACK_SUPPORT
+/*
+ * Process ack TLV to find out ack_id, ack_status
+ * and ack_message.
+ */
+static u8 data_tlv_rx_ack(struct data_tlv_rx *rx, const struct host_tlv *ack)
+{
+	struct host_tlv_iter it;
+	struct host_tlv tlv;
+	int rc;
+
+	host_tlv_iter_init(&it, ack->val, ack->len);
+	while ((rc = host_tlv_next(&it, &tlv)) > 0) {
+		switch (tlv.type) {
 		case ATLV_UTF8:
-			if (tlen > PROP_ACK_ID_LEN) {
-				err = AERR_LEN_ERR;
-				break;
+			if (tlv.len > PROP_ACK_ID_LEN) {
+				return AERR_INVAL_ACK;
 			}
-			memcpy(prop_ack.id, vp, tlen);
-			prop_ack.id[tlen] = '\0';
+			memcpy(prop_ack.id, tlv.val, tlv.len);
+			prop_ack.id[tlv.len] = '\0';
 			break;
 		case ATLV_INT:
-			if (tlv->len > sizeof(s32)) {
-				err = AERR_BAD_VAL;
-				break;
+			if (data_tlv_rx_s32(&tlv, &prop_ack.msg)) {
+				return AERR_INVAL_ACK;
 			}
-			prop_ack.msg = (s32)get_ua_be32(vp);
 			break;
 		case ATLV_ERR:
-			if (tlv->len != 1) {
-				err = AERR_LEN_ERR;
-				break;
+			if (tlv.len != 1) {
+				return AERR_INVAL_ACK;
 			}
-			prop_ack.status = *(u8 *)vp;
+			prop_ack.status = tlv.val[0];
 			break;
 		default:
+			return AERR_INVAL_ACK;
+		}
+	}
+	if (rc < 0) {
+		return AERR_INVAL_ACK;
+	}
+	rx->prop.ack = &prop_ack;
+	rx->prop.type = ATLV_ACK_ID;
+	return 0;
+}
+#endif
+
+#ifdef AYLA_HOST_PROP_MSG_SUPPORT
+static u8 data_tlv_rx_msg_type(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	rx->msg_type = (enum ayla_tlv_type)tlv->val[0];
+	return 0;
+}
+#endif
+
+#ifdef AYLA_HOST_PROP_BATCH_SUPPORT
+static u8 data_tlv_rx_batch_id(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	rx->batch_id = *tlv;
+	return 0;
+}
+
+static u8 data_tlv_rx_batch_end(struct data_tlv_rx *rx,
+		const struct host_tlv *tlv)
+{
+	rx->batch_end = 1;
+	return 0;
+}
+
+static u8 data_tlv_rx_time(struct data_tlv_rx *rx, const struct host_tlv *tlv)
+{
+	rx->timestamp = get_ua_be64(tlv->val);
+	return 0;
+}
+#endif
+
+/*
+ * Handling of a TLV type in data packets from the MCU.
+ * A TLV with a length outside min_len to max_len gets len_err, without
+ * calling the handler.
+ */
+struct data_tlv_rx_type {
+	u8 (*handler)(struct data_tlv_rx *rx, const struct host_tlv *tlv);
+	u8	min_len;
+	u8	max_len;
+	u8	len_err;
+};
+
+#define DATA_TLV_RX_ANY(handler) { handler, 0, TLV_MAX_LEN, 0 }
+#define DATA_TLV_RX_LEN(handler, min, max, err) { handler, min, max, err }
+
+/*
+ * TLV types accepted in data packets, by type.
+ * Types past the end of the table or without a handler are unknown.
+ */
+static const struct data_tlv_rx_type data_tlv_rx_types[] = {
+	[ATLV_NAME] = DATA_TLV_RX_ANY(data_tlv_rx_name),
+	[ATLV_INT] = DATA_TLV_RX_LEN(data_tlv_rx_int, 1, 4, AERR_LEN_ERR),
+	[ATLV_UINT] = DATA_TLV_RX_ANY(data_tlv_rx_uint),
+	[ATLV_BIN] = DATA_TLV_RX_ANY(data_tlv_rx_str),
+	[ATLV_UTF8] = DATA_TLV_RX_ANY(data_tlv_rx_str),
+	[ATLV_ERR] = DATA_TLV_RX_ANY(data_tlv_rx_err),
+	[ATLV_FORMAT] = DATA_TLV_RX_LEN(data_tlv_rx_format, 1, 1,
+	    AERR_LEN_ERR),
+	[ATLV_FEATURES] = DATA_TLV_RX_LEN(data_tlv_rx_features, 1, 2,
+	    AERR_LEN_ERR),
+	[ATLV_NODES] = DATA_TLV_RX_LEN(data_tlv_rx_nodes, 1, 1, AERR_LEN_ERR),
+	[ATLV_ECHO] = DATA_TLV_RX_ANY(data_tlv_rx_echo),
+	[ATLV_CONT] = DATA_TLV_RX_LEN(data_tlv_rx_cont, 4, 4, AERR_LEN_ERR),
+	[ATLV_LEN] = DATA_TLV_RX_ANY(data_tlv_rx_len),
+	[ATLV_OFF] = DATA_TLV_RX_ANY(data_tlv_rx_off),
+#ifdef AYLA_HOST_PROP_FILE_SUPPORT
+	[ATLV_LOC] = DATA_TLV_RX_ANY(data_tlv_rx_loc),
+#endif
+	[ATLV_EOF] = DATA_TLV_RX_ANY(data_tlv_rx_eof),
+	[ATLV_BOOL] = DATA_TLV_RX_LEN(data_tlv_rx_bool, 1, 1, AERR_LEN_ERR),
+	[ATLV_SCHED] = DATA_TLV_RX_ANY(data_tlv_rx_str),
+	[ATLV_CENTS] = DATA_TLV_RX_LEN(data_tlv_rx_int, 1, 4, AERR_LEN_ERR),
+	[ATLV_DPMETA] = DATA_TLV_RX_LEN(data_tlv_rx_dpmeta, 1,
+	    PROP_DPMETA_KEY_LEN, AERR_DPMETA),
+#ifdef AYLA_HOST_PROP_ACK_SUPPORT
+	[ATLV_ACK_ID] = DATA_TLV_RX_ANY(data_tlv_rx_ack),
+#endif
+#ifdef AYLA_HOST_PROP_MSG_SUPPORT
+	[ATLV_MSG_TYPE] = DATA_TLV_RX_LEN(data_tlv_rx_msg_type, 1, 1,
+	    AERR_LEN_ERR),
+#endif
+#ifdef AYLA_HOST_PROP_BATCH_SUPPORT
+	[ATLV_BATCH_ID] = DATA_TLV_RX_ANY(data_tlv_rx_batch_id),
+	[ATLV_BATCH_END] = DATA_TLV_RX_ANY(data_tlv_rx_batch_end),
+	[ATLV_TIME_MS] = DATA_TLV_RX_LEN(data_tlv_rx_time, 8, 8,
+	    AERR_INVAL_TLV),
+#endif
+	[ATLV_PROP_ID] = DATA_TLV_RX_LEN(data_tlv_rx_prop_id, 1, 2,
+	    AERR_LEN_ERR),
+};
+
+/*
+ * Parse the TLVs of a data packet.
+ * Values are left in the packet and only viewed, except for names and
+ * metadata, which are copied to be NUL-terminated.
+ * Returns 0 or the error for the NAK.
+ */
+static u8 data_tlv_rx_parse(struct data_tlv_rx *rx, const void *buf,
+		size_t len)
+{
+	const struct data_tlv_rx_type *rt;
+	struct host_tlv_iter it;
+	struct host_tlv tlv;
+	int rc;
+	u8 err;
+
+	host_tlv_iter_init(&it, buf, len);
+	while ((rc = host_tlv_next(&it, &tlv)) > 0) {
+		if (rx->dp_meta_recvd && tlv.type != ATLV_UTF8) {
+			return AERR_DPMETA;
+		}
+		if (tlv.type >= ARRAY_LEN(data_tlv_rx_types)) {
+			return AERR_UNK_TYPE;
+		}
+		rt = &data_tlv_rx_types[tlv.type];
+		if (!rt->handler) {
+			return AERR_UNK_TYPE;
+		}
+		if (tlv.len < rt->min_len || tlv.len > rt->max_len) {
+			return rt->len_err;
+		}
+		err = rt->handler(rx, &tlv);
+		if (err) {
+			return err;
+		}
+	}
+	if (rc < 0) {
+		return AERR_LEN_ERR;
+	}
+	return 0;
+}
+
+/*
+ * Deliver a property value from the MCU, once all of it has arrived.
+ */
+static u8 data_tlv_rx_prop(struct data_tlv_rx *rx, u8 opcode)
+{
+	struct prop *prop = &rx->prop;
+	struct data_tlv_recv *recv = &data_tlv_mcu_recv;
+	u8 err;
+	int rc;
+
+	if (!prop->val) {
+		return AERR_INVAL_TLV;
+	}
+
+	/*
+	 * A GET reply goes to the waiting request, not to the service,
+	 * so it is taken even while ADS is busy.
+	 */
+	if (opcode == AD_SEND_PROP_RESP) {
+		recv = data_tlv_resp_find(rx->req_id);
+		if (!recv) {
+			log_put(LOG_WARN "%s: req_id=%x no room for reply",
+			    __func__, rx->req_id);
+			return AERR_INVAL_REQ;
+		}
+		err = data_tlv_recv_val(recv, rx->req_id, prop, &rx->off,
+		    &rx->len);
+	} else {
+		err = data_tlv_recv_tlv(rx->req_id, prop, &rx->off, &rx->len);
+	}
+	if (err) {
+		return err;
+	}
+	if (!rx->eof && recv->next_off != recv->tot_size &&
+	    (rx->off.val || rx->len.val)) {
+		return 0;	/* more to come */
+	}
+	prop->val = recv->pkt;
+	prop->len = recv->next_off;
+	recv->pkt[recv->next_off] = '\0';
+	if (opcode == AD_SEND_PROP_RESP) {
+		recv->active = 0;	/* value stays until the next reply */
+	} else {
+		rc = data_tlv_check_dp_metadata(prop);
+		if (rc < 0) {
+			return AERR_DPMETA;
+		}
+	}
+	if (prop->type == ATLV_UTF8) {
+		rc = host_prop_check_val_json(prop->val);
+		if (rc) {
+			log_put(LOG_WARN "%s: tlv UTF8 check rc %d",
+			     __func__, rc);
+		}
+		if (rc == -1) {
+			return AERR_PROP_LEN;
+		} else if (rc == -2) {
+			return AERR_BAD_VAL;
+		}
+	}
+	prop_cache_update(prop);
+	data_tlv_set_dev_ads_busy();
+	if (opcode == AD_SEND_PROP_RESP) {
+		err = prop_req_get_resp(rx->req_id, prop, rx->continuation, 0);
+		if (err && err != AERR_ADS_BUSY) {
+			data_tlv_clear_dev_ads_busy();
+		}
+	} else if (opcode == AD_BATCH_SEND) {
+#ifdef AYLA_HOST_PROP_BATCH_SUPPORT
+		if (rx->batch_id.len != sizeof(u16)) {
+			return AERR_INVAL_TLV;
+		}
+		err = prop_send_batch(rx->req_id, prop,
+		    get_ua_be16(rx->batch_id.val), rx->batch_end,
+		    rx->timestamp);
+#else
+		err = AERR_INVAL_OP;
+#endif
+	} else {
+		err = host_prop_send(rx->req_id, prop, rx->node_mask);
+	}
+	return err;
+}
+
+/*
+ * Act on a parsed data packet.
+ * Returns 0 or the error for the NAK.
+ */
+static u8 data_tlv_rx_op(struct data_tlv_rx *rx, u8 opcode)
+{
+	struct prop *prop = &rx->prop;
+	u8 err = 0;
+#ifdef AYLA_HOST_PROP_FILE_SUPPORT
+	int rc;
+#endif
+
+	switch (opcode) {
+	case AD_SEND_TLV:
+	case AD_BATCH_SEND:
+		if (rx->nak) {
+			break;
+		}
+#ifdef AYLA_HOST_PROP_ACK_SUPPORT
+		if (prop->type == ATLV_ACK_ID) {
+			/*
+			 * Work-around for host_lib bug.
+			 * The host should not send a value with
+			 * the ACK ID.  Ignore if it does.
+			 * Compatible with legacy production agents.
+			 */
+			prop->val = NULL;
+			prop->len = 0;
+			prop_ack.src = rx->node_mask;
+			err = host_prop_send(rx->req_id, prop, rx->node_mask);
+			break;
+		}
+#endif
+		err = data_tlv_rx_prop(rx, opcode);
+		break;
+	case AD_SEND_PROP_RESP:
+		if (rx->nak) {
+			if (rx->features_given) {
+				mcu_feature_mask = (rx->features &
+				    ~mcu_feature_mask_unsup) |
+				    mcu_feature_mask_min;
+				mcu_feature_mask_ext = rx->features_ext;
+				log_put(LOG_INFO
+				    "host features rx %x effective %x ext %x",
+				    rx->features, mcu_feature_mask,
+				    mcu_feature_mask_ext);
+				data_tlv_reset_offset();
+			}
+			prop_req_get_resp(rx->req_id, NULL, 0, rx->nak);
+			break;
+		}
+		prop_req_resp_reset_timeout(rx->req_id);
+		err = data_tlv_rx_prop(rx, opcode);
+		break;
+#ifdef AYLA_HOST_PROP_FILE_SUPPORT
+	case AD_DP_CREATE:
+		if (rx->nak) {
+			break;
+		}
+		dp_evt_notified = 0;
+		rc = data_tlv_check_dp_metadata(prop);
+		if (rc < 0) {
+			err = AERR_DPMETA;
+			break;
+		}
+		prop->type = rx->msg_type;
+		data_tlv_set_dev_ads_busy();
+		err = prop_get_dp_loc(rx->req_id, prop);
+		break;
+	case AD_DP_SEND:
+		if (rx->nak) {
+			break;
+		}
+		if (!prop->val) {
 			err = AERR_INVAL_TLV;
+			break;
 		}
-		tlv = (struct ayla_tlv *)((char *)(vp + tlen));
+		err = data_tlv_dp_rx(rx->req_id, prop,
+		    &rx->loc, &rx->off, &rx->len, rx->eof);
+		if (client_check_np_event() && !dp_evt_notified) {
+			/*
+			 * If an ANS notification is pending
+			 * send an DP_NOTIFY to the MCU
+			 */
+			data_tlv_send_prop_notification();
+		}
+		break;
+	case AD_DP_FETCHED:
+		if (rx->nak) {
+			break;
+		}
+		if (!rx->loc.val) {
+			log_put(LOG_WARN
+			    "missing or bad loc TLV");
+			err = AERR_INVAL_DP;
+			break;
+		}
+		data_tlv_set_dev_ads_busy();
+		err = prop_set_dp_fetched(rx->req_id, (char *)rx->loc.val,
+		    rx->loc.len);
+		break;
+	case AD_DP_REQ:
+		if (rx->nak) {
+			break;
+		}
+		if (!rx->loc.val) {
+			log_put(LOG_WARN
+			    "missing or bad loc TLV");
+			err = AERR_INVAL_DP;
+			break;
+		}
+		if (host_prop_is_busy(NULL, NULL)) {
+			err = AERR_ADS_BUSY;
+			break;
+		}
+		data_tlv_set_dev_ads_busy();
+		if (rx->off.val && rx->off.len ==
+		    sizeof(data_tlv_mcu_recv.next_off)) {
+			data_tlv_mcu_recv.next_off = get_ua_be32(rx->off.val);
+		} else {
+			data_tlv_mcu_recv.next_off = 0;
+		}
+		err = prop_get_dp_req(rx->req_id, rx->msg_type,
+		    (char *)rx->loc.val, rx->loc.len,
+		    data_tlv_mcu_recv.next_off);
+		if (err) {
+			data_tlv_clear_dev_ads_busy();
+		}
+		break;
+#endif /* AYLA_HOST_PROP_DP_SUPPORT */
+	case AD_REQ_TLV:
+		if (rx->nak) {
+			break;
+		}
+		data_tlv_set_dev_ads_busy();
+		err = host_prop_get(rx->req_id, prop->name);
+		break;
+	default:
+		break;
 	}
 	return err;
 }
+
+/*
+ * Set up to parse a data packet.
+ */
+static void data_tlv_rx_init(struct data_tlv_rx *rx, u16 req_id)
+{
+	memset(rx, 0, sizeof(*rx));
+	rx->req_id = req_id;
+	rx->prop.name = rx->name;
+#ifdef AYLA_HOST_PROP_MSG_SUPPORT
+	rx->msg_type = ATLV_LOC;
 #endif
+}
+
+/*
+ * Callback to send the NAK for a packed packet, naming each property
+ * that failed.
+ */
+static void data_tlv_pack_rx_nak_cb(struct hp_buf *bp)
+{
+	struct data_tlv_pack_rx *pack = &data_tlv_pack_rx;
+	struct data_tlv_pack_grp *grp;
+	const u8 *name;
+	unsigned int dropped = 0;
+
+	data_tlv_cmd_set(bp, AD_NAK, pack->req_id);
+	for (grp = pack->grp; grp < &pack->grp[pack->count]; grp++) {
+		if (!grp->err) {
+			continue;
+		}
+		name = &pack->buf[grp->name];
+		if (hp_buf_tlv_space(bp) < 2 * sizeof(struct ayla_tlv) +
+		    sizeof(u8) + name[1]) {
+			dropped++;
+			continue;
+		}
+		hp_buf_tlv_append_u8(bp, ATLV_ERR, grp->err);
+		hp_buf_tlv_append(bp, name[0],
+		    name + sizeof(struct ayla_tlv), name[1]);
+	}
+	if (dropped) {
+		log_put(LOG_WARN "%s: req %#x %u errors not sent",
+		    __func__, pack->req_id, dropped);
+	}
+	data_tlv_enq_tx(bp);
+	pack->active = 0;
+	data_tlv_clear_dev_ads_busy();
+}
+
+/*
+ * All properties of a packed packet are done.  Confirm or NAK it.
+ */
+static void data_tlv_pack_rx_end(struct data_tlv_pack_rx *pack)
+{
+	struct data_tlv_pack_grp *grp;
+
+	for (grp = pack->grp; grp < &pack->grp[pack->count]; grp++) {
+		if (grp->err) {
+			hp_buf_callback_pend_pri(data_tlv_pack_rx_nak_cb, 0,
+			    HBCP_CTRL);
+			return;
+		}
+	}
+	pack->active = 0;
+	data_tlv_clear_ads(pack->req_id, 1);
+}
+
+/*
+ * Send the next property of a packed packet.
+ * Properties that fail before reaching the service are skipped.
+ */
+static void data_tlv_pack_rx_next(void *arg)
+{
+	struct data_tlv_pack_rx *pack = &data_tlv_pack_rx;
+	struct data_tlv_pack_grp *grp;
+	struct data_tlv_rx rx;
+	size_t end;
+	u8 err;
+
+	for (; pack->cur < pack->count; pack->cur++) {
+		grp = &pack->grp[pack->cur];
+		end = pack->cur + 1 < pack->count ? grp[1].off : pack->len;
+		data_tlv_rx_init(&rx, pack->req_id);
+		err = data_tlv_rx_parse(&rx, pack->buf + grp->off,
+		    end - grp->off);
+		if (!err) {
+			pack->waiting = 1;
+			err = data_tlv_rx_op(&rx, AD_SEND_TLV);
+			if (!pack->waiting) {
+				return;		/* already done */
+			}
+			if (!err && host_prop_is_busy(NULL, NULL)) {
+				return;		/* service has it */
+			}
+			pack->waiting = 0;
+			if (!err) {
+				err = AERR_INVAL_TLV;	/* partial value */
+			}
+		}
+		log_put(LOG_WARN "%s: req %#x prop %u err %#x",
+		    __func__, pack->req_id, pack->cur, err);
+		grp->err = err;
+		data_tlv_mcu_recv.active = 0;
+		dp_meta_off = dp_metadata;
+	}
+	data_tlv_pack_rx_end(pack);
+}
+
+/*
+ * The service is done with a property of a packed packet.
+ * Returns 1 if the result was for the packed packet.
+ */
+static int data_tlv_pack_rx_done(u16 req_id, u8 err)
+{
+	struct data_tlv_pack_rx *pack = &data_tlv_pack_rx;
+
+	if (!pack->waiting || req_id != pack->req_id) {
+		return 0;
+	}
+	pack->waiting = 0;
+	pack->grp[pack->cur++].err = err;
+	host_proto_callback_pend(&pack->next_cb);
+	return 1;
+}
+
+/*
+ * Start on an AD_SEND_TLV that may hold several properties.
+ * A name following a value starts the next property.
+ * Returns 0 if the packet is to be handled as a single property.
+ */
+static int data_tlv_pack_rx_start(u16 req_id, const void *buf, size_t len)
+{
+	struct data_tlv_pack_rx *pack = &data_tlv_pack_rx;
+	struct data_tlv_pack_grp *grp = pack->grp;
+	struct host_tlv_iter it;
+	struct host_tlv tlv;
+	unsigned int count = 0;
+	u8 prev_type = ATLV_INVALID;
+	u8 type;
+	u16 off;
+	int rc;
+
+	if (len > sizeof(pack->buf)) {
+		return 0;
+	}
+	host_tlv_iter_init(&it, buf, len);
+	while ((rc = host_tlv_next(&it, &tlv)) > 0) {
+		type = prev_type;
+		prev_type = tlv.type;
+		if (tlv.type != ATLV_NAME &&
+		    (tlv.type != ATLV_PROP_ID || type == ATLV_NAME)) {
+			continue;	/* not the start of a property */
+		}
+		if (count >= ARRAY_LEN(pack->grp)) {
+			return 0;
+		}
+		off = tlv.val - sizeof(struct ayla_tlv) - (const u8 *)buf;
+		grp[count].off = count ? off : 0;
+		grp[count].name = off;
+		grp[count].err = 0;
+		count++;
+	}
+	if (rc < 0 || count < 2) {
+		return 0;
+	}
+	memcpy(pack->buf, buf, len);
+	pack->len = len;
+	pack->count = count;
+	pack->cur = 0;
+	pack->req_id = req_id;
+	pack->active = 1;
+	data_tlv_pack_rx_next(NULL);
+	return 1;
+}
 
 /*
  * Handle incoming TLV message.
@@ -899,55 +2171,31 @@ static int data_tlv_process_ack(struct ayla_tlv *tlv)
  */
 static void data_tlv_recv(const void *buf, size_t len)
 {
-	struct prop prop;
+	struct data_tlv_rx rx;
 	const struct ayla_cmd *cmd = buf;
-	size_t rlen = len;
-	size_t tlen;
-	struct ayla_tlv *tlv;
-	u32 continuation = 0;
-	u32 uval;
-	s32 sval;
-	void *vp;
-	char name[PROP_NAME_LEN] = { '\0' };
-#ifdef AYLA_HOST_PROP_FILE_SUPPORT
-	struct ayla_tlv *loc_tlv = NULL;
-#endif
-	struct ayla_tlv *off_tlv = NULL;
-	struct ayla_tlv *len_tlv = NULL;
-#ifdef AYLA_HOST_PROP_BATCH_SUPPORT
-	struct ayla_tlv *batch_id_tlv = NULL;
-	struct ayla_tlv *batch_end_tlv = NULL;
-	unsigned long long timestamp = 0;
-#endif
-#ifdef AYLA_HOST_PROP_MSG_SUPPORT
-	enum ayla_tlv_type msg_type = ATLV_LOC;
-#endif
-	u8 eof = 0;
 	u8 err = 0;
-	u16 req_id;
-	u8 node_mask = 0;
-	u8 nak = 0;
-	u8 features_given = 0;
-	u8 features = 0;
-	u8 dp_meta_recvd = 0;
-	int rc;
 
-	ASSERT(rlen >= sizeof(*cmd));
-	rlen -= sizeof(*cmd);
-	tlv = (struct ayla_tlv *)(cmd + 1);
-	req_id = get_ua_be16(&cmd->req_id);
+	ASSERT(len >= sizeof(*cmd));
+	len -= sizeof(*cmd);
 
-	memset(&prop, 0, sizeof(prop));
-	prop.name = name;
+	data_tlv_rx_init(&rx, get_ua_be16(&cmd->req_id));
 
 	switch (cmd->opcode) {
 	case AD_SEND_PROP_RESP:
-		if (rlen == 0) {
-			prop_req_get_resp(req_id, NULL, continuation, 0);
+		if (len == 0) {
+			prop_req_get_resp(rx.req_id, NULL, 0, 0);
 			return;
 		}
 		break;
 	case AD_SEND_TLV:
+		if (data_tlv_pack_rx.active) {
+			data_tlv_internal_nak(rx.req_id, AERR_ADS_BUSY);
+			return;
+		}
+		if ((mcu_feature_mask & MCU_PROP_PACK) &&
+		    data_tlv_pack_rx_start(rx.req_id, cmd + 1, len)) {
+			return;
+		}
 		break;
 #ifdef AYLA_HOST_PROP_BATCH_SUPPORT
 	case AD_BATCH_SEND:
@@ -960,16 +2208,16 @@ static void data_tlv_recv(const void *buf, size_t len)
 		break;
 	case AD_DP_STOP:
 		dp_evt_notified = 0;
-		prop_abort_dp_operation(req_id);
+		prop_abort_dp_operation(rx.req_id);
 		return;
 #endif
 	case AD_NAK:
-		nak = 1;
+		rx.nak = 1;
 		break;
 	case AD_REQ_TLV:
-		if (!rlen) {
+		if (!len) {
 			data_tlv_set_dev_ads_busy();
-			err = host_prop_get_to_device(req_id);
+			err = host_prop_get_to_device(rx.req_id);
 		}
 		break;
 	case AD_LISTEN_ENB:
@@ -977,434 +2225,56 @@ static void data_tlv_recv(const void *buf, size_t len)
 		return;
 	case AD_SEND_TLV_V1:
 	default:
-		data_tlv_internal_nak(req_id, AERR_INVAL_OP);
+		data_tlv_internal_nak(rx.req_id, AERR_INVAL_OP);
 		return;
 	}
 
-	while (rlen > 0) {
-		if (rlen < sizeof(*tlv)) {
-			log_put("tlv_rx TLV len err rlen %u", rlen);
-			err = AERR_LEN_ERR;
-			break;
-		}
-		rlen -= sizeof(*tlv);
-		tlen = tlv->len;
-		if (rlen < tlen) {
-			log_put("tlv_rx TLV len err type %d tlen %u rlen %u",
-			    tlv->type, tlen, rlen);
-			err = AERR_LEN_ERR;
-			break;
-		}
-		vp = tlv + 1;
-		rlen -= tlen;
-
-		if (dp_meta_recvd && tlv->type != ATLV_UTF8) {
-			err = AERR_DPMETA;
-			break;
-		}
-
-		switch (tlv->type) {
-		case ATLV_NAME:
-			if (tlen > sizeof(name) - 1) {
-				memcpy(name, vp, sizeof(name) - 1);
-				name[sizeof(name) - 1] = '\0';
-			} else {
-				memcpy(name, vp, tlen);
-				name[tlen] = '\0';
-			}
-			if (!prop_name_valid(name)) {
-				err = AERR_INVAL_NAME;
-				break;
-			}
-			prop.fmt_flags = 0;
-			prop.type = ATLV_INVALID;
-			prop.val = NULL;
-			break;
-		case ATLV_FORMAT:
-			prop.fmt_flags = *(u8 *)vp;
-			break;
-		case ATLV_INT:
-		case ATLV_CENTS:
-			switch (tlv->len) {
-			case 1:
-				sval = *(s8 *)vp;
-				break;
-			case 2:
-				sval = (s16)get_ua_be16(vp);
-				break;
-			case 4:
-				sval = (s32)get_ua_be32(vp);
-				break;
-			default:
-				err = AERR_LEN_ERR;
-				break;
-			}
-			prop.type = tlv->type;
-			prop.val = &sval;
-			prop.len = sizeof(sval);
-			break;
-		case ATLV_CONT:
-			if (tlen != sizeof(continuation)) {
-				err = AERR_LEN_ERR;
-				break;
-			}
-			continuation = get_ua_be32(vp);
-			break;
-
-		case ATLV_UINT:
-			err = get_ua_with_len(vp, tlv->len, &uval);
-			prop.type = tlv->type;
-			prop.val = &uval;
-			prop.len = sizeof(uval);
-			break;
-
-		case ATLV_BOOL:
-			if (tlv->len != 1) {
-				err = AERR_LEN_ERR;
-				break;
-			}
-			uval = *(u8 *)vp;
-			if (uval > 1) {
-				err = AERR_INVAL_TLV;
-				break;
-			}
-			prop.type = tlv->type;
-			prop.val = &uval;
-			prop.len = sizeof(uval);
-			break;
-
-		case ATLV_BIN:
-		case ATLV_SCHED:
-		case ATLV_UTF8:
-			if (dp_meta_recvd) {
-				/* Parse the dp metadata value */
-				dp_meta_recvd = 0;
-				if (!tlv->len ||
-				    tlv->len > PROP_DPMETA_VAL_LEN) {
-					err = AERR_DPMETA;
-					break;
-				}
-				memcpy(dp_meta_off->value, vp, tlv->len);
-				dp_meta_off->value[tlv->len] = '\0';
-				dp_meta_off++;
-				break;
-			}
-			prop.type = tlv->type;
-			prop.val = vp;
-			prop.len = tlv->len;
-			break;
-#ifdef AYLA_HOST_PROP_FILE_SUPPORT
-		case ATLV_LOC:
-			loc_tlv = tlv;
-			break;
-#endif
-		case ATLV_LEN:
-			len_tlv = tlv;
-			break;
-		case ATLV_OFF:
-			off_tlv = tlv;
-			break;
-		case ATLV_NODES:
-			/* bit mask length limit is 1 */
-			if (tlv->len != 1) {
-				err = AERR_LEN_ERR;
-				break;
-			}
-			node_mask = *(u8 *)vp;
-			if (!node_mask) {
-				/* dest mask can't be 0 */
-				err = AERR_INVAL_TLV;
-			}
-			break;
-		case ATLV_EOF:
-			eof = 1;
-			break;
-		case ATLV_ECHO:
-			prop.echo = 1;
-			break;
-		case ATLV_ERR:
-			if (nak == 1) {
-				if (tlv->len != 1) {
-					break;
-				}
-				/* received nak from MCU */
-				log_put(LOG_DEBUG "rx nak %#x for req_id %#x",
-				    *(u8 *)vp, req_id);
-			}
-			nak = 1;   /* received AD_PROP_RESP err (feat mask) */
-			break;
-		case ATLV_FEATURES:
-			/* bit mask length limit is 1 */
-			if (tlv->len != 1) {
-				err = AERR_LEN_ERR;
-				break;
-			}
-			features_given = 1;
-			features = *(u8 *)vp;
-			break;
-		case ATLV_DPMETA:
-			/*
-			 * Parse this TLV for dp metadata key
-			 */
-			if (!tlv->len || tlv->len > PROP_DPMETA_KEY_LEN ||
-			    dp_meta_off >= dp_metadata + PROP_MAX_DPMETA ||
-			    prop.name[0] != '\0') {
-				err = AERR_DPMETA;
-				break;
-			}
-			memcpy(dp_meta_off->key, vp, tlv->len);
-			dp_meta_off->key[tlv->len] = '\0';
-			dp_meta_recvd = 1;
-			break;
-#ifdef AYLA_HOST_PROP_ACK_SUPPORT
-		case ATLV_ACK_ID:
-			err = data_tlv_process_ack(tlv);
-			if (err) {
-				err = AERR_INVAL_ACK;
-				break;
-			}
-			prop.ack = &prop_ack;
-			prop.type = ATLV_ACK_ID;
-			break;
-#endif
-#ifdef AYLA_HOST_PROP_MSG_SUPPORT
-		case ATLV_MSG_TYPE:
-			if (tlv->len != 1) {
-				err = AERR_LEN_ERR;
-				break;
-			}
-			msg_type = (enum ayla_tlv_type)*(u8 *)TLV_VAL(tlv);
-			break;
-#endif
-#ifdef AYLA_HOST_PROP_BATCH_SUPPORT
-		case ATLV_BATCH_ID:
-			batch_id_tlv = tlv;
-			break;
-		case ATLV_BATCH_END:
-			batch_end_tlv = tlv;
-			break;
-		case ATLV_TIME_MS:
-			if (tlv->len != sizeof(u64)) {
-				err = AERR_INVAL_TLV;
-				break;
-			}
-			timestamp = get_ua_be64(TLV_VAL(tlv));
-			break;
-#endif
-		default:
-			err = AERR_UNK_TYPE;
-			break;
-		}
-		switch (cmd->opcode) {
-		case AD_SEND_TLV:
-		case AD_BATCH_SEND:
-			if (nak || err || rlen) {
-				break;
-			}
-#ifdef AYLA_HOST_PROP_ACK_SUPPORT
-			if (prop.type == ATLV_ACK_ID) {
-				/*
-				 * Work-around for host_lib bug.
-				 * The host should not send a value with
-				 * the ACK ID.  Ignore if it does.
-				 * Compatible with legacy production agents.
-				 */
-				prop.val = NULL;
-				prop.len = 0;
-				prop_ack.src = node_mask;
-				err = host_prop_send(req_id, &prop, node_mask);
-				break;
-			}
-#endif
-send_to_dests:
-			if (!prop.val) {
-				err = AERR_INVAL_TLV;
-				break;
-			}
-			err = data_tlv_recv_tlv(req_id, &prop,
-			    off_tlv, len_tlv);
-			if (err) {
-				break;
-			}
-			if (eof || data_tlv_next_off == data_tlv_tot_size ||
-			    (!off_tlv && !len_tlv)) {
-				prop.val = data_tlv_pkt;
-				prop.len = data_tlv_next_off;
-				data_tlv_pkt[data_tlv_next_off] = '\0';
-				rc = data_tlv_check_dp_metadata(&prop);
-				if (rc < 0) {
-					err = AERR_DPMETA;
-					break;
-				}
-				if (prop.type == ATLV_UTF8) {
-					rc = host_prop_check_val_json(prop.val);
-					if (rc) {
-						log_put(LOG_WARN
-						     "%s: tlv UTF8 check rc %d",
-						     __func__, rc);
-					}
-					if (rc == -1) {
-						err = AERR_PROP_LEN;
-						break;
-					} else if (rc == -2) {
-						err = AERR_BAD_VAL;
-						break;
-					}
-				}
-				data_tlv_set_dev_ads_busy();
-				if (cmd->opcode == AD_SEND_PROP_RESP) {
-					err = prop_req_get_resp(req_id, &prop,
-					    continuation, 0);
-					if (err && err != AERR_ADS_BUSY) {
-						data_tlv_clear_dev_ads_busy();
-					}
-				} else if (cmd->opcode == AD_BATCH_SEND) {
-#ifdef AYLA_HOST_PROP_BATCH_SUPPORT
-					if (!batch_id_tlv ||
-					    batch_id_tlv->len != sizeof(u16)) {
-						err = AERR_INVAL_TLV;
-						break;
-					}
-					err = prop_send_batch(req_id, &prop,
-					    get_ua_be16(TLV_VAL(batch_id_tlv)),
-					    batch_end_tlv != NULL,
-					    timestamp);
-#else
-					err = AERR_INVAL_OP;
-#endif
-				} else {
-					err = host_prop_send(req_id,
-					    &prop, node_mask);
-				}
-			}
-			break;
-		case AD_SEND_PROP_RESP:
-			if (err || rlen) {
-				break;
-			}
-			if (nak) {
-				if (features_given) {
-					mcu_feature_mask = features |
-					    mcu_feature_mask_min;
-					log_put(LOG_INFO
-					    "host features rx %x effective %x",
-					    features, mcu_feature_mask);
-				}
-				prop_req_get_resp(req_id, NULL, 0, nak);
-				break;
-			}
-			prop_req_resp_reset_timeout(req_id);
-			goto send_to_dests;
-			break;
-#ifdef AYLA_HOST_PROP_FILE_SUPPORT
-		case AD_DP_CREATE:
-			if (nak || err || rlen) {
-				break;
-			}
-			dp_evt_notified = 0;
-			rc = data_tlv_check_dp_metadata(&prop);
-			if (rc < 0) {
-				err = AERR_DPMETA;
-				break;
-			}
-			prop.type = msg_type;
-			data_tlv_set_dev_ads_busy();
-			err = prop_get_dp_loc(req_id, &prop);
-			break;
-		case AD_DP_SEND:
-			if (nak || err || rlen) {
-				break;
-			}
-			if (!prop.val) {
-				err = AERR_INVAL_TLV;
-				break;
-			}
-			err = data_tlv_dp_rx(req_id, &prop,
-			    loc_tlv, off_tlv, len_tlv, eof);
-			if (client_check_np_event() && !dp_evt_notified) {
-				/*
-				 * If an ANS notification is pending
-				 * send an DP_NOTIFY to the MCU
-				 */
-				data_tlv_send_prop_notification();
-			}
-			break;
-		case AD_DP_FETCHED:
-			if (nak || err || rlen) {
-				break;
-			}
-			if (!loc_tlv) {
-				log_put(LOG_WARN
-				    "missing or bad loc TLV");
-				err = AERR_INVAL_DP;
-				break;
-			}
-			data_tlv_set_dev_ads_busy();
-			err = prop_set_dp_fetched(req_id, (char *)(loc_tlv + 1),
-			    loc_tlv->len);
-			break;
-		case AD_DP_REQ:
-			if (nak || err || rlen) {
-				break;
-			}
-			if (!loc_tlv) {
-				log_put(LOG_WARN
-				    "missing or bad loc TLV");
-				err = AERR_INVAL_DP;
-				break;
-			}
-			if (host_prop_is_busy(NULL, NULL)) {
-				err = AERR_ADS_BUSY;
-				break;
-			}
-			data_tlv_set_dev_ads_busy();
-			if (off_tlv && off_tlv->len ==
-			    sizeof(data_tlv_next_off)) {
-				data_tlv_next_off = get_ua_be32(off_tlv + 1);
-			} else {
-				data_tlv_next_off = 0;
-			}
-			err = prop_get_dp_req(req_id, msg_type,
-			    (char *)TLV_VAL(loc_tlv),
-			    loc_tlv->len, data_tlv_next_off);
-			if (err) {
-				data_tlv_clear_dev_ads_busy();
-			}
-			break;
-#endif /* AYLA_HOST_PROP_DP_SUPPORT */
-		case AD_REQ_TLV:
-			if (nak || err || rlen) {
-				break;
-			}
-			data_tlv_set_dev_ads_busy();
-			err = host_prop_get(req_id, prop.name);
-			break;
-		default:
-			break;
+	if (len) {
+		err = data_tlv_rx_parse(&rx, cmd + 1, len);
+		if (err) {
+			log_put(LOG_WARN "tlv_rx op %#x parse err %#x",
+			    cmd->opcode, err);
+		} else {
+			err = data_tlv_rx_op(&rx, cmd->opcode);
 		}
-		tlv = (struct ayla_tlv *)((char *)(vp + tlen));
 	}
 	if (err) {
 		if (cmd->opcode == AD_DP_SEND) {
 #ifdef AYLA_HOST_PROP_DP_SUPPORT
-			prop_abort_dp_operation(req_id);
+			prop_abort_dp_operation(rx.req_id);
 #endif
-		} else if (cmd->opcode == AD_SEND_TLV ||
-		    cmd->opcode == AD_SEND_PROP_RESP) {
-			data_tlv_next_off_val = 0;
+		} else if (cmd->opcode == AD_SEND_PROP_RESP) {
+			data_tlv_resp_end(rx.req_id);
+		} else if (cmd->opcode == AD_SEND_TLV) {
+			data_tlv_mcu_recv.active = 0;
 			dp_meta_off = dp_metadata;
 		}
-		data_tlv_internal_nak(req_id, err);
+		data_tlv_internal_nak(rx.req_id, err);
 	}
 }
 
+int data_tlv_recv_parse(const void *buf, size_t len)
+{
+	struct data_tlv_rx rx;
+	const struct ayla_cmd *cmd = buf;
+	u8 err;
+
+	if (len < sizeof(*cmd)) {
+		return AERR_LEN_ERR;
+	}
+	data_tlv_rx_init(&rx, 0);
+	err = data_tlv_rx_parse(&rx, cmd + 1, len - sizeof(*cmd));
+	dp_meta_off = dp_metadata;
+	return err;
+}
+
 /*
  * Reset the next expected offset for a datapoint put
  */
 void data_tlv_reset_offset(void)
 {
 	dp_meta_off = dp_metadata;
-	data_tlv_next_off_val = 0;
+	data_tlv_mcu_recv.active = 0;
 	memset(dp_metadata, 0, sizeof(dp_metadata));
 }
 
@@ -1413,11 +2283,16 @@ void data_tlv_reset_offset(void)
  */
 void data_tlv_clear_ads(u16 req_id, u8 send_confirmation)
 {
+	if (send_confirmation && data_tlv_pack_rx_done(req_id, 0)) {
+		return;
+	}
+	data_tlv_pack_flush();
 	if ((mcu_feature_mask & MCU_DATAPOINT_CONFIRM) &&
 	    send_confirmation && !confirm_needed) {
 		confirm_req_id = req_id;
 		confirm_needed = 1;
-		hp_buf_callback_pend(data_tlv_confirmation_cb);
+		hp_buf_callback_pend_pri(data_tlv_confirmation_cb,
+		    HP_BUF_SMALL_LEN, HBCP_CTRL);
 	}
 	data_tlv_clear_dev_ads_busy();
 }
@@ -1461,5 +2336,8 @@ int data_tlv_process_mcu_pkt(u8 *data_ptr, size_t recv_len)
  */
 void data_tlv_init(void)
 {
+	ayla_timer_init(&data_tlv_pack_tx.timer, data_tlv_pack_tx_timeout);
+	net_callback_init(&data_tlv_pack_rx.next_cb, data_tlv_pack_rx_next,
+	    NULL);
 	data_tlv_wifi_init();
 }
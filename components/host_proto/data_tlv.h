@@ -7,6 +7,8 @@
 struct hp_buf;
 struct prop;
 struct prop_dp_meta;
+struct data_tlv_meta;
+struct host_tlv;
 
 /*
  * Initialize the data_tlv module.
@@ -24,6 +26,17 @@ u16 data_tlv_cmd_req_set(struct hp_buf *bp, enum ayla_data_op op);
  */
 void data_tlv_cmd_set(struct hp_buf *bp, enum ayla_data_op op, u16 req_id);
 
+/*
+ * Queue a packet for the MCU behind any properties held for packing.
+ * All packets for the MCU go through this to keep them in order.
+ */
+void data_tlv_enq_tx(struct hp_buf *bp);
+
+/*
+ * Send any properties held for packing now.
+ */
+void data_tlv_pack_flush(void);
+
 /*
  * Send a property request to the MCU.
  * Eventually frees the packet in the device layer.
@@ -33,12 +46,50 @@ u16 data_tlv_prop_req_send(struct hp_buf *hp, const char *name);
 
 enum ada_err data_tlv_send(struct hp_buf *hp, const char *, const void *,
 	size_t, enum ayla_tlv_type, u32 *, u8, u16, u8,
-	const char *, const struct prop_dp_meta *);
+	const char *, const struct data_tlv_meta *);
+
+/*
+ * Return the buffer size needed to start a data_tlv_send(),
+ * or 0 if it may need a full-size buffer.
+ */
+size_t data_tlv_send_size(const char *name, size_t val_len,
+	enum ayla_tlv_type type, const char *ack_id,
+	const struct data_tlv_meta *meta);
+
+/*
+ * Datapoint metadata for a property send to the MCU, kept by the request
+ * as the ATLV_DPMETA and ATLV_UTF8 TLVs that carry it.
+ * It is sent in the first packet of a value split over several.  The
+ * later packets carry it again unless the MCU gives MCU_DPMETA_ONCE.
+ */
+struct data_tlv_meta {
+	size_t	len;		/* length of the TLVs */
+	u8	tlvs[];
+};
+
+/*
+ * Allocate the TLVs for the metadata of a send.
+ * Returns NULL on allocation failure.  The caller frees it with free().
+ */
+struct data_tlv_meta *data_tlv_meta_alloc(const struct prop_dp_meta *meta);
 
 void data_tlv_req_next(struct hp_buf *bp, u32 continuation, u16 *req_id);
 
 enum ada_err data_tlv_dp_create(u16 req_id, const char *location);
 void data_tlv_reset_offset(void);
+
+/*
+ * Replies to GETs from the MCU that may be reassembled at once, which
+ * limits the GETs outstanding.
+ */
+#ifndef DATA_TLV_RESP_SLOTS
+#define DATA_TLV_RESP_SLOTS 4
+#endif
+
+/*
+ * Drop any part of the reply to a GET that has ended.
+ */
+void data_tlv_resp_end(u16 req_id);
 void data_tlv_clear_ads(u16 req_id, u8 send_confirmation);
 void data_tlv_nak_req(u16 req_id, u8 err, const char *name, u8 failed_dests);
 void data_tlv_nak(u16 req_id, u8 err, u8 clear_ads);
@@ -67,8 +118,15 @@ int data_tlv_process_mcu_pkt(u8 *data_ptr, size_t recv_len);
 /*
  * Receive property update from mcu
  */
-int data_tlv_recv_tlv(u16 req_id, struct prop *prop, struct ayla_tlv *off_tlv,
-		struct ayla_tlv *len_tlv);
+int data_tlv_recv_tlv(u16 req_id, struct prop *prop,
+		const struct host_tlv *off_tlv, const struct host_tlv *len_tlv);
+
+/*
+ * Parse the TLVs of a data packet from the MCU without acting on it.
+ * This is for host benchmarks and fuzzing.
+ * Returns 0 or the error that would be sent in a NAK.
+ */
+int data_tlv_recv_parse(const void *buf, size_t len);
 
 /*
  * Setup a spi callback to notify host mcu of a pending update
@@ -94,7 +152,82 @@ void data_tlv_batch_status(u16 id, u8 status, u8 final,
 
 void data_tlv_wifi_init(void);
 
+/*
+ * Feature bits for the UART transport, advertised by the MCU in
+ * ATLV_FEATURES along with the MCU_* bits from ayla_proto_mcu.h.
+ * These are taken from the top of the mask to stay clear of those.
+ */
+#define MCU_UART_WINDOW	0x80	/* several data packets may be in flight */
+#define MCU_UART_FAST	0x40	/* link runs at MCU_UART_FAST_BAUD */
+#define MCU_UART_JUMBO	0x20	/* packets up to MCU_UART_JUMBO_LEN */
+#define MCU_PROP_PACK	0x10	/* several properties in a data packet */
+
+/*
+ * Feature bits in an optional second byte of the MCU's ATLV_FEATURES,
+ * as the first byte is full.  An MCU giving one byte has none of these.
+ */
+#define MCU_DPMETA_ONCE	0x01	/* metadata only in first packet of value */
+#define MCU_GET_PIPELINE 0x02	/* may have several GETs outstanding */
+
+/*
+ * With MCU_UART_WINDOW, each end takes data packets only in sequence.
+ * A packet following one that was lost is dropped without an ACK, and
+ * the sender resends the lost packet and every one sent after it, in
+ * order (go-back-N).  Only seq # 0 is taken out of sequence, as a new
+ * start.  If the sender gives up on a packet, it drops the ones sent
+ * after it as well and starts again with seq # 0.
+ */
+
+/*
+ * Link settings for MCU_UART_FAST and MCU_UART_JUMBO.
+ * Each end changes over once the MCU's feature response has been acked.
+ * The MCU goes back to the default link if it gives up on a packet, and
+ * answers a feature request on whatever link it is using.
+ * If the module gives up on a packet, or gets several bad packets in a
+ * row, it asks for the features again on the same link.  If either
+ * happens again after that request, it goes back to the default link
+ * and asks there.
+ * MCU_UART_FAST is only used if the module's serial driver can change
+ * speed.  The device's driver, from the ADA SDK, cannot, so a module
+ * built for the device only accepts MCU_UART_JUMBO.
+ * With MCU_UART_JUMBO, a string or binary value too long for one TLV may
+ * be sent as consecutive TLVs of its type in one packet, to be joined by
+ * the receiver.
+ */
+#define MCU_UART_FAST_BAUD	460800
+#define MCU_UART_JUMBO_LEN	1024
+
+/*
+ * With MCU_PROP_PACK, an AD_SEND_TLV from the MCU or an AD_RECV_TLV to it
+ * may carry several properties.  The TLVs of each property start with its
+ * ATLV_NAME, so a name after a value starts the next property.  Metadata
+ * may only be given before the first name, and each value must fit in the
+ * packet.
+ * The module sends the properties of a packed AD_SEND_TLV one at a time
+ * and answers once for the packet: with AD_CONFIRM if all were sent, or
+ * with an AD_NAK holding an ATLV_ERR and ATLV_NAME for each that failed.
+ * Properties not named in the NAK were sent.
+ */
+
+/*
+ * Property ID TLV, a host_proto extension to the ayla_tlv_type values.
+ * The value is a 1 or 2 byte big-endian ID from 1 to DATA_TLV_PROP_IDS.
+ *
+ * The MCU assigns the IDs.  An ATLV_PROP_ID right after an ATLV_NAME, in
+ * any data packet from the MCU, binds the ID to that name for the session,
+ * replacing any earlier binding of either.  The MCU would usually bind all
+ * its properties in its response to the feature request, which starts the
+ * session and clears the bindings.
+ * After that, either end may send an ATLV_PROP_ID in place of the
+ * ATLV_NAME of a bound property, including in packed packets and NAKs.
+ * An MCU that binds nothing keeps getting names.
+ */
+#define ATLV_PROP_ID		0x30
+#define DATA_TLV_PROP_IDS	64
+
 extern u8 mcu_feature_mask;	/* features of MCU */
 extern u8 mcu_feature_mask_min;	/* minimum features for transport */
+extern u8 mcu_feature_mask_unsup; /* features transport cannot do */
+extern u8 mcu_feature_mask_ext;	/* second byte of MCU features */
 
 #endif /* __AYLA_DATA_TLV_H__ */
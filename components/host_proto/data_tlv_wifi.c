@@ -60,7 +60,7 @@ static void data_tlv_wifi_notify(struct hp_buf *bp)
 	 */
 	data_tlv_wifi_status_append(bp,
 	    sp->final ? ATLV_WIFI_STATUS_FINAL : ATLV_WIFI_STATUS, sp);
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 }
 
 /*
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Benchmark for the UART frame CRC.
+ *
+ * Compares crc16() over a whole unescaped frame, as receive used to do
+ * once the frame was complete, with the table-driven kernel run over
+ * the buffer and run a byte at a time as mcu_uart_rx_intr() does.
+ * Frames are ASPI_LEN_MAX bytes plus the packet type and sequence number.
+ *
+ * Note that crc16() in the host build is the stand-in from host_ada.c.
+ *
+ * Usage: crc_bench [-n iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/crc.h>
+#include <ayla/ayla_spi_mcu.h>
+#include "mcu_uart_ppp.h"
+#include "host_loop.h"
+
+#define CRC_BENCH_ITER		100000
+#define CRC_BENCH_LEN		(ASPI_LEN_MAX + 2)
+
+static double crc_bench_ns(u64 start_us, u32 iter)
+{
+	return (double)(host_loop_time_us() - start_us) * 1000 /
+	    ((double)iter * CRC_BENCH_LEN);
+}
+
+int main(int argc, char **argv)
+{
+	static u8 frame[CRC_BENCH_LEN];
+	volatile u16 sink = 0;
+	u32 iter = CRC_BENCH_ITER;
+	u64 start;
+	double ref;
+	double table;
+	double byte;
+	u16 crc;
+	u32 i;
+	size_t j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iter = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	srand(1);
+	for (j = 0; j < sizeof(frame); j++) {
+		frame[j] = rand();
+	}
+	crc = crc16(frame, sizeof(frame), CRC16_INIT);
+	ASSERT(crc == mcu_uart_ppp_crc16(frame, sizeof(frame), CRC16_INIT));
+
+	start = host_loop_time_us();
+	for (i = 0; i < iter; i++) {
+		sink += crc16(frame, sizeof(frame), CRC16_INIT);
+	}
+	ref = crc_bench_ns(start, iter);
+
+	start = host_loop_time_us();
+	for (i = 0; i < iter; i++) {
+		sink += mcu_uart_ppp_crc16(frame, sizeof(frame), CRC16_INIT);
+	}
+	table = crc_bench_ns(start, iter);
+
+	start = host_loop_time_us();
+	for (i = 0; i < iter; i++) {
+		crc = CRC16_INIT;
+		for (j = 0; j < sizeof(frame); j++) {
+			crc = mcu_uart_ppp_crc_byte(crc, frame[j]);
+		}
+		sink += crc;
+	}
+	byte = crc_bench_ns(start, iter);
+
+	printf("%u byte frames, ns per byte\n", CRC_BENCH_LEN);
+	printf("%-24s %8.2f\n", "crc16()", ref);
+	printf("%-24s %8.2f %6.1fx\n", "table", table, ref / table);
+	printf("%-24s %8.2f %6.1fx\n", "table, byte at a time", byte,
+	    ref / byte);
+	return 0;
+}
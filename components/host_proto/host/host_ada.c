@@ -0,0 +1,364 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Stand-ins for the ADA library services used by host_proto.
+ * These are simple, portable versions good enough for the host harness.
+ */
+#include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/endian.h>
+#include <ayla/crc.h>
+#include <ayla/log.h>
+#include <ayla/mod_log.h>
+#include <ayla/tlv.h>
+#include <ayla/tlv_access.h>
+#include <ayla/utf8.h>
+#include <ayla/json.h>
+#include <ayla/clock.h>
+#include <ayla/ayla_proto_mcu.h>
+#include <al/al_os_lock.h>
+#include <ada/err.h>
+#include <ada/prop.h>
+#include "host_loop.h"
+#include "host_ada.h"
+
+int host_ada_verbose;
+
+/*
+ * Print a log line unless it is below the warning level and the
+ * harness is not verbose.  The severity may be a prefix of the format.
+ */
+static void host_ada_vlog(int show, const char *fmt, va_list args)
+{
+	if (!show && !host_ada_verbose) {
+		return;
+	}
+	if ((u8)fmt[0] >= 0x80) {
+		fmt++;
+	}
+	vfprintf(stderr, fmt, args);
+	fputc('\n', stderr);
+}
+
+static int host_ada_log_show(const char *fmt)
+{
+	return fmt[0] == LOG_ERR[0] || fmt[0] == LOG_WARN[0];
+}
+
+void log_put(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	host_ada_vlog(host_ada_log_show(fmt), fmt, args);
+	va_end(args);
+}
+
+void log_put_mod(u8 mod, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	host_ada_vlog(host_ada_log_show(fmt), fmt, args);
+	va_end(args);
+}
+
+void log_put_mod_sev(u8 mod, enum log_sev sev, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	host_ada_vlog(sev <= LOG_SEV_WARN, fmt, args);
+	va_end(args);
+}
+
+void log_info(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	host_ada_vlog(0, fmt, args);
+	va_end(args);
+}
+
+void log_warn(u8 mod, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	host_ada_vlog(1, fmt, args);
+	va_end(args);
+}
+
+int log_mod_sev_is_enabled(u8 mod, enum log_sev sev)
+{
+	return host_ada_verbose || sev <= LOG_SEV_WARN;
+}
+
+void log_bytes_in_hex_sev(u8 mod, enum log_sev sev, const void *buf,
+		size_t len)
+{
+	const u8 *bp = buf;
+	size_t i;
+
+	if (!log_mod_sev_is_enabled(mod, sev)) {
+		return;
+	}
+	for (i = 0; i < len; i++) {
+		fprintf(stderr, "%2.2x%c", bp[i],
+		    (i % 16 == 15 || i == len - 1) ? '\n' : ' ');
+	}
+}
+
+void printcli(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	putchar('\n');
+}
+
+/*
+ * CRC-16/CCITT, MSB first, as used for the UART framing.
+ */
+u16 crc16(const void *buf, size_t len, u16 crc)
+{
+	const u8 *bp = buf;
+	int bit;
+
+	while (len--) {
+		crc ^= (u16)*bp++ << 8;
+		for (bit = 0; bit < 8; bit++) {
+			if (crc & 0x8000) {
+				crc = (crc << 1) ^ 0x1021;
+			} else {
+				crc <<= 1;
+			}
+		}
+	}
+	return crc;
+}
+
+int get_ua_with_len(const void *src, u8 len, u32 *dest)
+{
+	switch (len) {
+	case sizeof(u8):
+		*dest = *(u8 *)src;
+		break;
+	case sizeof(u16):
+		*dest = get_ua_be16(src);
+		break;
+	case sizeof(u32):
+		*dest = get_ua_be32(src);
+		break;
+	default:
+		return AERR_LEN_ERR;
+	}
+	return 0;
+}
+
+int prop_name_valid(const char *name)
+{
+	const char *cp;
+
+	if (!name[0]) {
+		return 0;
+	}
+	for (cp = name; *cp; cp++) {
+		if (!isalnum((u8)*cp) && *cp != '_' && *cp != '-') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Find a TLV of the given type in a command packet.
+ */
+int tlv_getp(struct ayla_tlv **tlvp, enum ayla_tlv_type type,
+		void *buf, size_t len)
+{
+	struct ayla_tlv *tlv;
+	size_t rlen;
+
+	if (len < sizeof(struct ayla_cmd)) {
+		return AERR_LEN_ERR;
+	}
+	tlv = (struct ayla_tlv *)((struct ayla_cmd *)buf + 1);
+	rlen = len - sizeof(struct ayla_cmd);
+	while (rlen) {
+		if (rlen < sizeof(*tlv) || rlen - sizeof(*tlv) < tlv->len) {
+			return AERR_LEN_ERR;
+		}
+		if (tlv->type == type) {
+			*tlvp = tlv;
+			return 0;
+		}
+		rlen -= sizeof(*tlv) + tlv->len;
+		tlv = TLV_NEXT(tlv);
+	}
+	return AERR_TLV_MISSING;
+}
+
+int tlv_s32_get(s32 *val, const struct ayla_tlv *tlv)
+{
+	switch (tlv->len) {
+	case sizeof(s8):
+		*val = *(s8 *)TLV_VAL(tlv);
+		break;
+	case sizeof(s16):
+		*val = (s16)get_ua_be16(TLV_VAL(tlv));
+		break;
+	case sizeof(s32):
+		*val = (s32)get_ua_be32(TLV_VAL(tlv));
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+int tlv_u32_get(u32 *val, const struct ayla_tlv *tlv)
+{
+	return get_ua_with_len(TLV_VAL(tlv), tlv->len, val) ? -1 : 0;
+}
+
+int tlv_utf8_get(char *buf, size_t len, const struct ayla_tlv *tlv)
+{
+	if (tlv->len >= len) {
+		return -1;
+	}
+	memcpy(buf, TLV_VAL(tlv), tlv->len);
+	buf[tlv->len] = '\0';
+	return tlv->len;
+}
+
+ssize_t utf8_decode(const u8 *in, size_t len, u32 *code)
+{
+	size_t need;
+	size_t i;
+	u32 val;
+
+	if (!len) {
+		return 0;
+	}
+	if (in[0] < 0x80) {
+		*code = in[0];
+		return 1;
+	}
+	if ((in[0] & 0xe0) == 0xc0) {
+		need = 2;
+		val = in[0] & 0x1f;
+	} else if ((in[0] & 0xf0) == 0xe0) {
+		need = 3;
+		val = in[0] & 0xf;
+	} else if ((in[0] & 0xf8) == 0xf0) {
+		need = 4;
+		val = in[0] & 7;
+	} else {
+		return -1;
+	}
+	if (len < need) {
+		return -1;
+	}
+	for (i = 1; i < need; i++) {
+		if ((in[i] & 0xc0) != 0x80) {
+			return -1;
+		}
+		val = (val << 6) | (in[i] & 0x3f);
+	}
+	*code = val;
+	return need;
+}
+
+/*
+ * Decode UTF-8 into code points, terminated by 0 as ADA's version is.
+ * Returns the count without the terminator, or -1 if the input is
+ * invalid or there is no room for the terminator.
+ */
+int utf8_gets(u32 *out, int max, const u8 *in, size_t len)
+{
+	ssize_t rc;
+	int count = 0;
+
+	while (len) {
+		if (count >= max - 1) {
+			return -1;
+		}
+		rc = utf8_decode(in, len, &out[count]);
+		if (rc <= 0) {
+			return -1;
+		}
+		in += rc;
+		len -= rc;
+		count++;
+	}
+	if (count >= max) {
+		return -1;
+	}
+	out[count] = 0;
+	return count;
+}
+
+/*
+ * Return the length of the string after JSON escaping.
+ * Only the length is computed; the harness never needs the output.
+ */
+ssize_t json_format_bytes(char *out, size_t out_len, const char *in,
+		size_t len, size_t *consumed, void *state, int flags)
+{
+	ssize_t olen = 0;
+
+	while (len--) {
+		if (*in == '"' || *in == '\\') {
+			olen += 2;
+		} else if ((u8)*in < 0x20) {
+			olen += 6;
+		} else {
+			olen++;
+		}
+		in++;
+	}
+	return olen;
+}
+
+u32 clock_ms(void)
+{
+	return (u32)host_loop_time_ms();
+}
+
+struct al_lock {
+	pthread_mutex_t mutex;
+};
+
+struct al_lock *al_os_lock_create(void)
+{
+	struct al_lock *lock;
+
+	lock = calloc(1, sizeof(*lock));
+	if (lock) {
+		pthread_mutex_init(&lock->mutex, NULL);
+	}
+	return lock;
+}
+
+void al_os_lock_lock(struct al_lock *lock)
+{
+	pthread_mutex_lock(&lock->mutex);
+}
+
+void al_os_lock_unlock(struct al_lock *lock)
+{
+	pthread_mutex_unlock(&lock->mutex);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_HOST_ADA_H__
+#define __AYLA_HOST_ADA_H__
+
+/*
+ * Non-zero to print all log messages, not just warnings and errors.
+ */
+extern int host_ada_verbose;
+
+/*
+ * Number of property datapoints the stand-in agent has accepted from
+ * the MCU.
+ */
+extern u32 host_agent_props_rx;
+extern u64 host_agent_prop_bytes;	/* value bytes received */
+extern u32 host_agent_order_errs;	/* datapoints taken out of order */
+
+/*
+ * Cloud GETs of MCU properties issued by the stand-in agent.
+ */
+struct host_agent_gets {
+	u32	count;			/* GETs to issue */
+	u32	ok;			/* GETs answered with a value */
+	u32	failed;			/* GETs timed out or NAKed */
+	u32	bad;			/* of those ok, split values garbled */
+	u64	elapsed_us;		/* time for all GETs */
+	u64	resp_us_sum;		/* sum of the times for each GET */
+	volatile int done;		/* set when all GETs completed */
+};
+extern struct host_agent_gets host_agent_gets;
+
+/*
+ * Issue count cloud GETs for the named properties in turn, keeping
+ * several outstanding as the service would for a busy device.
+ * Must be called from the host loop thread.
+ */
+void host_agent_gets_start(const char * const *names, unsigned int nnames,
+		u32 count);
+
+#endif /* __AYLA_HOST_ADA_H__ */
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Stand-ins for the agent layers above host_proto: property manager,
+ * configuration, Wi-Fi and OTA.
+ * Property sends complete immediately as if the cloud accepted them.
+ * A GET of all to-device properties delivers a fixed set, one at a time
+ * as the property manager does.  One of them is a string with datapoint
+ * metadata, too long for one TLV, so it goes to the MCU in parts.
+ * Cloud GETs of MCU properties can be issued in a burst for the benchmark.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/log.h>
+#include <ayla/clock.h>
+#include <ayla/conf.h>
+#include <ayla/tlv.h>
+#include <ayla/timer.h>
+#include <ayla/ayla_proto_mcu.h>
+#include <ada/err.h>
+#include <ada/prop.h>
+#include <ada/prop_mgr.h>
+#include <ada/client.h>
+#include <ada/ada_conf.h>
+#include <adw/wifi.h>
+#include <adb/al_bt.h>
+#include <net/net.h>
+#include <libapp/libapp_ota.h>
+#include "host_prop.h"
+#include "host_proto_int.h"
+#include "host_proto_ota.h"
+#include "data_tlv.h"
+#include "prop_req.h"
+#include "host_ada.h"
+#include "host_loop.h"
+
+#define HOST_AGENT_GETS_OUT	8	/* cloud GETs outstanding at once */
+#define HOST_AGENT_NOTES_LEN	600	/* length of the long to-device value */
+
+u32 host_agent_props_rx;
+u64 host_agent_prop_bytes;
+u32 host_agent_order_errs;
+struct host_agent_gets host_agent_gets;
+
+/*
+ * Outstanding cloud GET.
+ */
+struct host_agent_get {
+	u64	start_us;
+	u8	in_use;
+};
+
+/*
+ * To-device property delivered on a GET, like the fan's full state.
+ */
+struct host_agent_prop {
+	const char *name;
+	enum ayla_tlv_type type;
+	const void *val;
+	size_t len;
+	const struct prop_dp_meta *meta;
+};
+
+static const u32 host_agent_fan_speed = 3;
+static const u8 host_agent_on = 1;
+static const u8 host_agent_off;
+static const u32 host_agent_light_rating = 40;
+static const char host_agent_light_color[] = "warm white";
+static const char host_agent_version[] = "1.0.4";
+static char host_agent_notes[HOST_AGENT_NOTES_LEN];
+static const struct prop_dp_meta host_agent_notes_meta[PROP_MAX_DPMETA] = {
+	{ "source", "schedule" },
+	{ "zone", "living room" },
+};
+
+static const struct host_agent_prop host_agent_to_dev[] = {
+	{ "fan_speed", ATLV_INT, &host_agent_fan_speed, sizeof(u32) },
+	{ "fan_power", ATLV_BOOL, &host_agent_on, sizeof(u8) },
+	{ "fan_dir", ATLV_BOOL, &host_agent_off, sizeof(u8) },
+	{ "light_power", ATLV_BOOL, &host_agent_on, sizeof(u8) },
+	{ "light_rating", ATLV_INT, &host_agent_light_rating, sizeof(u32) },
+	{ "light_color", ATLV_UTF8, host_agent_light_color,
+	    sizeof(host_agent_light_color) - 1 },
+	{ "fw_version", ATLV_UTF8, host_agent_version,
+	    sizeof(host_agent_version) - 1 },
+	{ "fan_notes", ATLV_UTF8, host_agent_notes, sizeof(host_agent_notes),
+	    host_agent_notes_meta },
+};
+
+struct host_agent_state {
+	u8	busy;
+	u16	req_id;
+	u8	get;		/* completing a GET rather than a send */
+	u8	to_dev;		/* delivering to-device properties */
+	u8	to_dev_next;	/* index of next to-device property */
+	u8	send_seen;	/* send_req_id is set */
+	u16	send_req_id;	/* req_id of the last property accepted */
+	struct net_callback done_cb;
+	struct net_callback to_dev_cb;
+	const char * const *get_names;	/* properties for cloud GETs */
+	unsigned int get_nnames;
+	u32	gets_issued;
+	u32	gets_out;
+	u64	gets_start_us;
+	struct host_agent_get gets[HOST_AGENT_GETS_OUT];
+};
+static struct host_agent_state host_agent_state;
+
+struct ada_conf ada_conf;
+struct conf_state conf_state;
+
+/*
+ * The service finished with the property.
+ */
+static void host_agent_done(void *arg)
+{
+	struct host_agent_state *agent = &host_agent_state;
+
+	agent->busy = 0;
+	if (agent->get) {
+		data_tlv_clear_ads(agent->req_id, 1);
+		return;
+	}
+	prop_req_client_finished(PROP_CB_DONE, 0, agent->req_id);
+}
+
+/*
+ * Deliver the next to-device property for a GET, or finish the GET.
+ */
+static void host_agent_to_dev_next(void *arg)
+{
+	struct host_agent_state *agent = &host_agent_state;
+	const struct host_agent_prop *prop;
+	u32 off = 0;
+
+	if (agent->to_dev_next >= ARRAY_LEN(host_agent_to_dev)) {
+		agent->to_dev = 0;
+		host_proto_callback_pend(&agent->done_cb);
+		return;
+	}
+	prop = &host_agent_to_dev[agent->to_dev_next++];
+	if (prop_req_prop_send(prop->name, prop->val, prop->len, prop->type,
+	    &off, NODES_ADS, agent->req_id, 1, "", prop->meta)) {
+		agent->to_dev = 0;
+		host_proto_callback_pend(&agent->done_cb);
+	}
+}
+
+static void host_agent_get_cb(struct prop *prop, void *arg, u32 cont,
+		int err);
+
+/*
+ * Issue cloud GETs until enough are outstanding or all are issued.
+ */
+static void host_agent_get_issue(void)
+{
+	struct host_agent_state *agent = &host_agent_state;
+	struct host_agent_gets *gets = &host_agent_gets;
+	struct host_agent_get *get;
+	const char *name;
+
+	for (get = agent->gets; get < &agent->gets[HOST_AGENT_GETS_OUT];
+	    get++) {
+		if (agent->gets_issued >= gets->count) {
+			break;
+		}
+		if (get->in_use) {
+			continue;
+		}
+		name = agent->get_names[agent->gets_issued++ %
+		    agent->get_nnames];
+		get->in_use = 1;
+		get->start_us = host_loop_time_us();
+		agent->gets_out++;
+		if (prop_req_get(name, host_agent_get_cb, get) !=
+		    AE_IN_PROGRESS) {
+			host_agent_get_cb(NULL, get, 0, AERR_INTERNAL);
+		}
+	}
+}
+
+/*
+ * A cloud GET completed, with the value or NULL on timeout.
+ */
+static void host_agent_get_cb(struct prop *prop, void *arg, u32 cont,
+		int err)
+{
+	struct host_agent_state *agent = &host_agent_state;
+	struct host_agent_gets *gets = &host_agent_gets;
+	struct host_agent_get *get = arg;
+	u64 now = host_loop_time_us();
+
+	if (prop && !err) {
+		gets->ok++;
+
+		/*
+		 * A reply split by the MCU gives the same 8 hex digits
+		 * twice, so a mix of parts of different replies shows.
+		 */
+		if (prop->type == ATLV_UTF8 && prop->len == 16 &&
+		    memcmp(prop->val, (char *)prop->val + 8, 8)) {
+			gets->bad++;
+		}
+	} else {
+		gets->failed++;
+	}
+	gets->resp_us_sum += now - get->start_us;
+	get->in_use = 0;
+	agent->gets_out--;
+	host_agent_get_issue();
+	if (!agent->gets_out && agent->gets_issued >= gets->count) {
+		gets->elapsed_us = now - agent->gets_start_us;
+		gets->done = 1;
+	}
+}
+
+void host_agent_gets_start(const char * const *names, unsigned int nnames,
+		u32 count)
+{
+	struct host_agent_state *agent = &host_agent_state;
+	struct host_agent_gets *gets = &host_agent_gets;
+
+	ASSERT(nnames);
+	memset(gets, 0, sizeof(*gets));
+	gets->count = count;
+	agent->get_names = names;
+	agent->get_nnames = nnames;
+	agent->gets_issued = 0;
+	agent->gets_start_us = host_loop_time_us();
+	if (!count) {
+		gets->done = 1;
+		return;
+	}
+	host_agent_get_issue();
+}
+
+void host_prop_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(host_agent_notes); i++) {
+		host_agent_notes[i] = 'a' + i % 26;
+	}
+	net_callback_init(&host_agent_state.done_cb, host_agent_done, NULL);
+	net_callback_init(&host_agent_state.to_dev_cb, host_agent_to_dev_next,
+	    NULL);
+	data_tlv_init();
+
+	/*
+	 * Request features as the real host_prop does.
+	 */
+	prop_req_get(NULL, NULL, NULL);
+}
+
+void host_prop_enable_listen(void)
+{
+}
+
+int host_prop_is_busy(const char *caller, const char *prop_name)
+{
+	return host_agent_state.busy;
+}
+
+u32 host_prop_backoff_time_remaining(void)
+{
+	return 1;
+}
+
+int host_prop_check_val_json(const char *val)
+{
+	return 0;
+}
+
+static int host_agent_start(u16 req_id, u8 get)
+{
+	struct host_agent_state *agent = &host_agent_state;
+
+	if (agent->busy) {
+		return AERR_ADS_BUSY;
+	}
+	agent->busy = 1;
+	agent->req_id = req_id;
+	agent->get = get;
+	host_proto_callback_pend(&agent->done_cb);
+	return 0;
+}
+
+int host_prop_get(u16 req_id, const char *prop_name)
+{
+	return host_agent_start(req_id, 1);
+}
+
+int host_prop_get_to_device(u16 req_id)
+{
+	struct host_agent_state *agent = &host_agent_state;
+
+	if (agent->busy) {
+		return AERR_ADS_BUSY;
+	}
+	agent->busy = 1;
+	agent->req_id = req_id;
+	agent->get = 1;
+	agent->to_dev = 1;
+	agent->to_dev_next = 0;
+	host_proto_callback_pend(&agent->to_dev_cb);
+	return 0;
+}
+
+int host_prop_send(u32 req_id, struct prop *prop, u8 dest)
+{
+	struct host_agent_state *agent = &host_agent_state;
+	int err;
+
+	err = host_agent_start((u16)req_id, 0);
+	if (!err) {
+		host_agent_props_rx++;
+		host_agent_prop_bytes += prop->len;
+
+		/*
+		 * The MCU numbers its requests in the order it sends them.
+		 * Properties packed in one packet share a req_id.
+		 */
+		if (agent->send_seen &&
+		    (s16)((u16)req_id - agent->send_req_id) < 0) {
+			host_agent_order_errs++;
+		}
+		agent->send_req_id = (u16)req_id;
+		agent->send_seen = 1;
+	}
+	return err;
+}
+
+void ada_prop_mgr_recv_done(u8 src)
+{
+	struct host_agent_state *agent = &host_agent_state;
+
+	if (agent->to_dev) {
+		host_proto_callback_pend(&agent->to_dev_cb);
+	}
+}
+
+void host_proto_ota_init(void)
+{
+}
+
+int host_proto_ota_rx(const void *buf, int len)
+{
+	return 0;
+}
+
+void data_tlv_wifi_init(void)
+{
+}
+
+void client_reset_mcu_overflow(void)
+{
+}
+
+u8 client_get_connectivity_mask(void)
+{
+	return NODES_ADS;
+}
+
+int client_check_np_event(void)
+{
+	return 0;
+}
+
+void ada_conf_reset(int factory)
+{
+}
+
+int adw_wifi_join_rx(void *buf, size_t len)
+{
+	return 0;
+}
+
+int adw_wifi_delete_rx(void *buf, size_t len)
+{
+	return 0;
+}
+
+void al_bt_wifi_timeout_set(u32 ms)
+{
+}
+
+void libapp_ota_register(const struct libapp_app_ota_ops *ops)
+{
+}
+
+void libapp_ota_apply(void)
+{
+}
+
+/*
+ * Configuration stand-ins.
+ * Every path reads as a short string and accepts any value.
+ */
+struct tz_info timezone_info;
+struct tz_info daylight_info;
+
+void conf_log(const char *fmt, ...)
+{
+}
+
+void conf_lock(void)
+{
+}
+
+void conf_unlock(void)
+{
+}
+
+void conf_commit(void)
+{
+}
+
+int conf_save(int conf)
+{
+	return CONF_ERR_NONE;
+}
+
+void conf_resp(int type, enum conf_token *path, int len)
+{
+}
+
+int conf_tokens_to_str(enum conf_token *tk, int ntok, char *buf, size_t len)
+{
+	return snprintf(buf, len, "conf");
+}
+
+enum conf_error conf_entry_get(int src, enum conf_token *tk, int ntok)
+{
+	struct conf_state *state = &conf_state;
+	static const char val[] = "host";
+	struct ayla_tlv *tlv;
+
+	if (state->rlen < sizeof(*tlv) + sizeof(val) - 1) {
+		return CONF_ERR_LEN;
+	}
+	tlv = (struct ayla_tlv *)state->next;
+	tlv->type = ATLV_UTF8;
+	tlv->len = sizeof(val) - 1;
+	memcpy(TLV_VAL(tlv), val, tlv->len);
+	state->next += sizeof(*tlv) + tlv->len;
+	state->rlen -= sizeof(*tlv) + tlv->len;
+	return CONF_ERR_NONE;
+}
+
+enum conf_error conf_entry_set(int src, enum conf_token *tk, int ntok,
+		struct ayla_tlv *tlv)
+{
+	return CONF_ERR_NONE;
+}
+
+static enum conf_error host_agent_conf_get(int src, enum conf_token *tk,
+		int ntok)
+{
+	return conf_entry_get(src, tk, ntok);
+}
+
+const struct conf_entry conf_sys_conf_entry = {
+	.get = host_agent_conf_get,
+};
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#include <pthread.h>
+#include <time.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/timer.h>
+#include <net/net.h>
+#include <host_proto/host_proto.h>
+#include "host_loop.h"
+#include "host_uart.h"
+
+#define HOST_LOOP_CB_MAX	64	/* max pending net callbacks */
+
+static struct timer *host_loop_timers;	/* sorted by expiration */
+static struct net_callback *host_loop_cbs[HOST_LOOP_CB_MAX];
+static unsigned int host_loop_cb_head;
+static unsigned int host_loop_cb_count;
+
+u64 host_loop_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+u64 host_loop_time_ms(void)
+{
+	return host_loop_time_us() / 1000;
+}
+
+static void host_loop_timer_cancel(struct timer *tm)
+{
+	struct timer **prev;
+
+	for (prev = &host_loop_timers; *prev; prev = &(*prev)->next) {
+		if (*prev == tm) {
+			*prev = tm->next;
+			break;
+		}
+	}
+	tm->next = NULL;
+	tm->time_ms = 0;
+}
+
+static void host_loop_timer_set(struct timer *tm, u32 delay_ms)
+{
+	struct timer **prev;
+
+	host_loop_timer_cancel(tm);
+	tm->time_ms = host_loop_time_ms() + delay_ms;
+	for (prev = &host_loop_timers; *prev; prev = &(*prev)->next) {
+		if ((*prev)->time_ms > tm->time_ms) {
+			break;
+		}
+	}
+	tm->next = *prev;
+	*prev = tm;
+}
+
+static void host_loop_callback_pend(struct net_callback *cb)
+{
+	if (cb->pending) {
+		return;
+	}
+	ASSERT(host_loop_cb_count < HOST_LOOP_CB_MAX);
+	cb->pending = 1;
+	host_loop_cbs[(host_loop_cb_head + host_loop_cb_count) %
+	    HOST_LOOP_CB_MAX] = cb;
+	host_loop_cb_count++;
+}
+
+/*
+ * All callbacks run in the loop thread, so there is nothing to block.
+ */
+static void *host_loop_call_blocking(void *(*func)(void *), void *arg)
+{
+	return func(arg);
+}
+
+const struct host_proto_ops host_loop_ops = {
+	.timer_set = host_loop_timer_set,
+	.timer_cancel = host_loop_timer_cancel,
+	.callback_pend = host_loop_callback_pend,
+	.call_blocking = host_loop_call_blocking,
+};
+
+void *host_app_curthread(void)
+{
+	return (void *)pthread_self();
+}
+
+/*
+ * Run expired timers.
+ * Returns the time until the next timer expires, limited to max_ms.
+ */
+static u32 host_loop_timers_run(u32 max_ms)
+{
+	struct timer *tm;
+	u64 now;
+
+	for (;;) {
+		tm = host_loop_timers;
+		if (!tm) {
+			return max_ms;
+		}
+		now = host_loop_time_ms();
+		if (tm->time_ms > now) {
+			if (tm->time_ms - now < max_ms) {
+				return (u32)(tm->time_ms - now);
+			}
+			return max_ms;
+		}
+		host_loop_timers = tm->next;
+		tm->next = NULL;
+		tm->time_ms = 0;
+		tm->handler(tm);
+	}
+}
+
+static int host_loop_callbacks_run(void)
+{
+	struct net_callback *cb;
+	int ran = 0;
+
+	while (host_loop_cb_count) {
+		cb = host_loop_cbs[host_loop_cb_head];
+		host_loop_cb_head = (host_loop_cb_head + 1) % HOST_LOOP_CB_MAX;
+		host_loop_cb_count--;
+		cb->pending = 0;
+		cb->func(cb->arg);
+		ran = 1;
+	}
+	return ran;
+}
+
+void host_loop_run_once(u32 wait_ms)
+{
+	if (host_loop_callbacks_run()) {
+		wait_ms = 0;
+	}
+	wait_ms = host_loop_timers_run(wait_ms);
+	if (host_loop_cb_count) {
+		wait_ms = 0;
+	}
+	host_uart_poll(wait_ms);
+}
+
+void host_loop_run(volatile int *done)
+{
+	while (!*done) {
+		host_loop_run_once(10);
+	}
+}
+
+void net_callback_init(struct net_callback *cb, void (*func)(void *),
+		void *arg)
+{
+	cb->func = func;
+	cb->arg = arg;
+	cb->pending = 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_HOST_LOOP_H__
+#define __AYLA_HOST_LOOP_H__
+
+/*
+ * Single-threaded event loop standing in for the agent_app thread.
+ * Runs timers, net callbacks and the simulated UART.
+ */
+extern const struct host_proto_ops host_loop_ops;
+
+/*
+ * Return monotonic time in milliseconds.
+ */
+u64 host_loop_time_ms(void);
+
+/*
+ * Return monotonic time in microseconds.
+ */
+u64 host_loop_time_us(void);
+
+/*
+ * Run timers and callbacks that are due, then wait up to wait_ms for
+ * UART activity.
+ */
+void host_loop_run_once(u32 wait_ms);
+
+/*
+ * Run the loop until *done becomes non-zero.
+ */
+void host_loop_run(volatile int *done);
+
+#endif /* __AYLA_HOST_LOOP_H__ */
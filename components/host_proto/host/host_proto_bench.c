@@ -0,0 +1,430 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Host benchmark for host_proto.
+ *
+ * Runs the module side of host_proto on the host loop against a simulated
+ * MCU over a socket pair, then reports throughput and latency for each
+ * kind of message.
+ *
+ * Usage: host_proto_bench [-n count] [-b baud] [-f features]
+ *	[-e ext_features] [-w window]
+ *	[-l drop_every] [-c corrupt_every] [-g gets] [-d delay_ms]
+ *	[-p inflight] [-k cache_ttl_ms] [-m lose_every] [-o outage_ms]
+ *	[-i] [-s] [-v]
+ *
+ * -w sets the number of packets the MCU keeps in flight and advertises
+ * MCU_UART_WINDOW.  -l drops every Nth data packet from the module
+ * and -c corrupts every Nth packet to the module, to exercise resends.
+ * -s makes the simulated serial driver move bytes one at a time.
+ * Features 0x40 (MCU_UART_FAST) and 0x20 (MCU_UART_JUMBO) change the
+ * link after negotiation, e.g. -b 115200 -f 0x64; jumbo also adds a
+ * "send long" message with a value split over several TLVs.
+ * -o cuts the line for outage_ms after the first kind of message, so
+ * both ends give up on packets and must agree on the link again,
+ * e.g. -b 115200 -f 0x40 -o 1500.
+ * Feature 0x10 (MCU_PROP_PACK) packs several properties per packet in
+ * each direction and adds a "send pack" message with three properties.
+ * The "get to-dev" message asks for all to-device properties, and the
+ * report gives the properties and packets the MCU received for them.
+ * One of those, "fan_notes", is too long for one TLV and has datapoint
+ * metadata.  -e gives a second feature byte, e.g. -e 1 for
+ * MCU_DPMETA_ONCE, which has the module send that metadata only in the
+ * first part of the value.  The report counts the packets carrying
+ * metadata and how many of them were later parts.
+ * "conf get" and "conf set" read and write the sys/time configuration item.
+ * -i has the MCU bind its property names to IDs in the feature response
+ * and send the IDs in place of the names.
+ * -g has the agent make that many cloud GETs of MCU properties after the
+ * messages, several at a time, and -d has the MCU take delay_ms to answer
+ * each.  The module keeps one GET waiting on the MCU at a time unless the
+ * MCU gives MCU_GET_PIPELINE, -e 2, e.g. compare -n 0 -g 200 -d 50 with
+ * -e 2.  That MCU sends each reply in two parts, the first parts of the
+ * replies due before their second parts, and the report counts values
+ * that came back garbled as bad.  -p sets how many GETs the module keeps
+ * waiting either way.
+ * -m has the MCU never answer every Nth GET, which must time out on its
+ * own while the other answers keep coming, e.g. -n 0 -g 200 -d 50 -p 4 -m 10.
+ * -k caches the values of the MCU's properties for cloud GETs for
+ * cache_ttl_ms, or until replaced with 0xffffffff,
+ * e.g. -n 1 -g 200 -d 50 -k 1000.
+ * The module's UART statistics, including its RTO, are shown at the end.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/endian.h>
+#include <ayla/log.h>
+#include <ayla/tlv.h>
+#include <ayla/ayla_proto_mcu.h>
+#include <ayla/conf_token.h>
+#include <host_proto/host_proto.h>
+#include <host_proto/mcu_dev.h>
+#include <ada/err.h>
+#include <ada/prop.h>
+#include "data_tlv.h"
+#include "prop_req.h"
+#include "host_ada.h"
+#include "host_loop.h"
+#include "host_uart.h"
+#include "mcu_sim.h"
+
+#define BENCH_COUNT	1000
+#define BENCH_BAUD	0	/* unlimited */
+#define BENCH_LONG_LEN	700	/* value length for "send long" */
+
+/*
+ * Property names the MCU binds to IDs 1 to n with -i.
+ */
+static const char * const bench_prop_ids[] = {
+	"fan_speed",
+	"fan_power",
+	"fan_label",
+	"fan_sched",
+	"fan_dir",
+	"light_power",
+	"light_rating",
+	"light_color",
+	"fw_version",
+};
+
+/*
+ * Start a message with the command header.  The req_id is set per send.
+ */
+static void bench_cmd(struct mcu_sim_msg *msg, const char *name,
+		enum aspi_proto proto, u8 opcode, u8 wait_resp)
+{
+	struct ayla_cmd *cmd = (struct ayla_cmd *)msg->buf;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->name = name;
+	msg->wait_resp = wait_resp;
+	cmd->protocol = proto;
+	cmd->opcode = opcode;
+	msg->len = sizeof(*cmd);
+}
+
+static void bench_tlv(struct mcu_sim_msg *msg, enum ayla_tlv_type type,
+		const void *val, size_t len)
+{
+	struct ayla_tlv *tlv = (struct ayla_tlv *)(msg->buf + msg->len);
+
+	ASSERT(len <= TLV_MAX_LEN);
+	ASSERT(msg->len + sizeof(*tlv) + len <= sizeof(msg->buf));
+	tlv->type = type;
+	tlv->len = len;
+	memcpy(TLV_VAL(tlv), val, len);
+	msg->len += sizeof(*tlv) + len;
+}
+
+/*
+ * Name a property, by its ID if the MCU binds IDs.
+ */
+static void bench_name(struct mcu_sim_msg *msg, const char *name, u8 ids)
+{
+	u8 id;
+
+	for (id = 0; ids && id < ARRAY_LEN(bench_prop_ids); id++) {
+		if (!strcmp(bench_prop_ids[id], name)) {
+			id++;
+			bench_tlv(msg, ATLV_PROP_ID, &id, sizeof(id));
+			return;
+		}
+	}
+	bench_tlv(msg, ATLV_NAME, name, strlen(name));
+}
+
+/*
+ * Add a string too long for one TLV, split as MCU_UART_JUMBO allows.
+ */
+static void bench_tlv_long(struct mcu_sim_msg *msg, enum ayla_tlv_type type,
+		size_t len)
+{
+	static char val[BENCH_LONG_LEN];
+	size_t tlen;
+	size_t i;
+
+	ASSERT(len <= sizeof(val));
+	for (i = 0; i < len; i++) {
+		val[i] = 'a' + i % 26;
+	}
+	for (i = 0; i < len; i += tlen) {
+		tlen = len - i;
+		if (tlen > TLV_MAX_LEN) {
+			tlen = TLV_MAX_LEN;
+		}
+		bench_tlv(msg, type, val + i, tlen);
+	}
+}
+
+static unsigned int bench_msgs_init(struct mcu_sim_msg *msgs, u8 features,
+		u8 ids)
+{
+	struct mcu_sim_msg *msg = msgs;
+	static const char str[] = "0123456789abcdefghijklmnopqrstuv";
+	static const char log_msg[] = "bench log message from host mcu";
+	static const u8 conf_path[] = { CT_sys, CT_time };
+	u8 val[4];
+	u8 bval = 1;
+
+	put_ua_be32(val, 1234);
+	bench_cmd(msg, "send int", ASPI_PROTO_DATA, AD_SEND_TLV, 1);
+	bench_name(msg, "fan_speed", ids);
+	bench_tlv(msg, ATLV_INT, val, sizeof(val));
+	msg++;
+
+	bench_cmd(msg, "send bool", ASPI_PROTO_DATA, AD_SEND_TLV, 1);
+	bench_name(msg, "fan_power", ids);
+	bench_tlv(msg, ATLV_BOOL, &bval, sizeof(bval));
+	msg++;
+
+	bench_cmd(msg, "send utf8", ASPI_PROTO_DATA, AD_SEND_TLV, 1);
+	bench_name(msg, "fan_label", ids);
+	bench_tlv(msg, ATLV_UTF8, str, sizeof(str) - 1);
+	msg++;
+
+	/* back-to-back sends fill the window to check delivery order */
+	bench_cmd(msg, "send burst", ASPI_PROTO_DATA, AD_SEND_TLV, 0);
+	bench_name(msg, "fan_speed", ids);
+	bench_tlv(msg, ATLV_INT, val, sizeof(val));
+	msg++;
+
+	if (features & MCU_UART_JUMBO) {
+		bench_cmd(msg, "send long", ASPI_PROTO_DATA, AD_SEND_TLV, 1);
+		bench_name(msg, "fan_sched", ids);
+		bench_tlv_long(msg, ATLV_UTF8, BENCH_LONG_LEN);
+		msg++;
+	}
+
+	if (features & MCU_PROP_PACK) {
+		bench_cmd(msg, "send pack", ASPI_PROTO_DATA, AD_SEND_TLV, 1);
+		bench_name(msg, "fan_speed", ids);
+		bench_tlv(msg, ATLV_INT, val, sizeof(val));
+		bench_name(msg, "fan_power", ids);
+		bench_tlv(msg, ATLV_BOOL, &bval, sizeof(bval));
+		bench_name(msg, "fan_label", ids);
+		bench_tlv(msg, ATLV_UTF8, str, sizeof(str) - 1);
+		msg++;
+	}
+
+	bench_cmd(msg, "get to-dev", ASPI_PROTO_DATA, AD_REQ_TLV, 1);
+	msg++;
+
+	bench_cmd(msg, "conf get", ASPI_PROTO_CMD, ACMD_GET_CONF, 1);
+	bench_tlv(msg, ATLV_CONF, conf_path, sizeof(conf_path));
+	msg++;
+
+	bench_cmd(msg, "conf set", ASPI_PROTO_CMD, ACMD_SET_CONF, 0);
+	bench_tlv(msg, ATLV_CONF, conf_path, sizeof(conf_path));
+	bench_tlv(msg, ATLV_INT, val, sizeof(val));
+	msg++;
+
+	bench_cmd(msg, "conf log", ASPI_PROTO_CMD, ACMD_LOG, 0);
+	bench_tlv(msg, ATLV_UTF8, log_msg, sizeof(log_msg) - 1);
+	msg++;
+
+	bench_cmd(msg, "ping", ASPI_PROTO_PING, 0, 0);
+	bench_tlv(msg, ATLV_BIN, str, sizeof(str) - 1);
+	msg++;
+
+	return msg - msgs;
+}
+
+static u64 bench_rate(u64 val, u64 us)
+{
+	return us ? val * 1000000 / us : 0;
+}
+
+static void bench_report(struct mcu_sim *sim)
+{
+	struct mcu_sim_msg *msg;
+	unsigned int i;
+
+	printf("%-10s %6s %8s %10s %10s %8s %8s %8s %8s\n",
+	    "message", "count", "pkt/s", "payload/s", "wire/s",
+	    "ack avg", "ack min", "ack max", "resp avg");
+	for (i = 0; i < sim->nmsgs; i++) {
+		msg = &sim->msgs[i];
+		if (!msg->count) {
+			printf("%-10s %6u\n", msg->name, 0);
+			continue;
+		}
+		printf("%-10s %6u %8llu %10llu %10llu %8llu %8u %8u ",
+		    msg->name, msg->count,
+		    (unsigned long long)bench_rate(msg->count,
+		    msg->elapsed_us),
+		    (unsigned long long)bench_rate(msg->payload_bytes,
+		    msg->elapsed_us),
+		    (unsigned long long)bench_rate(msg->wire_bytes,
+		    msg->elapsed_us),
+		    (unsigned long long)(msg->ack_us_sum / msg->count),
+		    msg->ack_us_min, msg->ack_us_max);
+		if (msg->resps) {
+			printf("%8llu\n",
+			    (unsigned long long)(msg->resp_us_sum /
+			    msg->resps));
+		} else {
+			printf("%8s\n", "-");
+		}
+		if (msg->naks) {
+			printf("%-10s %u NAKs\n", "", msg->naks);
+		}
+	}
+	printf("times in us. resends %u lost %u dropped %u rx_errs %u "
+	    "feature_reqs %u props_rx %u prop_bytes %llu\n",
+	    sim->resends, sim->lost, sim->dropped, sim->rx_errs,
+	    sim->feature_reqs, host_agent_props_rx,
+	    (unsigned long long)host_agent_prop_bytes);
+	printf("to-device props %u in %u packets, props NAKed %u\n",
+	    sim->recv_props, sim->recv_pkts, sim->nak_props);
+	printf("to-device metadata in %u packets, %u of them later parts\n",
+	    sim->recv_meta, sim->recv_meta_parts);
+	printf("in-order check: MCU dropped %u ahead %u dups, "
+	    "module took %u out of order\n",
+	    sim->rx_ahead, sim->rx_dups, host_agent_order_errs);
+	printf("link: MCU fell back %u times, ends with features %#x, "
+	    "%u bytes lost with line down\n",
+	    sim->link_fallbacks, sim->link, sim->line_lost);
+}
+
+static void bench_gets_report(struct mcu_sim *sim)
+{
+	struct host_agent_gets *gets = &host_agent_gets;
+	u32 completed = gets->ok + gets->failed;
+
+	printf("cloud gets %u ok %u failed %u bad %u in %llu us, %llu gets/s, "
+	    "resp avg %llu us\n",
+	    gets->count, gets->ok, gets->failed, gets->bad,
+	    (unsigned long long)gets->elapsed_us,
+	    (unsigned long long)bench_rate(completed, gets->elapsed_us),
+	    (unsigned long long)(completed ?
+	    gets->resp_us_sum / completed : 0));
+	printf("MCU answered %u gets, most pending %u, dropped %u, lost %u\n",
+	    sim->gets, sim->gets_max, sim->gets_dropped, sim->gets_lost);
+}
+
+static void bench_usage(const char *cmd)
+{
+	fprintf(stderr,
+	    "usage: %s [-n count] [-b baud] [-f features] "
+	    "[-e ext_features] [-w window] "
+	    "[-l drop_every] [-c corrupt_every] [-g gets] [-d delay_ms] "
+	    "[-p inflight] [-k cache_ttl_ms] [-m lose_every] [-o outage_ms] "
+	    "[-i] [-s] [-v]\n",
+	    cmd);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static struct mcu_sim_msg msgs[12];
+	static struct mcu_sim sim;
+	u32 gets = 0;
+	u32 cache_ttl = 0;
+	unsigned int i;
+	u8 ids = 0;
+	int opt;
+
+	sim.count = BENCH_COUNT;
+	sim.features = MCU_DATAPOINT_CONFIRM;
+	host_uart_baud_set(BENCH_BAUD);
+
+	while ((opt = getopt(argc, argv,
+	    "n:b:f:e:w:l:c:g:d:p:k:m:o:isv")) != -1) {
+		switch (opt) {
+		case 'n':
+			sim.count = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			host_uart_baud_set(strtoul(optarg, NULL, 0));
+			break;
+		case 'f':
+			sim.features = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			sim.features_ext = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			sim.window = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			sim.drop_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			sim.corrupt_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			gets = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			sim.get_delay_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			prop_req_inflight_set(strtoul(optarg, NULL, 0));
+			break;
+		case 'k':
+			cache_ttl = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			sim.get_lose_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			sim.outage_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			ids = 1;
+			break;
+		case 's':
+			host_uart_bytewise_set(1);
+			break;
+		case 'v':
+			host_ada_verbose = 1;
+			break;
+		default:
+			bench_usage(argv[0]);
+			break;
+		}
+	}
+
+	if (sim.window > 1) {
+		sim.features |= MCU_UART_WINDOW;
+	}
+	sim.msgs = msgs;
+	if (ids) {
+		sim.prop_ids = bench_prop_ids;
+		sim.nprop_ids = ARRAY_LEN(bench_prop_ids);
+	}
+	sim.nmsgs = bench_msgs_init(msgs, sim.features, ids);
+	sim.fd = host_uart_open();
+	if (sim.fd < 0) {
+		fprintf(stderr, "host_uart_open failed\n");
+		return 1;
+	}
+	host_proto_init(&host_loop_ops);
+	for (i = 0; cache_ttl && i < ARRAY_LEN(bench_prop_ids); i++) {
+		host_proto_prop_cache_set(bench_prop_ids[i], cache_ttl);
+	}
+	if (mcu_sim_start(&sim)) {
+		fprintf(stderr, "mcu_sim_start failed\n");
+		return 1;
+	}
+	host_loop_run(&sim.done);
+	if (gets) {
+		host_agent_gets_start(bench_prop_ids,
+		    ARRAY_LEN(bench_prop_ids), gets);
+		host_loop_run(&host_agent_gets.done);
+	}
+	mcu_sim_join(&sim);
+	bench_report(&sim);
+	if (gets) {
+		bench_gets_report(&sim);
+	}
+	mcu_dev->show();
+	return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/log.h>
+#include <ayla/serial.h>
+#include "mcu_uart_int.h"
+#include "host_uart.h"
+
+#define HOST_UART_CHUNK		64	/* bytes moved per FIFO "interrupt" */
+#define HOST_UART_RX_BUF	1024
+
+struct host_uart_state {
+	int	fd;			/* module side of socket pair */
+	u32	baud;			/* current line speed, 0 if unlimited */
+	u32	base_baud;		/* speed set by host_uart_baud_set() */
+	u32	speed;			/* speed set by the module, 0 default */
+	int	(*get_tx)(void);
+	int	(*rx_intr)(u8);
+	u8	bytewise;		/* use the byte-at-a-time callbacks */
+	u8	tx_active;
+	u8	rx_blocked;
+	size_t	rx_off;			/* next byte to deliver */
+	size_t	rx_len;			/* bytes in rx_buf */
+	u8	rx_buf[HOST_UART_RX_BUF];
+};
+static struct host_uart_state host_uart_state = { .fd = -1 };
+
+int host_uart_open(void)
+{
+	struct host_uart_state *hu = &host_uart_state;
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		return -1;
+	}
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	hu->fd = fds[0];
+	return fds[1];
+}
+
+void host_uart_baud_set(u32 baud)
+{
+	host_uart_state.baud = baud;
+	host_uart_state.base_baud = baud;
+}
+
+void host_uart_bytewise_set(int enable)
+{
+	host_uart_state.bytewise = enable;
+}
+
+void host_uart_line_delay(size_t len)
+{
+	u32 baud = host_uart_state.baud;
+
+	if (baud) {
+		usleep((useconds_t)((u64)len * 10 * 1000000 / baud));
+	}
+}
+
+int serial_init(int port, int speed, int (*get_tx)(void),
+		int (*rx_intr)(u8))
+{
+	struct host_uart_state *hu = &host_uart_state;
+
+	ASSERT(hu->fd >= 0);
+
+	hu->get_tx = get_tx;
+	hu->rx_intr = rx_intr;
+	return serial_set_speed(port, speed);
+}
+
+int serial_set_speed(int port, u32 speed)
+{
+	struct host_uart_state *hu = &host_uart_state;
+
+	/* a requested speed only applies if the line is limited at all */
+	hu->baud = (speed && hu->base_baud) ? speed : hu->base_baud;
+	hu->speed = speed;
+	return 0;
+}
+
+u32 host_uart_speed(void)
+{
+	return host_uart_state.speed;
+}
+
+void serial_start_tx(int port)
+{
+	host_uart_state.tx_active = 1;
+}
+
+void serial_rx_unblock(int port)
+{
+	host_uart_state.rx_blocked = 0;
+}
+
+/*
+ * Deliver buffered bytes a FIFO-sized chunk at a time until the
+ * mcu_uart layer pushes back.
+ */
+static void host_uart_rx_deliver(struct host_uart_state *hu)
+{
+	size_t len;
+	size_t taken;
+
+	while (hu->rx_off < hu->rx_len && !hu->rx_blocked) {
+		if (hu->bytewise) {
+			if (hu->rx_intr(hu->rx_buf[hu->rx_off])) {
+				hu->rx_blocked = 1;
+				break;
+			}
+			hu->rx_off++;
+			continue;
+		}
+		len = hu->rx_len - hu->rx_off;
+		if (len > HOST_UART_CHUNK) {
+			len = HOST_UART_CHUNK;
+		}
+		taken = mcu_uart_rx_block(hu->rx_buf + hu->rx_off, len);
+		hu->rx_off += taken;
+		if (taken < len) {
+			hu->rx_blocked = 1;
+			break;
+		}
+	}
+	if (hu->rx_off == hu->rx_len) {
+		hu->rx_off = 0;
+		hu->rx_len = 0;
+	}
+}
+
+/*
+ * Get up to a chunk of bytes one at a time, as a byte-oriented driver would.
+ */
+static size_t host_uart_tx_bytes(struct host_uart_state *hu, u8 *buf)
+{
+	size_t len;
+	int byte;
+
+	for (len = 0; len < HOST_UART_CHUNK; len++) {
+		byte = hu->get_tx();
+		if (byte < 0) {
+			break;
+		}
+		buf[len] = (u8)byte;
+	}
+	return len;
+}
+
+/*
+ * Send runs of framed bytes as a FIFO or DMA driver would, up to a
+ * chunk per write.
+ */
+static void host_uart_tx(struct host_uart_state *hu)
+{
+	u8 chunk[HOST_UART_CHUNK];
+	const u8 *buf;
+	size_t len;
+	ssize_t rc;
+
+	while (hu->tx_active) {
+		if (hu->bytewise) {
+			buf = chunk;
+			len = host_uart_tx_bytes(hu, chunk);
+		} else {
+			len = mcu_uart_tx_span(&buf);
+		}
+		if (!len) {
+			hu->tx_active = 0;
+			break;
+		}
+		if (len > HOST_UART_CHUNK) {
+			len = HOST_UART_CHUNK;
+		}
+		host_uart_line_delay(len);
+		rc = write(hu->fd, buf, len);
+		if (rc != len) {
+			log_put(LOG_ERR "host_uart: write err %d", errno);
+			return;
+		}
+		if (!hu->bytewise) {
+			mcu_uart_tx_advance(len);
+		}
+	}
+}
+
+void host_uart_poll(u32 wait_ms)
+{
+	struct host_uart_state *hu = &host_uart_state;
+	struct pollfd pfd;
+	ssize_t rc;
+
+	host_uart_tx(hu);
+	host_uart_rx_deliver(hu);
+	if (hu->rx_len) {
+		return;		/* wait for the receiver to drain */
+	}
+	pfd.fd = hu->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, (int)wait_ms) <= 0 || !(pfd.revents & POLLIN)) {
+		return;
+	}
+	rc = read(hu->fd, hu->rx_buf, sizeof(hu->rx_buf));
+	if (rc <= 0) {
+		return;
+	}
+	hu->rx_off = 0;
+	hu->rx_len = rc;
+	host_uart_rx_deliver(hu);
+}
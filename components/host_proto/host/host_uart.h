@@ -0,0 +1,46 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_HOST_UART_H__
+#define __AYLA_HOST_UART_H__
+
+/*
+ * Simulated serial driver for the MCU port.
+ * The module side is driven from the host loop; the MCU side is a
+ * socket handed to the MCU simulator.
+ */
+
+/*
+ * Create the socket pair.  Must be called before host_proto_init().
+ * Returns the MCU-side descriptor or -1 on error.
+ */
+int host_uart_open(void);
+
+/*
+ * Limit the line rate to simulate a real UART.  Zero means unlimited.
+ */
+void host_uart_baud_set(u32 baud);
+
+/*
+ * Return the speed the module set with serial_set_speed(), 0 for the
+ * default.
+ */
+u32 host_uart_speed(void);
+
+/*
+ * Use the byte-at-a-time serial callbacks instead of the block interfaces.
+ */
+void host_uart_bytewise_set(int enable);
+
+/*
+ * Move bytes between the socket and the mcu_uart layer.
+ * Waits up to wait_ms for received data.
+ */
+void host_uart_poll(u32 wait_ms);
+
+/*
+ * Sleep for the time it takes to send len bytes at the configured rate.
+ */
+void host_uart_line_delay(size_t len);
+
+#endif /* __AYLA_HOST_UART_H__ */
@@ -0,0 +1,492 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Benchmark for the hp_buf pool layout under mixed traffic.
+ *
+ * Replays the same random mix of short messages (acks, NAKs, confirms),
+ * short property updates and full-size packets against the pool as it
+ * was, seven full-size buffers, and against the default size classes.
+ * Each message holds its buffer for a few ticks, as if queued and waiting
+ * for an ack.  Messages that find no buffer wait in order and are retried
+ * every tick, as hp_buf_callback_pend() does.
+ *
+ * The "chains" layout is the default pool with full-size packets built
+ * as chains of medium and large buffers when no large buffer is free.
+ *
+ * Reports the memory used by the pool, the peak payload space in use,
+ * the rate of failed allocations and how long messages waited.
+ *
+ * With -t, instead runs that many threads allocating, filling, checking
+ * and freeing buffers concurrently, to test the lock-free free lists, and
+ * reports the time per alloc and free.
+ *
+ * With -c, instead builds full packets of TLVs in a chain of medium
+ * buffers and in one large buffer, checks that the bytes match and
+ * reports the time to build each.
+ *
+ * Usage: hp_buf_bench [-n ticks] [-r messages per 100 ticks] [-t threads]
+ *	[-c]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include "hp_buf.h"
+#include "hp_buf_tlv.h"
+#include "host_loop.h"
+
+#define HP_BUF_BENCH_TICKS	100000
+#define HP_BUF_BENCH_HELD	64	/* max buffers held at once */
+#define HP_BUF_BENCH_WAITING	1024	/* max messages waiting */
+#define HP_BUF_BENCH_THREADS	16	/* max threads for -t */
+#define HP_BUF_BENCH_THREAD_HELD 4	/* buffers held by each thread */
+
+/*
+ * Kind of message in the traffic mix.
+ */
+struct hp_buf_bench_kind {
+	const char *name;
+	unsigned int weight;	/* percent of messages */
+	size_t	min_len;
+	size_t	max_len;
+	size_t	hint;		/* size passed to hp_buf_alloc() or 0 */
+	unsigned int min_hold;	/* ticks */
+	unsigned int max_hold;
+};
+
+static const struct hp_buf_bench_kind hp_buf_bench_kinds[] = {
+	{ "short", 45, 4, 16, HP_BUF_SMALL_LEN, 1, 3 },
+	{ "prop", 35, 20, HP_BUF_MEDIUM_LEN, 0, 2, 6 },
+	{ "full", 20, HP_BUF_MEDIUM_LEN + 1, HP_BUF_LEN, 0, 2, 8 },
+};
+
+/*
+ * Pool layouts compared.
+ */
+struct hp_buf_bench_layout {
+	const char *name;
+	unsigned int counts[HBC_COUNT];
+	u8	chain;		/* full-size messages may use chains */
+};
+
+static const struct hp_buf_bench_layout hp_buf_bench_layouts[] = {
+	{ "7 full", { [HBC_LARGE] = 7 } },
+	{ "classes", {
+		[HBC_SMALL] = HP_BUF_SMALL_COUNT,
+		[HBC_MEDIUM] = HP_BUF_MEDIUM_COUNT,
+		[HBC_LARGE] = HP_BUF_COUNT,
+	} },
+	{ "chains", {
+		[HBC_SMALL] = HP_BUF_SMALL_COUNT,
+		[HBC_MEDIUM] = HP_BUF_MEDIUM_COUNT,
+		[HBC_LARGE] = HP_BUF_COUNT,
+	}, 1 },
+};
+
+struct hp_buf_bench_msg {
+	size_t	size;
+	u32	arrival;
+	unsigned int hold;
+};
+
+struct hp_buf_bench_held {
+	struct hp_buf *bp;
+	u32	release;
+};
+
+struct hp_buf_bench_result {
+	u32	msgs;
+	u32	delayed;	/* messages whose first alloc failed */
+	u32	wait_sum;	/* ticks */
+	u32	wait_max;
+	u32	waiting_max;
+	struct hp_buf_stats stats;
+};
+
+static struct hp_buf_bench_msg hp_buf_bench_waiting[HP_BUF_BENCH_WAITING];
+static struct hp_buf_bench_held hp_buf_bench_held[HP_BUF_BENCH_HELD];
+static u8 hp_buf_bench_chain;
+
+/*
+ * Make a message of a random kind.
+ */
+static void hp_buf_bench_msg_new(struct hp_buf_bench_msg *msg, u32 tick)
+{
+	const struct hp_buf_bench_kind *kind = hp_buf_bench_kinds;
+	unsigned int pick = rand() % 100;
+	size_t len;
+
+	while (pick >= kind->weight) {
+		pick -= kind->weight;
+		kind++;
+	}
+	len = kind->min_len + rand() % (kind->max_len - kind->min_len + 1);
+	msg->size = kind->hint ? kind->hint : len;
+	if (len > HP_BUF_MEDIUM_LEN) {
+		msg->size = 0;		/* full-size buffer */
+	}
+	msg->arrival = tick;
+	msg->hold = kind->min_hold +
+	    rand() % (kind->max_hold - kind->min_hold + 1);
+}
+
+/*
+ * Try to give the message a buffer.  Returns 0 on success.
+ */
+static int hp_buf_bench_alloc(struct hp_buf_bench_msg *msg, u32 tick)
+{
+	struct hp_buf_bench_held *held;
+	struct hp_buf *bp;
+
+	if (hp_buf_bench_chain && !msg->size) {
+		bp = hp_buf_alloc_chain(0);
+	} else {
+		bp = hp_buf_alloc(msg->size);
+	}
+	if (!bp) {
+		return -1;
+	}
+	for (held = hp_buf_bench_held; held->bp; held++) {
+		ASSERT(held < &hp_buf_bench_held[HP_BUF_BENCH_HELD - 1]);
+	}
+	held->bp = bp;
+	held->release = tick + msg->hold;
+	return 0;
+}
+
+static void hp_buf_bench_run(const struct hp_buf_bench_layout *layout,
+		u32 ticks, unsigned int rate, struct hp_buf_bench_result *res)
+{
+	struct hp_buf_bench_held *held;
+	struct hp_buf_bench_msg *msg;
+	unsigned int head = 0;
+	unsigned int count = 0;
+	unsigned int arrivals;
+	u32 wait;
+	u32 tick;
+
+	memset(res, 0, sizeof(*res));
+	if (hp_buf_init_counts(layout->counts)) {
+		return;
+	}
+	hp_buf_bench_chain = layout->chain;
+	srand(1);
+	for (tick = 0; tick < ticks; tick++) {
+		for (held = hp_buf_bench_held;
+		    held < &hp_buf_bench_held[HP_BUF_BENCH_HELD]; held++) {
+			if (held->bp && held->release <= tick) {
+				hp_buf_free(held->bp);
+				held->bp = NULL;
+			}
+		}
+
+		/*
+		 * Serve waiting messages in order.
+		 */
+		while (count) {
+			msg = &hp_buf_bench_waiting[head];
+			if (hp_buf_bench_alloc(msg, tick)) {
+				break;
+			}
+			wait = tick - msg->arrival;
+			res->wait_sum += wait;
+			if (wait > res->wait_max) {
+				res->wait_max = wait;
+			}
+			head = (head + 1) % HP_BUF_BENCH_WAITING;
+			count--;
+		}
+
+		/*
+		 * New messages, rate per 100 ticks.
+		 */
+		arrivals = rate / 100;
+		if (rand() % 100 < rate % 100) {
+			arrivals++;
+		}
+		while (arrivals--) {
+			ASSERT(count < HP_BUF_BENCH_WAITING);
+			msg = &hp_buf_bench_waiting[(head + count) %
+			    HP_BUF_BENCH_WAITING];
+			hp_buf_bench_msg_new(msg, tick);
+			res->msgs++;
+			if (!count && !hp_buf_bench_alloc(msg, tick)) {
+				continue;
+			}
+			res->delayed++;
+			count++;
+			if (count > res->waiting_max) {
+				res->waiting_max = count;
+			}
+		}
+	}
+
+	for (held = hp_buf_bench_held;
+	    held < &hp_buf_bench_held[HP_BUF_BENCH_HELD]; held++) {
+		hp_buf_free(held->bp);
+		held->bp = NULL;
+	}
+	hp_buf_stats_get(&res->stats);
+	hp_buf_exit();
+}
+
+/*
+ * State for one thread of the concurrent test.
+ */
+struct hp_buf_bench_thread {
+	pthread_t thread;
+	u8	id;
+	u32	iter;
+	u32	allocs;
+	u32	errors;		/* buffers found changed by another thread */
+};
+
+static void *hp_buf_bench_thread_run(void *arg)
+{
+	struct hp_buf_bench_thread *thr = arg;
+	struct hp_buf *held[HP_BUF_BENCH_THREAD_HELD] = { NULL };
+	static const size_t sizes[] = {
+		HP_BUF_SMALL_LEN, HP_BUF_MEDIUM_LEN, 0
+	};
+	struct hp_buf *bp;
+	unsigned int seed = thr->id;
+	unsigned int slot;
+	size_t i;
+	u32 n;
+
+	for (n = 0; n < thr->iter; n++) {
+		slot = rand_r(&seed) % HP_BUF_BENCH_THREAD_HELD;
+		bp = held[slot];
+		if (bp) {
+			for (i = 0; i < bp->size; i++) {
+				if (((u8 *)bp->payload)[i] != thr->id) {
+					thr->errors++;
+					break;
+				}
+			}
+			hp_buf_free(bp);
+			held[slot] = NULL;
+			continue;
+		}
+		bp = hp_buf_alloc(sizes[rand_r(&seed) % ARRAY_LEN(sizes)]);
+		if (!bp) {
+			continue;
+		}
+		thr->allocs++;
+		memset(bp->payload, thr->id, bp->size);
+		held[slot] = bp;
+	}
+	for (slot = 0; slot < HP_BUF_BENCH_THREAD_HELD; slot++) {
+		hp_buf_free(held[slot]);
+	}
+	return NULL;
+}
+
+/*
+ * Run threads sharing the pool.  Returns the number of errors found.
+ */
+static int hp_buf_bench_threads(unsigned int threads, u32 iter)
+{
+	static struct hp_buf_bench_thread thr[HP_BUF_BENCH_THREADS];
+	struct hp_buf_stats stats;
+	u32 allocs = 0;
+	u32 errors = 0;
+	u64 start;
+	u64 usecs;
+	unsigned int i;
+
+	if (threads > HP_BUF_BENCH_THREADS) {
+		threads = HP_BUF_BENCH_THREADS;
+	}
+	if (hp_buf_init()) {
+		return 1;
+	}
+	start = host_loop_time_us();
+	for (i = 0; i < threads; i++) {
+		thr[i].id = i + 1;
+		thr[i].iter = iter;
+		pthread_create(&thr[i].thread, NULL,
+		    hp_buf_bench_thread_run, &thr[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(thr[i].thread, NULL);
+		allocs += thr[i].allocs;
+		errors += thr[i].errors;
+	}
+	usecs = host_loop_time_us() - start;
+	hp_buf_stats_get(&stats);
+	if (stats.in_use) {
+		errors++;
+	}
+
+	printf("%u threads: allocs %lu fails %lu in use %lu errors %lu, "
+	    "%.1f ns per alloc, fill, check and free\n",
+	    threads, (unsigned long)allocs, (unsigned long)stats.fails,
+	    (unsigned long)stats.in_use, (unsigned long)errors,
+	    allocs ? usecs * 1000.0 / allocs : 0);
+	hp_buf_exit();
+	return errors != 0;
+}
+
+/*
+ * Build a full packet like an MCU OTA chunk: command, offset and as much
+ * of the value as fits in TLVs.
+ */
+static void hp_buf_bench_chain_build(struct hp_buf *bp, const u8 *val,
+		size_t len)
+{
+	hp_buf_tlv_cmd_set(bp, ASPI_PROTO_CMD, ACMD_MCU_OTA_LOAD, 1);
+	hp_buf_tlv_append_be32(bp, ATLV_OFF, 0x12345678);
+	hp_buf_tlv_append_split(bp, ATLV_BIN, val, len);
+}
+
+/*
+ * Compare chained and contiguous packets.  Returns the number of errors.
+ */
+static int hp_buf_bench_chains(u32 iter)
+{
+	struct hp_buf *large[HP_BUF_COUNT];
+	struct hp_buf *chain;
+	struct hp_buf *bp;
+	struct hp_buf *seg;
+	u8 val[HP_BUF_LEN * 2];
+	u8 *flat;
+	size_t off = 0;
+	unsigned int segs = 0;
+	unsigned int i;
+	u64 start;
+	double chain_ns;
+	double flat_ns;
+	u32 n;
+	int errors = 0;
+
+	for (i = 0; i < sizeof(val); i++) {
+		val[i] = i * 7;
+	}
+	if (hp_buf_init()) {
+		return 1;
+	}
+
+	/*
+	 * Hold the large buffers so the packet has to be chained.
+	 */
+	for (i = 0; i < HP_BUF_COUNT; i++) {
+		large[i] = hp_buf_alloc(0);
+	}
+	chain = hp_buf_alloc_chain(0);
+	if (!chain) {
+		printf("chain alloc failed\n");
+		errors++;
+		goto out;
+	}
+	bp = large[0];
+	large[0] = NULL;
+
+	start = host_loop_time_us();
+	for (n = 0; n < iter; n++) {
+		hp_buf_bench_chain_build(chain, val, sizeof(val));
+	}
+	chain_ns = (host_loop_time_us() - start) * 1000.0 / iter;
+	start = host_loop_time_us();
+	for (n = 0; n < iter; n++) {
+		hp_buf_bench_chain_build(bp, val, sizeof(val));
+	}
+	flat_ns = (host_loop_time_us() - start) * 1000.0 / iter;
+
+	flat = bp->payload;
+	for (seg = chain; seg; seg = seg->seg) {
+		segs++;
+		if (off + seg->len > bp->len ||
+		    memcmp(flat + off, seg->payload, seg->len)) {
+			errors++;
+		}
+		off += seg->len;
+	}
+	if (off != bp->len || off != hp_buf_chain_len(chain)) {
+		errors++;
+	}
+	printf("%zu byte packet: %u segments %.1f ns, one buffer %.1f ns, "
+	    "errors %d\n", off, segs, chain_ns, flat_ns, errors);
+	hp_buf_free(bp);
+	hp_buf_free(chain);
+out:
+	for (i = 0; i < HP_BUF_COUNT; i++) {
+		hp_buf_free(large[i]);
+	}
+	hp_buf_exit();
+	return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned int rates[] = { 50, 100, 150, 200 };
+	const struct hp_buf_bench_layout *layout;
+	struct hp_buf_bench_result res;
+	u32 ticks = HP_BUF_BENCH_TICKS;
+	unsigned int nrates = ARRAY_LEN(rates);
+	unsigned int threads = 0;
+	unsigned int i;
+	int chains = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:r:t:c")) != -1) {
+		switch (opt) {
+		case 'n':
+			ticks = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rates[0] = strtoul(optarg, NULL, 0);
+			nrates = 1;
+			break;
+		case 't':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			chains = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ticks] "
+			    "[-r messages per 100 ticks] [-t threads] [-c]\n",
+			    argv[0]);
+			return 2;
+		}
+	}
+	if (chains) {
+		return hp_buf_bench_chains(ticks);
+	}
+	if (threads) {
+		return hp_buf_bench_threads(threads, ticks * 10);
+	}
+
+	printf("%u ticks, sizes in bytes, waits in ticks\n", ticks);
+	printf("%-8s %5s %4s %6s %6s %8s %8s %8s %6s %5s\n",
+	    "layout", "rate", "bufs", "bytes", "peak", "fails", "delayed",
+	    "wait avg", "max", "queue");
+	for (i = 0; i < nrates; i++) {
+		for (layout = hp_buf_bench_layouts;
+		    layout < &hp_buf_bench_layouts[
+		    ARRAY_LEN(hp_buf_bench_layouts)]; layout++) {
+			hp_buf_bench_run(layout, ticks, rates[i], &res);
+			printf("%-8s %5u %4lu %6lu %6lu %7.2f%% %7.2f%% "
+			    "%8.2f %6lu %5lu\n",
+			    layout->name, rates[i],
+			    (unsigned long)res.stats.count,
+			    (unsigned long)res.stats.bytes,
+			    (unsigned long)res.stats.bytes_peak,
+			    res.stats.allocs + res.stats.fails ?
+			    100.0 * res.stats.fails /
+			    (res.stats.allocs + res.stats.fails) : 0,
+			    res.msgs ? 100.0 * res.delayed / res.msgs : 0,
+			    res.msgs ? (double)res.wait_sum / res.msgs : 0,
+			    (unsigned long)res.wait_max,
+			    (unsigned long)res.waiting_max);
+		}
+	}
+	return 0;
+}
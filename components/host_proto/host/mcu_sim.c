@@ -0,0 +1,877 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Simulated host MCU.
+ *
+ * Implements the MCU end of the UART PPP framing with its own encoder
+ * and decoder, so the module side is checked against an independent
+ * implementation.  Sends each kind of message a number of times.
+ * If the module accepts MCU_UART_WINDOW, up to sim->window packets
+ * are kept in flight, otherwise each waits for its ACK.  Packets are
+ * then taken only in sequence, and a lost packet is resent with all those
+ * sent after it.  Messages needing a confirmation always wait for it
+ * before the next.
+ * If given property names, it binds them to IDs in its feature response.
+ * It changes to MCU_UART_FAST and MCU_UART_JUMBO once that response is
+ * acked, and goes back to the default link if it gives up on a packet.
+ * While its speed differs from the module's, or during a line outage,
+ * nothing gets through in either direction.
+ * It answers property GETs from the module with an integer value after
+ * sim->get_delay_ms, several at once if the module sends them, as an MCU
+ * fetching values from slower peripherals would.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/crc.h>
+#include <ayla/endian.h>
+#include <ayla/log.h>
+#include <ayla/tlv.h>
+#include <ayla/ayla_spi_mcu.h>
+#include <ayla/ayla_proto_mcu.h>
+#include "data_tlv.h"
+#include "host_loop.h"
+#include "host_uart.h"
+#include "mcu_sim.h"
+
+#define MCU_SIM_FLAG		0x7e
+#define MCU_SIM_ESC		0x7d
+#define MCU_SIM_XOR		0x20
+
+#define MCU_SIM_PT_DATA		1
+#define MCU_SIM_PT_ACK		2
+
+#define MCU_SIM_ACK_WAIT	200	/* ms before resending a packet */
+#define MCU_SIM_RETRIES		5
+#define MCU_SIM_RESP_WAIT	6000	/* ms, longer than module resend */
+#define MCU_SIM_FEATURE_WAIT	3000	/* ms to wait for feature request */
+#define MCU_SIM_LINK_WAIT	100	/* ms for module to change the link */
+#define MCU_SIM_SEQ_SPAN	255	/* seq #s 1 to 255 follow 0 */
+
+/*
+ * Append bytes with PPP escapes.  Returns the new length.
+ */
+static size_t mcu_sim_stuff(u8 *out, size_t off, const u8 *in, size_t len)
+{
+	while (len--) {
+		if (*in == MCU_SIM_FLAG || *in == MCU_SIM_ESC) {
+			out[off++] = MCU_SIM_ESC;
+			out[off++] = *in++ ^ MCU_SIM_XOR;
+		} else {
+			out[off++] = *in++;
+		}
+	}
+	return off;
+}
+
+/*
+ * Build a complete frame.  Returns its length.
+ */
+static size_t mcu_sim_frame(u8 *out, u8 ptype, u8 seq,
+		const u8 *data, size_t len)
+{
+	u8 head[2];
+	u8 tail[2];
+	u16 crc;
+	size_t off = 0;
+
+	head[0] = ptype;
+	head[1] = seq;
+	crc = crc16(head, sizeof(head), CRC16_INIT);
+	crc = crc16(data, len, crc);
+	put_ua_be16(tail, crc);
+
+	out[off++] = MCU_SIM_FLAG;
+	off = mcu_sim_stuff(out, off, head, sizeof(head));
+	off = mcu_sim_stuff(out, off, data, len);
+	off = mcu_sim_stuff(out, off, tail, sizeof(tail));
+	out[off++] = MCU_SIM_FLAG;
+	return off;
+}
+
+/*
+ * Return non-zero if the module's speed matches the simulated MCU's link.
+ * The module's speed is the one its driver was set to.
+ */
+static int mcu_sim_speed_ok(struct mcu_sim *sim)
+{
+	return !(sim->link & MCU_UART_FAST) == !host_uart_speed();
+}
+
+/*
+ * Return non-zero if bytes get through the line.
+ */
+static int mcu_sim_line_up(struct mcu_sim *sim)
+{
+	if (host_loop_time_us() < sim->outage_end_us) {
+		return 0;
+	}
+	return mcu_sim_speed_ok(sim);
+}
+
+static void mcu_sim_write_raw(struct mcu_sim *sim, const u8 *buf, size_t len)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = write(sim->fd, buf, len);
+		if (rc <= 0) {
+			log_put(LOG_ERR "mcu_sim: write err %d", errno);
+			return;
+		}
+		buf += rc;
+		len -= rc;
+	}
+}
+
+/*
+ * Write to the module.
+ * Nothing gets through during an outage.  At the wrong speed the module
+ * receives garbage, simulated by keeping the frame flags and replacing
+ * the other bytes, so it sees bad packets.
+ */
+static void mcu_sim_write(struct mcu_sim *sim, const u8 *buf, size_t len)
+{
+	u8 junk[64];
+	size_t tlen;
+	size_t i;
+
+	host_uart_line_delay(len);
+	if (mcu_sim_line_up(sim)) {
+		mcu_sim_write_raw(sim, buf, len);
+		return;
+	}
+	sim->line_lost += len;
+	if (host_loop_time_us() < sim->outage_end_us) {
+		return;
+	}
+	while (len) {
+		tlen = len < sizeof(junk) ? len : sizeof(junk);
+		for (i = 0; i < tlen; i++) {
+			junk[i] = buf[i] == MCU_SIM_FLAG ? MCU_SIM_FLAG : 0x55;
+		}
+		mcu_sim_write_raw(sim, junk, tlen);
+		buf += tlen;
+		len -= tlen;
+	}
+}
+
+static void mcu_sim_ack(struct mcu_sim *sim, u8 seq)
+{
+	u8 frame[16];
+
+	mcu_sim_write(sim, frame,
+	    mcu_sim_frame(frame, MCU_SIM_PT_ACK, seq, NULL, 0));
+}
+
+/*
+ * Count the TLVs of a type in a data packet.
+ */
+static u32 mcu_sim_tlv_count(const u8 *data, size_t len,
+		enum ayla_tlv_type type)
+{
+	const struct ayla_tlv *tlv;
+	size_t off = sizeof(struct ayla_cmd);
+	u32 count = 0;
+
+	while (off + sizeof(*tlv) <= len) {
+		tlv = (const struct ayla_tlv *)(data + off);
+		if (tlv->type == type) {
+			count++;
+		}
+		off += sizeof(*tlv) + tlv->len;
+	}
+	return count;
+}
+
+/*
+ * Note a property GET from the module to be answered later.
+ */
+static void mcu_sim_get_rx(struct mcu_sim *sim, u16 req_id,
+		const u8 *data, size_t len)
+{
+	const struct ayla_tlv *tlv;
+	struct mcu_sim_get *get;
+	size_t tlv_len;
+
+	len -= sizeof(struct ayla_cmd);
+	tlv = (const struct ayla_tlv *)(data + sizeof(struct ayla_cmd));
+	if (len < sizeof(*tlv)) {
+		sim->rx_errs++;
+		return;
+	}
+	tlv_len = sizeof(*tlv) + tlv->len;
+	if (len < tlv_len ||
+	    tlv_len > sizeof(get->tlv) ||
+	    (tlv->type != ATLV_NAME && tlv->type != ATLV_PROP_ID)) {
+		sim->rx_errs++;
+		return;
+	}
+	if (sim->get_lose_every && !(++sim->gets_rx % sim->get_lose_every)) {
+		sim->gets_lost++;
+		return;
+	}
+	for (get = sim->get_reqs; get->in_use; get++) {
+		if (get >= &sim->get_reqs[MCU_SIM_GETS_MAX - 1]) {
+			sim->gets_dropped++;
+			return;
+		}
+	}
+	get->in_use = 1;
+	get->second = 0;
+	get->req_id = req_id;
+	get->due_us = host_loop_time_us() + sim->get_delay_ms * 1000ULL;
+	get->tlv_len = tlv_len;
+	memcpy(get->tlv, tlv, tlv_len);
+	if (++sim->gets_pending > sim->gets_max) {
+		sim->gets_max = sim->gets_pending;
+	}
+}
+
+/*
+ * Handle a data packet from the module.
+ */
+static void mcu_sim_rx_data(struct mcu_sim *sim, const u8 *data, size_t len)
+{
+	const struct ayla_cmd *cmd = (const struct ayla_cmd *)data;
+	u16 req_id;
+
+	if (len < sizeof(*cmd)) {
+		return;
+	}
+	req_id = get_ua_be16(&cmd->req_id);
+	if (cmd->protocol == ASPI_PROTO_CMD) {
+		/* configuration response or NAK */
+		if ((cmd->opcode == ACMD_RESP || cmd->opcode == ACMD_NAK) &&
+		    req_id == sim->wait_req_id) {
+			sim->resp_seen = 1;
+			sim->resp_nak = cmd->opcode == ACMD_NAK;
+		}
+		return;
+	}
+	if (cmd->protocol != ASPI_PROTO_DATA) {
+		return;
+	}
+	switch (cmd->opcode) {
+	case AD_SEND_PROP:
+		if (len == sizeof(*cmd)) {
+			/* request without a name asks for features */
+			sim->feat_req_id = req_id;
+			sim->feat_pending = 1;
+			sim->feature_reqs++;
+			break;
+		}
+		mcu_sim_get_rx(sim, req_id, data, len);
+		break;
+	case AD_RECV_TLV:
+		sim->recv_pkts++;
+		sim->recv_props += mcu_sim_tlv_count(data, len, ATLV_NAME) +
+		    mcu_sim_tlv_count(data, len, ATLV_PROP_ID);
+		if (mcu_sim_tlv_count(data, len, ATLV_DPMETA)) {
+			sim->recv_meta++;
+			if (mcu_sim_tlv_count(data, len, ATLV_OFF)) {
+				sim->recv_meta_parts++;
+			}
+		}
+		break;
+	case AD_NAK:
+		sim->nak_props += mcu_sim_tlv_count(data, len, ATLV_NAME) +
+		    mcu_sim_tlv_count(data, len, ATLV_PROP_ID);
+		/* fall through */
+	case AD_CONFIRM:
+		if (req_id == sim->wait_req_id) {
+			sim->resp_seen = 1;
+			sim->resp_nak = cmd->opcode == AD_NAK;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Handle an ACK for a packet in flight.
+ */
+static void mcu_sim_rx_ack(struct mcu_sim *sim, u8 seq)
+{
+	struct mcu_sim_frame *frame;
+	struct mcu_sim_msg *msg;
+	u32 us;
+
+	for (frame = sim->frames;
+	    frame < &sim->frames[MCU_SIM_WINDOW_MAX]; frame++) {
+		if (frame->in_use && frame->seq == seq) {
+			break;
+		}
+	}
+	if (frame >= &sim->frames[MCU_SIM_WINDOW_MAX]) {
+		return;
+	}
+	frame->in_use = 0;
+	sim->in_flight--;
+	msg = frame->msg;
+	if (!msg) {
+		return;
+	}
+	us = (u32)(host_loop_time_us() - frame->sent_us);
+	msg->count++;
+	msg->payload_bytes += frame->len;
+	msg->ack_us_sum += us;
+	if (us < msg->ack_us_min) {
+		msg->ack_us_min = us;
+	}
+	if (us > msg->ack_us_max) {
+		msg->ack_us_max = us;
+	}
+}
+
+/*
+ * Check a received data packet's seq # against the last one taken.
+ * Returns 0 to take it, 1 if it is a duplicate, or -1 if it is out of
+ * sequence after a lost packet and must be dropped.
+ */
+static int mcu_sim_rx_seq(struct mcu_sim *sim, u8 seq)
+{
+	u8 dist;
+
+	if (!seq || !sim->rx_seq_valid) {
+		return 0;
+	}
+	dist = sim->rx_seq ?
+	    (seq + MCU_SIM_SEQ_SPAN - sim->rx_seq) % MCU_SIM_SEQ_SPAN : seq;
+	if (dist == 1) {
+		return 0;
+	}
+	if (!dist || (sim->rx_seq &&
+	    dist > MCU_SIM_SEQ_SPAN - MCU_SIM_WINDOW_MAX)) {
+		return 1;
+	}
+	if (sim->features & MCU_UART_WINDOW) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Handle a complete unescaped frame.
+ */
+static void mcu_sim_rx_frame(struct mcu_sim *sim, const u8 *buf, size_t len)
+{
+	int dup;
+
+	if (len < 4 || crc16(buf, len, CRC16_INIT)) {
+		sim->rx_errs++;
+		return;
+	}
+	switch (buf[0]) {
+	case MCU_SIM_PT_ACK:
+		mcu_sim_rx_ack(sim, buf[1]);
+		break;
+	case MCU_SIM_PT_DATA:
+		if (sim->drop_every && !(++sim->rx_data % sim->drop_every)) {
+			/* act as if the packet was lost on the line */
+			sim->dropped++;
+			break;
+		}
+		dup = mcu_sim_rx_seq(sim, buf[1]);
+		if (dup < 0) {
+			sim->rx_ahead++;
+			break;
+		}
+		mcu_sim_ack(sim, buf[1]);
+		if (dup) {
+			sim->rx_dups++;
+			break;
+		}
+		sim->rx_seq = buf[1];
+		sim->rx_seq_valid = 1;
+		mcu_sim_rx_data(sim, buf + 2, len - 4);
+		break;
+	default:
+		sim->rx_errs++;
+		break;
+	}
+}
+
+static void mcu_sim_rx_byte(struct mcu_sim *sim, u8 byte)
+{
+	if (byte == MCU_SIM_FLAG) {
+		if (sim->rx_len) {
+			mcu_sim_rx_frame(sim, sim->rx_buf, sim->rx_len);
+		}
+		sim->rx_len = 0;
+		sim->rx_esc = 0;
+		return;
+	}
+	if (byte == MCU_SIM_ESC) {
+		sim->rx_esc = 1;
+		return;
+	}
+	if (sim->rx_esc) {
+		byte ^= MCU_SIM_XOR;
+		sim->rx_esc = 0;
+	}
+	if (sim->rx_len >= sizeof(sim->rx_buf)) {
+		sim->rx_errs++;
+		sim->rx_len = 0;
+		return;
+	}
+	sim->rx_buf[sim->rx_len++] = byte;
+}
+
+/*
+ * Receive and handle whatever arrives within wait_ms.
+ */
+static void mcu_sim_service(struct mcu_sim *sim, u32 wait_ms)
+{
+	struct pollfd pfd;
+	u8 buf[256];
+	ssize_t rc;
+	ssize_t i;
+
+	pfd.fd = sim->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, (int)wait_ms) <= 0) {
+		return;
+	}
+	rc = read(sim->fd, buf, sizeof(buf));
+	if (rc > 0 && !mcu_sim_line_up(sim)) {
+		sim->line_lost += rc;
+		sim->rx_len = 0;
+		sim->rx_esc = 0;
+		return;
+	}
+	for (i = 0; i < rc; i++) {
+		mcu_sim_rx_byte(sim, buf[i]);
+	}
+}
+
+static void mcu_sim_xmit(struct mcu_sim *sim, struct mcu_sim_frame *frame)
+{
+	u8 buf[sizeof(frame->buf)];
+
+	if (sim->corrupt_every && !(++sim->tx_count % sim->corrupt_every)) {
+		/* flip a bit in the sequence number so the CRC fails */
+		memcpy(buf, frame->buf, frame->flen);
+		buf[2] ^= 0x40;
+		mcu_sim_write(sim, buf, frame->flen);
+	} else {
+		mcu_sim_write(sim, frame->buf, frame->flen);
+	}
+	frame->xmit_us = host_loop_time_us();
+	if (frame->msg) {
+		frame->msg->wire_bytes += frame->flen;
+	}
+}
+
+/*
+ * Return the packet in flight sent next after prev, or the earliest
+ * if prev is NULL.  Returns NULL if there is none.
+ */
+static struct mcu_sim_frame *mcu_sim_frame_next(struct mcu_sim *sim,
+		struct mcu_sim_frame *prev)
+{
+	struct mcu_sim_frame *frame;
+	struct mcu_sim_frame *next = NULL;
+
+	for (frame = sim->frames;
+	    frame < &sim->frames[MCU_SIM_WINDOW_MAX]; frame++) {
+		if (frame->in_use && frame != prev &&
+		    (!prev || (s16)(frame->order - prev->order) > 0) &&
+		    (!next || (s16)(frame->order - next->order) < 0)) {
+			next = frame;
+		}
+	}
+	return next;
+}
+
+/*
+ * Once the earliest packet's ACK wait has expired, resend it and every
+ * packet sent after it, in order, as the module takes them in sequence.
+ * On giving up, drop those too and restart the sequence at 0.
+ */
+static void mcu_sim_resend_check(struct mcu_sim *sim)
+{
+	struct mcu_sim_frame *frame;
+	u64 now = host_loop_time_us();
+
+	frame = mcu_sim_frame_next(sim, NULL);
+	if (!frame || now - frame->xmit_us < MCU_SIM_ACK_WAIT * 1000) {
+		return;
+	}
+	if (frame->tries >= MCU_SIM_RETRIES) {
+		for (; frame; frame = mcu_sim_frame_next(sim, frame)) {
+			log_put(LOG_ERR "mcu_sim: no ack for seq %u",
+			    frame->seq);
+			frame->in_use = 0;
+			sim->in_flight--;
+			sim->lost++;
+		}
+		sim->tx_first = 1;
+		if (sim->link) {
+			log_put(LOG_WARN "mcu_sim: back to default link");
+			sim->link = 0;
+			sim->link_fallbacks++;
+		}
+		return;
+	}
+	for (; frame; frame = mcu_sim_frame_next(sim, frame)) {
+		frame->tries++;
+		sim->resends++;
+		mcu_sim_xmit(sim, frame);
+	}
+}
+
+static void mcu_sim_send(struct mcu_sim *sim, struct mcu_sim_msg *msg,
+		const u8 *data, size_t len);
+
+/*
+ * Answer a module GET with an integer value.
+ * With MCU_GET_PIPELINE, the value is instead a string of the number in
+ * hex twice, sent in two parts, so the parts of replies can interleave.
+ * Returns non-zero if the second part is still to be sent.
+ */
+static int mcu_sim_get_reply(struct mcu_sim *sim, struct mcu_sim_get *get)
+{
+	u8 buf[sizeof(struct ayla_cmd) + MCU_SIM_GET_TLV_LEN +
+	    2 * sizeof(struct ayla_tlv) + 2 * MCU_SIM_GET_PART_LEN];
+	char str[2 * MCU_SIM_GET_PART_LEN + 1];
+	struct ayla_cmd *cmd = (struct ayla_cmd *)buf;
+	struct ayla_tlv *tlv;
+	int split = sim->features_ext & MCU_GET_PIPELINE;
+
+	if (!get->second) {
+		get->val = sim->gets++;
+	}
+	cmd->protocol = ASPI_PROTO_DATA;
+	cmd->opcode = AD_SEND_PROP_RESP;
+	put_ua_be16(&cmd->req_id, get->req_id);
+	tlv = (struct ayla_tlv *)(cmd + 1);
+	memcpy(tlv, get->tlv, get->tlv_len);
+	tlv = TLV_NEXT(tlv);
+	if (!split) {
+		tlv->type = ATLV_INT;
+		tlv->len = sizeof(u32);
+		put_ua_be32(TLV_VAL(tlv), get->val);
+		tlv = TLV_NEXT(tlv);
+		mcu_sim_send(sim, NULL, buf, (u8 *)tlv - buf);
+		return 0;
+	}
+	snprintf(str, sizeof(str), "%08x%08x", get->val, get->val);
+	tlv->type = ATLV_UTF8;
+	tlv->len = MCU_SIM_GET_PART_LEN;
+	memcpy(TLV_VAL(tlv), str + get->second * MCU_SIM_GET_PART_LEN,
+	    MCU_SIM_GET_PART_LEN);
+	tlv = TLV_NEXT(tlv);
+	if (!get->second) {
+		tlv->type = ATLV_LEN;
+		put_ua_be32(TLV_VAL(tlv), 2 * MCU_SIM_GET_PART_LEN);
+	} else {
+		tlv->type = ATLV_OFF;
+		put_ua_be32(TLV_VAL(tlv), MCU_SIM_GET_PART_LEN);
+	}
+	tlv->len = sizeof(u32);
+	tlv = TLV_NEXT(tlv);
+	mcu_sim_send(sim, NULL, buf, (u8 *)tlv - buf);
+	get->second = !get->second;
+	return get->second;
+}
+
+/*
+ * Send replies to module GETs that are due.
+ * The first parts of split replies all go before their second parts.
+ * Sending may wait for the window, which polls again, so this is guarded.
+ */
+static void mcu_sim_get_check(struct mcu_sim *sim)
+{
+	struct mcu_sim_get *get;
+	u64 now;
+
+	if (!sim->gets_pending || sim->get_sending) {
+		return;
+	}
+	sim->get_sending = 1;
+	for (get = sim->get_reqs;
+	    get < &sim->get_reqs[MCU_SIM_GETS_MAX]; get++) {
+		now = host_loop_time_us();
+		if (!get->in_use || get->second || now < get->due_us) {
+			continue;
+		}
+		if (mcu_sim_get_reply(sim, get)) {
+			continue;
+		}
+		get->in_use = 0;
+		sim->gets_pending--;
+	}
+	for (get = sim->get_reqs;
+	    get < &sim->get_reqs[MCU_SIM_GETS_MAX]; get++) {
+		if (!get->in_use || !get->second) {
+			continue;
+		}
+		mcu_sim_get_reply(sim, get);
+		get->in_use = 0;
+		sim->gets_pending--;
+	}
+	sim->get_sending = 0;
+}
+
+/*
+ * Return the time to wait for input, no later than the next GET reply.
+ */
+static u32 mcu_sim_get_wait(struct mcu_sim *sim, u32 wait_ms)
+{
+	struct mcu_sim_get *get;
+	u64 now = host_loop_time_us();
+	u32 ms;
+
+	if (!sim->gets_pending || sim->get_sending) {
+		return wait_ms;
+	}
+	for (get = sim->get_reqs;
+	    get < &sim->get_reqs[MCU_SIM_GETS_MAX]; get++) {
+		if (!get->in_use) {
+			continue;
+		}
+		ms = get->due_us > now ?
+		    (u32)((get->due_us - now + 999) / 1000) : 0;
+		if (ms < wait_ms) {
+			wait_ms = ms;
+		}
+	}
+	return wait_ms;
+}
+
+/*
+ * Receive for up to wait_ms, then handle resends and GET replies.
+ */
+static void mcu_sim_poll(struct mcu_sim *sim, u32 wait_ms)
+{
+	mcu_sim_service(sim, mcu_sim_get_wait(sim, wait_ms));
+	mcu_sim_resend_check(sim);
+	mcu_sim_get_check(sim);
+}
+
+/*
+ * Wait until *flag is set or the time limit passes.
+ * Returns the flag.
+ */
+static int mcu_sim_wait(struct mcu_sim *sim, u8 *flag, u32 limit_ms)
+{
+	u64 end = host_loop_time_ms() + limit_ms;
+	u64 now;
+
+	while (!*flag) {
+		now = host_loop_time_ms();
+		if (now >= end) {
+			break;
+		}
+		mcu_sim_poll(sim, (u32)(end - now) < MCU_SIM_ACK_WAIT ?
+		    (u32)(end - now) : MCU_SIM_ACK_WAIT);
+	}
+	return *flag;
+}
+
+/*
+ * Wait until fewer than limit packets are in flight.
+ */
+static void mcu_sim_wait_window(struct mcu_sim *sim, u8 limit)
+{
+	while (sim->in_flight >= limit) {
+		mcu_sim_poll(sim, MCU_SIM_ACK_WAIT);
+	}
+}
+
+/*
+ * Return the number of packets that may be in flight.
+ */
+static u8 mcu_sim_window(struct mcu_sim *sim)
+{
+	if (!(sim->features & MCU_UART_WINDOW) || sim->window <= 1) {
+		return 1;
+	}
+	return sim->window < MCU_SIM_WINDOW_MAX ?
+	    sim->window : MCU_SIM_WINDOW_MAX;
+}
+
+static u8 mcu_sim_seq_next(struct mcu_sim *sim)
+{
+	if (sim->tx_first) {
+		sim->tx_first = 0;
+		sim->tx_seq = 0;	/* lollipop start */
+	} else if (!++sim->tx_seq) {
+		sim->tx_seq = 1;
+	}
+	return sim->tx_seq;
+}
+
+/*
+ * Send a data packet once the window allows it.
+ * The ACK is handled as it arrives.
+ */
+static void mcu_sim_send(struct mcu_sim *sim, struct mcu_sim_msg *msg,
+		const u8 *data, size_t len)
+{
+	struct mcu_sim_frame *frame;
+
+	mcu_sim_wait_window(sim, mcu_sim_window(sim));
+	for (frame = sim->frames; frame->in_use; frame++) {
+		ASSERT(frame < &sim->frames[MCU_SIM_WINDOW_MAX - 1]);
+	}
+	frame->in_use = 1;
+	frame->msg = msg;
+	frame->tries = 0;
+	frame->len = len;
+	frame->seq = mcu_sim_seq_next(sim);
+	frame->order = sim->tx_order++;
+	frame->flen = mcu_sim_frame(frame->buf, MCU_SIM_PT_DATA, frame->seq,
+	    data, len);
+	frame->sent_us = host_loop_time_us();
+	sim->in_flight++;
+	mcu_sim_xmit(sim, frame);
+}
+
+/*
+ * Answer the module's feature request with a NAK carrying features.
+ */
+static void mcu_sim_feat_reply(struct mcu_sim *sim)
+{
+	u8 buf[MCU_UART_JUMBO_LEN];
+	struct ayla_cmd *cmd = (struct ayla_cmd *)buf;
+	struct ayla_tlv *tlv;
+	unsigned int i;
+	size_t len;
+	u32 lost;
+	u64 end;
+
+	sim->feat_pending = 0;
+	cmd->protocol = ASPI_PROTO_DATA;
+	cmd->opcode = AD_SEND_PROP_RESP;
+	put_ua_be16(&cmd->req_id, sim->feat_req_id);
+	tlv = (struct ayla_tlv *)(cmd + 1);
+	tlv->type = ATLV_ERR;
+	tlv->len = 1;
+	*(u8 *)TLV_VAL(tlv) = AERR_UNK_PROP;
+	tlv = TLV_NEXT(tlv);
+	tlv->type = ATLV_FEATURES;
+	tlv->len = 1;
+	*(u8 *)TLV_VAL(tlv) = sim->features;
+	if (sim->features_ext) {
+		tlv->len = 2;
+		((u8 *)TLV_VAL(tlv))[1] = sim->features_ext;
+	}
+	tlv = TLV_NEXT(tlv);
+	for (i = 0; i < sim->nprop_ids; i++) {
+		len = strlen(sim->prop_ids[i]);
+		ASSERT((u8 *)tlv + 3 * sizeof(*tlv) + len + 1 <=
+		    buf + ASPI_LEN_MAX);
+		tlv->type = ATLV_NAME;
+		tlv->len = len;
+		memcpy(TLV_VAL(tlv), sim->prop_ids[i], len);
+		tlv = TLV_NEXT(tlv);
+		tlv->type = ATLV_PROP_ID;
+		tlv->len = 1;
+		*(u8 *)TLV_VAL(tlv) = i + 1;
+		tlv = TLV_NEXT(tlv);
+	}
+	lost = sim->lost;
+	mcu_sim_send(sim, NULL, buf, (u8 *)tlv - buf);
+
+	/* the module uses the features once it has the response */
+	mcu_sim_wait_window(sim, 1);
+	if (sim->lost != lost) {
+		return;
+	}
+
+	/* give the module time to change the link before using it */
+	if (sim->features & (MCU_UART_FAST | MCU_UART_JUMBO)) {
+		end = host_loop_time_ms() + MCU_SIM_LINK_WAIT;
+		while (host_loop_time_ms() < end) {
+			mcu_sim_poll(sim, MCU_SIM_LINK_WAIT);
+		}
+	}
+	sim->link = sim->features & (MCU_UART_FAST | MCU_UART_JUMBO);
+}
+
+/*
+ * Send one kind of message sim->count times.
+ */
+static void mcu_sim_run_msg(struct mcu_sim *sim, struct mcu_sim_msg *msg)
+{
+	struct ayla_cmd *cmd = (struct ayla_cmd *)msg->buf;
+	u64 start;
+	u64 sent;
+	u32 i;
+
+	msg->ack_us_min = MAX_U32;
+	start = host_loop_time_us();
+	for (i = 0; i < sim->count; i++) {
+		if (sim->feat_pending) {
+			mcu_sim_feat_reply(sim);
+		}
+		sim->req_id++;
+		put_ua_be16(&cmd->req_id, sim->req_id);
+		sim->wait_req_id = sim->req_id;
+		sim->resp_seen = 0;
+
+		sent = host_loop_time_us();
+		mcu_sim_send(sim, msg, msg->buf, msg->len);
+		if (!msg->wait_resp) {
+			continue;
+		}
+		if (!mcu_sim_wait(sim, &sim->resp_seen, MCU_SIM_RESP_WAIT)) {
+			log_put(LOG_WARN "mcu_sim: %s req %#x no response",
+			    msg->name, sim->req_id);
+			continue;
+		}
+		msg->resps++;
+		msg->resp_us_sum += host_loop_time_us() - sent;
+		if (sim->resp_nak) {
+			msg->naks++;
+		}
+	}
+	mcu_sim_wait_window(sim, 1);
+	msg->elapsed_us = host_loop_time_us() - start;
+}
+
+static void *mcu_sim_thread(void *arg)
+{
+	struct mcu_sim *sim = arg;
+	unsigned int i;
+
+	sim->tx_first = 1;
+	mcu_sim_wait(sim, &sim->feat_pending, MCU_SIM_FEATURE_WAIT);
+	for (i = 0; i < sim->nmsgs; i++) {
+		mcu_sim_run_msg(sim, &sim->msgs[i]);
+		if (!i && sim->outage_ms) {
+			sim->outage_end_us = host_loop_time_us() +
+			    (u64)sim->outage_ms * 1000;
+		}
+	}
+	sim->done = 1;
+	while (!sim->stop) {
+		if (sim->feat_pending) {
+			mcu_sim_feat_reply(sim);
+		}
+		mcu_sim_poll(sim, MCU_SIM_ACK_WAIT);
+	}
+	return NULL;
+}
+
+int mcu_sim_start(struct mcu_sim *sim)
+{
+	return pthread_create(&sim->thread, NULL, mcu_sim_thread, sim);
+}
+
+void mcu_sim_join(struct mcu_sim *sim)
+{
+	sim->stop = 1;
+	pthread_join(sim->thread, NULL);
+}
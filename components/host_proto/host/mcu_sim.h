@@ -0,0 +1,143 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_MCU_SIM_H__
+#define __AYLA_MCU_SIM_H__
+
+#include <pthread.h>
+
+#define MCU_SIM_WINDOW_MAX	4	/* max packets in flight */
+#define MCU_SIM_GETS_MAX	16	/* max module GETs awaiting replies */
+#define MCU_SIM_GET_TLV_LEN	34	/* name or ID TLV of a module GET */
+#define MCU_SIM_GET_PART_LEN	8	/* each part of a split GET reply */
+
+/*
+ * One kind of message the simulated MCU sends, with its results.
+ */
+struct mcu_sim_msg {
+	const char *name;		/* label for the report */
+	u8	buf[MCU_UART_JUMBO_LEN];	/* packet, req_id filled in */
+	size_t	len;
+	u8	wait_resp;		/* wait for confirm or NAK by req_id */
+
+	u32	count;			/* packets acknowledged */
+	u32	resps;			/* responses received */
+	u32	naks;			/* NAKs received */
+	u64	payload_bytes;
+	u64	wire_bytes;		/* bytes on the line incl. framing */
+	u64	elapsed_us;
+	u64	ack_us_sum;
+	u32	ack_us_min;
+	u32	ack_us_max;
+	u64	resp_us_sum;
+};
+
+/*
+ * Data packet sent by the simulator and not yet acknowledged.
+ */
+struct mcu_sim_frame {
+	struct mcu_sim_msg *msg;	/* message for stats, may be NULL */
+	u64	sent_us;		/* time of first transmission */
+	u64	xmit_us;		/* time of latest transmission */
+	size_t	len;			/* payload length */
+	size_t	flen;			/* framed length */
+	u16	order;			/* position in the send sequence */
+	u8	seq;
+	u8	tries;
+	u8	in_use;
+	u8	buf[(MCU_UART_JUMBO_LEN + 4) * 2 + 2];
+};
+
+/*
+ * Property GET from the module, answered once its delay has passed.
+ */
+struct mcu_sim_get {
+	u64	due_us;			/* time to send the reply */
+	u16	req_id;
+	u8	in_use;
+	u8	second;			/* first part of a split reply sent */
+	u8	tlv_len;
+	u32	val;			/* value, once the reply is started */
+	u8	tlv[MCU_SIM_GET_TLV_LEN];	/* name or ID, echoed */
+};
+
+/*
+ * Simulated MCU running in its own thread on the other end of host_uart.
+ */
+struct mcu_sim {
+	int	fd;
+	u8	features;		/* feature mask sent to the module */
+	u8	features_ext;		/* second feature byte, if not 0 */
+	u8	window;			/* packets in flight if windowed */
+	u32	drop_every;		/* drop every Nth data packet rx */
+	u32	corrupt_every;		/* corrupt every Nth packet sent */
+	u32	count;			/* packets to send of each kind */
+	u32	get_delay_ms;		/* time taken to answer a module GET */
+	u32	get_lose_every;		/* never answer every Nth module GET */
+	u32	outage_ms;		/* line down after the first message */
+	const char * const *prop_ids;	/* names bound to IDs 1 to n */
+	unsigned int nprop_ids;
+	struct mcu_sim_msg *msgs;
+	unsigned int nmsgs;
+	volatile int done;		/* set when the run is complete */
+
+	u32	resends;
+	u32	rx_errs;
+	u32	feature_reqs;
+	u32	lost;			/* packets given up after retries */
+	u32	dropped;		/* rx packets dropped on purpose */
+	u32	rx_ahead;		/* rx packets after a lost one */
+	u32	rx_dups;		/* rx packets received again */
+	u32	recv_pkts;		/* property packets from the module */
+	u32	recv_props;		/* properties in those packets */
+	u32	nak_props;		/* properties named in NAKs */
+	u32	recv_meta;		/* property packets with metadata */
+	u32	recv_meta_parts;	/* of those, later parts of a value */
+	u32	gets;			/* module GETs answered */
+	u32	gets_dropped;		/* module GETs over MCU_SIM_GETS_MAX */
+	u32	gets_rx;		/* module GETs received */
+	u32	gets_lost;		/* module GETs never answered */
+	u8	gets_max;		/* most module GETs pending at once */
+	u32	link_fallbacks;		/* times back to the default link */
+	u32	line_lost;		/* bytes lost while the line was down */
+	u8	link;			/* MCU_UART_FAST and JUMBO if in use */
+
+	/* internal state */
+	pthread_t thread;
+	u8	tx_seq;
+	u8	tx_first;
+	u16	tx_order;
+	u8	rx_seq;			/* seq # of the last packet taken */
+	u8	rx_seq_valid;
+	u8	in_flight;
+	u8	resp_seen;
+	u8	resp_nak;
+	u16	req_id;
+	u16	wait_req_id;
+	u16	feat_req_id;		/* feature request needing a reply */
+	u8	feat_pending;
+	u8	gets_pending;
+	u8	get_sending;
+	volatile u8 stop;		/* set to end the thread */
+	u64	outage_end_us;		/* end of the line outage */
+	u8	rx_esc;
+	u32	rx_data;
+	u32	tx_count;
+	size_t	rx_len;
+	struct mcu_sim_frame frames[MCU_SIM_WINDOW_MAX];
+	struct mcu_sim_get get_reqs[MCU_SIM_GETS_MAX];
+	u8	rx_buf[MCU_UART_JUMBO_LEN + 4];
+};
+
+/*
+ * Start the simulator thread.  Returns 0 on success.
+ */
+int mcu_sim_start(struct mcu_sim *sim);
+
+/*
+ * Wait for the simulator to finish its messages, then stop its thread.
+ * Until then it keeps answering GETs from the module.
+ */
+void mcu_sim_join(struct mcu_sim *sim);
+
+#endif /* __AYLA_MCU_SIM_H__ */
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Micro-benchmark for the UART PPP framing.
+ *
+ * Compares the span-based mcu_uart_ppp_stuff() and mcu_uart_ppp_unstuff()
+ * against the byte-at-a-time ring buffer loops they replaced, over
+ * typical TLV payloads, and checks that both produce the same frames.
+ *
+ * Usage: ppp_bench [-n iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/endian.h>
+#include <ayla/tlv.h>
+#include <ayla/ayla_spi_mcu.h>
+#include <ayla/ayla_proto_mcu.h>
+#include "mcu_uart_ppp.h"
+#include "host_loop.h"
+
+#define PPP_BENCH_ITER	200000
+#define PPP_BENCH_OUT	(ASPI_LEN_MAX * 2 + 8)
+
+struct ppp_bench_case {
+	const char *name;
+	u8	buf[ASPI_LEN_MAX];
+	size_t	len;
+};
+
+/*
+ * Ring buffer as used by mcu_uart.c before the span-based framing.
+ */
+struct ppp_bench_ring {
+	u16	start;
+	u16	end;
+	u8	*buf;
+	u32	size;
+};
+
+static int ppp_bench_enq(struct ppp_bench_ring *ring, u8 data)
+{
+	int end = ring->end;
+
+	if (++end >= ring->size) {
+		end = 0;
+	}
+	if (end == ring->start) {
+		return -1;
+	}
+	ring->buf[ring->end] = data;
+	ring->end = end;
+	return 0;
+}
+
+static u8 *ppp_bench_deq(struct ppp_bench_ring *ring)
+{
+	int start = ring->start;
+	u8 *data;
+
+	if (start == ring->end) {
+		return NULL;
+	}
+	data = &ring->buf[start];
+	if (++start >= ring->size) {
+		start = 0;
+	}
+	ring->start = start;
+	return data;
+}
+
+static int ppp_bench_stuff_ref(struct ppp_bench_ring *ring,
+		const u8 *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (data[i] == UART_PPP_FLAG_BYTE ||
+		    data[i] == UART_PPP_ESCAPE_BYTE) {
+			if (ppp_bench_enq(ring, UART_PPP_ESCAPE_BYTE)) {
+				return -1;
+			}
+			if (ppp_bench_enq(ring, data[i] ^ UART_PPP_XOR_BYTE)) {
+				return -1;
+			}
+		} else if (ppp_bench_enq(ring, data[i])) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static ssize_t ppp_bench_unstuff_ref(struct ppp_bench_ring *ring,
+		u8 *out, size_t out_len)
+{
+	size_t len = 0;
+	u8 esc = 0;
+	u8 *data;
+
+	data = ppp_bench_deq(ring);
+	while (data != NULL && *data != UART_PPP_FLAG_BYTE) {
+		if (len == out_len) {
+			return -1;
+		}
+		if (esc) {
+			out[len++] = *data ^ UART_PPP_XOR_BYTE;
+			esc = 0;
+		} else if (*data == UART_PPP_ESCAPE_BYTE) {
+			esc = 1;
+		} else {
+			out[len++] = *data;
+		}
+		data = ppp_bench_deq(ring);
+	}
+	return data ? len : -1;
+}
+
+static void ppp_bench_tlv(struct ppp_bench_case *bc, enum ayla_tlv_type type,
+		const void *val, size_t len)
+{
+	struct ayla_tlv *tlv = (struct ayla_tlv *)(bc->buf + bc->len);
+
+	ASSERT(bc->len + sizeof(*tlv) + len <= sizeof(bc->buf));
+	tlv->type = type;
+	tlv->len = len;
+	memcpy(TLV_VAL(tlv), val, len);
+	bc->len += sizeof(*tlv) + len;
+}
+
+static void ppp_bench_cmd(struct ppp_bench_case *bc, const char *name,
+		u8 opcode)
+{
+	struct ayla_cmd *cmd = (struct ayla_cmd *)bc->buf;
+
+	memset(bc, 0, sizeof(*bc));
+	bc->name = name;
+	cmd->protocol = ASPI_PROTO_DATA;
+	cmd->opcode = opcode;
+	put_ua_be16(&cmd->req_id, 0x127e);
+	bc->len = sizeof(*cmd);
+}
+
+static unsigned int ppp_bench_cases(struct ppp_bench_case *bc)
+{
+	struct ppp_bench_case *start = bc;
+	static const char str[] =
+	    "Living room fan, speed 3 of 6, light dimmed to 40 percent";
+	u8 val[4];
+	u8 bin[TLV_MAX_LEN];
+	size_t i;
+
+	put_ua_be32(val, 0x7d);
+	ppp_bench_cmd(bc, "int", AD_SEND_TLV);
+	ppp_bench_tlv(bc, ATLV_NAME, "fan_speed", 9);
+	ppp_bench_tlv(bc, ATLV_INT, val, sizeof(val));
+	bc++;
+
+	ppp_bench_cmd(bc, "utf8", AD_SEND_TLV);
+	ppp_bench_tlv(bc, ATLV_NAME, "fan_status", 10);
+	ppp_bench_tlv(bc, ATLV_UTF8, str, sizeof(str) - 1);
+	bc++;
+
+	srand(1);
+	for (i = 0; i < sizeof(bin); i++) {
+		bin[i] = rand();
+	}
+	ppp_bench_cmd(bc, "bin random", AD_SEND_TLV);
+	ppp_bench_tlv(bc, ATLV_NAME, "fan_sched", 9);
+	ppp_bench_tlv(bc, ATLV_BIN, bin, sizeof(bin));
+	bc++;
+
+	memset(bin, UART_PPP_FLAG_BYTE, sizeof(bin));
+	ppp_bench_cmd(bc, "bin all 7e", AD_SEND_TLV);
+	ppp_bench_tlv(bc, ATLV_BIN, bin, 160);
+	bc++;
+
+	return bc - start;
+}
+
+/*
+ * Returns nanoseconds per payload byte.
+ */
+static double ppp_bench_ns(u64 start_us, u32 iter, size_t len)
+{
+	return (double)(host_loop_time_us() - start_us) * 1000 /
+	    ((double)iter * len);
+}
+
+static void ppp_bench_run(struct ppp_bench_case *bc, u32 iter)
+{
+	static u8 ring_area[PPP_BENCH_OUT + 1];
+	static u8 out[PPP_BENCH_OUT];
+	static u8 back[ASPI_LEN_MAX];
+	struct ppp_bench_ring ring;
+	struct mcu_uart_ppp_rx rx;
+	volatile size_t sink = 0;
+	ssize_t flen;
+	ssize_t rc;
+	u64 start;
+	double ref_tx;
+	double ref_rx;
+	double tx;
+	double rx_ns;
+	u32 i;
+
+	ring.buf = ring_area;
+	ring.size = sizeof(ring_area);
+
+	/* check the span version against the reference */
+	ring.start = 0;
+	ring.end = 0;
+	rc = ppp_bench_stuff_ref(&ring, bc->buf, bc->len);
+	ASSERT(!rc);
+	flen = mcu_uart_ppp_stuff(out, sizeof(out), bc->buf, bc->len,
+	    NULL);
+	ASSERT(flen == ring.end && !memcmp(out, ring.buf, flen));
+	out[flen] = UART_PPP_FLAG_BYTE;
+	memset(&rx, 0, sizeof(rx));
+	rx.buf = back;
+	rx.size = sizeof(back);
+	rc = mcu_uart_ppp_unstuff(&rx, out, flen + 1);
+	ASSERT(rc == flen + 1 && rx.done && rx.len == bc->len);
+	ASSERT(!memcmp(back, bc->buf, bc->len));
+
+	start = host_loop_time_us();
+	for (i = 0; i < iter; i++) {
+		ring.start = 0;
+		ring.end = 0;
+		ppp_bench_stuff_ref(&ring, bc->buf, bc->len);
+		sink += ring.end;
+	}
+	ref_tx = ppp_bench_ns(start, iter, bc->len);
+
+	start = host_loop_time_us();
+	for (i = 0; i < iter; i++) {
+		sink += mcu_uart_ppp_stuff(out, sizeof(out), bc->buf, bc->len,
+		    NULL);
+	}
+	tx = ppp_bench_ns(start, iter, bc->len);
+
+	/* the reference unstuffs from a ring holding the frame */
+	memcpy(ring_area, out, flen + 1);
+	start = host_loop_time_us();
+	for (i = 0; i < iter; i++) {
+		ring.start = 0;
+		ring.end = flen + 1;
+		sink += ppp_bench_unstuff_ref(&ring, back, sizeof(back));
+	}
+	ref_rx = ppp_bench_ns(start, iter, bc->len);
+
+	start = host_loop_time_us();
+	for (i = 0; i < iter; i++) {
+		memset(&rx, 0, sizeof(rx));
+		rx.buf = back;
+		rx.size = sizeof(back);
+		sink += mcu_uart_ppp_unstuff(&rx, out, flen + 1);
+	}
+	rx_ns = ppp_bench_ns(start, iter, bc->len);
+
+	printf("%-12s %5zu %5zd %8.2f %8.2f %6.1fx %8.2f %8.2f %6.1fx\n",
+	    bc->name, bc->len, flen, ref_tx, tx, ref_tx / tx,
+	    ref_rx, rx_ns, ref_rx / rx_ns);
+}
+
+int main(int argc, char **argv)
+{
+	struct ppp_bench_case cases[4];
+	unsigned int ncases;
+	unsigned int i;
+	u32 iter = PPP_BENCH_ITER;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iter = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+			return 2;
+		}
+	}
+	ncases = ppp_bench_cases(cases);
+	printf("%-12s %5s %5s %8s %8s %7s %8s %8s %7s\n",
+	    "payload", "len", "wire", "ref tx", "tx", "", "ref rx", "rx", "");
+	for (i = 0; i < ncases; i++) {
+		ppp_bench_run(&cases[i], iter);
+	}
+	printf("times in ns per payload byte\n");
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Benchmark for parsing data packets from the MCU.
+ *
+ * Runs data_tlv_recv_parse() over packets like those the MCU sends:
+ * integer, boolean and string property updates, a long string joined
+ * from several TLVs in a jumbo packet, an update with datapoint metadata,
+ * an ack and a batch entry.  Each packet is copied to a work buffer
+ * before parsing, as the UART receive does, since a jumbo join moves the
+ * value in place.  Reports packets and TLVs parsed per second.
+ *
+ * With -f, instead replays the packets in a file, one per line in hex,
+ * starting with the command header, as in the "dump:" lines of the
+ * host_proto_bench verbose output.
+ *
+ * Usage: tlv_bench [-n iterations] [-f file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/endian.h>
+#include <ayla/ayla_proto_mcu.h>
+#include "data_tlv.h"
+#include "host_loop.h"
+
+#define TLV_BENCH_ITER		100000
+#define TLV_BENCH_PKT_LEN	(MCU_UART_JUMBO_LEN + 64)
+#define TLV_BENCH_PKTS		64	/* max packets in a replay file */
+
+/*
+ * Packet to parse.
+ */
+struct tlv_bench_pkt {
+	char	name[24];
+	size_t	len;
+	unsigned int tlvs;
+	u8	buf[TLV_BENCH_PKT_LEN];
+};
+
+static struct tlv_bench_pkt tlv_bench_pkts[TLV_BENCH_PKTS];
+static unsigned int tlv_bench_count;
+
+static struct tlv_bench_pkt *tlv_bench_start(const char *name, u8 opcode)
+{
+	struct tlv_bench_pkt *pkt;
+	struct ayla_cmd *cmd;
+
+	ASSERT(tlv_bench_count < TLV_BENCH_PKTS);
+	pkt = &tlv_bench_pkts[tlv_bench_count++];
+	snprintf(pkt->name, sizeof(pkt->name), "%s", name);
+	cmd = (struct ayla_cmd *)pkt->buf;
+	cmd->protocol = ASPI_PROTO_DATA;
+	cmd->opcode = opcode;
+	put_ua_be16(&cmd->req_id, tlv_bench_count);
+	pkt->len = sizeof(*cmd);
+	pkt->tlvs = 0;
+	return pkt;
+}
+
+static void tlv_bench_put(struct tlv_bench_pkt *pkt, enum ayla_tlv_type type,
+		const void *val, size_t len)
+{
+	u8 *bp = pkt->buf + pkt->len;
+
+	ASSERT(len <= TLV_MAX_LEN);
+	ASSERT(pkt->len + sizeof(struct ayla_tlv) + len <= sizeof(pkt->buf));
+	bp[0] = type;
+	bp[1] = len;
+	memcpy(bp + sizeof(struct ayla_tlv), val, len);
+	pkt->len += sizeof(struct ayla_tlv) + len;
+	pkt->tlvs++;
+}
+
+static void tlv_bench_put_str(struct tlv_bench_pkt *pkt,
+		enum ayla_tlv_type type, const char *val)
+{
+	tlv_bench_put(pkt, type, val, strlen(val));
+}
+
+static void tlv_bench_put_u8(struct tlv_bench_pkt *pkt,
+		enum ayla_tlv_type type, u8 val)
+{
+	tlv_bench_put(pkt, type, &val, sizeof(val));
+}
+
+/*
+ * Build the default packet mix.
+ */
+static void tlv_bench_build(void)
+{
+	struct tlv_bench_pkt *pkt;
+	char str[TLV_MAX_LEN + 1];
+	u8 val[4];
+	int i;
+
+	pkt = tlv_bench_start("send int", AD_SEND_TLV);
+	tlv_bench_put_str(pkt, ATLV_NAME, "fan_speed");
+	put_ua_be32(val, 123456);
+	tlv_bench_put(pkt, ATLV_INT, val, sizeof(val));
+
+	pkt = tlv_bench_start("send bool", AD_SEND_TLV);
+	tlv_bench_put_str(pkt, ATLV_NAME, "fan_power");
+	tlv_bench_put_u8(pkt, ATLV_BOOL, 1);
+	tlv_bench_put_u8(pkt, ATLV_NODES, 1);
+
+	pkt = tlv_bench_start("send utf8", AD_SEND_TLV);
+	tlv_bench_put_str(pkt, ATLV_NAME, "fan_status");
+	tlv_bench_put_str(pkt, ATLV_UTF8,
+	    "speed 3 direction forward light 40 timer off");
+
+	pkt = tlv_bench_start("send long", AD_SEND_TLV);
+	tlv_bench_put_str(pkt, ATLV_NAME, "fan_schedule");
+	put_ua_be32(val, 3 * TLV_MAX_LEN);
+	tlv_bench_put(pkt, ATLV_LEN, val, sizeof(val));
+	memset(str, 'x', TLV_MAX_LEN);
+	str[TLV_MAX_LEN] = '\0';
+	for (i = 0; i < 3; i++) {
+		tlv_bench_put_str(pkt, ATLV_UTF8, str);
+	}
+
+	pkt = tlv_bench_start("send meta", AD_SEND_TLV);
+	tlv_bench_put_str(pkt, ATLV_DPMETA, "source");
+	tlv_bench_put_str(pkt, ATLV_UTF8, "remote");
+	tlv_bench_put_str(pkt, ATLV_DPMETA, "user");
+	tlv_bench_put_str(pkt, ATLV_UTF8, "kitchen");
+	tlv_bench_put_str(pkt, ATLV_NAME, "fan_light");
+	put_ua_be32(val, 40);
+	tlv_bench_put(pkt, ATLV_INT, val, sizeof(val));
+
+	pkt = tlv_bench_start("prop resp", AD_SEND_PROP_RESP);
+	tlv_bench_put_str(pkt, ATLV_NAME, "fan_direction");
+	tlv_bench_put_u8(pkt, ATLV_INT, 1);
+	put_ua_be32(val, 0);
+	tlv_bench_put(pkt, ATLV_CONT, val, sizeof(val));
+}
+
+/*
+ * Read packets from a file of hex lines.
+ */
+static int tlv_bench_read(const char *file)
+{
+	struct tlv_bench_pkt *pkt;
+	char line[2 * TLV_BENCH_PKT_LEN + 2];
+	unsigned int byte;
+	const char *cp;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) &&
+	    tlv_bench_count < TLV_BENCH_PKTS) {
+		pkt = &tlv_bench_pkts[tlv_bench_count];
+		snprintf(pkt->name, sizeof(pkt->name), "line %u",
+		    tlv_bench_count + 1);
+		pkt->len = 0;
+		pkt->tlvs = 0;
+		for (cp = line; isxdigit((u8)cp[0]) && isxdigit((u8)cp[1]) &&
+		    pkt->len < sizeof(pkt->buf); cp += 2) {
+			if (sscanf(cp, "%2x", &byte) != 1) {
+				break;
+			}
+			pkt->buf[pkt->len++] = byte;
+		}
+		if (pkt->len < sizeof(struct ayla_cmd)) {
+			continue;
+		}
+		for (cp = (char *)pkt->buf + sizeof(struct ayla_cmd);
+		    cp + sizeof(struct ayla_tlv) <= (char *)pkt->buf + pkt->len;
+		    cp += sizeof(struct ayla_tlv) + (u8)cp[1]) {
+			pkt->tlvs++;
+		}
+		tlv_bench_count++;
+	}
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static u8 work[TLV_BENCH_PKT_LEN];
+	struct tlv_bench_pkt *pkt;
+	const char *file = NULL;
+	u32 iter = TLV_BENCH_ITER;
+	u64 tot_us = 0;
+	u64 tot_tlvs = 0;
+	u64 start;
+	u64 us;
+	unsigned int i;
+	u32 n;
+	int err;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iter = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations] [-f file]\n",
+			    argv[0]);
+			return 2;
+		}
+	}
+	if (!iter) {
+		iter = 1;
+	}
+
+	mcu_feature_mask = MCU_UART_JUMBO;
+	if (file) {
+		if (tlv_bench_read(file)) {
+			return 1;
+		}
+	} else {
+		tlv_bench_build();
+	}
+
+	printf("%-12s %5s %5s %4s %10s %12s %8s\n",
+	    "packet", "len", "tlvs", "err", "pkt/s", "tlv/s", "ns/tlv");
+	for (i = 0; i < tlv_bench_count; i++) {
+		pkt = &tlv_bench_pkts[i];
+		memcpy(work, pkt->buf, pkt->len);
+		err = data_tlv_recv_parse(work, pkt->len);
+
+		start = host_loop_time_us();
+		for (n = 0; n < iter; n++) {
+			memcpy(work, pkt->buf, pkt->len);
+			data_tlv_recv_parse(work, pkt->len);
+		}
+		us = host_loop_time_us() - start;
+		if (!us) {
+			us = 1;
+		}
+		tot_us += us;
+		tot_tlvs += (u64)iter * pkt->tlvs;
+		printf("%-12s %5zu %5u %4x %10.0f %12.0f %8.1f\n",
+		    pkt->name, pkt->len, pkt->tlvs, err,
+		    (double)iter * 1000000 / us,
+		    (double)iter * pkt->tlvs * 1000000 / us,
+		    pkt->tlvs ? (double)us * 1000 / iter / pkt->tlvs : 0.0);
+	}
+	if (tot_us) {
+		printf("%-12s %5s %5s %4s %10s %12.0f %8.1f\n", "total",
+		    "", "", "", "", (double)tot_tlvs * 1000000 / tot_us,
+		    tot_tlvs ? (double)tot_us * 1000 / tot_tlvs : 0.0);
+	}
+	return 0;
+}
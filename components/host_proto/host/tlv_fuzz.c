@@ -0,0 +1,420 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Fuzzing and replay harness for the parsers of packets from the MCU.
+ *
+ * LLVMFuzzerTestOneInput() gives each input to data_tlv_process_mcu_pkt()
+ * as a packet received from the MCU, in a buffer of exactly its length,
+ * and then runs the callbacks and expired timers it pends.  Packets to
+ * the MCU are counted and freed.  Built with TLV_FUZZ_CONF, the input is
+ * instead the TLVs of a configuration get, or a set if the low bit of
+ * the first byte is 1, to go straight at conf_tlv_get() and conf_tlv_set().
+ * The module state carries over from one input to the next, as it would
+ * on the link.
+ *
+ * CMake links these with libFuzzer as tlv_fuzz_lf and conf_tlv_fuzz_lf when
+ * configured with -DHOST_PROTO_FUZZ=ON and clang, e.g.:
+ *
+ *	tlv_fuzz -o corpus host_proto_bench.log
+ *	tlv_fuzz_lf -max_len=1028 corpus
+ *
+ * Without libFuzzer, tlv_fuzz replays the packets the module received in
+ * host_proto_bench -v logs, each "uart_rx seq" line followed by the packet
+ * in hex, and reports the ns per packet for each opcode.  The packets of
+ * all the logs are replayed in order, as one session, for each iteration.
+ * The time includes the callbacks each packet pends.
+ * -o writes each packet to a file in the directory, for a seed corpus.
+ * -x instead runs each file given once through LLVMFuzzerTestOneInput(),
+ * to reproduce a failure from the fuzzer without it.
+ *
+ * Usage: tlv_fuzz [-n iterations] [-o corpus_dir] log...
+ *	tlv_fuzz -x file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/endian.h>
+#include <ayla/ayla_proto_mcu.h>
+#include <host_proto/host_proto.h>
+#include <host_proto/mcu_dev.h>
+#include "data_tlv.h"
+#include "host_decode.h"
+#include "hp_buf.h"
+#include "host_loop.h"
+#include "host_uart.h"
+
+#define TLV_FUZZ_ITER		1000
+#define TLV_FUZZ_LEN_MAX	(MCU_UART_JUMBO_LEN + 4)
+#define TLV_FUZZ_PKTS		512	/* max packets replayed */
+#define TLV_FUZZ_PROTOS		(ASPI_PROTO_LOG + 1)
+
+/*
+ * Packet from a log.
+ */
+struct tlv_fuzz_pkt {
+	size_t	len;
+	u8	buf[TLV_FUZZ_LEN_MAX];
+};
+
+/*
+ * Replay results for an opcode.
+ */
+struct tlv_fuzz_op {
+	u32	count;
+	u64	bytes;
+	u64	ns;
+};
+
+static struct tlv_fuzz_pkt tlv_fuzz_pkts[TLV_FUZZ_PKTS];
+static unsigned int tlv_fuzz_count;
+static struct tlv_fuzz_op tlv_fuzz_ops[TLV_FUZZ_PROTOS][256];
+static u32 tlv_fuzz_tx_pkts;
+
+static void tlv_fuzz_enq_tx(struct hp_buf *bp)
+{
+	tlv_fuzz_tx_pkts++;
+	hp_buf_free(bp);
+}
+
+static void tlv_fuzz_nop(void)
+{
+}
+
+static void tlv_fuzz_ping(void *buf, size_t len)
+{
+}
+
+/*
+ * Device in place of the UART, discarding packets to the MCU.
+ */
+static const struct mcu_dev tlv_fuzz_dev = {
+	.enq_tx = tlv_fuzz_enq_tx,
+	.set_ads = tlv_fuzz_nop,
+	.clear_ads = tlv_fuzz_nop,
+	.show = tlv_fuzz_nop,
+	.ping = tlv_fuzz_ping,
+};
+
+/*
+ * Run the callbacks and expired timers pended so far.
+ */
+static void tlv_fuzz_drain(void)
+{
+	host_loop_run_once(0);
+	host_loop_run_once(0);
+}
+
+static void tlv_fuzz_init(void)
+{
+	static u8 done;
+
+	if (done) {
+		return;
+	}
+	done = 1;
+	if (host_uart_open() < 0) {
+		fprintf(stderr, "host_uart_open failed\n");
+		exit(1);
+	}
+	host_proto_init(&host_loop_ops);
+	mcu_dev = &tlv_fuzz_dev;
+	mcu_feature_mask |= MCU_UART_JUMBO | MCU_PROP_PACK;
+	tlv_fuzz_drain();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	u8 *buf;
+	size_t len;
+#ifdef TLV_FUZZ_CONF
+	struct ayla_cmd *cmd;
+
+	if (!size || size - 1 > TLV_FUZZ_LEN_MAX - sizeof(*cmd)) {
+		return 0;
+	}
+	len = sizeof(*cmd) + size - 1;
+	buf = malloc(len);
+	ASSERT(buf);
+	cmd = (struct ayla_cmd *)buf;
+	cmd->protocol = ASPI_PROTO_CMD;
+	cmd->opcode = (data[0] & 1) ? ACMD_SET_CONF : ACMD_GET_CONF;
+	put_ua_be16(&cmd->req_id, data[0]);
+	memcpy(cmd + 1, data + 1, size - 1);
+#else
+	if (!size || size > TLV_FUZZ_LEN_MAX) {
+		return 0;
+	}
+	len = size;
+	buf = malloc(len);
+	ASSERT(buf);
+	memcpy(buf, data, len);
+#endif
+	tlv_fuzz_init();
+	data_tlv_process_mcu_pkt(buf, len);
+	free(buf);
+	tlv_fuzz_drain();
+	return 0;
+}
+
+#ifndef TLV_FUZZ_LIBFUZZER
+static u64 tlv_fuzz_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Read the packets received in a log.
+ */
+static int tlv_fuzz_read(const char *file)
+{
+	struct tlv_fuzz_pkt *pkt = NULL;
+	char line[256];
+	const char *cp;
+	unsigned int seq;
+	unsigned int byte;
+	size_t want = 0;
+	int off;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		perror(file);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		cp = strstr(line, "uart_rx seq ");
+		if (cp) {
+			pkt = NULL;
+			if (sscanf(cp, "uart_rx seq %x %zu bytes",
+			    &seq, &want) != 2 || want > TLV_FUZZ_LEN_MAX) {
+				continue;
+			}
+			if (tlv_fuzz_count >= TLV_FUZZ_PKTS) {
+				fprintf(stderr, "%s: more than %u packets\n",
+				    file, TLV_FUZZ_PKTS);
+				break;
+			}
+			pkt = &tlv_fuzz_pkts[tlv_fuzz_count];
+			pkt->len = 0;
+			continue;
+		}
+		if (!pkt) {
+			continue;
+		}
+		for (cp = line; pkt->len < want &&
+		    sscanf(cp, " %2x%n", &byte, &off) == 1; cp += off) {
+			pkt->buf[pkt->len++] = byte;
+		}
+		if (pkt->len < want && cp != line) {
+			continue;
+		}
+		if (pkt->len == want &&
+		    want >= sizeof(struct ayla_cmd) &&
+		    pkt->buf[0] < TLV_FUZZ_PROTOS) {
+			tlv_fuzz_count++;
+		}
+		pkt = NULL;
+	}
+	fclose(fp);
+	return 0;
+}
+
+static const char *tlv_fuzz_op_name(u8 protocol, u8 opcode)
+{
+	static const char * const protos[] = {
+		[ASPI_PROTO_CMD] = "cmd",
+		[ASPI_PROTO_DATA] = "data",
+		[ASPI_PROTO_PING] = "ping",
+		[ASPI_PROTO_LOG] = "log",
+	};
+	static char name[32];
+	const char *op;
+
+	op = host_decode_op_name(protocol, opcode);
+	if (op) {
+		snprintf(name, sizeof(name), "%s %s", protos[protocol], op);
+	} else {
+		snprintf(name, sizeof(name), "%s 0x%x", protos[protocol],
+		    opcode);
+	}
+	return name;
+}
+
+/*
+ * Write the packets as a libFuzzer corpus.
+ */
+static int tlv_fuzz_corpus_write(const char *dir)
+{
+	struct tlv_fuzz_pkt *pkt;
+	char path[256];
+	unsigned int i;
+	FILE *fp;
+
+	for (i = 0; i < tlv_fuzz_count; i++) {
+		pkt = &tlv_fuzz_pkts[i];
+		snprintf(path, sizeof(path), "%s/pkt-%4.4u", dir, i);
+		fp = fopen(path, "wb");
+		if (!fp) {
+			perror(path);
+			return -1;
+		}
+		if (fwrite(pkt->buf, pkt->len, 1, fp) != 1) {
+			perror(path);
+			fclose(fp);
+			return -1;
+		}
+		fclose(fp);
+	}
+	printf("%u packets written to %s\n", tlv_fuzz_count, dir);
+	return 0;
+}
+
+/*
+ * Run files through the fuzz entry point.
+ */
+static int tlv_fuzz_run_files(char **files, int count)
+{
+	static u8 buf[TLV_FUZZ_LEN_MAX + 1];
+	size_t len;
+	FILE *fp;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		fp = fopen(files[i], "rb");
+		if (!fp) {
+			perror(files[i]);
+			return 1;
+		}
+		len = fread(buf, 1, sizeof(buf), fp);
+		fclose(fp);
+		printf("%s: %zu bytes\n", files[i], len);
+		LLVMFuzzerTestOneInput(buf, len);
+	}
+	return 0;
+}
+
+static void tlv_fuzz_replay(u32 iter)
+{
+	static u8 work[TLV_FUZZ_LEN_MAX];
+	struct tlv_fuzz_pkt *pkt;
+	struct tlv_fuzz_op *op;
+	unsigned int i;
+	u64 start;
+	u64 ns;
+	u32 n;
+
+	for (n = 0; n < iter; n++) {
+		for (i = 0; i < tlv_fuzz_count; i++) {
+			pkt = &tlv_fuzz_pkts[i];
+			op = &tlv_fuzz_ops[pkt->buf[0]][pkt->buf[1]];
+			memcpy(work, pkt->buf, pkt->len);
+
+			start = tlv_fuzz_time_ns();
+			data_tlv_process_mcu_pkt(work, pkt->len);
+			tlv_fuzz_drain();
+			ns = tlv_fuzz_time_ns() - start;
+
+			op->count++;
+			op->bytes += pkt->len;
+			op->ns += ns;
+		}
+	}
+}
+
+static void tlv_fuzz_report(void)
+{
+	struct tlv_fuzz_op *op;
+	unsigned int proto;
+	unsigned int opcode;
+	u64 count = 0;
+	u64 ns = 0;
+
+	printf("%-20s %8s %6s %10s\n", "opcode", "count", "bytes", "ns/pkt");
+	for (proto = 0; proto < TLV_FUZZ_PROTOS; proto++) {
+		for (opcode = 0; opcode < 256; opcode++) {
+			op = &tlv_fuzz_ops[proto][opcode];
+			if (!op->count) {
+				continue;
+			}
+			printf("%-20s %8u %6llu %10.0f\n",
+			    tlv_fuzz_op_name(proto, opcode), op->count,
+			    (unsigned long long)(op->bytes / op->count),
+			    (double)op->ns / op->count);
+			count += op->count;
+			ns += op->ns;
+		}
+	}
+	if (count) {
+		printf("%-20s %8llu %6s %10.0f\n", "total",
+		    (unsigned long long)count, "", (double)ns / count);
+	}
+	printf("packets to the MCU %u\n", tlv_fuzz_tx_pkts);
+}
+
+static void tlv_fuzz_usage(const char *cmd)
+{
+	fprintf(stderr,
+	    "usage: %s [-n iterations] [-o corpus_dir] log...\n"
+	    "       %s -x file...\n", cmd, cmd);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = NULL;
+	u32 iter = TLV_FUZZ_ITER;
+	u8 run_files = 0;
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "n:o:x")) != -1) {
+		switch (opt) {
+		case 'n':
+			iter = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			dir = optarg;
+			break;
+		case 'x':
+			run_files = 1;
+			break;
+		default:
+			tlv_fuzz_usage(argv[0]);
+			break;
+		}
+	}
+	if (optind >= argc) {
+		tlv_fuzz_usage(argv[0]);
+	}
+	if (run_files) {
+		return tlv_fuzz_run_files(argv + optind, argc - optind);
+	}
+	for (i = optind; i < argc; i++) {
+		if (tlv_fuzz_read(argv[i])) {
+			return 1;
+		}
+	}
+	if (!tlv_fuzz_count) {
+		fprintf(stderr, "no packets found\n");
+		return 1;
+	}
+	if (dir) {
+		return tlv_fuzz_corpus_write(dir) ? 1 : 0;
+	}
+	tlv_fuzz_init();
+	tlv_fuzz_replay(iter);
+	tlv_fuzz_report();
+	return 0;
+}
+#endif /* TLV_FUZZ_LIBFUZZER */
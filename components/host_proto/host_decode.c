@@ -267,7 +267,7 @@ static void host_decode_tlv(struct host_decode_context *ctxt,
 			host_decode_put(ctxt, "tlv_u32_get err");
 			break;
 		}
-		host_decode_put(ctxt, "%lu", uval);
+		host_decode_put(ctxt, "%lu", (unsigned long)uval);
 		break;
 	case ATLV_EVENT_MASK:
 	case ATLV_FEATURES:
@@ -276,7 +276,7 @@ static void host_decode_tlv(struct host_decode_context *ctxt,
 			host_decode_put(ctxt, "tlv_u32_get err");
 			break;
 		}
-		host_decode_put(ctxt, "%#lx", uval);
+		host_decode_put(ctxt, "%#lx", (unsigned long)uval);
 		break;
 	case ATLV_INT:
 	case ATLV_CENTS:
@@ -284,7 +284,7 @@ static void host_decode_tlv(struct host_decode_context *ctxt,
 			host_decode_put(ctxt, "tlv_s32_get err");
 			break;
 		}
-		host_decode_put(ctxt, "%ld", ival);
+		host_decode_put(ctxt, "%ld", (long)ival);
 		break;
 	case ATLV_ACK_ID:
 		/*
@@ -387,6 +387,25 @@ static void host_decode_tlvs(struct host_decode_context *ctxt,
 	}
 }
 
+const char *host_decode_op_name(u8 protocol, u8 opcode)
+{
+	switch (protocol) {
+	case ASPI_PROTO_CMD:
+		if (opcode < ARRAY_LEN(host_decode_cmd)) {
+			return host_decode_cmd[opcode];
+		}
+		break;
+	case ASPI_PROTO_DATA:
+		if (opcode < ARRAY_LEN(host_decode_data)) {
+			return host_decode_data[opcode];
+		}
+		break;
+	default:
+		break;
+	}
+	return NULL;
+}
+
 /*
  * Decode Ayla command or data operation.
  */
@@ -6,4 +6,9 @@
 
 void host_decode_log(const char *msg, const void *buf, size_t len);
 
+/*
+ * Return the name of a command or data opcode, or NULL if unknown.
+ */
+const char *host_decode_op_name(u8 protocol, u8 opcode);
+
 #endif /* __AYLA_HOST_DECODE_H__ */
@@ -35,6 +35,7 @@
 #include "hp_buf.h"
 #include "hp_buf_cb.h"
 #include "host_proto_ota.h"
+#include "host_proto_int.h"
 
 const struct mcu_dev *mcu_dev;
 
@@ -80,3 +81,15 @@ void host_proto_timer_cancel(struct timer *tm)
 {
 	host_proto_app_ops->timer_cancel(tm);
 }
+
+ssize_t host_proto_put_varint(u8 *buf, size_t len, size_t off, u32 val)
+{
+	do {
+		if (off >= len) {
+			return -1;
+		}
+		buf[off++] = (val & 0x7f) | (val > 0x7f ? 0x80 : 0);
+		val >>= 7;
+	} while (val);
+	return off;
+}
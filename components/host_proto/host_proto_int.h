@@ -4,6 +4,8 @@
 #ifndef __AYLA_HOST_PROTO_INT_H__
 #define __AYLA_HOST_PROTO_INT_H__
 
+struct timer;
+
 /*
  * Schedule callback.
  *
@@ -27,4 +29,10 @@ void host_proto_timer_set(struct timer *tm, u32 delay_ms);
  */
 void host_proto_timer_cancel(struct timer *tm);
 
+/*
+ * Put an unsigned LEB128 varint in buf at offset off, for binary dumps.
+ * Returns the new offset or -1 if it does not fit.
+ */
+ssize_t host_proto_put_varint(u8 *buf, size_t len, size_t off, u32 val);
+
 #endif /* __AYLA_HOST_PROTO_INT_H__ */
@@ -23,7 +23,9 @@
 
 #include "hp_buf.h"
 #include "hp_buf_cb.h"
+#include "hp_buf_tlv.h"
 #include "host_proto_ota.h"
+#include "data_tlv.h"
 #include "conf_tlv.h"
 #include "host_proto_int.h"
 
@@ -48,6 +50,7 @@ struct host_proto_ota_state {
 static struct host_proto_ota_state host_proto_ota_state;
 
 static void host_proto_ota_notify_tmo(struct timer *tm);
+static void host_proto_ota_send_chunk(struct hp_buf *bp);
 static enum ada_err host_proto_ota_save_start(void);
 
 /*
@@ -63,6 +66,7 @@ static void host_proto_ota_free(void)
 	ota_state->version = NULL;
 	free(ota_state->image_buf);
 	ota_state->image_buf = NULL;
+	hp_buf_callback_cancel(host_proto_ota_send_chunk);
 }
 
 /*
@@ -97,7 +101,7 @@ static void host_proto_ota_status_cb(struct hp_buf *bp)
 
 	len = sizeof(*cmd);
 	if (ota_state->version) {
-		rc = tlv_put_str(bp->payload + len, HP_BUF_LEN - len,
+		rc = tlv_put_str(bp->payload + len, bp->size - len,
 		    ota_state->version);
 		if (rc > 0) {
 			len += rc;
@@ -105,7 +109,7 @@ static void host_proto_ota_status_cb(struct hp_buf *bp)
 	}
 	if (sz) {
 		put_ua_be32(&sz, sz);
-		rc = tlv_put(bp->payload + len, HP_BUF_LEN - len,
+		rc = tlv_put(bp->payload + len, bp->size - len,
 		    ATLV_LEN, &sz, sizeof(sz));
 		if (rc > 0) {
 			len += rc;
@@ -113,7 +117,7 @@ static void host_proto_ota_status_cb(struct hp_buf *bp)
 	}
 	bp->len = len;
 
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 
 	al_os_lock_lock(ota_state->lock);
 	if (ota_state->status_op == ACMD_MCU_OTA) {
@@ -283,13 +287,15 @@ static enum ada_err host_proto_ota_save_start(void)
 
 /*
  * Send OTA LOAD message to MCU.
+ * The chunk waits only for a medium buffer, then takes whatever free
+ * buffers it can as a chain to fill the packet.
  * Called in agent_app thread.
  */
 static void host_proto_ota_send_chunk(struct hp_buf *bp)
 {
 	struct host_proto_ota_state *ota_state = &host_proto_ota_state;
-	struct ayla_cmd *cmd;
-	struct ayla_tlv *tlv;
+	const void *data;
+	size_t space;
 	size_t len;
 
 	al_os_lock_lock(ota_state->lock);
@@ -299,32 +305,29 @@ static void host_proto_ota_send_chunk(struct hp_buf *bp)
 		return;			/* OTA may have failed */
 	}
 	len = ota_state->image_buf_len - ota_state->buf_off;
-	if (len > MAX_U8) {
-		len = MAX_U8;
+	data = (char *)ota_state->image_buf + ota_state->buf_off;
+
+	hp_buf_tlv_cmd_set(bp, ASPI_PROTO_CMD, ACMD_MCU_OTA_LOAD,
+	    conf_tlv_next_req_id());
+	hp_buf_tlv_append_be32(bp, ATLV_OFF, ota_state->file_off);
+	hp_buf_chain_extend(bp, 0);
+	if (mcu_feature_mask & MCU_UART_JUMBO) {
+		/* as much as fits, the MCU joins the TLVs */
+		len = hp_buf_tlv_append_split(bp, ATLV_BIN, data, len);
+	} else {
+		if (len > MAX_U8) {
+			len = MAX_U8;
+		}
+		space = hp_buf_tlv_space(bp);
+		if (len > space) {
+			len = space;
+		}
+		hp_buf_tlv_append(bp, ATLV_BIN, data, len);
 	}
 
-	cmd = (struct ayla_cmd *)bp->payload;
-	cmd->protocol = ASPI_PROTO_CMD;
-	cmd->opcode = ACMD_MCU_OTA_LOAD;
-	put_ua_be16(&cmd->req_id, conf_tlv_next_req_id());
-
-	tlv = (struct ayla_tlv *)(cmd + 1);
-	tlv->type = ATLV_OFF;
-	tlv->len = sizeof(u32);
-	put_ua_be32(TLV_VAL(tlv), ota_state->file_off);
-
-	tlv = TLV_NEXT_LEN(tlv, sizeof(u32));
-	tlv->type = ATLV_BIN;
-	tlv->len = (u8)len;
-	memcpy(TLV_VAL(tlv),
-	    (char *)ota_state->image_buf + ota_state->buf_off, len);
-
-	bp->len = sizeof(*cmd) + sizeof(*tlv) + sizeof(u32) +
-	    sizeof(*tlv) + len;
-
 	ota_state->buf_off += len;
 	ota_state->file_off += len;
-	mcu_dev->enq_tx(bp);
+	data_tlv_enq_tx(bp);
 
 	if (ota_state->file_off >= ota_state->ota_size) {
 		ota_state->done = 1;
@@ -333,7 +336,8 @@ static void host_proto_ota_send_chunk(struct hp_buf *bp)
 		ota_state->image_buf_len = 0;
 		ada_ota_continue();
 	} else {
-		hp_buf_callback_pend(host_proto_ota_send_chunk);
+		hp_buf_callback_pend_pri(host_proto_ota_send_chunk,
+		    HP_BUF_MEDIUM_LEN, HBCP_BULK);
 	}
 	al_os_lock_unlock(ota_state->lock);
 }
@@ -378,7 +382,8 @@ static enum patch_state host_proto_ota_save(unsigned int foff,
 		al_os_lock_unlock(ota_state->lock);
 		return PB_DONE;
 	}
-	hp_buf_callback_pend(host_proto_ota_send_chunk);
+	hp_buf_callback_pend_pri(host_proto_ota_send_chunk,
+	    HP_BUF_MEDIUM_LEN, HBCP_BULK);
 	al_os_lock_unlock(ota_state->lock);
 	return PB_ERR_STALL;
 
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_HOST_TLV_H__
+#define __AYLA_HOST_TLV_H__
+
+/*
+ * View of one TLV in a received packet.
+ * The value points into the packet and is not NUL-terminated.
+ * A TLV that was not received has a NULL val.
+ */
+struct host_tlv {
+	const u8 *val;
+	u8	type;
+	u8	len;
+};
+
+/*
+ * Cursor over the TLVs in a received packet.
+ */
+struct host_tlv_iter {
+	const u8 *pos;		/* next TLV */
+	const u8 *end;		/* end of packet */
+};
+
+static inline void host_tlv_iter_init(struct host_tlv_iter *it,
+		const void *buf, size_t len)
+{
+	it->pos = buf;
+	it->end = it->pos + len;
+}
+
+/*
+ * Get a view of the next TLV.
+ * Returns 1 with *tlv set, 0 at the end of the packet, or -1 if the
+ * packet ends inside a TLV, after which the cursor stays at the end.
+ */
+static inline int host_tlv_next(struct host_tlv_iter *it,
+		struct host_tlv *tlv)
+{
+	size_t left = it->end - it->pos;
+
+	if (!left) {
+		return 0;
+	}
+	if (left < sizeof(struct ayla_tlv) ||
+	    left - sizeof(struct ayla_tlv) < it->pos[1]) {
+		it->pos = it->end;
+		return -1;
+	}
+	tlv->type = it->pos[0];
+	tlv->len = it->pos[1];
+	tlv->val = it->pos + sizeof(struct ayla_tlv);
+	it->pos = tlv->val + tlv->len;
+	return 1;
+}
+
+#endif /* __AYLA_HOST_TLV_H__ */
@@ -1,60 +1,433 @@
 /*
  * Copyright 2021 Ayla Networks, Inc.  All rights reserved.
  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <ayla/utypes.h>
 #include <ayla/assert.h>
+#include <ayla/clock.h>
+#include <ayla/log.h>
+#include <ayla/timer.h>
 #include <ayla/ayla_proto_mcu.h>
+#include <net/net.h>
 #include <host_proto/host_proto.h>
 #include "hp_buf.h"
 #include "hp_buf_cb.h"
+#include "host_proto_int.h"
 
-static struct hp_buf *hp_buf_free_list;
-static void *hp_buf_thread;	/* thread that should be used for everything */
+/*
+ * Alloc counts for one caller.
+ */
+struct hp_buf_site {
+	const char *name;	/* NULL for the overflow slot */
+	u32	allocs;
+	u32	fails;
+};
+
+/*
+ * Pool of buffers of one size class.
+ *
+ * The free list is a stack of buffer indexes, so that it can be shared
+ * by tasks and ISRs without a lock.  The head holds the index of the
+ * first free buffer in the low 8 bits and a tag above that which changes
+ * on every push and pop, so a compare-and-swap fails if the head was
+ * popped and pushed back by another task in between (the ABA problem).
+ */
+struct hp_buf_class {
+	u32	head;		/* tag << 8 | index of first free buffer */
+	struct hp_buf **bufs;	/* buffers by index */
+	u8	*link;		/* index of next free buffer, by index */
+	size_t	size;		/* payload size, or 0 for hp_buf_len */
+	u16	count;		/* buffers in the class */
+	u16	free;		/* buffers on the free list */
+};
+
+#define HP_BUF_NONE	0xff	/* index for end of free list */
+#define HP_BUF_TAG	(1U << 8)	/* head tag increment */
+
+/*
+ * Atomic operations used for the pool and its statistics.
+ */
+#define HP_BUF_LOAD(ptr)	__atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define HP_BUF_CAS(ptr, oldp, val, order) \
+	__atomic_compare_exchange_n(ptr, oldp, val, 1, order, __ATOMIC_ACQUIRE)
+#define HP_BUF_ADD(ptr, val)	__atomic_add_fetch(ptr, val, __ATOMIC_RELAXED)
+#define HP_BUF_SUB(ptr, val)	__atomic_sub_fetch(ptr, val, __ATOMIC_RELAXED)
+#define HP_BUF_STAT(field)	HP_BUF_ADD(&hp_buf_stats.field, 1)
+
+static struct hp_buf_class hp_buf_classes[HBC_COUNT] = {
+	[HBC_SMALL] = { .size = HP_BUF_SMALL_LEN },
+	[HBC_MEDIUM] = { .size = HP_BUF_MEDIUM_LEN },
+	[HBC_LARGE] = { .size = 0 },
+};
+static const unsigned int hp_buf_class_counts[HBC_COUNT] = {
+	[HBC_SMALL] = HP_BUF_SMALL_COUNT,
+	[HBC_MEDIUM] = HP_BUF_MEDIUM_COUNT,
+	[HBC_LARGE] = HP_BUF_COUNT,
+};
+static void *hp_buf_thread;	/* thread for init and resize */
+size_t hp_buf_len = HP_BUF_LEN;
+
+static struct hp_buf_stats hp_buf_stats;
+static struct hp_buf_site hp_buf_sites[HP_BUF_SITES];
+static u32 hp_buf_wait_start;	/* time of first failure, if waiting */
+static u8 hp_buf_waiting;
+
+/*
+ * Return the payload size of buffers in a class.
+ */
+static size_t hp_buf_class_size(enum hp_buf_class_id id)
+{
+	size_t size = hp_buf_classes[id].size;
+
+	return size ? size : hp_buf_len;
+}
+
+/*
+ * Raise a maximum statistic to val.
+ */
+static void hp_buf_stat_max(u32 *max, u32 val)
+{
+	u32 old = HP_BUF_LOAD(max);
+
+	while (val > old) {
+		if (HP_BUF_CAS(max, &old, val, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+	}
+}
+
+/*
+ * Find or add the counts for a call site.
+ * The site name is a constant string, so it is matched by address.
+ */
+static struct hp_buf_site *hp_buf_site_get(const char *name)
+{
+	struct hp_buf_site *site;
+	const char *old;
+
+	for (site = hp_buf_sites; site < &hp_buf_sites[HP_BUF_SITES - 1];
+	    site++) {
+		old = HP_BUF_LOAD(&site->name);
+		if (!old && HP_BUF_CAS(&site->name, &old, name,
+		    __ATOMIC_ACQUIRE)) {
+			return site;
+		}
+		if (old == name) {
+			return site;
+		}
+	}
+	return site;		/* last slot counts all others */
+}
+
+/*
+ * Take the first buffer from the free list of a class.
+ */
+static struct hp_buf *hp_buf_pop(struct hp_buf_class *class)
+{
+	u32 head = HP_BUF_LOAD(&class->head);
+	u32 next;
+	u8 index;
+
+	do {
+		index = head & HP_BUF_NONE;
+		if (index == HP_BUF_NONE) {
+			return NULL;
+		}
+		next = ((head + HP_BUF_TAG) & ~HP_BUF_NONE) |
+		    class->link[index];
+	} while (!HP_BUF_CAS(&class->head, &head, next, __ATOMIC_ACQUIRE));
+	HP_BUF_SUB(&class->free, 1);
+	return class->bufs[index];
+}
+
+/*
+ * Put a buffer on the free list of its class.
+ */
+static void hp_buf_push(struct hp_buf *bp)
+{
+	struct hp_buf_class *class = &hp_buf_classes[bp->class_id];
+	u32 head = HP_BUF_LOAD(&class->head);
+	u32 next;
+
+	class->bufs[bp->index] = bp;
+	do {
+		class->link[bp->index] = head & HP_BUF_NONE;
+		next = ((head + HP_BUF_TAG) & ~HP_BUF_NONE) | bp->index;
+	} while (!HP_BUF_CAS(&class->head, &head, next, __ATOMIC_ACQ_REL));
+	HP_BUF_ADD(&class->free, 1);
+}
+
+/*
+ * Count an allocation that found the pool empty.
+ */
+static void hp_buf_alloc_failed(struct hp_buf_site *site)
+{
+	HP_BUF_STAT(fails);
+	HP_BUF_ADD(&site->fails, 1);
+	if (!__atomic_exchange_n(&hp_buf_waiting, 1, __ATOMIC_RELAXED)) {
+		hp_buf_wait_start = clock_ms();
+	}
+}
 
-struct hp_buf *hp_buf_alloc(size_t len)
+/*
+ * Set up a buffer taken from the pool and count the allocation.
+ */
+static struct hp_buf *hp_buf_alloc_done(struct hp_buf *bp,
+		struct hp_buf_site *site)
 {
+	struct hp_buf_stats *stats = &hp_buf_stats;
+	u32 wait;
+
+	bp->payload = bp + 1;
+	bp->len = 0;
+	bp->next = NULL;
+	bp->seg = NULL;
+
+	HP_BUF_STAT(allocs);
+	HP_BUF_ADD(&site->allocs, 1);
+	hp_buf_stat_max(&stats->peak, HP_BUF_STAT(in_use));
+	hp_buf_stat_max(&stats->bytes_peak,
+	    HP_BUF_ADD(&stats->bytes_in_use, bp->size));
+	if (__atomic_exchange_n(&hp_buf_waiting, 0, __ATOMIC_RELAXED)) {
+		wait = clock_ms() - hp_buf_wait_start;
+		HP_BUF_STAT(waits);
+		HP_BUF_ADD(&stats->wait_ms_sum, wait);
+		hp_buf_stat_max(&stats->wait_ms_max, wait);
+	}
+	return bp;
+}
+
+/*
+ * Take a free buffer of at least size bytes from the pool.
+ * Use the smallest class that fits, or a larger one if it is empty.
+ */
+static struct hp_buf *hp_buf_take(size_t size)
+{
+	struct hp_buf *bp = NULL;
+	enum hp_buf_class_id id;
+	enum hp_buf_class_id want;
+
+	want = HBC_LARGE;
+	if (size) {
+		for (want = 0; want < HBC_LARGE; want++) {
+			if (size <= hp_buf_class_size(want)) {
+				break;
+			}
+		}
+	}
+	for (id = want; id < HBC_COUNT; id++) {
+		bp = hp_buf_pop(&hp_buf_classes[id]);
+		if (bp) {
+			if (id != want) {
+				HP_BUF_STAT(fallbacks);
+			}
+			break;
+		}
+	}
+	return bp;
+}
+
+/*
+ * Count an allocation longer than the packet size.
+ */
+static void hp_buf_alloc_too_long(struct hp_buf_site *site)
+{
+	HP_BUF_STAT(too_long);
+	HP_BUF_ADD(&site->fails, 1);
+}
+
+struct hp_buf *hp_buf_alloc_site(size_t size, const char *name)
+{
+	struct hp_buf_site *site;
 	struct hp_buf *bp;
 
-	ASSERT(host_app_curthread() == hp_buf_thread);
-	if (len > HP_BUF_LEN) {
+	site = hp_buf_site_get(name);
+	if (size > hp_buf_len) {
+		hp_buf_alloc_too_long(site);
 		return NULL;
 	}
-	bp = hp_buf_free_list;
+	bp = hp_buf_take(size);
 	if (!bp) {
+		hp_buf_alloc_failed(site);
 		return NULL;
 	}
-	hp_buf_free_list = bp->next;
-	bp->payload = bp + 1;
-	bp->len = len;
-	bp->next = NULL;
+	return hp_buf_alloc_done(bp, site);
+}
+
+/*
+ * Allocate a segment for a chain that needs len more bytes.
+ * Small buffers are left for short messages.  A medium buffer is used
+ * if it holds the rest, otherwise a large one, or else whichever is free.
+ */
+static struct hp_buf *hp_buf_seg_alloc(size_t len, struct hp_buf_site *site)
+{
+	enum hp_buf_class_id id = HBC_LARGE;
+	enum hp_buf_class_id other = HBC_MEDIUM;
+	struct hp_buf *bp;
+
+	if (len <= hp_buf_class_size(HBC_MEDIUM)) {
+		id = HBC_MEDIUM;
+		other = HBC_LARGE;
+	}
+	bp = hp_buf_pop(&hp_buf_classes[id]);
+	if (!bp) {
+		bp = hp_buf_pop(&hp_buf_classes[other]);
+		if (!bp) {
+			hp_buf_alloc_failed(site);
+			return NULL;
+		}
+	}
+	return hp_buf_alloc_done(bp, site);
+}
+
+/*
+ * Add segments to a chain until it has room for size bytes.
+ */
+static int hp_buf_chain_fill(struct hp_buf *bp, size_t size,
+		struct hp_buf_site *site)
+{
+	size_t room = 0;
+
+	for (;;) {
+		room += bp->size;
+		if (!bp->seg) {
+			break;
+		}
+		bp = bp->seg;
+	}
+	while (room < size) {
+		bp->seg = hp_buf_seg_alloc(size - room, site);
+		if (!bp->seg) {
+			return -1;
+		}
+		bp = bp->seg;
+		room += bp->size;
+		HP_BUF_STAT(segs);
+	}
+	return 0;
+}
+
+int hp_buf_chain_extend_site(struct hp_buf *bp, size_t size,
+		const char *name)
+{
+	if (!size || size > hp_buf_len) {
+		size = hp_buf_len;
+	}
+	return hp_buf_chain_fill(bp, size, hp_buf_site_get(name));
+}
+
+struct hp_buf *hp_buf_alloc_chain_site(size_t size, const char *name)
+{
+	struct hp_buf_site *site;
+	struct hp_buf *bp;
+
+	site = hp_buf_site_get(name);
+	if (size > hp_buf_len) {
+		hp_buf_alloc_too_long(site);
+		return NULL;
+	}
+	bp = hp_buf_take(size);
+	if (bp) {
+		return hp_buf_alloc_done(bp, site);
+	}
+	if (!size) {
+		size = hp_buf_len;
+	}
+	bp = hp_buf_seg_alloc(size, site);
+	if (bp && hp_buf_chain_fill(bp, size, site)) {
+		hp_buf_free(bp);
+		bp = NULL;
+	}
 	return bp;
 }
 
-static void hp_buf_free_int(struct hp_buf *bp)
+size_t hp_buf_chain_len(const struct hp_buf *bp)
 {
-	bp->next = hp_buf_free_list;
-	hp_buf_free_list = bp;
+	size_t len = 0;
+
+	for (; bp; bp = bp->seg) {
+		len += bp->len;
+	}
+	return len;
+}
+
+/*
+ * Grow a large buffer to the current size if needed.
+ * Returns the possibly moved buffer or NULL if it could not be grown,
+ * in which case the old buffer is still valid.
+ */
+static struct hp_buf *hp_buf_grow(struct hp_buf *bp)
+{
+	struct hp_buf *nbp;
+	size_t len = hp_buf_len;
+
+	if (bp->class_id != HBC_LARGE || bp->size >= len) {
+		return bp;
+	}
+	nbp = realloc(bp, sizeof(*bp) + len);
+	if (!nbp) {
+		return NULL;
+	}
+	HP_BUF_ADD(&hp_buf_stats.bytes, len - nbp->size);
+	nbp->payload = nbp + 1;
+	nbp->size = len;
+	return nbp;
+}
+
+/*
+ * Return one buffer to the pool.
+ */
+static void hp_buf_free_one(struct hp_buf *bp)
+{
+	struct hp_buf *nbp;
+
+	HP_BUF_SUB(&hp_buf_stats.in_use, 1);
+	HP_BUF_SUB(&hp_buf_stats.bytes_in_use, bp->size);
+	nbp = hp_buf_grow(bp);
+	if (!nbp) {
+		/* give up the buffer rather than keep a short one */
+		log_put(LOG_WARN "hp_buf: grow failed, pool shrinks");
+		hp_buf_classes[bp->class_id].bufs[bp->index] = NULL;
+		HP_BUF_SUB(&hp_buf_classes[bp->class_id].count, 1);
+		HP_BUF_SUB(&hp_buf_stats.count, 1);
+		HP_BUF_SUB(&hp_buf_stats.bytes, sizeof(*bp) + bp->size);
+		free(bp);
+		return;
+	}
+	hp_buf_push(nbp);
 }
 
 void hp_buf_free(struct hp_buf *bp)
 {
-	ASSERT(host_app_curthread() == hp_buf_thread);
+	struct hp_buf *seg;
+
 	if (bp) {
-		hp_buf_free_int(bp);
+		do {
+			seg = bp->seg;
+			hp_buf_free_one(bp);
+			bp = seg;
+		} while (bp);
 		hp_buf_callback_invoke();
 	}
 }
 
-static struct hp_buf *hp_buf_new(size_t len)
+static struct hp_buf *hp_buf_new(enum hp_buf_class_id id, u8 index)
 {
 	struct hp_buf *bp;
+	size_t len = hp_buf_class_size(id);
 
-	ASSERT(host_app_curthread() == hp_buf_thread);
 	bp = malloc(sizeof(*bp) + len);
 	if (bp) {
 		bp->payload = bp + 1;
 		bp->len = len;
+		bp->size = len;
+		bp->class_id = id;
+		bp->index = index;
 		bp->next = NULL;
+		bp->seg = NULL;
+		hp_buf_stats.bytes += sizeof(*bp) + len;
 	}
 	return bp;
 }
@@ -64,17 +437,212 @@ static struct hp_buf *hp_buf_new(size_t len)
  */
 int hp_buf_init(void)
 {
+	return hp_buf_init_counts(hp_buf_class_counts);
+}
+
+int hp_buf_init_counts(const unsigned int *counts)
+{
+	struct hp_buf_class *class;
+	enum hp_buf_class_id id;
 	unsigned int i;
 	struct hp_buf *bp;
 
 	hp_buf_thread = host_app_curthread();
-	for (i = 0; i < HP_BUF_COUNT; i++) {
-		bp = hp_buf_new(HP_BUF_LEN);
-		if (!bp) {
+	for (id = 0; id < HBC_COUNT; id++) {
+		class = &hp_buf_classes[id];
+		ASSERT(counts[id] < HP_BUF_NONE);
+		class->head = HP_BUF_NONE;
+		class->bufs = calloc(counts[id] + 1, sizeof(*class->bufs));
+		class->link = calloc(counts[id] + 1, sizeof(*class->link));
+		if (!class->bufs || !class->link) {
 			ASSERT_NOTREACHED();
 			return -1;
 		}
-		hp_buf_free_int(bp);
+		for (i = 0; i < counts[id]; i++) {
+			bp = hp_buf_new(id, i);
+			if (!bp) {
+				ASSERT_NOTREACHED();
+				return -1;
+			}
+			hp_buf_push(bp);
+			class->count++;
+			hp_buf_stats.count++;
+		}
 	}
 	return 0;
 }
+
+void hp_buf_exit(void)
+{
+	struct hp_buf_class *class;
+	struct hp_buf *bp;
+
+	ASSERT(host_app_curthread() == hp_buf_thread);
+	ASSERT(!hp_buf_stats.in_use);
+	for (class = hp_buf_classes; class < &hp_buf_classes[HBC_COUNT];
+	    class++) {
+		while ((bp = hp_buf_pop(class)) != NULL) {
+			free(bp);
+		}
+		free(class->bufs);
+		class->bufs = NULL;
+		free(class->link);
+		class->link = NULL;
+		class->count = 0;
+	}
+	memset(&hp_buf_stats, 0, sizeof(hp_buf_stats));
+	memset(hp_buf_sites, 0, sizeof(hp_buf_sites));
+	hp_buf_waiting = 0;
+}
+
+int hp_buf_resize(size_t len)
+{
+	struct hp_buf_class *class = &hp_buf_classes[HBC_LARGE];
+	struct hp_buf *list = NULL;
+	struct hp_buf *bp;
+	struct hp_buf *nbp;
+	size_t old_len = hp_buf_len;
+	int rc = 0;
+
+	ASSERT(host_app_curthread() == hp_buf_thread);
+	hp_buf_len = len;
+
+	/*
+	 * Take the free buffers off the list to grow them.
+	 * Other tasks may find the class empty meanwhile.
+	 */
+	while ((bp = hp_buf_pop(class)) != NULL) {
+		bp->next = list;
+		list = bp;
+	}
+	while (list) {
+		bp = list;
+		list = bp->next;
+		nbp = rc ? NULL : hp_buf_grow(bp);
+		if (!nbp) {
+			/* buffers already grown are still usable */
+			rc = -1;
+			nbp = bp;
+		}
+		nbp->next = NULL;
+		hp_buf_push(nbp);
+	}
+	if (rc) {
+		hp_buf_len = old_len;
+	}
+	return rc;
+}
+
+void hp_buf_stats_get(struct hp_buf_stats *stats)
+{
+	*stats = hp_buf_stats;
+}
+
+void hp_buf_stats_clear(void)
+{
+	struct hp_buf_stats *stats = &hp_buf_stats;
+
+	stats->peak = stats->in_use;
+	stats->bytes_peak = stats->bytes_in_use;
+	stats->fallbacks = 0;
+	stats->segs = 0;
+	stats->allocs = 0;
+	stats->fails = 0;
+	stats->too_long = 0;
+	stats->waits = 0;
+	stats->wait_ms_sum = 0;
+	stats->wait_ms_max = 0;
+	memset(hp_buf_sites, 0, sizeof(hp_buf_sites));
+}
+
+void hp_buf_show(void)
+{
+	struct hp_buf_stats *stats = &hp_buf_stats;
+	struct hp_buf_site *site;
+	struct hp_buf_class *class;
+	u8 dump[sizeof(*stats) / 4 * 5 + HP_BUF_SITES * 32];
+	char hex[80];
+	ssize_t len;
+	ssize_t i;
+	size_t off = 0;
+
+	printcli("hp_buf pool: len %zu count %lu in use %lu peak %lu",
+	    hp_buf_len, (unsigned long)stats->count,
+	    (unsigned long)stats->in_use, (unsigned long)stats->peak);
+	printcli("  bytes %lu in use %lu peak %lu",
+	    (unsigned long)stats->bytes, (unsigned long)stats->bytes_in_use,
+	    (unsigned long)stats->bytes_peak);
+	for (class = hp_buf_classes; class < &hp_buf_classes[HBC_COUNT];
+	    class++) {
+		printcli("  class %zu: count %u free %u",
+		    hp_buf_class_size(class - hp_buf_classes),
+		    class->count, class->free);
+	}
+	printcli("  allocs %lu fails %lu too_long %lu fallbacks %lu segs %lu",
+	    (unsigned long)stats->allocs, (unsigned long)stats->fails,
+	    (unsigned long)stats->too_long, (unsigned long)stats->fallbacks,
+	    (unsigned long)stats->segs);
+	printcli("  waits %lu avg %lu max %lu ms",
+	    (unsigned long)stats->waits,
+	    stats->waits ?
+	    (unsigned long)(stats->wait_ms_sum / stats->waits) : 0,
+	    (unsigned long)stats->wait_ms_max);
+	for (site = hp_buf_sites; site < &hp_buf_sites[HP_BUF_SITES]; site++) {
+		if (!site->allocs && !site->fails) {
+			continue;
+		}
+		printcli("  %-28s allocs %lu fails %lu",
+		    site->name ? site->name : "(other)",
+		    (unsigned long)site->allocs, (unsigned long)site->fails);
+	}
+
+	len = hp_buf_stats_dump(dump, sizeof(dump));
+	for (i = 0; i < len; i++) {
+		off += snprintf(hex + off, sizeof(hex) - off, "%2.2x", dump[i]);
+		if (off >= sizeof(hex) - 2 || i == len - 1) {
+			printcli("  dump: %s", hex);
+			off = 0;
+		}
+	}
+}
+
+ssize_t hp_buf_stats_dump(void *buf, size_t len)
+{
+	const u32 *val = (const u32 *)&hp_buf_stats;
+	size_t count = sizeof(hp_buf_stats) / sizeof(*val);
+	struct hp_buf_site *site;
+	const char *name;
+	size_t name_len;
+	ssize_t off = 3;
+	u8 *bp = buf;
+	size_t i;
+
+	if (len < off) {
+		return -1;
+	}
+	bp[0] = 1;		/* version */
+	bp[1] = count;
+	bp[2] = 0;
+	for (i = 0; i < count && off >= 0; i++) {
+		off = host_proto_put_varint(bp, len, off, val[i]);
+	}
+	for (site = hp_buf_sites; site < &hp_buf_sites[HP_BUF_SITES] &&
+	    off >= 0; site++) {
+		if (!site->allocs && !site->fails) {
+			continue;
+		}
+		name = site->name ? site->name : "";
+		name_len = strlen(name) + 1;
+		if (name_len > len - off) {
+			return -1;
+		}
+		memcpy(bp + off, name, name_len);
+		off += name_len;
+		off = host_proto_put_varint(bp, len, off, site->allocs);
+		if (off >= 0) {
+			off = host_proto_put_varint(bp, len, off, site->fails);
+		}
+		bp[2]++;
+	}
+	return off;
+}
@@ -7,34 +7,127 @@
 #include <ayla/ayla_proto_mcu.h>
 
 /*
- * Size of all buffers in the pool.
+ * Initial size of all buffers in the pool.
  */
 #define	HP_BUF_LEN	ASPI_LEN_MAX
 
 /*
- * Number of buffers in the pool.
- * These are used for transmit and six should be plenty for one
- * outstanding message and acks.
+ * Buffer size classes.
+ * Small buffers hold acks, NAKs, confirmations and events, medium buffers
+ * hold most property updates with short names and values, and large
+ * buffers hold a full packet of hp_buf_len bytes.
+ * An allocation uses the smallest class that fits, or a larger one if
+ * that class is empty.
  */
-#define HP_BUF_COUNT	6
+enum hp_buf_class_id {
+	HBC_SMALL,
+	HBC_MEDIUM,
+	HBC_LARGE,
+	HBC_COUNT		/* number of classes */
+};
+
+#define HP_BUF_SMALL_LEN	32
+#define HP_BUF_MEDIUM_LEN	128
+
+/*
+ * Number of buffers in each class of the pool.
+ * Large buffers are used for long property values and OTA.
+ * Small messages do not take large buffers, so fewer of those are needed
+ * and there are more buffers in total for less memory.
+ */
+#define HP_BUF_SMALL_COUNT	6
+#define HP_BUF_MEDIUM_COUNT	3
+#define HP_BUF_COUNT		4
 
 /*
  * Buffer for host MCU communication.
+ *
+ * A packet may be held in a chain of buffers linked by seg, each segment
+ * with its own len.  The head segment holds the command and is the one
+ * queued, using next.  Only the TLV helpers in hp_buf_tlv.c and the
+ * transmit side of the link handle chains.
  */
 struct hp_buf {
 	void	*payload;
 	size_t	len;
+	size_t	size;		/* payload space */
+	u32	queued_ms;	/* time queued for transmit, for stats */
+	u8	class_id;	/* size class, enum hp_buf_class_id */
+	u8	index;		/* index in class */
 	struct hp_buf *next;
+	struct hp_buf *seg;	/* next segment of the packet */
 };
 
 /*
- * Allocate a buffer of the specified length, and initialize it.
+ * Current size of buffers in the pool.
+ * This starts at HP_BUF_LEN and follows the max packet length of the link.
+ */
+extern size_t hp_buf_len;
+
+/*
+ * Pool statistics.
+ */
+struct hp_buf_stats {
+	u32	count;		/* buffers in the pool */
+	u32	in_use;
+	u32	peak;		/* max in use */
+	u32	allocs;
+	u32	fails;		/* allocs failed with the pool empty */
+	u32	too_long;	/* allocs failed for length over hp_buf_len */
+	u32	waits;		/* times the pool ran dry, then had a buffer */
+	u32	wait_ms_sum;	/* time from first failure to next alloc */
+	u32	wait_ms_max;
+	u32	bytes;		/* memory used by the pool */
+	u32	bytes_in_use;	/* payload space of buffers in use */
+	u32	bytes_peak;	/* max payload space in use */
+	u32	fallbacks;	/* allocs from a larger class than needed */
+	u32	segs;		/* buffers allocated as chain segments */
+};
+
+/*
+ * Number of call sites with separate alloc and failure counts.
+ * Sites past this are counted together.
+ */
+#define HP_BUF_SITES	16
+
+/*
+ * Allocate an empty buffer with room for a packet of at least size bytes.
+ * A size of 0 asks for a full-size buffer of hp_buf_len bytes.
+ * The site is the caller's name for statistics, and must be constant.
+ * This does not block and may be called from any task or from an ISR.
+ */
+struct hp_buf *hp_buf_alloc_site(size_t size, const char *site);
+#define hp_buf_alloc(size)	hp_buf_alloc_site(size, __func__)
+
+/*
+ * Allocate a packet buffer of size bytes, or hp_buf_len if size is 0,
+ * as a chain of medium and large buffers if no single buffer is free.
+ * Returns NULL if the pool does not have enough free space.
+ */
+struct hp_buf *hp_buf_alloc_chain_site(size_t size, const char *site);
+#define hp_buf_alloc_chain(size) hp_buf_alloc_chain_site(size, __func__)
+
+/*
+ * Add segments to a buffer until the chain has room for a packet of
+ * size bytes, or hp_buf_len if size is 0.
+ * Returns 0 on success, or -1 if the pool ran out, in which case the
+ * segments added so far are kept.
  */
-struct hp_buf *hp_buf_alloc(size_t len);
+int hp_buf_chain_extend_site(struct hp_buf *bp, size_t size,
+		const char *site);
+#define hp_buf_chain_extend(bp, size) \
+	hp_buf_chain_extend_site(bp, size, __func__)
 
 /*
- * Free a buffer.
+ * Return the length of the packet in a buffer chain.
+ */
+size_t hp_buf_chain_len(const struct hp_buf *bp);
+
+/*
+ * Free a buffer and any segments chained to it.
  * It is valid to call this with a NULL pointer to skip checks in the caller.
+ * This may be called from any task, but not from an ISR, since it may
+ * grow the buffer and wakes callbacks waiting for buffers.
  */
 void hp_buf_free(struct hp_buf *bp);
 
@@ -43,4 +136,46 @@ void hp_buf_free(struct hp_buf *bp);
  */
 int hp_buf_init(void);
 
+/*
+ * Initialize the pool with counts[HBC_COUNT] buffers of each class,
+ * instead of the default counts.  For host benchmarks.
+ */
+int hp_buf_init_counts(const unsigned int *counts);
+
+/*
+ * Free the pool so it can be initialized again.
+ * All buffers must have been freed.  For host benchmarks.
+ */
+void hp_buf_exit(void);
+
+/*
+ * Change the size of buffers in the pool.
+ * Free buffers are grown now and others when they are freed.
+ * Returns 0 on success, or -1 if memory is short.
+ * Called in the host_proto thread.
+ */
+int hp_buf_resize(size_t len);
+
+/*
+ * Get or reset the pool statistics.
+ */
+void hp_buf_stats_get(struct hp_buf_stats *stats);
+void hp_buf_stats_clear(void);
+
+/*
+ * Show the pool statistics, per-site counts and binary dump on the CLI.
+ */
+void hp_buf_show(void);
+
+/*
+ * Put the statistics in a compact binary form for tools.
+ * The format is a header of three bytes:
+ *	version (1), # of counters, # of sites,
+ * followed by each counter in the order of struct hp_buf_stats as an
+ * unsigned LEB128 varint, then for each site its NUL-terminated name and
+ * its allocs and failures as varints.
+ * Returns the length used, or -1 if the buffer is too small.
+ */
+ssize_t hp_buf_stats_dump(void *buf, size_t len);
+
 #endif /* __AYLA_HP_BUF_H__ */
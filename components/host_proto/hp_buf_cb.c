@@ -1,7 +1,7 @@
 /*
  * Copyright 2021 Ayla Networks, Inc.  All rights reserved.
  */
-#include <sys/queue.h>
+#include <stdint.h>
 #include <ayla/utypes.h>
 #include <ayla/assert.h>
 #include <al/al_os_lock.h>
@@ -14,123 +14,221 @@
 #include "hp_buf_cb.h"
 #include "host_proto_int.h"
 
+/*
+ * Callback slots.
+ * A handler gets a slot the first time it is pended and keeps it, since
+ * handlers are static functions and there are only a few of them.
+ * The slot is found by hashing the handler address, so pending and
+ * cancelling take constant time.  Pending slots are kept as one bitmap
+ * per priority.
+ */
 struct hp_buf_callback {
 	void (*handler)(struct hp_buf *);
-	STAILQ_ENTRY(hp_buf_callback) list;
+	const char *site;		/* pending caller, for hp_buf stats */
+	size_t size;			/* buffer size needed, 0 for full */
+	u8 pri;				/* priority while pending */
 };
 
-STAILQ_HEAD(hp_buf_cb_head, hp_buf_callback);	/* struct for list head */
+#define HP_BUF_CB_BIT(slot)	((u32)1 << (slot))
 
-static struct hp_buf_cb_head hp_buf_cb_active =
-    STAILQ_HEAD_INITIALIZER(hp_buf_cb_active);	/* list of active callbacks */
-
-static struct hp_buf_cb_head hp_buf_cb_free =
-    STAILQ_HEAD_INITIALIZER(hp_buf_cb_free);	/* list of free callbacks */
+static struct hp_buf_callback hp_buf_cbs[HP_BUF_CB_COUNT];
+static u32 hp_buf_cb_pending[HBCP_COUNT];	/* pending slots by priority */
+static u8 hp_buf_cb_next[HBCP_COUNT];	/* round-robin start by priority */
 
 static struct net_callback hp_buf_callback_net_cb;
 static struct al_lock *hp_buf_lock;
 
 /*
- * Find callback in the active list.
- * Called with lock held.
+ * Return the first slot to try for a handler.
  */
-static struct hp_buf_callback *
-hp_buf_callback_find(void (*handler)(struct hp_buf *))
+static unsigned int hp_buf_callback_hash(void (*handler)(struct hp_buf *))
 {
-	struct hp_buf_callback *cb;
+	u32 addr = (u32)(uintptr_t)handler;
 
-	STAILQ_FOREACH(cb, &hp_buf_cb_active, list) {
-		if (cb->handler == handler) {
-			return cb;
-		}
-	}
-	return NULL;
+	return (u32)(addr * 2654435761UL) >> (32 - HP_BUF_CB_HASH_BITS);
 }
 
 /*
- * Allocate a buffer from the free list or by malloc.
- * If the freelist was empty, a potential error exists.
+ * Find or assign the slot for a handler.
+ * Returns -1 if the table is full.
  * Called with lock held.
  */
-static struct hp_buf_callback *hp_buf_callback_alloc(void)
+static int hp_buf_callback_slot(void (*handler)(struct hp_buf *))
 {
 	struct hp_buf_callback *cb;
+	unsigned int slot;
+	unsigned int i;
 
-	cb = STAILQ_FIRST(&hp_buf_cb_free);
-	if (cb) {
-		STAILQ_REMOVE_HEAD(&hp_buf_cb_free, list);
-		cb->list.stqe_next = NULL;
-	} else {
-		log_put(LOG_ERR "%s: cb freelist empty", __func__);
-		cb = calloc(1, sizeof(*cb));
-		if (!cb) {
-			log_put(LOG_ERR "%s: cb malloc fails", __func__);
+	slot = hp_buf_callback_hash(handler);
+	for (i = 0; i < HP_BUF_CB_COUNT; i++) {
+		cb = &hp_buf_cbs[slot];
+		if (cb->handler == handler) {
+			return slot;
 		}
+		if (!cb->handler) {
+			cb->handler = handler;
+			return slot;
+		}
+		slot = (slot + 1) % HP_BUF_CB_COUNT;
 	}
-	return cb;
+	return -1;
 }
 
 /*
- * Free callback structure back to the freelist.
+ * Return the priority a slot is pending at, or HBCP_COUNT if not pending.
  * Called with lock held.
  */
-static void hp_buf_callback_free(struct hp_buf_callback *cb)
+static enum hp_buf_cb_pri hp_buf_callback_pri(unsigned int slot)
 {
-	STAILQ_INSERT_TAIL(&hp_buf_cb_free, cb, list);
+	enum hp_buf_cb_pri pri = (enum hp_buf_cb_pri)hp_buf_cbs[slot].pri;
+
+	if (hp_buf_cb_pending[pri] & HP_BUF_CB_BIT(slot)) {
+		return pri;
+	}
+	return HBCP_COUNT;
 }
 
 /*
  * Allocate a buffer and invoke a callback with a buffer as the arg when done.
  */
-void hp_buf_callback_pend(void (*handler)(struct hp_buf *))
+void hp_buf_callback_pend_site(void (*handler)(struct hp_buf *),
+		size_t size, enum hp_buf_cb_pri pri, const char *site)
 {
 	struct hp_buf_callback *cb;
+	enum hp_buf_cb_pri cur;
+	int slot;
 
+	ASSERT(pri < HBCP_COUNT);
 	al_os_lock_lock(hp_buf_lock);
-	cb = hp_buf_callback_find(handler);
-	if (cb) {
+	slot = hp_buf_callback_slot(handler);
+	if (slot < 0) {
 		al_os_lock_unlock(hp_buf_lock);
-		return;		/* already pending */
+		log_put(LOG_ERR "%s: no callback slot for %s", __func__, site);
+		ASSERT_NOTREACHED();
+		return;
 	}
-	cb = hp_buf_callback_alloc();
-	ASSERT(cb);
-	cb->handler = handler;
-	STAILQ_INSERT_TAIL(&hp_buf_cb_active, cb, list);
+	cb = &hp_buf_cbs[slot];
+	cur = hp_buf_callback_pri(slot);
+	if (cur < HBCP_COUNT) {
+		/* already pending, but may need a larger buffer now */
+		if (cb->size && (!size || size > cb->size)) {
+			cb->size = size;
+		}
+		if (pri < cur) {
+			hp_buf_cb_pending[cur] &= ~HP_BUF_CB_BIT(slot);
+			hp_buf_cb_pending[pri] |= HP_BUF_CB_BIT(slot);
+			cb->pri = pri;
+		}
+		al_os_lock_unlock(hp_buf_lock);
+		return;
+	}
+	cb->site = site;
+	cb->size = size;
+	cb->pri = pri;
+	hp_buf_cb_pending[pri] |= HP_BUF_CB_BIT(slot);
 	host_proto_callback_pend(&hp_buf_callback_net_cb);
 	al_os_lock_unlock(hp_buf_lock);
 }
 
+/*
+ * Cancel a pending callback, if any.
+ */
+void hp_buf_callback_cancel(void (*handler)(struct hp_buf *))
+{
+	enum hp_buf_cb_pri pri;
+	int slot;
+
+	al_os_lock_lock(hp_buf_lock);
+	slot = hp_buf_callback_slot(handler);
+	if (slot >= 0) {
+		pri = hp_buf_callback_pri(slot);
+		if (pri < HBCP_COUNT) {
+			hp_buf_cb_pending[pri] &= ~HP_BUF_CB_BIT(slot);
+		}
+	}
+	al_os_lock_unlock(hp_buf_lock);
+}
+
+/*
+ * Return non-zero if any callback is pending.
+ */
+static int hp_buf_callback_any(void)
+{
+	unsigned int pri;
+
+	for (pri = 0; pri < HBCP_COUNT; pri++) {
+		if (hp_buf_cb_pending[pri]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
 void hp_buf_callback_invoke(void)
 {
-	if (STAILQ_FIRST(&hp_buf_cb_active)) {
+	if (hp_buf_callback_any()) {
 		al_os_lock_lock(hp_buf_lock);
 		host_proto_callback_pend(&hp_buf_callback_net_cb);
 		al_os_lock_unlock(hp_buf_lock);
 	}
 }
 
+/*
+ * Return the next slot to serve, or -1 if none are pending.
+ * This is the highest priority pending slot, taken round-robin within
+ * its priority so one busy handler cannot starve the others.
+ * Called with lock held.
+ */
+static int hp_buf_callback_next(enum hp_buf_cb_pri *prip)
+{
+	unsigned int pri;
+	u32 pending;
+	u32 later;
+
+	for (pri = 0; pri < HBCP_COUNT; pri++) {
+		pending = hp_buf_cb_pending[pri];
+		if (!pending) {
+			continue;
+		}
+		later = pending & ~(HP_BUF_CB_BIT(hp_buf_cb_next[pri]) - 1);
+		*prip = (enum hp_buf_cb_pri)pri;
+		return __builtin_ctz(later ? later : pending);
+	}
+	return -1;
+}
+
+/*
+ * Serve waiting callbacks as buffers become available.
+ * Only the highest priority waiter is tried, so a bulk transfer cannot take
+ * a freed buffer ahead of a control message or property update.
+ * Each waiter gets a buffer of the size it asked for, so a small message
+ * does not hold a full-size buffer.
+ */
 static void hp_buf_callback_handle(void *arg)
 {
 	struct hp_buf_callback *cb;
 	void (*handler)(struct hp_buf *bp);
+	enum hp_buf_cb_pri pri;
 	struct hp_buf *bp;
+	int slot;
 
 	for (;;) {
 		al_os_lock_lock(hp_buf_lock);
-		cb = STAILQ_FIRST(&hp_buf_cb_active);
-		if (!cb) {
+		slot = hp_buf_callback_next(&pri);
+		if (slot < 0) {
 			al_os_lock_unlock(hp_buf_lock);
 			client_reset_mcu_overflow();
 			return;
 		}
-		bp = hp_buf_alloc(HP_BUF_LEN);
+		cb = &hp_buf_cbs[slot];
+		bp = hp_buf_alloc_site(cb->size, cb->site);
 		if (!bp) {
 			al_os_lock_unlock(hp_buf_lock);
 			return;
 		}
-		STAILQ_REMOVE_HEAD(&hp_buf_cb_active, list);
+		hp_buf_cb_pending[pri] &= ~HP_BUF_CB_BIT(slot);
+		hp_buf_cb_next[pri] = (slot + 1) % HP_BUF_CB_COUNT;
 		handler = cb->handler;
-		hp_buf_callback_free(cb);
 		al_os_lock_unlock(hp_buf_lock);
 		handler(bp);
 	}
@@ -138,21 +236,11 @@ static void hp_buf_callback_handle(void *arg)
 
 void hp_buf_callback_init(void)
 {
-	struct hp_buf_callback *cb;
-	unsigned int i;
+	ASSERT(HP_BUF_CB_COUNT <= 32);	/* slots must fit in a u32 bitmap */
+	ASSERT(HP_BUF_CB_COUNT == 1 << HP_BUF_CB_HASH_BITS);
 
 	hp_buf_lock = al_os_lock_create();
 	ASSERT(hp_buf_lock);
 	net_callback_init(&hp_buf_callback_net_cb,
 	    hp_buf_callback_handle, NULL);
-
-	for (i = 0; i < HP_BUF_CB_COUNT; i++) {
-		cb = malloc(sizeof(*cb));
-		if (!cb) {
-			ASSERT_NOTREACHED();
-			return;
-		}
-		cb->handler = NULL;
-		STAILQ_INSERT_TAIL(&hp_buf_cb_free, cb, list);
-	}
 }
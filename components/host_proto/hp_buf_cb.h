@@ -4,14 +4,44 @@
 #ifndef __AYLA_HP_BUF_CB_H__
 #define __AYLA_HP_BUF_CB_H__
 
-#define HP_BUF_CB_COUNT	20	/* number of callbacks available */
+#define HP_BUF_CB_HASH_BITS 5
+#define HP_BUF_CB_COUNT	(1 << HP_BUF_CB_HASH_BITS) /* callback slots */
+
+/*
+ * Callback priorities, highest first.
+ * When a buffer is freed, the highest priority waiter gets the next one.
+ * Control messages (NAKs, confirms and errors) go ahead of property
+ * updates, which go ahead of MCU OTA image chunks.
+ */
+enum hp_buf_cb_pri {
+	HBCP_CTRL = 0,
+	HBCP_PROP,
+	HBCP_BULK,
+	HBCP_COUNT
+};
 
 /*
  * Allocate a buffer and invoke a callback with the buffer when done.
- * The function called back will return non-zero if it did not use the buffer
- * and needs to be called again.
+ * The function called back owns the buffer, and must use or free it.
+ * If it needs another buffer later, it pends the callback again.
+ * The buffer is counted against the caller's site in the hp_buf stats.
+ * The size is as for hp_buf_alloc(), with 0 for a full-size buffer.
+ * If the callback is already pending, it keeps its place, but the size and
+ * priority are raised if needed.
+ */
+void hp_buf_callback_pend_site(void (*func)(struct hp_buf *),
+		size_t size, enum hp_buf_cb_pri pri, const char *site);
+#define hp_buf_callback_pend(func) \
+	hp_buf_callback_pend_site(func, 0, HBCP_PROP, __func__)
+#define hp_buf_callback_pend_size(func, size) \
+	hp_buf_callback_pend_site(func, size, HBCP_PROP, __func__)
+#define hp_buf_callback_pend_pri(func, size, pri) \
+	hp_buf_callback_pend_site(func, size, pri, __func__)
+
+/*
+ * Cancel a pending callback, if any.
  */
-void hp_buf_callback_pend(void (*func)(struct hp_buf *));
+void hp_buf_callback_cancel(void (*func)(struct hp_buf *));
 
 /*
  * Invoke pending callbacks.
@@ -17,45 +17,104 @@
  * Set command fields in the buffer.
  * The buffer is guaranteed to be large enough to hold a command.
  * Sets the buffer length in preparation for appending TLVs.
+ * Any segments chained to the buffer are emptied.
  */
 void hp_buf_tlv_cmd_set(struct hp_buf *bp, u8 proto, u8 op, u16 req_id)
 {
 	struct ayla_cmd *cmd = (struct ayla_cmd *)bp->payload;
+	struct hp_buf *seg;
 
 	bp->len = sizeof(*cmd);
+	for (seg = bp->seg; seg; seg = seg->seg) {
+		seg->len = 0;
+	}
 	cmd->protocol = proto;
 	cmd->opcode = op;
 	put_ua_be16(&cmd->req_id, req_id);
 }
 
+/*
+ * Return the max length of the packet in the buffer chain.
+ * A buffer allocated before the pool grew may be short.
+ */
+static size_t hp_buf_tlv_limit(struct hp_buf *bp)
+{
+	size_t size = 0;
+
+	for (; bp; bp = bp->seg) {
+		size += bp->size;
+	}
+	return size < hp_buf_len ? size : hp_buf_len;
+}
+
 /*
  * Return the largest TLV payload that could be appended.
  */
 size_t hp_buf_tlv_space(struct hp_buf *bp)
 {
-	if (bp->len + sizeof(struct ayla_tlv) >= HP_BUF_LEN) {
+	size_t limit = hp_buf_tlv_limit(bp);
+	size_t len = hp_buf_chain_len(bp);
+
+	if (len + sizeof(struct ayla_tlv) >= limit) {
 		return 0;
 	}
-	return HP_BUF_LEN - bp->len - sizeof(struct ayla_tlv);
+	return limit - len - sizeof(struct ayla_tlv);
+}
+
+/*
+ * Copy bytes after the data in a buffer chain.
+ * Each segment is filled before the next one is used, so a TLV may
+ * start in one segment and end in another.
+ */
+static void hp_buf_tlv_put(struct hp_buf *bp, const void *buf, size_t len)
+{
+	const u8 *data = buf;
+	size_t part;
+
+	while (bp->seg && bp->seg->len) {
+		bp = bp->seg;
+	}
+	while (len) {
+		if (bp->len >= bp->size) {
+			bp = bp->seg;
+			ASSERT(bp);
+			continue;
+		}
+		part = bp->size - bp->len;
+		if (part > len) {
+			part = len;
+		}
+		memcpy((u8 *)bp->payload + bp->len, data, part);
+		bp->len += part;
+		data += part;
+		len -= part;
+	}
 }
 
 /*
- * Append a TLV to the buffer.
+ * Append a TLV to the buffer chain.
  * Adjust the length.
  */
 void hp_buf_tlv_append(struct hp_buf *bp, enum ayla_tlv_type tlv_type,
 		const void *val, size_t val_len)
 {
-	size_t new_len;
-	struct ayla_tlv *tlv;
-
-	new_len = bp->len + sizeof(*tlv) + val_len;
-	ASSERT(new_len <= HP_BUF_LEN);
-	tlv = (struct ayla_tlv *)((char *)bp->payload + bp->len);
-	tlv->type = tlv_type;
-	tlv->len = val_len;
-	memcpy(TLV_VAL(tlv), val, val_len);
-	bp->len = new_len;
+	struct ayla_tlv tlv;
+
+	ASSERT(hp_buf_chain_len(bp) + sizeof(tlv) + val_len <=
+	    hp_buf_tlv_limit(bp));
+	tlv.type = tlv_type;
+	tlv.len = val_len;
+	hp_buf_tlv_put(bp, &tlv, sizeof(tlv));
+	hp_buf_tlv_put(bp, val, val_len);
+}
+
+/*
+ * Append formed TLVs to the buffer chain.
+ */
+void hp_buf_tlv_append_tlvs(struct hp_buf *bp, const void *tlvs, size_t len)
+{
+	ASSERT(hp_buf_chain_len(bp) + len <= hp_buf_tlv_limit(bp));
+	hp_buf_tlv_put(bp, tlvs, len);
 }
 
 /*
@@ -96,3 +155,31 @@ void hp_buf_tlv_append_str(struct hp_buf *bp, enum ayla_tlv_type tlv_type,
 {
 	hp_buf_tlv_append(bp, tlv_type, str, strlen(str));
 }
+
+/*
+ * Append as much of a value as fits as consecutive TLVs of the type.
+ */
+size_t hp_buf_tlv_append_split(struct hp_buf *bp,
+		enum ayla_tlv_type tlv_type, const void *val, size_t val_len)
+{
+	size_t done = 0;
+	size_t space;
+	size_t part;
+
+	while (done < val_len) {
+		space = hp_buf_tlv_space(bp);
+		if (!space) {
+			break;
+		}
+		part = val_len - done;
+		if (part > TLV_MAX_LEN) {
+			part = TLV_MAX_LEN;
+		}
+		if (part > space) {
+			part = space;
+		}
+		hp_buf_tlv_append(bp, tlv_type, (const u8 *)val + done, part);
+		done += part;
+	}
+	return done;
+}
@@ -12,6 +12,8 @@ void hp_buf_tlv_cmd_set(struct hp_buf *bp, u8 protocol, u8 opcode, u16 req_id);
 /*
  * Append a TLV to the buffer.
  * Adjust the length.
+ * These append helpers fill a chain of segments in order, and a TLV may
+ * span the end of one segment and the start of the next.
  */
 void hp_buf_tlv_append(struct hp_buf *bp, enum ayla_tlv_type tlv_type,
 		const void *val, size_t val_len);
@@ -40,9 +42,21 @@ void hp_buf_tlv_append_u8(struct hp_buf *bp,
 void hp_buf_tlv_append_str(struct hp_buf *bp, enum ayla_tlv_type tlv_type,
 		const char *str);
 
+/*
+ * Append TLVs already formed, such as those saved by a request.
+ */
+void hp_buf_tlv_append_tlvs(struct hp_buf *bp, const void *tlvs, size_t len);
+
 /*
  * Return the largest TLV payload that could be appended.
  */
 size_t hp_buf_tlv_space(struct hp_buf *bp);
 
+/*
+ * Append as much of a value as fits in the buffer as consecutive TLVs of
+ * the type, each up to TLV_MAX_LEN.  Returns the length appended.
+ */
+size_t hp_buf_tlv_append_split(struct hp_buf *bp,
+		enum ayla_tlv_type tlv_type, const void *val, size_t val_len);
+
 #endif /* __AYLA_HP_BUF_TLV_H__ */
@@ -29,6 +29,18 @@ void host_proto_init(const struct host_proto_ops *ops);
  */
 void host_proto_reset_send(void);
 
+/*
+ * Answer cloud GETs of a property from the last value the MCU reported,
+ * while it is fresh, instead of asking the MCU.
+ * ttl_ms is how long a value stays fresh.  HOST_PROTO_CACHE_PUSHED is for
+ * a property the MCU always sends when it changes, so its value stays
+ * fresh until replaced.  0 stops caching the property.
+ * Call after host_proto_init().
+ * Returns 0 on success, or -1 if the name is invalid or the table is full.
+ */
+#define HOST_PROTO_CACHE_PUSHED	0xffffffff
+int host_proto_prop_cache_set(const char *name, u32 ttl_ms);
+
 /*
  * Get an opaque identifier for the current thread.
  * Supplied by application and used for assertions.
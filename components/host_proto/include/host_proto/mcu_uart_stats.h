@@ -0,0 +1,87 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_MCU_UART_STATS_H__
+#define __AYLA_MCU_UART_STATS_H__
+
+#include <sys/types.h>
+
+/*
+ * Statistics for the UART link to the host MCU.
+ *
+ * Counters are 32 bits and count from startup or the last clear.
+ * Histograms have log2 buckets: bucket 0 counts zero values and bucket
+ * n counts values from 2^(n-1) to 2^n - 1, with the last bucket also
+ * counting everything larger.
+ */
+#define MCU_UART_HIST_BUCKETS	16
+#define MCU_UART_TX_LANES	3	/* ctrl, prop, bulk */
+
+enum mcu_uart_hist {
+	MUH_RX_LEN,		/* received data packet length */
+	MUH_TX_LEN,		/* sent data packet length */
+	MUH_RX_DELAY,		/* ms from packet start to dispatch */
+	MUH_ACK_RTT,		/* ms from data sent to ack */
+	MUH_COUNT
+};
+
+struct mcu_uart_stats {
+	u32 tx_bytes;
+	u32 tx_pkts;
+	u32 tx_acks;
+	u32 tx_ack_merged;
+	u32 tx_data;
+	u32 tx_resend;
+	u32 tx_timeout;
+
+	u32 rtt_samples;
+	u32 rtt_last;
+	u32 rtt_max;
+
+	u32 txq_pkts[MCU_UART_TX_LANES];
+	u32 txq_starved[MCU_UART_TX_LANES];	/* sent out of order */
+	u32 txq_depth_max[MCU_UART_TX_LANES];
+	u32 txq_wait_max[MCU_UART_TX_LANES];	/* ms */
+	u32 txq_wait_sum[MCU_UART_TX_LANES];	/* ms */
+
+	u32 rx_bytes;
+	u32 rx_pkts;
+	u32 rx_data;
+	u32 rx_acks;
+
+	u32 rx_frame_err;
+	u32 rx_len_err;
+	u32 rx_crc_err;
+	u32 rx_ptype_err;
+	u32 rx_seq_err;
+	u32 rx_ack_full;
+	u32 rx_cmd_err;
+
+	/* histograms must be last, see mcu_uart_stats_dump() */
+	u32 hist[MUH_COUNT][MCU_UART_HIST_BUCKETS];
+};
+
+/*
+ * Copy the current statistics.
+ * Returns 0 on success, or -1 if the UART is not in use or statistics
+ * are not compiled in.
+ */
+int mcu_uart_stats_get(struct mcu_uart_stats *stats);
+
+/*
+ * Reset all statistics to zero.
+ */
+void mcu_uart_stats_clear(void);
+
+/*
+ * Put the statistics in a compact binary form for tools.
+ * The format is a header of four bytes:
+ *	version (1), # of counters, # of histograms, # of buckets each,
+ * followed by each counter in the order of struct mcu_uart_stats and
+ * then each histogram bucket, all as unsigned LEB128 varints.
+ * Returns the length used, or -1 if the buffer is too small or there are
+ * no statistics.
+ */
+ssize_t mcu_uart_stats_dump(void *buf, size_t len);
+
+#endif /* __AYLA_MCU_UART_STATS_H__ */
@@ -6,8 +6,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
 
 #include <ayla/utypes.h>
+#include <ayla/clock.h>
 #include <ayla/crc.h>
 #include <ayla/endian.h>
 #include <ayla/assert.h>
@@ -24,9 +26,12 @@
 #include <net/net.h>
 
 #include <host_proto/mcu_dev.h>
+#include <host_proto/mcu_uart_stats.h>
 #include "host_proto_int.h"
 #include "data_tlv.h"
+#include "prop_req.h"
 #include "mcu_uart_int.h"
+#include "mcu_uart_ppp.h"
 #include "host_decode.h"
 #include "hp_buf.h"
 #include "hp_buf_cb.h"
@@ -54,29 +59,73 @@
  */
 #undef MCU_UART_LOG_RAW
 
+/*
+ * MCU_UART_SPEED_SET is defined by the build if the serial driver has
+ * serial_set_speed().  Without it, MCU_UART_FAST is never offered.
+ * The device's serial driver comes from the ADA SDK and does not have it,
+ * so only MCU_UART_JUMBO takes effect there.  The host build defines it.
+ */
+
 /* ppp frame size. 2 flag bytes, stuff(crc) */
 #define MCU_UART_PPP_SIZE	4
 
 /* ack message size. ppp + stuff(seq) + ptype */
 #define MCU_UART_ACK_SIZE	(MCU_UART_PPP_SIZE + 3)
 
-/* max receiving buffer length. recv interrupts will fill this */
-#define MCU_UART_RX_SIZE	(ASPI_LEN_MAX *  2 + MCU_UART_ACK_SIZE * 2)
+/*
+ * Buffer sizes for packets with up to len bytes of data.
+ * The max data length is ASPI_LEN_MAX, or MCU_UART_JUMBO_LEN if negotiated.
+ */
+/* receiving buffer length. recv interrupts will fill this */
+#define MCU_UART_RX_SIZE(len)	((len) * 2 + MCU_UART_ACK_SIZE * 2)
+
+/* unescaped recvd packet: ptype, seq #, data, 2-byte crc */
+#define MCU_UART_RX_PKT_SIZE(len) ((len) + 4)
 
-/* max recvd data from mcu */
-#define MCU_UART_RX_DATA_SIZE	ASPI_LEN_MAX
+/* transmit frame: ptype, seq #, data and crc all escaped, 2 flags */
+#define MCU_UART_TX_DATA_SIZE(len) (((len) + 4) * 2 + 2)
 
-/* max transmit data to mcu */
-#define MCU_UART_TX_DATA_SIZE	(ASPI_LEN_MAX * 2 + MCU_UART_PPP_SIZE)
+/* time after the link is idle before changing speed or packet size (ms) */
+#define MCU_UART_LINK_DELAY	20
 
-/* max len of ack queue */
+/* max # of pending acks, at least MCU_UART_WINDOW_LEN */
 #define	MCU_UART_MAX_ACKS	5
 
-/* time to wait for an ack response for a packet before retransmitting (ms) */
+/* max time to wait for an ack response before retransmitting (ms) */
 #define MCU_UART_ACK_WAIT	5000
 
+/*
+ * Retransmission timeout (ms).
+ * The RTO is derived from the ack round trip time of data packets as in
+ * TCP (RFC 6298), with the smoothed RTT kept scaled by 8 and the RTT
+ * variance scaled by 4.  It doubles on each timeout until an ack arrives
+ * for a packet that was not resent.
+ */
+#define MCU_UART_RTO_INIT	1000	/* before the first RTT sample */
+#define MCU_UART_RTO_MIN	100
+#define MCU_UART_RTO_MAX	MCU_UART_ACK_WAIT
+#define MCU_UART_RTO_GRAN	10	/* min variance term (ms) */
+
 /* max # of retransmissions */
-#define MCU_UART_MAX_RETRIES	2
+#define MCU_UART_MAX_RETRIES	4
+
+/*
+ * Bad packets in a row after which the link set by the features is
+ * checked, as the MCU may have gone back to the default speed.
+ */
+#define MCU_UART_LINK_BAD_PKTS	4
+
+/*
+ * Max # of data packets in flight when MCU_UART_WINDOW is negotiated.
+ * An MCU advertising MCU_UART_WINDOW may send up to this many as well.
+ * Without it, the window is one packet (stop-and-wait).
+ */
+#define MCU_UART_WINDOW_LEN	4
+
+/*
+ * Sequence numbers run from 1 to 255 after the first packet, which is 0.
+ */
+#define MCU_UART_SEQ_SPAN	255
 
 enum muart_ptype {
 	MP_NONE = 0,
@@ -84,42 +133,57 @@ enum muart_ptype {
 	MP_ACK,
 };
 
-/***** PPP Protocol *****/
-#define	UART_PPP_FLAG_BYTE		0x7E
-#define	UART_PPP_ESCAPE_BYTE		0x7D
-#define	UART_PPP_XOR_BYTE		0x20
-/************************/
+/*
+ * Sequence check of a received data packet.
+ */
+enum muart_rx_seq {
+	MRS_NEW,		/* next in sequence, or starting over */
+	MRS_DUP,		/* already received */
+	MRS_AHEAD,		/* an earlier packet is missing */
+};
+
+/*
+ * Transmit queue lanes, highest priority first.
+ * Packets in a lane keep their order.  Control packets (NAKs, confirms
+ * and conf responses) go ahead of property updates, which go ahead of
+ * MCU OTA images and file datapoints.
+ */
+enum muart_tx_lane {
+	MTL_CTRL = 0,
+	MTL_PROP,
+	MTL_BULK,
+	MTL_COUNT
+};
+
+/*
+ * A waiting lane sends its next packet after this many from higher lanes.
+ */
+#define MCU_UART_TX_STARVE	4
 
+/*
+ * Optional counters and histograms for various conditions, kept in
+ * struct mcu_uart_stats.
+ * These can be deleted to save space but may help debugging.
+ */
 #define MCU_UART_STATS
 
 #ifndef MCU_UART_STATS
 #define MUART_STATS(_muart, x)
+#define MUART_STATS_ADD(_muart, x, n)
+#define MUART_HIST(_muart, h, val)
 #else
 #define MUART_STATS(_muart, x)	do { (_muart)->stats.x++; } while (0)
+#define MUART_STATS_ADD(_muart, x, n) \
+	do { (_muart)->stats.x += (n); } while (0)
+#define MUART_HIST(_muart, h, val) \
+	do { (_muart)->stats.hist[h][mcu_uart_hist_bucket(val)]++; } while (0)
+#endif
+
 /*
- * Optional debug counters for various conditions.
- * These can be deleted to save space but may help debugging.
+ * Number of received packet start times kept for MUH_RX_DELAY.
+ * Packets beyond this many waiting in the ring are not sampled.
  */
-struct muart_stats {
-	u16 tx_bytes;
-	u16 tx_pkts;
-	u16 tx_acks;
-	u16 tx_data;
-	u16 tx_resend;
-
-	u16 rx_bytes;
-	u16 rx_pkts;
-	u16 rx_data;
-	u16 rx_acks;
-
-	u16 rx_frame_err;
-	u16 rx_len_err;
-	u16 rx_crc_err;
-	u16 rx_ptype_err;
-	u16 rx_seq_err;
-	u16 rx_cmd_err;
-};
-#endif
+#define MCU_UART_RX_TIMES	8
 
 struct muart_buffer {
 	/* circular buffer implementing "keep one slot open" */
@@ -136,36 +200,83 @@ enum muart_tx_state {
 	MTS_DATA_FINISH
 };
 
+/*
+ * Queue of packets for one transmit lane.
+ */
+struct muart_tx_queue {
+	struct hp_buf *head;
+	struct hp_buf *tail;
+	u8	len;
+	u8	skipped;		/* # sent from higher lanes meanwhile */
+};
+
+/*
+ * Data packet sent or to be sent, kept until acknowledged.
+ */
+struct muart_tx_frame {
+	struct muart_buffer buf;	/* framed and escaped packet */
+	u32	sent_ms;		/* time transmission finished */
+	u16	order;			/* position in the send sequence */
+	u8	seq_no;			/* seq # of the packet */
+	u8	retransmit_count;	/* # of retransmissions for packet */
+	u8	in_use:1;		/* waiting for ack */
+	u8	sent:1;			/* transmitted, ack timer running */
+	u8	resend:1;		/* retransmit when possible */
+};
+
 struct mcu_uart_state {
 	void	(*data_tlv_cb)(void);	/* non-NULL if it needs bufs */
-	struct hp_buf *ack_queue;	/* ack queue */
-	struct hp_buf *tx_queue;	/* transmit queue */
+	struct muart_tx_queue tx_queue[MTL_COUNT]; /* transmit lanes */
 	struct net_callback rx_callback;/* rx data callback */
 	struct net_callback tx_callback;/* tx callback */
 	struct muart_buffer *tx_buf;	/* current buffer to be transmitted */
+	struct muart_tx_frame *tx_frame; /* data frame being transmitted */
 	enum	muart_tx_state mts;	/* current state of transmission */
-	u8	retransmit_count;	/* # of retransmissions for packet */
 	u8	saw_ppp_flag;		/* saw the first PPP flag byte */
-	u8	tx_queue_len;		/* len of tx queue */
+	u8	rx_esc;			/* last byte received was an escape */
+	u16	rx_crc;			/* CRC of packet being received */
+	u16	rx_pkt_len;		/* unescaped length received so far */
+	u16	rx_pkt_start;		/* rx_buf index where packet started */
+	u8	rx_bad_run;		/* bad packets since a good one */
+	u8	tx_queue_len;		/* total len of tx lanes */
+	u8	ack_seq[MCU_UART_MAX_ACKS]; /* seq #s waiting to be acked */
+	u8	ack_start;		/* index of the oldest pending ack */
+	u8	ack_count;		/* # of pending acks */
 	u8	num_pkts_recvd;		/* # of complete recvd packets */
-	u8	recved_seq_no;		/* seq # of the last recved packet */
+	u8	rx_seq;			/* seq # of the last packet taken */
 	u8	tx_seq_no;		/* seq # of the last tx packet */
-	u8	wait_for_ack;		/* 1 if waiting for ack to last tx */
-	u8	resend:1;		/* resend last packet */
+	u8	tx_in_flight;		/* # of data packets awaiting ack */
+	u16	tx_order;		/* order of the next new frame */
 	u8	first_tx:1;		/* next tx is the 1st since init */
+	u8	rx_seq_valid:1;		/* rx_seq has been set */
+	u8	rtt_valid:1;		/* srtt and rttvar have been measured */
+	u8	rx_hold:1;		/* refuse rx bytes, buffers changing */
+	u8	link_wait:1;		/* link_timer set for a link change */
+	u8	link_check:1;		/* features asked for after a loss */
+	u16	link_check_order;	/* order of first frame after that */
+	u16	frame_max;		/* max data length of a packet */
+	u32	baud;			/* serial speed, 0 for the default */
+	u8	rto_backoff;		/* # of doublings of rto since ack */
+	u16	rto;			/* retrans timeout before backoff */
+	u16	srtt;			/* smoothed ack RTT, scaled by 8 */
+	u16	rttvar;			/* RTT variance, scaled by 4 */
 #ifdef MCU_UART_STATS
-	struct muart_stats stats;	/* statistics counters */
+	struct mcu_uart_stats stats;	/* statistics counters */
+	u32	rx_pkt_ms;		/* time packet being received started */
+	u16	rx_time_in;		/* # of start times added */
+	u16	rx_time_out;		/* # of start times used */
+	u32	rx_start_ms[MCU_UART_RX_TIMES]; /* start times of packets */
 #endif
 
 	struct muart_buffer rx_buf;
+	u8	*rx_pkt;		/* packet unescaped from rx_buf */
 	struct muart_buffer tx_ack_buf;
-	struct muart_buffer tx_data_buf;
+	struct muart_tx_frame tx_frames[MCU_UART_WINDOW_LEN];
 
-	u8 rx_area[MCU_UART_RX_SIZE + 1];
-	u8 tx_data_area[MCU_UART_TX_DATA_SIZE + 1];
 	u8 tx_ack_area[MCU_UART_ACK_SIZE + 1];
 
 	struct timer tx_resend_timer;
+	struct timer link_timer;
 };
 
 static struct mcu_uart_state *muart_state;
@@ -173,6 +284,79 @@ static const struct mcu_dev mcu_uart_ops;
 
 static void mcu_uart_send_next(struct mcu_uart_state *muart);
 static int mcu_uart_can_recv(struct mcu_uart_state *);
+static void mcu_uart_issue_rx_cb(struct mcu_uart_state *muart);
+static int mcu_uart_link_pending(struct mcu_uart_state *muart);
+static void mcu_uart_link_check(struct mcu_uart_state *muart);
+
+#ifdef MCU_UART_STATS
+/*
+ * Return the log2 histogram bucket for a value.
+ */
+static unsigned int mcu_uart_hist_bucket(u32 val)
+{
+	unsigned int bucket = 0;
+
+	while (val && bucket < MCU_UART_HIST_BUCKETS - 1) {
+		val >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+#endif
+
+/*
+ * Note the time the first byte of a packet arrived.
+ */
+static void mcu_uart_rx_time_start(struct mcu_uart_state *muart)
+{
+#ifdef MCU_UART_STATS
+	if (!muart->rx_pkt_len) {
+		muart->rx_pkt_ms = clock_ms();
+	}
+#endif
+}
+
+/*
+ * Keep the start time of a non-empty packet added to the ring.
+ */
+static void mcu_uart_rx_time_add(struct mcu_uart_state *muart)
+{
+#ifdef MCU_UART_STATS
+	muart->rx_start_ms[muart->rx_time_in % MCU_UART_RX_TIMES] =
+	    muart->rx_pkt_ms;
+	muart->rx_time_in++;
+#endif
+}
+
+/*
+ * Take the start time of the oldest non-empty packet in the ring.
+ * Returns 0 if it was not kept.
+ */
+static int mcu_uart_rx_time_get(struct mcu_uart_state *muart, u32 *msp)
+{
+#ifdef MCU_UART_STATS
+	u16 idx = muart->rx_time_out++;
+
+	if ((u16)(muart->rx_time_in - idx) > MCU_UART_RX_TIMES) {
+		return 0;	/* overwritten by later packets */
+	}
+	*msp = muart->rx_start_ms[idx % MCU_UART_RX_TIMES];
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Forget the start times of packets dropped from the ring.
+ */
+static void mcu_uart_rx_time_flush(struct mcu_uart_state *muart)
+{
+#ifdef MCU_UART_STATS
+	muart->rx_time_out = muart->rx_time_in;
+#endif
+}
 
 /*
  * Dequeue from buffer and return pointer to data. Return null if empty
@@ -194,21 +378,258 @@ static u8 *mcu_uart_buf_deq(struct muart_buffer *muart_buf)
 }
 
 /*
- * Timeout for handling data resend
+ * Return the number of data packets allowed in flight.
  */
-static void mcu_uart_tx_resend(struct timer *tm)
+static u8 mcu_uart_tx_window(void)
 {
-	struct mcu_uart_state *muart = muart_state;
+	return (mcu_feature_mask & MCU_UART_WINDOW) ? MCU_UART_WINDOW_LEN : 1;
+}
 
-	if (muart->retransmit_count < MCU_UART_MAX_RETRIES) {
-		/* retransmit packet */
-		muart->resend = 1;
-		muart->retransmit_count++;
-	} else {
+/*
+ * Find the unacknowledged frame with the given sequence number.
+ */
+static struct muart_tx_frame *mcu_uart_tx_frame_find(
+		struct mcu_uart_state *muart, u8 seq_no)
+{
+	struct muart_tx_frame *frame;
+
+	for (frame = muart->tx_frames;
+	    frame < &muart->tx_frames[MCU_UART_WINDOW_LEN]; frame++) {
+		if (frame->in_use && frame->seq_no == seq_no) {
+			return frame;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Get a free frame for a new data packet.
+ */
+static struct muart_tx_frame *mcu_uart_tx_frame_alloc(
+		struct mcu_uart_state *muart)
+{
+	struct muart_tx_frame *frame;
+
+	for (frame = muart->tx_frames;
+	    frame < &muart->tx_frames[MCU_UART_WINDOW_LEN]; frame++) {
+		if (!frame->in_use) {
+			frame->in_use = 1;
+			frame->sent = 0;
+			frame->resend = 0;
+			frame->retransmit_count = 0;
+			frame->order = muart->tx_order++;
+			muart->tx_in_flight++;
+			return frame;
+		}
+	}
+	return NULL;
+}
+
+static void mcu_uart_tx_frame_free(struct mcu_uart_state *muart,
+		struct muart_tx_frame *frame)
+{
+	ASSERT(frame->in_use);
+	frame->in_use = 0;
+	frame->sent = 0;
+	frame->resend = 0;
+	muart->tx_in_flight--;
+}
+
+/*
+ * Handle giving up on a frame on the link set by the features, or a run
+ * of bad packets from the MCU, given the order of the next new frame.
+ * The MCU may have gone back to the default link, or the line may have
+ * been down for a while.  First ask for the features again on this link.
+ * If a frame sent after that is also given up, or more bad packets
+ * arrive, go back to the default link, and ask again once there.
+ */
+static void mcu_uart_link_lost(struct mcu_uart_state *muart, u16 order)
+{
+	if (!(mcu_feature_mask & (MCU_UART_FAST | MCU_UART_JUMBO))) {
+		return;
+	}
+	if (!muart->link_check) {
 		log_put_mod_sev(MOD_LOG_IO, LOG_SEV_WARN,
-		    "uart_tx_resend: pkt dropped");
+		    "uart_link: checking features");
+		muart->link_check = 1;
+		muart->link_check_order = muart->tx_order;
+		prop_req_features_get();
+		return;
+	}
+	if ((s16)(order - muart->link_check_order) < 0) {
+		return;		/* sent before the check */
+	}
+	log_put_mod_sev(MOD_LOG_IO, LOG_SEV_WARN,
+	    "uart_link: no answer, using default link");
+	mcu_feature_mask &= ~(MCU_UART_FAST | MCU_UART_JUMBO);
+	mcu_uart_link_check(muart);
+}
+
+/*
+ * Handle the ACK of a frame.  If it was sent after the features were
+ * asked for again, the MCU is still on the link.
+ */
+static void mcu_uart_link_acked(struct mcu_uart_state *muart, u16 order)
+{
+	if (muart->link_check &&
+	    (mcu_feature_mask & (MCU_UART_FAST | MCU_UART_JUMBO)) &&
+	    (s16)(order - muart->link_check_order) >= 0) {
+		muart->link_check = 0;
 	}
-	muart->wait_for_ack = 0;
+}
+
+/*
+ * Return the current retransmission timeout including backoff.
+ */
+static u32 mcu_uart_rto(struct mcu_uart_state *muart)
+{
+	u32 rto = (u32)muart->rto << muart->rto_backoff;
+
+	return rto < MCU_UART_RTO_MAX ? rto : MCU_UART_RTO_MAX;
+}
+
+/*
+ * Update the RTT estimate and RTO with a measured ack round trip time.
+ * Only packets sent once are measured, since the ack for a resent packet
+ * may be for either transmission (Karn's algorithm).
+ */
+static void mcu_uart_rtt_sample(struct mcu_uart_state *muart, u32 rtt)
+{
+	s32 delta;
+	u32 rto;
+
+	if (rtt > MCU_UART_RTO_MAX) {
+		rtt = MCU_UART_RTO_MAX;
+	}
+	if (!muart->rtt_valid) {
+		muart->rtt_valid = 1;
+		muart->srtt = rtt << 3;
+		muart->rttvar = rtt << 1;
+	} else {
+		delta = (s32)rtt - (muart->srtt >> 3);
+		muart->srtt += delta;
+		if (delta < 0) {
+			delta = -delta;
+		}
+		muart->rttvar += delta - (muart->rttvar >> 2);
+	}
+	rto = (muart->srtt >> 3) +
+	    (muart->rttvar > MCU_UART_RTO_GRAN ?
+	    muart->rttvar : MCU_UART_RTO_GRAN);
+	if (rto < MCU_UART_RTO_MIN) {
+		rto = MCU_UART_RTO_MIN;
+	} else if (rto > MCU_UART_RTO_MAX) {
+		rto = MCU_UART_RTO_MAX;
+	}
+	muart->rto = rto;
+	muart->rto_backoff = 0;
+#ifdef MCU_UART_STATS
+	muart->stats.rtt_samples++;
+	muart->stats.rtt_last = rtt;
+	MUART_HIST(muart, MUH_ACK_RTT, rtt);
+	if (rtt > muart->stats.rtt_max) {
+		muart->stats.rtt_max = rtt;
+	}
+#endif
+}
+
+/*
+ * Set the resend timer for the earliest frame waiting for an ack.
+ */
+static void mcu_uart_tx_resend_set(struct mcu_uart_state *muart)
+{
+	struct muart_tx_frame *frame;
+	struct muart_tx_frame *oldest = NULL;
+	u32 now;
+	u32 wait;
+
+	for (frame = muart->tx_frames;
+	    frame < &muart->tx_frames[MCU_UART_WINDOW_LEN]; frame++) {
+		if (frame->in_use && frame->sent && (!oldest ||
+		    clock_gt(oldest->sent_ms, frame->sent_ms))) {
+			oldest = frame;
+		}
+	}
+	if (!oldest) {
+		host_proto_timer_cancel(&muart->tx_resend_timer);
+		return;
+	}
+	now = clock_ms();
+	wait = 0;
+	if (clock_gt(oldest->sent_ms + mcu_uart_rto(muart), now)) {
+		wait = oldest->sent_ms + mcu_uart_rto(muart) - now;
+	}
+	host_proto_timer_set(&muart->tx_resend_timer, wait);
+}
+
+/*
+ * Return non-zero if frame a was first sent before frame b.
+ */
+static int mcu_uart_tx_before(const struct muart_tx_frame *a,
+		const struct muart_tx_frame *b)
+{
+	return (s16)(a->order - b->order) < 0;
+}
+
+/*
+ * Timeout for handling data resend.
+ * The MCU takes packets only in sequence, so the earliest frame whose ack
+ * wait has expired is resent along with every frame sent after it.
+ * If that frame is given up, the ones sent after it can no longer be
+ * taken either, so they are dropped too and the sequence restarts at 0.
+ */
+static void mcu_uart_tx_resend(struct timer *tm)
+{
+	struct mcu_uart_state *muart = muart_state;
+	struct muart_tx_frame *frame;
+	struct muart_tx_frame *first = NULL;
+	u32 now = clock_ms();
+	u32 rto = mcu_uart_rto(muart);
+	u8 expired = 0;
+	u8 drop;
+
+	for (frame = muart->tx_frames;
+	    frame < &muart->tx_frames[MCU_UART_WINDOW_LEN]; frame++) {
+		if (frame->in_use && frame->sent &&
+		    !clock_gt(frame->sent_ms + rto, now) &&
+		    (!first || mcu_uart_tx_before(frame, first))) {
+			first = frame;
+		}
+	}
+	drop = first && first->retransmit_count >= MCU_UART_MAX_RETRIES;
+	for (frame = muart->tx_frames;
+	    frame < &muart->tx_frames[MCU_UART_WINDOW_LEN]; frame++) {
+		if (!first || !frame->in_use || frame == muart->tx_frame ||
+		    mcu_uart_tx_before(frame, first)) {
+			continue;
+		}
+		if (drop) {
+			log_put_mod_sev(MOD_LOG_IO, LOG_SEV_WARN,
+			    "uart_tx_resend: pkt seq %#x dropped",
+			    frame->seq_no);
+			mcu_uart_tx_frame_free(muart, frame);
+			muart->first_tx = 1;
+			mcu_uart_link_lost(muart, frame->order);
+			continue;
+		}
+		if (!frame->sent) {
+			continue;
+		}
+		expired = 1;
+		frame->sent = 0;
+		if (frame->retransmit_count < MCU_UART_MAX_RETRIES) {
+			/* retransmit packet */
+			frame->resend = 1;
+			frame->retransmit_count++;
+		}
+	}
+	if (expired) {
+		MUART_STATS(muart, tx_timeout);
+		if (mcu_uart_rto(muart) < MCU_UART_RTO_MAX) {
+			muart->rto_backoff++;
+		}
+	}
+	mcu_uart_tx_resend_set(muart);
 	if (muart->mts == MTS_IDLE) {
 		mcu_uart_send_next(muart);
 	}
@@ -234,56 +655,143 @@ static int mcu_uart_buf_enq(struct muart_buffer *muart_buf, u8 data)
 }
 
 /*
- * Generate a ack buf
+ * Return the number of bytes that can be added to the buffer.
  */
-static int mcu_uart_gen_ack(struct mcu_uart_state *muart, u8 ack_seq)
+static size_t mcu_uart_buf_room(struct muart_buffer *muart_buf)
 {
-	struct hp_buf *ack_buf;
-	struct hp_buf *prev;
-	struct hp_buf *bp;
+	if (muart_buf->end >= muart_buf->start) {
+		return muart_buf->size - 1 -
+		    (muart_buf->end - muart_buf->start);
+	}
+	return muart_buf->start - muart_buf->end - 1;
+}
 
-	ack_buf = hp_buf_alloc(1);
-	if (!ack_buf) {
-		return -1;
+/*
+ * Append bytes to the buffer, which must have room for them.
+ */
+static void mcu_uart_buf_enq_span(struct muart_buffer *muart_buf,
+		const u8 *data, size_t len)
+{
+	size_t part = muart_buf->size - muart_buf->end;
+	u32 end;
+
+	if (part > len) {
+		part = len;
+	}
+	memcpy(&muart_buf->buf[muart_buf->end], data, part);
+	memcpy(muart_buf->buf, data + part, len - part);
+	end = muart_buf->end + len;
+	if (end >= muart_buf->size) {
+		end -= muart_buf->size;
 	}
+	muart_buf->end = end;
+}
+
+/*
+ * Queue an ack for a received data packet.
+ * Pending acks are just sequence numbers in a small ring, so no buffer
+ * is needed.  An ack already pending for the same sequence number also
+ * covers a duplicate of that packet.
+ */
+static int mcu_uart_gen_ack(struct mcu_uart_state *muart, u8 ack_seq)
+{
+	u8 i;
+	u8 idx;
+
 	if (ack_seq == 0) {
 		/* lollipop seq #, starting over */
-		while ((bp = muart->ack_queue) != NULL) {
-			muart->ack_queue = bp->next;
-			bp->next = NULL;
-			hp_buf_free(bp);
-		}
+		muart->ack_count = 0;
 	}
-	prev = muart->ack_queue;
-	*(u8 *)ack_buf->payload = ack_seq;
-	if (prev == NULL) {
-		muart->ack_queue = ack_buf;
-		return 0;
+	for (i = 0; i < muart->ack_count; i++) {
+		idx = (muart->ack_start + i) % MCU_UART_MAX_ACKS;
+		if (muart->ack_seq[idx] == ack_seq) {
+			MUART_STATS(muart, tx_ack_merged);
+			return 0;
+		}
 	}
-	while (prev->next != NULL) {
-		prev = prev->next;
+	if (muart->ack_count >= MCU_UART_MAX_ACKS) {
+		MUART_STATS(muart, rx_ack_full);
+		return -1;
 	}
-	prev->next = ack_buf;
+	muart->ack_seq[(muart->ack_start + muart->ack_count) %
+	    MCU_UART_MAX_ACKS] = ack_seq;
+	muart->ack_count++;
 	return 0;
 }
 
+/*
+ * Return the number of steps from one seq # to a later one.
+ */
+static u8 mcu_uart_seq_dist(u8 from, u8 to)
+{
+	if (!from) {
+		return to;
+	}
+	return (to + MCU_UART_SEQ_SPAN - from) % MCU_UART_SEQ_SPAN;
+}
+
+/*
+ * Check the seq # of a received data packet against the last one taken.
+ * Seq # 0 starts a new lollipop sequence, and a repeat of the last seq #
+ * is a duplicate whose ack was lost.  With MCU_UART_WINDOW, the MCU may
+ * resend any of the last MCU_UART_WINDOW_LEN packets, so those are
+ * duplicates too, and any other packet out of sequence follows a lost one
+ * and is dropped so that packets are taken in order.  Without it, any
+ * other seq # is taken as a new start.
+ */
+static enum muart_rx_seq mcu_uart_rx_seq_check(struct mcu_uart_state *muart,
+		u8 seq_no)
+{
+	u8 dist;
+
+	if (!seq_no || !muart->rx_seq_valid) {
+		return MRS_NEW;
+	}
+	dist = mcu_uart_seq_dist(muart->rx_seq, seq_no);
+	if (dist == 1) {
+		return MRS_NEW;
+	}
+	if (!dist) {
+		return MRS_DUP;
+	}
+	if (!(mcu_feature_mask & MCU_UART_WINDOW)) {
+		return MRS_NEW;
+	}
+	if (muart->rx_seq && dist > MCU_UART_SEQ_SPAN - MCU_UART_WINDOW_LEN) {
+		return MRS_DUP;
+	}
+	return MRS_AHEAD;
+}
+
 /*
  * Process the recved data on the UART buffer.
+ * Packets are unescaped from the ring into rx_pkt, which is handed to the
+ * TLV layer.  It is not taken from the pool, so ACKs are always handled
+ * even while queued transmit packets hold all pool buffers.
  */
 static void mcu_uart_recv_cb(void *arg)
 {
 	struct mcu_uart_state *muart = arg;
 	struct muart_buffer *recv = &muart->rx_buf;
-	u8 escape_found;
+	struct muart_tx_frame *frame;
+	struct mcu_uart_ppp_rx rx;
 	u8 *data;
-	u8 recv_buffer[MCU_UART_RX_DATA_SIZE * 2];
+	u8 *recv_buffer = muart->rx_pkt;
 	u8 *data_ptr = recv_buffer + 2;
 	size_t recv_len;
+	u16 end;
+	ssize_t rc;
+	u32 start_ms = 0;
+	int timed;
+	enum muart_rx_seq rx_seq;
 	void (*data_tlv_cb)(void);
 
+	if (muart->rx_bad_run >= MCU_UART_LINK_BAD_PKTS) {
+		muart->rx_bad_run = 0;
+		mcu_uart_link_lost(muart, muart->tx_order);
+	}
+
 process_next_packet:
-	recv_len = 0;
-	escape_found = 0;
 	if (!muart->num_pkts_recvd) {
 		if (!mcu_uart_can_recv(muart)) {
 			/* overflow of recv buffer without complete packet */
@@ -291,6 +799,7 @@ process_next_packet:
 			recv->start = 0;
 			recv->end = 0;
 			muart->saw_ppp_flag = 0;
+			mcu_uart_rx_time_flush(muart);
 		}
 		goto finish;
 	}
@@ -306,32 +815,42 @@ process_next_packet:
 
 	if (data == NULL || !muart->num_pkts_recvd) {
 		muart->num_pkts_recvd = 0;
+		mcu_uart_rx_time_flush(muart);
 		goto finish;
 	}
-	/* unstuff bytes */
-	while (data != NULL && *data != UART_PPP_FLAG_BYTE) {
-		if (recv_len == sizeof(recv_buffer)) {
+	/* unstuff bytes, a contiguous span of the ring at a time */
+	recv->start = data - recv->buf;
+	memset(&rx, 0, sizeof(rx));
+	rx.buf = recv_buffer;
+	rx.size = MCU_UART_RX_PKT_SIZE(muart->frame_max);
+	while (!rx.done && recv->start != recv->end) {
+		end = recv->end;
+		if (end < recv->start) {
+			end = recv->size;
+		}
+		rc = mcu_uart_ppp_unstuff(&rx, &recv->buf[recv->start],
+		    end - recv->start);
+		if (rc < 0) {
 			/* received packet too long */
 			MUART_STATS(muart, rx_len_err);
+			mcu_uart_rx_time_get(muart, &start_ms);
 			goto skip_packet;
 		}
-		if (escape_found) {
-			recv_buffer[recv_len++] = *data ^ UART_PPP_XOR_BYTE;
-			escape_found = 0;
-		} else if (*data == UART_PPP_ESCAPE_BYTE) {
-			escape_found = 1;
-		} else {
-			recv_buffer[recv_len++] = *data;
+		recv->start += rc;
+		if (recv->start >= recv->size) {
+			recv->start = 0;
 		}
-		data = mcu_uart_buf_deq(recv);
 	}
+	recv_len = rx.len;
 	muart->num_pkts_recvd--;
-	if (data == NULL) {
+	if (!rx.done) {
 		/* incomplete packet, just drop it */
 		muart->num_pkts_recvd = 0;
+		mcu_uart_rx_time_flush(muart);
 		MUART_STATS(muart, rx_frame_err);
 		goto finish;
 	}
+	timed = mcu_uart_rx_time_get(muart, &start_ms);
 	serial_rx_unblock(SERIAL_MCU);
 
 #ifdef MCU_UART_LOG_RAW
@@ -339,17 +858,15 @@ process_next_packet:
 	log_bytes_in_hex_sev(MOD_LOG_IO, LOG_SEV_DEBUG2, recv_buffer, recv_len);
 #endif
 
-	/* check min ppp len. ptype, seq #, 2-byte crc */
+	/*
+	 * Check min ppp len. ptype, seq #, 2-byte crc.
+	 * Packets that are short or have a bad CRC were already dropped
+	 * by mcu_uart_rx_intr().
+	 */
 	if (recv_len < 4) {
 		MUART_STATS(muart, rx_len_err);
 		goto process_next_packet;
 	}
-	/* check crc */
-	if (crc16(recv_buffer, recv_len, CRC16_INIT)) {
-		/* bad crc, drop packet */
-		MUART_STATS(muart, rx_crc_err);
-		goto process_next_packet;
-	}
 	/* check ptype */
 	if (recv_buffer[0] != MP_DATA && recv_buffer[0] != MP_ACK) {
 		/* bad ptype, skip packet */
@@ -363,10 +880,22 @@ process_next_packet:
 #endif
 		MUART_STATS(muart, rx_acks);
 
-		if (muart->wait_for_ack &&
-		    recv_buffer[1] == muart->tx_seq_no) {
-			host_proto_timer_cancel(&muart->tx_resend_timer);
-			muart->wait_for_ack = 0;
+		frame = mcu_uart_tx_frame_find(muart, recv_buffer[1]);
+		if (frame) {
+			if (frame->sent && !frame->retransmit_count) {
+				mcu_uart_rtt_sample(muart,
+				    clock_ms() - frame->sent_ms);
+			} else {
+				/*
+				 * Resends go out together, so few acks give
+				 * samples.  The MCU is answering, so stop
+				 * backing off.
+				 */
+				muart->rto_backoff = 0;
+			}
+			mcu_uart_link_acked(muart, frame->order);
+			mcu_uart_tx_frame_free(muart, frame);
+			mcu_uart_tx_resend_set(muart);
 			if (muart->data_tlv_cb &&
 			    muart->tx_queue_len < MAX_SERIAL_TX_PBUFS) {
 				data_tlv_cb = muart->data_tlv_cb;
@@ -382,6 +911,7 @@ process_next_packet:
 
 	/* trim out the framing */
 	recv_len -= 4;
+	MUART_HIST(muart, MUH_RX_LEN, recv_len);
 #ifdef MCU_UART_LOG_BYTES_SEV
 	log_put_mod_sev(MOD_LOG_IO, MCU_UART_LOG_BYTES_SEV,
 	    "uart_rx seq %#x %zu bytes",
@@ -390,24 +920,32 @@ process_next_packet:
 	    data_ptr, recv_len);
 #endif
 
+	rx_seq = mcu_uart_rx_seq_check(muart, recv_buffer[1]);
+	if (rx_seq == MRS_AHEAD) {
+		/* wait for the lost packet and those after it to be resent */
+		MUART_STATS(muart, rx_seq_err);
+		goto process_next_packet;
+	}
 	if (mcu_uart_gen_ack(muart, recv_buffer[1])) {
 		goto process_next_packet;
 	}
 	if (muart->mts == MTS_IDLE) {
 		mcu_uart_send_next(muart);
 	}
-	/* check seq #, make sure its not the lollip seq # */
-	if (recv_buffer[1] && recv_buffer[1] == muart->recved_seq_no) {
+	if (rx_seq == MRS_DUP) {
 		/* already received and processed packet with this seq no */
 		MUART_STATS(muart, rx_seq_err);
 		goto process_next_packet;
 	}
-
-	muart->recved_seq_no = recv_buffer[1];
+	muart->rx_seq = recv_buffer[1];
+	muart->rx_seq_valid = 1;
 
 #ifdef MCU_UART_DECODE
 	host_decode_log("rx", data_ptr, recv_len);
 #endif
+	if (timed) {
+		MUART_HIST(muart, MUH_RX_DELAY, clock_ms() - start_ms);
+	}
 	if (data_tlv_process_mcu_pkt(data_ptr, recv_len)) {
 		MUART_STATS(muart, rx_cmd_err);
 	}
@@ -425,6 +963,7 @@ skip_packet:
 	muart->num_pkts_recvd--;
 	if (data == NULL || !muart->num_pkts_recvd) {
 		muart->num_pkts_recvd = 0;
+		mcu_uart_rx_time_flush(muart);
 		goto finish;
 	}
 	goto process_next_packet;
@@ -460,9 +999,90 @@ static int mcu_uart_can_recv(struct mcu_uart_state *muart)
 	return 1;
 }
 
+/*
+ * Start checking a new packet after a flag byte.
+ */
+static void mcu_uart_rx_pkt_start(struct mcu_uart_state *muart)
+{
+	muart->rx_esc = 0;
+	muart->rx_crc = CRC16_INIT;
+	muart->rx_pkt_len = 0;
+	muart->rx_pkt_start = muart->rx_buf.end;
+}
+
+/*
+ * Handle the flag byte ending a packet, which has been added to the ring.
+ * A short packet or one with a bad CRC is removed from the ring.
+ * Returns 1 if a packet was kept for mcu_uart_recv_cb().
+ */
+static int mcu_uart_rx_pkt_end(struct mcu_uart_state *muart)
+{
+	if (muart->rx_pkt_len && (muart->rx_pkt_len < 4 || muart->rx_crc)) {
+		/* short packet or bad crc, drop it */
+		if (muart->rx_crc) {
+			MUART_STATS(muart, rx_crc_err);
+		} else {
+			MUART_STATS(muart, rx_len_err);
+		}
+		muart->rx_buf.end = muart->rx_pkt_start;
+		mcu_uart_rx_pkt_start(muart);
+		if (++muart->rx_bad_run == MCU_UART_LINK_BAD_PKTS &&
+		    (mcu_feature_mask & (MCU_UART_FAST | MCU_UART_JUMBO))) {
+			mcu_uart_issue_rx_cb(muart);	/* to check the link */
+		}
+		return 0;
+	}
+	if (muart->rx_pkt_len) {
+		mcu_uart_rx_time_add(muart);
+		muart->rx_bad_run = 0;
+	}
+	mcu_uart_rx_pkt_start(muart);
+	MUART_STATS(muart, rx_pkts);
+	muart->num_pkts_recvd++;
+	return 1;
+}
+
+/*
+ * Update the CRC and length of the packet being received with escaped
+ * bytes that contain no flag byte.
+ */
+static void mcu_uart_rx_check(struct mcu_uart_state *muart,
+		const u8 *buf, size_t len)
+{
+	size_t run;
+
+	if (len) {
+		mcu_uart_rx_time_start(muart);
+	}
+	while (len) {
+		if (muart->rx_esc) {
+			muart->rx_crc = mcu_uart_ppp_crc_byte(muart->rx_crc,
+			    *buf++ ^ UART_PPP_XOR_BYTE);
+			muart->rx_pkt_len++;
+			muart->rx_esc = 0;
+			len--;
+			continue;
+		}
+		run = mcu_uart_ppp_span(buf, len);
+		if (run) {
+			muart->rx_crc = mcu_uart_ppp_crc16(buf, run,
+			    muart->rx_crc);
+			muart->rx_pkt_len += run;
+			buf += run;
+			len -= run;
+			continue;
+		}
+		muart->rx_esc = 1;
+		buf++;
+		len--;
+	}
+}
+
 /*
  * Process UART receive interrupts.
  * Called by the callback in serial driver.
+ * The CRC is updated as each byte arrives so that a bad packet can be
+ * dropped from the ring as soon as its closing flag is seen.
  * Return non-zero if nothing can be received; the caller must buffer the byte.
  */
 static int mcu_uart_rx_intr(u8 dr)
@@ -470,63 +1090,128 @@ static int mcu_uart_rx_intr(u8 dr)
 	struct mcu_uart_state *muart = muart_state;
 	struct muart_buffer *recv = &muart->rx_buf;
 
-	if (!mcu_uart_can_recv(muart)) {
+	if (muart->rx_hold || !mcu_uart_can_recv(muart)) {
 		return -1;
 	}
 	MUART_STATS(muart, rx_bytes);
 	if (!muart->saw_ppp_flag) {
 		if (dr == UART_PPP_FLAG_BYTE) {
 			muart->saw_ppp_flag = 1;
+			mcu_uart_rx_pkt_start(muart);
 		}
 		/* saw bytes without the first ppp flag, just drop */
 		return 0;
 	}
 	mcu_uart_buf_enq(recv, dr);
 	if (dr == UART_PPP_FLAG_BYTE) {
-		MUART_STATS(muart, rx_pkts);
-		muart->num_pkts_recvd++;
-		mcu_uart_issue_rx_cb(muart);
+		if (mcu_uart_rx_pkt_end(muart)) {
+			mcu_uart_issue_rx_cb(muart);
+		}
+		return 0;
 	}
+	if (muart->rx_esc) {
+		dr ^= UART_PPP_XOR_BYTE;
+		muart->rx_esc = 0;
+	} else if (dr == UART_PPP_ESCAPE_BYTE) {
+		muart->rx_esc = 1;
+		return 0;
+	}
+	mcu_uart_rx_time_start(muart);
+	muart->rx_crc = mcu_uart_ppp_crc_byte(muart->rx_crc, dr);
+	muart->rx_pkt_len++;
 	return 0;
 }
 
+/*
+ * Receive a block of bytes, such as the contents of the UART FIFO.
+ * The bytes up to each flag byte are copied into the ring at once, and
+ * the receive callback is pended once for all packets completed.
+ * Returns the number of bytes taken.  If the ring fills, the caller must
+ * keep the rest and offer them again after serial_rx_unblock().
+ */
+size_t mcu_uart_rx_block(const u8 *buf, size_t len)
+{
+	struct mcu_uart_state *muart = muart_state;
+	struct muart_buffer *recv = &muart->rx_buf;
+	const u8 *cp = buf;
+	const u8 *end = buf + len;
+	const u8 *flag;
+	size_t room;
+	size_t seg;
+	int pkts = 0;
+
+	if (muart->rx_hold) {
+		return 0;
+	}
+	while (cp < end) {
+		flag = memchr(cp, UART_PPP_FLAG_BYTE, end - cp);
+		if (!muart->saw_ppp_flag) {
+			/* drop bytes before the first ppp flag */
+			if (!flag) {
+				MUART_STATS_ADD(muart, rx_bytes, end - cp);
+				cp = end;
+				break;
+			}
+			MUART_STATS_ADD(muart, rx_bytes, flag + 1 - cp);
+			cp = flag + 1;
+			muart->saw_ppp_flag = 1;
+			mcu_uart_rx_pkt_start(muart);
+			continue;
+		}
+		seg = (flag ? flag + 1 : end) - cp;
+		room = mcu_uart_buf_room(recv);
+		if (!room) {
+			break;
+		}
+		if (seg > room) {
+			seg = room;
+			flag = NULL;
+		}
+		mcu_uart_rx_check(muart, cp, flag ? seg - 1 : seg);
+		mcu_uart_buf_enq_span(recv, cp, seg);
+		MUART_STATS_ADD(muart, rx_bytes, seg);
+		cp += seg;
+		if (flag) {
+			pkts += mcu_uart_rx_pkt_end(muart);
+		}
+	}
+	if (pkts || cp < end) {
+		mcu_uart_issue_rx_cb(muart);
+	}
+	return cp - buf;
+}
+
 /*
  * Helper function for mcu_uart_build_tx.
- * Enqueues the data, escaping where necessary.
+ * Appends the data, escaping where necessary.
+ * The packet is built from index 0, so the buffer does not wrap.
  */
 static int mcu_uart_build_tx_helper(struct muart_buffer *in,
-		u8 *data, size_t len)
+		u8 *data, size_t len, u16 *crcp)
 {
-	int i;
+	ssize_t rc;
 
-	ASSERT(len <= MCU_UART_TX_DATA_SIZE);
+	ASSERT(!in->start && in->end < in->size);
 
-	for (i = 0; i < len; i++) {
-		if (data[i] == UART_PPP_FLAG_BYTE ||
-		    data[i] == UART_PPP_ESCAPE_BYTE) {
-			if (mcu_uart_buf_enq(in, UART_PPP_ESCAPE_BYTE)) {
-				return -1;
-			}
-			if (mcu_uart_buf_enq(in,
-			    data[i] ^ UART_PPP_XOR_BYTE)) {
-				return -1;
-			}
-		} else {
-			if (mcu_uart_buf_enq(in, data[i])) {
-				return -1;
-			}
-		}
+	/* leave one slot open, as mcu_uart_buf_enq() does */
+	rc = mcu_uart_ppp_stuff(&in->buf[in->end], in->size - 1 - in->end,
+	    data, len, crcp);
+	if (rc < 0) {
+		return -1;
 	}
+	in->end += rc;
 	return 0;
 }
 
 /*
  * Build a packet with the PPP flag bytes + ptype + seq no + data + crc.
- * Starts from index 0.
+ * Starts from index 0.  The CRC is computed as the bytes are escaped.
+ * The data is taken from each segment of the buffer chain in turn, so a
+ * chained packet is framed without copying it together first.
  */
 static int mcu_uart_build_tx(struct mcu_uart_state *muart,
 	struct muart_buffer *output, enum muart_ptype ptype, u8 seq_no,
-	u8 *data, u16 len)
+	const struct hp_buf *bp)
 {
 	u8 head[2];
 	u8 tail[2];
@@ -539,18 +1224,19 @@ static int mcu_uart_build_tx(struct mcu_uart_state *muart,
 	if (mcu_uart_buf_enq(output, UART_PPP_FLAG_BYTE)) {
 		goto full;
 	}
-	if (mcu_uart_build_tx_helper(output, head, sizeof(head))) {
+	crc = CRC16_INIT;
+	if (mcu_uart_build_tx_helper(output, head, sizeof(head), &crc)) {
 		goto full;
 	}
-	crc = crc16(head, sizeof(head), CRC16_INIT);
-	if (data != NULL && len) {
-		if (mcu_uart_build_tx_helper(output, data, len)) {
+	for (; bp; bp = bp->seg) {
+		if (bp->len &&
+		    mcu_uart_build_tx_helper(output, bp->payload, bp->len,
+		    &crc)) {
 			goto full;
 		}
-		crc = crc16(data, len, crc);
 	}
 	put_ua_be16(tail, crc);
-	if (mcu_uart_build_tx_helper(output, tail, sizeof(tail))) {
+	if (mcu_uart_build_tx_helper(output, tail, sizeof(tail), NULL)) {
 		goto full;
 	}
 	if (mcu_uart_buf_enq(output, UART_PPP_FLAG_BYTE)) {
@@ -563,46 +1249,197 @@ full:
 	return -1;
 }
 
+/*
+ * Return the transmit lane for a packet.
+ */
+static enum muart_tx_lane mcu_uart_tx_lane(struct mcu_uart_state *muart,
+		struct hp_buf *bp)
+{
+	const struct ayla_cmd *cmd = bp->payload;
+
+	if (bp->len < sizeof(*cmd)) {
+		return MTL_CTRL;
+	}
+	switch (cmd->protocol) {
+	case ASPI_PROTO_CMD:
+		switch (cmd->opcode) {
+		case ACMD_MCU_OTA:
+		case ACMD_MCU_OTA_LOAD:
+		case ACMD_MCU_OTA_BOOT:
+			return MTL_BULK;
+		default:
+			break;
+		}
+		break;
+	case ASPI_PROTO_DATA:
+		switch (cmd->opcode) {
+		case AD_NAK:
+		case AD_CONFIRM:
+			/* must not pass the property data it may end */
+			if (muart->tx_queue[MTL_PROP].len) {
+				return MTL_PROP;
+			}
+			break;
+		case AD_ERROR:
+		case AD_ECHO_FAIL:
+			break;
+		case AD_DP_REQ:
+		case AD_DP_RESP:
+		case AD_DP_CREATE:
+		case AD_DP_FETCHED:
+		case AD_DP_STOP:
+		case AD_DP_SEND:
+			return MTL_BULK;
+		default:
+			return MTL_PROP;
+		}
+		break;
+	default:
+		break;
+	}
+	return MTL_CTRL;
+}
+
+/*
+ * Add a packet to the tail of its transmit lane.
+ */
+static void mcu_uart_tx_enq(struct mcu_uart_state *muart, struct hp_buf *bp)
+{
+	enum muart_tx_lane lane = mcu_uart_tx_lane(muart, bp);
+	struct muart_tx_queue *txq = &muart->tx_queue[lane];
+
+	if (txq->tail) {
+		txq->tail->next = bp;
+	} else {
+		txq->head = bp;
+	}
+	txq->tail = bp;
+	txq->len++;
+	muart->tx_queue_len++;
+#ifdef MCU_UART_STATS
+	bp->queued_ms = clock_ms();
+	if (txq->len > muart->stats.txq_depth_max[lane]) {
+		muart->stats.txq_depth_max[lane] = txq->len;
+	}
+#endif
+}
+
+/*
+ * Take the next packet to send from the highest priority lane,
+ * unless a lower lane has waited too long.
+ */
+static struct hp_buf *mcu_uart_tx_deq(struct mcu_uart_state *muart)
+{
+	struct muart_tx_queue *txq;
+	struct muart_tx_queue *pick = NULL;
+	struct hp_buf *bp;
+	enum muart_tx_lane lane;
+#ifdef MCU_UART_STATS
+	u32 wait;
+#endif
+
+	for (txq = muart->tx_queue; txq < &muart->tx_queue[MTL_COUNT];
+	    txq++) {
+		if (!txq->head) {
+			continue;
+		}
+		if (!pick) {
+			pick = txq;
+		} else if (txq->skipped >= MCU_UART_TX_STARVE) {
+			pick = txq;
+			MUART_STATS(muart, txq_starved[txq - muart->tx_queue]);
+			break;
+		}
+	}
+	if (!pick) {
+		return NULL;
+	}
+	for (txq = muart->tx_queue; txq < &muart->tx_queue[MTL_COUNT];
+	    txq++) {
+		if (txq->head && txq != pick) {
+			txq->skipped++;
+		}
+	}
+	pick->skipped = 0;
+
+	bp = pick->head;
+	pick->head = bp->next;
+	if (!pick->head) {
+		pick->tail = NULL;
+	}
+	bp->next = NULL;
+	pick->len--;
+	muart->tx_queue_len--;
+
+	lane = pick - muart->tx_queue;
+	MUART_STATS(muart, txq_pkts[lane]);
+#ifdef MCU_UART_STATS
+	wait = clock_ms() - bp->queued_ms;
+	muart->stats.txq_wait_sum[lane] += wait;
+	if (wait > muart->stats.txq_wait_max[lane]) {
+		muart->stats.txq_wait_max[lane] = wait;
+	}
+#endif
+	return bp;
+}
+
 /*
  * Determine next packet to send
  */
 static void mcu_uart_send_next(struct mcu_uart_state *muart)
 {
 	struct hp_buf *sendbuf;
-	struct hp_buf *next;
+	struct muart_tx_frame *frame;
+	struct muart_tx_frame *resend;
+	size_t len;
 	u8 seq;
+#ifdef MCU_UART_LOG_BYTES_SEV
+	struct hp_buf *seg;
+#endif
 
 	if (muart->mts == MTS_SENDING) {
 		/* still transmitting */
 		return;
 	}
 
-	if (muart->mts == MTS_DATA_FINISH && muart->wait_for_ack) {
+	frame = muart->tx_frame;
+	if (muart->mts == MTS_DATA_FINISH && frame && frame->in_use) {
 		/* just finished transmitting data */
-		host_proto_timer_set(&muart->tx_resend_timer,
-		    MCU_UART_ACK_WAIT);
+		frame->sent = 1;
+		frame->sent_ms = clock_ms();
+		mcu_uart_tx_resend_set(muart);
 	}
 	muart->mts = MTS_IDLE;
 	muart->tx_buf = NULL;
-
-build_packet:
-	if (muart->resend) {
-		/* give resends a high priority */
+	muart->tx_frame = NULL;
+
+	/* give resends a high priority, in the order first sent */
+	resend = NULL;
+	for (frame = muart->tx_frames;
+	    frame < &muart->tx_frames[MCU_UART_WINDOW_LEN]; frame++) {
+		if (frame->in_use && frame->resend &&
+		    (!resend || mcu_uart_tx_before(frame, resend))) {
+			resend = frame;
+		}
+	}
+	frame = resend;
+	if (frame) {
 		log_put_mod_sev(MOD_LOG_IO, LOG_SEV_DEBUG,
-		    "uart_resend");
+		    "uart_resend seq %#x", frame->seq_no);
 
-		muart->resend = 0;
-		muart->tx_data_buf.start = 0;
-		if (muart->tx_data_buf.end == 0) {
-			goto build_packet;
-		}
-		muart->tx_buf = &muart->tx_data_buf;
+		frame->resend = 0;
+		frame->buf.start = 0;
+		muart->tx_buf = &frame->buf;
+		muart->tx_frame = frame;
 		MUART_STATS(muart, tx_resend);
 		MUART_STATS(muart, tx_pkts);
-	} else if (muart->ack_queue) {
+	} else if (muart->ack_count) {
 		/* prioritize acks over tx data */
-		sendbuf = muart->ack_queue;
-		seq = *(u8 *)sendbuf->payload;
+		seq = muart->ack_seq[muart->ack_start];
+		if (++muart->ack_start >= MCU_UART_MAX_ACKS) {
+			muart->ack_start = 0;
+		}
+		muart->ack_count--;
 
 #ifdef MCU_UART_LOG_ACK_SEV
 		log_put_mod_sev(MOD_LOG_IO, MCU_UART_LOG_ACK_SEV,
@@ -610,20 +1447,19 @@ build_packet:
 #endif
 
 		mcu_uart_build_tx(muart, &muart->tx_ack_buf, MP_ACK,
-		    seq, NULL, 0);
-		next = sendbuf->next;
-		muart->ack_queue = next;
-		sendbuf->next = NULL;
-		hp_buf_free(sendbuf);
-		sendbuf = NULL;
+		    seq, NULL);
 		muart->tx_buf = &muart->tx_ack_buf;
 		MUART_STATS(muart, tx_acks);
 		MUART_STATS(muart, tx_pkts);
-	} else if (muart->tx_queue_len && !muart->wait_for_ack) {
-		sendbuf = muart->tx_queue;
+	} else if (muart->tx_queue_len &&
+	    muart->tx_in_flight < mcu_uart_tx_window() &&
+	    !mcu_uart_link_pending(muart)) {
+		sendbuf = mcu_uart_tx_deq(muart);
 		if (!sendbuf) {
 			goto start_tx;
 		}
+		frame = mcu_uart_tx_frame_alloc(muart);
+		ASSERT(frame);
 		muart->tx_seq_no++;
 		if (muart->first_tx) {
 			muart->tx_seq_no = 0;
@@ -633,27 +1469,30 @@ build_packet:
 			muart->tx_seq_no = 1;
 		}
 
+		len = hp_buf_chain_len(sendbuf);
 #ifdef MCU_UART_DECODE
-		host_decode_log("tx", sendbuf->payload, sendbuf->len);
+		if (!sendbuf->seg) {
+			/* the decoder needs the packet in one piece */
+			host_decode_log("tx", sendbuf->payload, len);
+		}
 #endif
 #ifdef MCU_UART_LOG_BYTES_SEV
 		log_put_mod_sev(MOD_LOG_IO, MCU_UART_LOG_BYTES_SEV,
 		    "uart_tx seq %#x %zu bytes",
-		    muart->tx_seq_no, sendbuf->len);
-		log_bytes_in_hex_sev(MOD_LOG_IO, MCU_UART_LOG_BYTES_SEV,
-		    sendbuf->payload, sendbuf->len);
+		    muart->tx_seq_no, len);
+		for (seg = sendbuf; seg; seg = seg->seg) {
+			log_bytes_in_hex_sev(MOD_LOG_IO, MCU_UART_LOG_BYTES_SEV,
+			    seg->payload, seg->len);
+		}
 #endif
 
-		mcu_uart_build_tx(muart, &muart->tx_data_buf, MP_DATA,
-		    muart->tx_seq_no, sendbuf->payload, sendbuf->len);
-		muart->tx_queue = sendbuf->next;
-		next = sendbuf->next;
-		muart->tx_queue = next;
-		sendbuf->next = NULL;
-		muart->tx_queue_len--;
-		muart->retransmit_count = 0;
+		frame->seq_no = muart->tx_seq_no;
+		mcu_uart_build_tx(muart, &frame->buf, MP_DATA,
+		    muart->tx_seq_no, sendbuf);
+		MUART_HIST(muart, MUH_TX_LEN, len);
 		hp_buf_free(sendbuf);
-		muart->tx_buf = &muart->tx_data_buf;
+		muart->tx_buf = &frame->buf;
+		muart->tx_frame = frame;
 		MUART_STATS(muart, tx_data);
 		MUART_STATS(muart, tx_pkts);
 	}
@@ -669,7 +1508,9 @@ start_tx:
 
 		muart->mts = MTS_SENDING;
 		serial_start_tx(SERIAL_MCU);
+		return;
 	}
+	mcu_uart_link_check(muart);
 }
 
 /*
@@ -683,33 +1524,68 @@ static void mcu_uart_trans_cb(void *arg)
 }
 
 /*
- * Returns the next byte to be transmitted. -1 if nothing to send.
+ * Get the next contiguous run of framed bytes to transmit.
+ * Sets *bufp and returns the length, or 0 if nothing to send.  When the
+ * frame is done, the transmit callback is pended once for the frame.
  */
-static int mcu_uart_get_tx(void)
+size_t mcu_uart_tx_span(const u8 **bufp)
 {
 	struct mcu_uart_state *muart = muart_state;
-	u8 *data;
+	struct muart_buffer *tx_buf;
+	size_t len;
 
 	if (muart->mts != MTS_SENDING) {
-		return -1;
+		return 0;
 	}
-	if (muart->tx_buf == NULL) {
+	tx_buf = muart->tx_buf;
+	if (tx_buf == NULL) {
 		muart->mts = MTS_IDLE;
-		return -1;
+		return 0;
 	}
-	data = mcu_uart_buf_deq(muart->tx_buf);
-	if (data == NULL) {
-		if (muart->tx_buf == &muart->tx_data_buf) {
+	if (tx_buf->start == tx_buf->end) {
+		if (muart->tx_frame) {
 			muart->mts = MTS_DATA_FINISH;
-			muart->wait_for_ack = 1;
 		} else {
 			muart->mts = MTS_ACK_FINISH;
 		}
 		host_proto_callback_pend(&muart->tx_callback);
+		return 0;
+	}
+
+	/* frames are built from the start of the buffer and never wrap */
+	ASSERT(tx_buf->start < tx_buf->end);
+	len = tx_buf->end - tx_buf->start;
+	*bufp = &tx_buf->buf[tx_buf->start];
+	return len;
+}
+
+/*
+ * Consume len bytes of the run returned by mcu_uart_tx_span().
+ */
+void mcu_uart_tx_advance(size_t len)
+{
+	struct mcu_uart_state *muart = muart_state;
+	struct muart_buffer *tx_buf = muart->tx_buf;
+
+	ASSERT(muart->mts == MTS_SENDING && tx_buf);
+	ASSERT(len <= tx_buf->end - tx_buf->start);
+	tx_buf->start += len;
+	MUART_STATS_ADD(muart, tx_bytes, len);
+}
+
+/*
+ * Returns the next byte to be transmitted. -1 if nothing to send.
+ * For serial drivers that take one byte at a time.
+ */
+static int mcu_uart_get_tx(void)
+{
+	const u8 *buf;
+
+	if (!mcu_uart_tx_span(&buf)) {
 		return -1;
 	}
-	MUART_STATS(muart, tx_bytes);
-	return (int)*data;
+	mcu_uart_tx_advance(1);
+	return (int)*buf;
 }
 
 /*
@@ -718,30 +1594,218 @@ static int mcu_uart_get_tx(void)
 static void mcu_uart_enq_tx(struct hp_buf *bp)
 {
 	struct mcu_uart_state *muart = muart_state;
-	struct hp_buf *prev;
+	size_t len;
 
 	if (!muart) {
 		hp_buf_free(bp);
 		return;
 	}
 	ASSERT(bp->next == NULL);
-	ASSERT(bp->len <= ASPI_LEN_MAX);
-
-	prev = muart->tx_queue;
-	if (prev == NULL) {
-		muart->tx_queue = bp;
-	} else {
-		while (prev->next != NULL) {
-			prev = prev->next;
-		}
-		prev->next = bp;
+	len = hp_buf_chain_len(bp);
+	if (len > muart->frame_max) {
+		/* built before the link went back to shorter packets */
+		log_put_mod_sev(MOD_LOG_IO, LOG_SEV_WARN,
+		    "uart_tx: %zu byte pkt too long, dropped", len);
+		hp_buf_free(bp);
+		return;
 	}
-	muart->tx_queue_len++;
+
+	mcu_uart_tx_enq(muart, bp);
 	if (muart->mts == MTS_IDLE) {
 		mcu_uart_send_next(muart);
 	}
 }
 
+/*
+ * Return the max packet data length allowed by the features.
+ */
+static u16 mcu_uart_link_len(void)
+{
+	return (mcu_feature_mask & MCU_UART_JUMBO) ?
+	    MCU_UART_JUMBO_LEN : ASPI_LEN_MAX;
+}
+
+/*
+ * Return the serial speed allowed by the features, 0 for the default.
+ */
+static u32 mcu_uart_link_baud(void)
+{
+	return (mcu_feature_mask & MCU_UART_FAST) ? MCU_UART_FAST_BAUD : 0;
+}
+
+/*
+ * Return non-zero if the features call for a change to the link.
+ * No new data packets are started until the change is made.
+ */
+static int mcu_uart_link_pending(struct mcu_uart_state *muart)
+{
+	return mcu_uart_link_len() != muart->frame_max ||
+	    mcu_uart_link_baud() != muart->baud;
+}
+
+/*
+ * Return 1 if nothing is being sent, awaited or received.
+ */
+static int mcu_uart_link_idle(struct mcu_uart_state *muart)
+{
+	return muart->mts == MTS_IDLE && !muart->tx_in_flight &&
+	    !muart->ack_count && !muart->num_pkts_recvd &&
+	    muart->rx_buf.start == muart->rx_buf.end;
+}
+
+/*
+ * Allocate the receive ring, unescape buffer and transmit frames for
+ * packets of up to len data bytes, replacing the old ones, which must be
+ * empty.
+ */
+static int mcu_uart_bufs_alloc(struct mcu_uart_state *muart, u16 len)
+{
+	struct muart_tx_frame *frame;
+	size_t rx_size = MCU_UART_RX_SIZE(len) + 1;
+	size_t tx_size = MCU_UART_TX_DATA_SIZE(len) + 1;
+	u8 *rx_area;
+	u8 *rx_pkt;
+	u8 *tx_area;
+
+	rx_area = malloc(rx_size);
+	rx_pkt = malloc(MCU_UART_RX_PKT_SIZE(len));
+	tx_area = malloc(tx_size * MCU_UART_WINDOW_LEN);
+	if (!rx_area || !rx_pkt || !tx_area) {
+		free(rx_area);
+		free(rx_pkt);
+		free(tx_area);
+		return -1;
+	}
+	free(muart->rx_buf.buf);
+	free(muart->rx_pkt);
+	free(muart->tx_frames[0].buf.buf);	/* holds all frames */
+
+	muart->rx_pkt = rx_pkt;
+	muart->rx_buf.buf = rx_area;
+	muart->rx_buf.size = rx_size;
+	muart->rx_buf.start = 0;
+	muart->rx_buf.end = 0;
+	for (frame = muart->tx_frames;
+	    frame < &muart->tx_frames[MCU_UART_WINDOW_LEN]; frame++) {
+		frame->buf.buf = tx_area;
+		frame->buf.size = tx_size;
+		frame->buf.start = 0;
+		frame->buf.end = 0;
+		tx_area += tx_size;
+	}
+	return 0;
+}
+
+/*
+ * Change the max packet data length and resize buffers for it.
+ */
+static int mcu_uart_link_len_set(struct mcu_uart_state *muart, u16 len)
+{
+	struct muart_tx_queue *txq;
+	struct hp_buf **prev;
+	struct hp_buf *bp;
+	size_t pkt_len;
+
+	if (hp_buf_resize(len)) {
+		return -1;
+	}
+	if (mcu_uart_bufs_alloc(muart, len) && len > muart->frame_max) {
+		hp_buf_resize(muart->frame_max);
+		return -1;
+	}
+	muart->frame_max = len;
+
+	/* drop queued packets that are now too long */
+	for (txq = muart->tx_queue; txq < &muart->tx_queue[MTL_COUNT];
+	    txq++) {
+		txq->tail = NULL;
+		prev = &txq->head;
+		while ((bp = *prev) != NULL) {
+			pkt_len = hp_buf_chain_len(bp);
+			if (pkt_len <= len) {
+				txq->tail = bp;
+				prev = &bp->next;
+				continue;
+			}
+			log_put_mod_sev(MOD_LOG_IO, LOG_SEV_WARN,
+			    "uart_tx: %zu byte pkt too long, dropped",
+			    pkt_len);
+			*prev = bp->next;
+			bp->next = NULL;
+			txq->len--;
+			muart->tx_queue_len--;
+			hp_buf_free(bp);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Change the link to what the features allow once it is idle.
+ * The delay lets the last ack leave the UART at the old speed.
+ */
+static void mcu_uart_link_timeout(struct timer *tm)
+{
+	struct mcu_uart_state *muart = muart_state;
+	u16 len = mcu_uart_link_len();
+#ifdef MCU_UART_SPEED_SET
+	u32 baud = mcu_uart_link_baud();
+#endif
+
+	muart->link_wait = 0;
+	if (!mcu_uart_link_pending(muart)) {
+		return;
+	}
+	if (!mcu_uart_link_idle(muart)) {
+		mcu_uart_link_check(muart);
+		return;
+	}
+	muart->rx_hold = 1;
+	if (len != muart->frame_max && mcu_uart_link_len_set(muart, len)) {
+		log_put_mod_sev(MOD_LOG_IO, LOG_SEV_ERR,
+		    "uart_link: no memory for %u byte pkts", len);
+		mcu_feature_mask &= ~MCU_UART_JUMBO;
+	}
+#ifdef MCU_UART_SPEED_SET
+	if (baud != muart->baud) {
+		if (serial_set_speed(SERIAL_MCU, baud)) {
+			log_put_mod_sev(MOD_LOG_IO, LOG_SEV_ERR,
+			    "uart_link: baud %lu not supported",
+			    (unsigned long)baud);
+			mcu_feature_mask &= ~MCU_UART_FAST;
+			mcu_feature_mask_unsup |= MCU_UART_FAST;
+		} else {
+			muart->baud = baud;
+		}
+	}
+#endif
+	muart->rx_hold = 0;
+	serial_rx_unblock(SERIAL_MCU);
+	log_put_mod_sev(MOD_LOG_IO, LOG_SEV_INFO,
+	    "uart_link: baud %lu max pkt %u",
+	    (unsigned long)muart->baud, muart->frame_max);
+
+	/* the MCU went back to the default link too, get its features */
+	if (muart->link_check &&
+	    !(mcu_feature_mask & (MCU_UART_FAST | MCU_UART_JUMBO))) {
+		muart->link_check = 0;
+		prop_req_features_get();
+	}
+	mcu_uart_send_next(muart);
+}
+
+/*
+ * Schedule a link change if the features call for one.
+ */
+static void mcu_uart_link_check(struct mcu_uart_state *muart)
+{
+	if (muart->link_wait || !mcu_uart_link_pending(muart)) {
+		return;
+	}
+	muart->link_wait = 1;
+	host_proto_timer_set(&muart->link_timer, MCU_UART_LINK_DELAY);
+}
+
 /*
  * Setup UART Interface to MCU
  * Add 1 to circular buf sizes so we know when they're full vs. empty
@@ -751,26 +1815,32 @@ const struct mcu_dev *mcu_uart_init(void)
 	struct mcu_uart_state *muart;
 
 	ASSERT(!muart_state);
+	ASSERT(MTL_COUNT == MCU_UART_TX_LANES);
 	muart = calloc(1, sizeof(*muart));
 	if (!muart) {
 		return NULL;
 	}
+	if (mcu_uart_bufs_alloc(muart, ASPI_LEN_MAX)) {
+		free(muart);
+		return NULL;
+	}
+	muart->frame_max = ASPI_LEN_MAX;
 	ayla_timer_init(&muart->tx_resend_timer, mcu_uart_tx_resend);
+	ayla_timer_init(&muart->link_timer, mcu_uart_link_timeout);
+	muart->rto = MCU_UART_RTO_INIT;
 
 	mcu_feature_mask |= MCU_DATAPOINT_CONFIRM;
 	mcu_feature_mask_min |= MCU_DATAPOINT_CONFIRM;
+#ifndef MCU_UART_SPEED_SET
+	mcu_feature_mask_unsup |= MCU_UART_FAST;
+#endif
 
-	muart->rx_buf.buf = muart->rx_area;
-	muart->rx_buf.size = sizeof(muart->rx_area);
 	net_callback_init(&muart->rx_callback, mcu_uart_recv_cb, muart);
 	net_callback_init(&muart->tx_callback, mcu_uart_trans_cb, muart);
 
 	muart->tx_ack_buf.buf = muart->tx_ack_area;
 	muart->tx_ack_buf.size = sizeof(muart->tx_ack_area);
 
-	muart->tx_data_buf.buf = muart->tx_data_area;
-	muart->tx_data_buf.size = sizeof(muart->tx_data_area);
-
 	muart->first_tx = 1;
 	muart_state = muart;
 
@@ -779,23 +1849,156 @@ const struct mcu_dev *mcu_uart_init(void)
 	return &mcu_uart_ops;
 }
 
+#ifdef MCU_UART_STATS
+/*
+ * Show the non-empty buckets of a histogram as "upper_bound:count".
+ */
+static void mcu_uart_hist_show(const char *name, const u32 *hist)
+{
+	char buf[MCU_UART_HIST_BUCKETS * 16];
+	size_t len = 0;
+	unsigned int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < MCU_UART_HIST_BUCKETS && len < sizeof(buf); i++) {
+		if (!hist[i]) {
+			continue;
+		}
+		len += snprintf(buf + len, sizeof(buf) - len, " %s%lu:%lu",
+		    i == MCU_UART_HIST_BUCKETS - 1 ? ">" : "<",
+		    i == MCU_UART_HIST_BUCKETS - 1 ? (1UL << (i - 1)) - 1 :
+		    1UL << i, (unsigned long)hist[i]);
+	}
+	printcli("  %s:%s", name, buf);
+}
+
+/*
+ * Show the binary dump in hex for tools reading the CLI.
+ */
+static void mcu_uart_dump_show(void)
+{
+	u8 dump[sizeof(struct mcu_uart_stats) / 4 * 5 + 4];	/* varints */
+	char hex[80];
+	ssize_t len;
+	ssize_t i;
+	size_t off = 0;
+
+	len = mcu_uart_stats_dump(dump, sizeof(dump));
+	for (i = 0; i < len; i++) {
+		off += snprintf(hex + off, sizeof(hex) - off, "%2.2x", dump[i]);
+		if (off >= sizeof(hex) - 2 || i == len - 1) {
+			printcli("  dump: %s", hex);
+			off = 0;
+		}
+	}
+}
+#endif
+
 static void mcu_uart_show(void)
 {
 #ifdef MCU_UART_STATS
-	struct muart_stats *stats = &muart_state->stats;
+	static const char * const mcu_uart_tx_lane_names[MTL_COUNT] = {
+		[MTL_CTRL] = "ctrl",
+		[MTL_PROP] = "prop",
+		[MTL_BULK] = "bulk",
+	};
+	struct mcu_uart_stats *stats = &muart_state->stats;
+	struct muart_tx_queue *txq;
+	unsigned int lane;
 
 	printcli("UART statistics:");
-	printcli("  tx: bytes %u pkts: %u data %u acks %u resend %u",
-	    stats->tx_bytes, stats->tx_pkts, stats->tx_data,
-	    stats->tx_acks, stats->tx_resend);
-
-	printcli("  rx: bytes %u pkts: %u data %u acks %u "
-	    "errs: frame %u len %u crc %u ptype %u seq %u cmd %u",
-	    stats->rx_bytes, stats->rx_pkts, stats->rx_data, stats->rx_acks,
-	    stats->rx_frame_err, stats->rx_len_err,
-	    stats->rx_crc_err, stats->rx_ptype_err,
-	    stats->rx_seq_err, stats->rx_cmd_err);
+	printcli("  tx: bytes %lu pkts: %lu data %lu acks %lu merged %lu "
+	    "resend %lu timeout %lu",
+	    (unsigned long)stats->tx_bytes, (unsigned long)stats->tx_pkts,
+	    (unsigned long)stats->tx_data, (unsigned long)stats->tx_acks,
+	    (unsigned long)stats->tx_ack_merged,
+	    (unsigned long)stats->tx_resend,
+	    (unsigned long)stats->tx_timeout);
+	printcli("  rtt: samples %lu last %lu max %lu",
+	    (unsigned long)stats->rtt_samples,
+	    (unsigned long)stats->rtt_last, (unsigned long)stats->rtt_max);
+	for (lane = 0; lane < MTL_COUNT; lane++) {
+		txq = &muart_state->tx_queue[lane];
+		printcli("  txq %s: len %u max %lu pkts %lu starved %lu "
+		    "wait avg %lu max %lu ms",
+		    mcu_uart_tx_lane_names[lane], txq->len,
+		    (unsigned long)stats->txq_depth_max[lane],
+		    (unsigned long)stats->txq_pkts[lane],
+		    (unsigned long)stats->txq_starved[lane],
+		    stats->txq_pkts[lane] ? (unsigned long)
+		    (stats->txq_wait_sum[lane] / stats->txq_pkts[lane]) : 0,
+		    (unsigned long)stats->txq_wait_max[lane]);
+	}
+
+	printcli("  rx: bytes %lu pkts: %lu data %lu acks %lu",
+	    (unsigned long)stats->rx_bytes, (unsigned long)stats->rx_pkts,
+	    (unsigned long)stats->rx_data, (unsigned long)stats->rx_acks);
+	printcli("  rx errs: frame %lu len %lu crc %lu ptype %lu seq %lu "
+	    "cmd %lu ack_full %lu",
+	    (unsigned long)stats->rx_frame_err,
+	    (unsigned long)stats->rx_len_err,
+	    (unsigned long)stats->rx_crc_err,
+	    (unsigned long)stats->rx_ptype_err,
+	    (unsigned long)stats->rx_seq_err,
+	    (unsigned long)stats->rx_cmd_err,
+	    (unsigned long)stats->rx_ack_full);
+	mcu_uart_hist_show("rx len", stats->hist[MUH_RX_LEN]);
+	mcu_uart_hist_show("tx len", stats->hist[MUH_TX_LEN]);
+	mcu_uart_hist_show("rx delay ms", stats->hist[MUH_RX_DELAY]);
+	mcu_uart_hist_show("ack rtt ms", stats->hist[MUH_ACK_RTT]);
+	mcu_uart_dump_show();
 #endif
+	printcli("  tx window %u in flight %u",
+	    mcu_uart_tx_window(), muart_state->tx_in_flight);
+	printcli("  link: baud %lu max pkt %u",
+	    (unsigned long)muart_state->baud, muart_state->frame_max);
+	printcli("  rto %u ms backoff %u srtt %u rttvar %u",
+	    (unsigned int)mcu_uart_rto(muart_state), muart_state->rto_backoff,
+	    muart_state->srtt >> 3, muart_state->rttvar >> 2);
+	hp_buf_show();
+}
+
+int mcu_uart_stats_get(struct mcu_uart_stats *stats)
+{
+#ifdef MCU_UART_STATS
+	if (muart_state) {
+		*stats = muart_state->stats;
+		return 0;
+	}
+#endif
+	memset(stats, 0, sizeof(*stats));
+	return -1;
+}
+
+void mcu_uart_stats_clear(void)
+{
+#ifdef MCU_UART_STATS
+	if (muart_state) {
+		memset(&muart_state->stats, 0, sizeof(muart_state->stats));
+	}
+#endif
+}
+
+ssize_t mcu_uart_stats_dump(void *buf, size_t len)
+{
+	struct mcu_uart_stats stats;
+	const u32 *val = (const u32 *)&stats;
+	size_t count = sizeof(stats) / sizeof(*val);
+	ssize_t off = 4;
+	u8 *bp = buf;
+	size_t i;
+
+	if (mcu_uart_stats_get(&stats) || len < off) {
+		return -1;
+	}
+	bp[0] = 1;		/* version */
+	bp[1] = offsetof(struct mcu_uart_stats, hist) / sizeof(*val);
+	bp[2] = MUH_COUNT;
+	bp[3] = MCU_UART_HIST_BUCKETS;
+	for (i = 0; i < count && off >= 0; i++) {
+		off = host_proto_put_varint(bp, len, off, val[i]);
+	}
+	return off;
 }
 
 static void mcu_uart_noop(void)
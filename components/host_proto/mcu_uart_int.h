@@ -6,4 +6,35 @@
 
 const struct mcu_dev *mcu_uart_init(void);
 
+/*
+ * Bulk transmit interface for serial drivers that can move a run of
+ * bytes into the UART FIFO or a DMA descriptor at once.
+ *
+ * mcu_uart_tx_span() points *bufp at the next run of framed bytes and
+ * returns its length, or returns 0 if there is nothing more to send.
+ * The run stays valid until it is consumed with mcu_uart_tx_advance(),
+ * which may take less than all of it.  Both are called from the transmit
+ * interrupt, in place of the byte-at-a-time callback given to serial_init().
+ */
+size_t mcu_uart_tx_span(const u8 **bufp);
+void mcu_uart_tx_advance(size_t len);
+
+/*
+ * Block receive for serial drivers that read the UART FIFO in chunks,
+ * called from the receive interrupt in place of the byte callback.
+ * Returns the number of bytes taken.  The rest must be kept and offered
+ * again after serial_rx_unblock().
+ */
+size_t mcu_uart_rx_block(const u8 *buf, size_t len);
+
+/*
+ * Change the speed of a running serial port, for MCU_UART_FAST.
+ * A speed of 0 goes back to the speed the port started with.
+ * Returns 0 on success.  Provided by serial drivers that can do this,
+ * which define MCU_UART_SPEED_SET in the build.  The ADA SDK serial
+ * driver used on the device does not provide it; only the host build's
+ * does.
+ */
+int serial_set_speed(int port, u32 speed);
+
 #endif /* __AYLA_MCU_UART_INT_H__ */
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_MCU_UART_PPP_H__
+#define __AYLA_MCU_UART_PPP_H__
+
+/***** PPP Protocol *****/
+#define	UART_PPP_FLAG_BYTE		0x7E
+#define	UART_PPP_ESCAPE_BYTE		0x7D
+#define	UART_PPP_XOR_BYTE		0x20
+/************************/
+
+#ifdef AYLA_ESP32_SUPPORT
+#include <esp_attr.h>
+#else
+#define IRAM_ATTR
+#define DRAM_ATTR
+#endif
+
+extern const u16 mcu_uart_ppp_crc_table[256];
+
+/*
+ * Update the frame CRC-16/CCITT with one byte, as crc16() would.
+ * The table is in internal RAM so this may be used in the receive
+ * interrupt.
+ */
+static inline u16 mcu_uart_ppp_crc_byte(u16 crc, u8 byte)
+{
+	return (crc << 8) ^ mcu_uart_ppp_crc_table[(u8)(crc >> 8) ^ byte];
+}
+
+/*
+ * Update the frame CRC-16/CCITT with a buffer, as crc16() would.
+ */
+u16 mcu_uart_ppp_crc16(const void *buf, size_t len, u16 crc);
+
+/*
+ * State for unstuffing a received packet.
+ */
+struct mcu_uart_ppp_rx {
+	u8	*buf;		/* unescaped packet */
+	size_t	size;		/* size of buf */
+	size_t	len;		/* length unescaped so far */
+	u8	esc;		/* escape byte ended the previous span */
+	u8	done;		/* saw the closing flag byte */
+};
+
+/*
+ * Return the length of the leading run of bytes needing no escape,
+ * i.e. up to the first flag or escape byte.
+ */
+size_t mcu_uart_ppp_span(const u8 *buf, size_t len);
+
+/*
+ * Escape data into out.
+ * If crcp is non-NULL, the CRC it points to is updated with the data.
+ * Returns the length written or -1 if out is too small.
+ */
+ssize_t mcu_uart_ppp_stuff(u8 *out, size_t out_len, const u8 *in, size_t len,
+		u16 *crcp);
+
+/*
+ * Unescape received bytes into rx->buf, stopping after the closing flag.
+ * May be called repeatedly as the bytes arrive in separate spans.
+ * Returns the number of bytes consumed or -1 if the packet is too long.
+ */
+ssize_t mcu_uart_ppp_unstuff(struct mcu_uart_ppp_rx *rx,
+		const u8 *in, size_t len);
+
+#endif /* __AYLA_MCU_UART_PPP_H__ */
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+
+/*
+ * Property value cache.
+ *
+ * A cloud GET of a host property normally goes to the MCU and waits for
+ * its reply.  For a property with a cache policy, the last value the MCU
+ * reported answers the GET instead, while it is fresh.  A property the
+ * MCU always sends when it changes stays fresh until replaced.  Others
+ * are fresh for their TTL.  A to-device update or a new MCU session
+ * discards the value.
+ */
+#include <string.h>
+
+#include <ayla/utypes.h>
+#include <ayla/assert.h>
+#include <ayla/log.h>
+#include <ayla/tlv.h>
+#include <ayla/clock.h>
+#include <ada/err.h>
+#include <ada/prop.h>
+#include <host_proto/host_proto.h>
+#include "host_proto_int.h"
+#include "prop_cache.h"
+
+#ifndef PROP_CACHE_ENTRIES
+#define PROP_CACHE_ENTRIES	16	/* properties with a policy */
+#endif
+#ifndef PROP_CACHE_VAL_LEN
+#define PROP_CACHE_VAL_LEN	32	/* longest value kept */
+#endif
+
+struct prop_cache_entry {
+	char	name[PROP_NAME_LEN];	/* empty if entry unused */
+	u32	ttl_ms;			/* time value stays fresh */
+	u32	time_ms;		/* clock_ms() when value received */
+	u8	valid;
+	u8	type;			/* enum ayla_tlv_type */
+	u8	len;
+	u8	val[PROP_CACHE_VAL_LEN + 1];	/* with NUL for strings */
+};
+
+struct prop_cache_state {
+	struct prop_cache_entry entries[PROP_CACHE_ENTRIES];
+};
+static struct prop_cache_state prop_cache_state;
+
+static struct prop_cache_entry *prop_cache_lookup(const char *name)
+{
+	struct prop_cache_entry *entry;
+
+	if (!name || !name[0]) {
+		return NULL;
+	}
+	for (entry = prop_cache_state.entries;
+	    entry < &prop_cache_state.entries[PROP_CACHE_ENTRIES]; entry++) {
+		if (!strcmp(entry->name, name)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return non-zero if a value of the type and length may be cached.
+ * These are the simple types, as for packing.
+ */
+static int prop_cache_type_ok(enum ayla_tlv_type type, size_t len)
+{
+	if (len > PROP_CACHE_VAL_LEN) {
+		return 0;
+	}
+	switch (type) {
+	case ATLV_INT:
+	case ATLV_UINT:
+	case ATLV_CENTS:
+	case ATLV_BOOL:
+	case ATLV_UTF8:
+	case ATLV_BIN:
+	case ATLV_SCHED:
+		return 1;
+	default:
+		break;
+	}
+	return 0;
+}
+
+void prop_cache_update(const struct prop *prop)
+{
+	struct prop_cache_entry *entry;
+
+	entry = prop_cache_lookup(prop->name);
+	if (!entry) {
+		return;
+	}
+	if (!prop_cache_type_ok(prop->type, prop->len)) {
+		entry->valid = 0;
+		return;
+	}
+	memcpy(entry->val, prop->val, prop->len);
+	entry->val[prop->len] = '\0';
+	entry->len = prop->len;
+	entry->type = prop->type;
+	entry->time_ms = clock_ms();
+	entry->valid = 1;
+}
+
+void prop_cache_invalidate(const char *name)
+{
+	struct prop_cache_entry *entry;
+
+	entry = prop_cache_lookup(name);
+	if (entry) {
+		entry->valid = 0;
+	}
+}
+
+void prop_cache_flush(void)
+{
+	struct prop_cache_entry *entry;
+
+	for (entry = prop_cache_state.entries;
+	    entry < &prop_cache_state.entries[PROP_CACHE_ENTRIES]; entry++) {
+		entry->valid = 0;
+	}
+}
+
+int prop_cache_get(const char *name, struct prop *prop)
+{
+	struct prop_cache_entry *entry;
+
+	entry = prop_cache_lookup(name);
+	if (!entry) {
+		return -1;
+	}
+	if (!entry->valid || (entry->ttl_ms != HOST_PROTO_CACHE_PUSHED &&
+	    clock_ms() - entry->time_ms >= entry->ttl_ms)) {
+		return -1;
+	}
+	prop->name = entry->name;
+	prop->type = entry->type;
+	prop->val = entry->val;
+	prop->len = entry->len;
+	return 0;
+}
+
+/*
+ * Set or clear the policy for a property, on the host_proto thread.
+ */
+static void *prop_cache_set_int(void *arg)
+{
+	struct prop_cache_state *state = &prop_cache_state;
+	struct prop_cache_entry *policy = arg;
+	struct prop_cache_entry *entry;
+
+	entry = prop_cache_lookup(policy->name);
+	if (!policy->ttl_ms) {
+		if (entry) {
+			memset(entry, 0, sizeof(*entry));
+		}
+		return NULL;
+	}
+	if (!entry) {
+		for (entry = state->entries; entry->name[0]; entry++) {
+			if (entry == &state->entries[PROP_CACHE_ENTRIES - 1]) {
+				log_put(LOG_WARN "prop_cache: no room for %s",
+				    policy->name);
+				return arg;
+			}
+		}
+		memset(entry, 0, sizeof(*entry));
+		memcpy(entry->name, policy->name, sizeof(entry->name));
+	}
+	entry->ttl_ms = policy->ttl_ms;
+	return NULL;
+}
+
+int host_proto_prop_cache_set(const char *name, u32 ttl_ms)
+{
+	struct prop_cache_entry policy;
+	size_t len;
+
+	len = strlen(name);
+	if (!len || len >= sizeof(policy.name)) {
+		return -1;
+	}
+	memset(&policy, 0, sizeof(policy));
+	memcpy(policy.name, name, len + 1);
+	policy.ttl_ms = ttl_ms;
+	if (host_proto_call_blocking(prop_cache_set_int, &policy)) {
+		return -1;
+	}
+	return 0;
+}
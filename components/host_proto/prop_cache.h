@@ -0,0 +1,35 @@
+/*
+ * Copyright 2026 Ayla Networks, Inc.  All rights reserved.
+ */
+#ifndef __AYLA_PROP_CACHE_H__
+#define __AYLA_PROP_CACHE_H__
+
+/*
+ * Cache of property values reported by the MCU, for cloud GETs.
+ * Only properties given a policy with host_proto_prop_cache_set() are kept.
+ * Called only from the host_proto thread.
+ */
+
+/*
+ * Note a complete property value from the MCU, sent or in a GET reply.
+ */
+void prop_cache_update(const struct prop *prop);
+
+/*
+ * Forget the value of a property, as when the cloud changes it.
+ */
+void prop_cache_invalidate(const char *name);
+
+/*
+ * Forget all values, as when the MCU starts a new session.
+ */
+void prop_cache_flush(void);
+
+/*
+ * Look up a fresh value for a property.
+ * On a hit, fills in the name, type, value and length of prop, pointing
+ * into the cache, and returns 0.  Returns -1 on a miss.
+ */
+int prop_cache_get(const char *name, struct prop *prop);
+
+#endif /* __AYLA_PROP_CACHE_H__ */
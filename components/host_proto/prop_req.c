@@ -27,8 +27,25 @@
 #include "hp_buf_cb.h"
 #include "data_tlv.h"
 #include "prop_req.h"
+#include "prop_cache.h"
 
 #define MAX_ADS_BUSY_RESETS 2	/* max # of times we'll reset b/c ads busy */
+#define PROP_REQ_POOL	16	/* max requests queued or waiting for MCU */
+#define PROP_REQ_WAITERS 16	/* max GETs folded into others */
+#ifndef PROP_REQ_INFLIGHT
+#define PROP_REQ_INFLIGHT 4	/* max GETs waiting for an MCU that can */
+#endif
+
+/*
+ * A GET folded into another for the same property.
+ * It keeps only what is needed to answer it, and its prop_req entry goes
+ * back to the pool.
+ */
+struct prop_req_waiter {
+	struct prop_req_waiter *next;
+	void	(*callback)(struct prop *, void *arg, u32 cont, int err);
+	void	*arg;
+};
 
 /*
  * property request.
@@ -37,6 +54,7 @@
 struct prop_req {
 	char	name[PROP_NAME_LEN];
 	struct prop_req *next;
+	struct prop_req_waiter *waiters; /* GETs folded into this one */
 	u32	continuation;
 
 	/*
@@ -52,10 +70,15 @@ struct prop_req {
 	void	*arg;			/* arg for callback */
 	u8	busy_resets;		/* times we reset timeout due to busy */
 	u8	use_req_id;
-	u16	req_id;
+	u8	waiting;		/* sent, on wait_list for the reply */
+	u8	halted;			/* timeout paused while ADS is busy */
+	u16	req_id;			/* ID of send, or of GET sent to MCU */
 	u32	offset;
 	struct timer host_timer;	/* limit the time for MCU response */
+	u32	deadline_ms;		/* clock_ms() at reply timeout */
+	u32	time_left;		/* ms left of the timeout when halted */
 	struct prop prop;		/* prop for send or get */
+	struct data_tlv_meta *meta;	/* datapoint metadata for send */
 	char ack_id[PROP_ACK_ID_LEN + 1];
 };
 
@@ -77,10 +100,17 @@ static u32 dp_recv_offset;
 
 struct prop_req_state {
 	u16	req_id;			/* current request ID */
-	u16	get_req_id;		/* request ID of last GET request */
 	u8	cb_trylater;
 	u8	get_rst_timer;
-	struct prop_req *req_list;	/* list of waiting get requests */
+	u8	inflight;		/* max on wait_list, 0 for default */
+	u8	wait_count;		/* GETs on wait_list */
+	struct prop_req *req_list;	/* list of requests not yet sent */
+	struct prop_req *req_tail;	/* last request on req_list */
+	struct prop_req *wait_list;	/* GETs sent and awaiting replies */
+	struct prop_req *free_list;	/* requests returned to the pool */
+	unsigned int pool_used;		/* pool entries ever handed out */
+	struct prop_req_waiter *waiter_free; /* waiters returned to pool */
+	unsigned int waiters_used;	/* waiter entries ever handed out */
 
 	/*
 	 * Property being requested by/from the host.
@@ -95,10 +125,18 @@ struct prop_req_state {
 	} send_name;
 };
 static struct prop_req_state prop_req_state;
+static struct prop_req prop_req_pool[PROP_REQ_POOL];
+static struct prop_req_waiter prop_req_waiter_pool[PROP_REQ_WAITERS];
 
 static void prop_req_timeout_start(struct prop_req *, u32);
 static void prop_req_timeout_end(struct prop_req *req);
+static void prop_req_cache_answer(struct timer *tm);
+static void prop_req_get_timeout(struct timer *tm);
 static void prop_req_cb(struct hp_buf *bp);
+static size_t prop_req_buf_size(void);
+static void prop_req_handle_get(struct hp_buf *bp, struct prop_req *req);
+static void prop_req_continuation(struct hp_buf *bp, struct prop_req *req);
+static void prop_req_handle_send(struct hp_buf *bp, struct prop_req *preq);
 
 /*
  * Client finished sending this property.
@@ -179,10 +217,10 @@ conn_err:
 
 	if (reqs->cb_trylater) {
 		reqs->cb_trylater = 0;
-		hp_buf_callback_pend(prop_req_cb);
+		hp_buf_callback_pend_size(prop_req_cb, prop_req_buf_size());
 	} else if (reqs->get_rst_timer) {
 		reqs->get_rst_timer = 0;
-		if (reqs->req_list) {
+		if (reqs->wait_list) {
 			prop_req_timeout_restart();
 		}
 	}
@@ -500,77 +538,389 @@ static void prop_req_setup_cb(void)
 	struct prop_req_state *reqs = &prop_req_state;
 
 	if (!prop_req_is_busy(NULL, NULL)) {
-		hp_buf_callback_pend(prop_req_cb);
+		hp_buf_callback_pend_size(prop_req_cb, prop_req_buf_size());
 	} else {
 		reqs->cb_trylater = 1;
 	}
 }
 
+/*
+ * Take a request from the pool.  Entries never used are handed out before
+ * returned ones, so the pool needs no initialization.
+ */
+static struct prop_req *prop_req_alloc(void)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+	struct prop_req *preq;
+
+	preq = reqs->free_list;
+	if (preq) {
+		reqs->free_list = preq->next;
+	} else if (reqs->pool_used < ARRAY_LEN(prop_req_pool)) {
+		preq = &prop_req_pool[reqs->pool_used++];
+	} else {
+		log_put(LOG_WARN "prop_req: pool empty");
+		return NULL;
+	}
+	memset(preq, 0, sizeof(*preq));
+	return preq;
+}
+
+/*
+ * Return a request to the pool.
+ */
+static void prop_req_free(struct prop_req *preq)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+
+	free(preq->meta);
+	preq->meta = NULL;
+	preq->next = reqs->free_list;
+	reqs->free_list = preq;
+}
+
+/*
+ * Fold a GET into an earlier one for the same property.
+ * The GET's entry is freed.  Returns -1 if no waiter entry is free.
+ */
+static int prop_req_fold(struct prop_req *req, struct prop_req *preq)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+	struct prop_req_waiter *waiter;
+
+	waiter = reqs->waiter_free;
+	if (waiter) {
+		reqs->waiter_free = waiter->next;
+	} else if (reqs->waiters_used < ARRAY_LEN(prop_req_waiter_pool)) {
+		waiter = &prop_req_waiter_pool[reqs->waiters_used++];
+	} else {
+		return -1;
+	}
+	waiter->callback = preq->callback;
+	waiter->arg = preq->arg;
+	waiter->next = req->waiters;
+	req->waiters = waiter;
+	prop_req_free(preq);
+	return 0;
+}
+
+/*
+ * Find a GET for the same property as a new one on a list.
+ */
+static struct prop_req *prop_req_get_match_list(struct prop_req *req,
+		struct prop_req *preq)
+{
+	for (; req; req = req->next) {
+		if (req->handler == prop_req_handle_get &&
+		    !strcmp(req->name, preq->name)) {
+			return req;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Return non-zero if a send of the property to the MCU is queued.
+ */
+static int prop_req_send_queued(const char *name)
+{
+	struct prop_req *req;
+
+	for (req = prop_req_state.req_list; req; req = req->next) {
+		if (req->handler == prop_req_handle_send &&
+		    !strcmp(req->name, name)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find a GET queued or waiting for the same property as a new one.
+ */
+static struct prop_req *prop_req_get_match(struct prop_req *preq)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+	struct prop_req *req;
+
+	if (preq->handler != prop_req_handle_get || !preq->name[0]) {
+		return NULL;
+	}
+	req = prop_req_get_match_list(reqs->wait_list, preq);
+	if (!req) {
+		req = prop_req_get_match_list(reqs->req_list, preq);
+	}
+	return req;
+}
+
+/*
+ * Return non-zero if the request is the feature request, a GET with no name.
+ */
+static int prop_req_is_features(struct prop_req *preq)
+{
+	return preq->handler == prop_req_handle_get && !preq->name[0];
+}
+
+/*
+ * Return the reply timeout for a request.
+ */
+static u32 prop_req_time_limit(struct prop_req *preq)
+{
+	if (prop_req_is_features(preq)) {
+		return HOST_PROP_FEATURES_TIMEOUT;
+	}
+	return HOST_PROP_REQ_TIMEOUT;
+}
+
+/*
+ * Return the number of GETs that may wait for the MCU at once.
+ * An MCU that does not give MCU_GET_PIPELINE may expect to answer
+ * one GET at a time, as before.
+ */
+static unsigned int prop_req_inflight(void)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+	unsigned int count = PROP_REQ_INFLIGHT;
+
+	if (reqs->inflight) {
+		count = reqs->inflight;
+	} else if (!(mcu_feature_mask_ext & MCU_GET_PIPELINE)) {
+		return 1;
+	}
+	return count < DATA_TLV_RESP_SLOTS ? count : DATA_TLV_RESP_SLOTS;
+}
+
+/*
+ * Return non-zero if the request at the head of req_list may be sent now.
+ * Sends go as soon as they reach the head.  GETs go while fewer than the
+ * in-flight limit are waiting for replies.  The feature request starts
+ * a new session with the MCU, so it waits for earlier GETs to finish and
+ * nothing goes while it is outstanding.
+ */
+static int prop_req_may_start(struct prop_req *preq)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+	struct prop_req *wait = reqs->wait_list;
+
+	if (!wait) {
+		return 1;
+	}
+	if (prop_req_is_features(wait) || prop_req_is_features(preq)) {
+		return 0;
+	}
+	if (preq->handler == prop_req_handle_send) {
+		return 1;
+	}
+	return reqs->wait_count < prop_req_inflight();
+}
+
+/*
+ * Start the request at the head of the req_list if it may go now.
+ */
+static void prop_req_start_next(void)
+{
+	struct prop_req *preq = prop_req_state.req_list;
+
+	if (preq && prop_req_may_start(preq)) {
+		prop_req_setup_cb();
+	}
+}
+
+void prop_req_inflight_set(unsigned int count)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+
+	reqs->inflight = count < MAX_U8 ? count : MAX_U8;
+}
+
 static void *prop_req_enq_int(void *arg)
 {
 	struct prop_req *preq = (struct prop_req *)arg;
 	struct prop_req_state *reqs = &prop_req_state;
-	struct prop_req *prev = reqs->req_list;
+	struct prop_req *req;
+	struct prop prop;
+
+	/*
+	 * The cached value is stale as soon as a change is queued.  A GET
+	 * reply sent before the change may cache it again, so don't answer
+	 * GETs from the cache while the send waits its turn.
+	 */
+	if (preq->handler == prop_req_handle_send) {
+		prop_cache_invalidate(preq->name);
+	}
 
-	if (prev == NULL) {
+	/*
+	 * A GET for a fresh cached value is answered from the host loop
+	 * rather than within the caller.
+	 */
+	if (preq->handler == prop_req_handle_get &&
+	    !prop_req_send_queued(preq->name) &&
+	    !prop_cache_get(preq->name, &prop)) {
+		ayla_timer_init(&preq->host_timer, prop_req_cache_answer);
+		host_proto_timer_set(&preq->host_timer, 0);
+		return NULL;
+	}
+
+	/*
+	 * A GET for a property already being fetched waits for that reply,
+	 * even if the request has already gone to the MCU.  If too many
+	 * are waiting, it is queued as a GET of its own.
+	 */
+	req = prop_req_get_match(preq);
+	if (req && !prop_req_fold(req, preq)) {
+		log_put(LOG_DEBUG "prop_req_get: prop %s joins pending get",
+		    req->name);
+		return NULL;
+	}
+	if (reqs->req_list == NULL) {
 		reqs->req_list = preq;
-		prop_req_setup_cb();
+		reqs->req_tail = preq;
+		prop_req_start_next();
 	} else {
-		while (prev->next != NULL) {
-			prev = prev->next;
-		}
-		prev->next = preq;
+		reqs->req_tail->next = preq;
+		reqs->req_tail = preq;
 	}
 	return NULL;
 }
 
 /*
- * Add a property request to the end of the req_list.
- * Starts the request if the list was previously empty.
+ * Take a pool entry for a request set up by another thread, and queue it.
+ * Returns NULL if the pool is empty.
  */
-static void prop_req_enq(struct prop_req *preq)
+static void *prop_req_enq_new_int(void *arg)
 {
-	host_proto_call_blocking(prop_req_enq_int, preq);
+	struct prop_req *req = arg;
+	struct prop_req *preq;
+
+	preq = prop_req_alloc();
+	if (!preq) {
+		return NULL;
+	}
+	*preq = *req;
+	if (req->prop.name == req->name) {
+		preq->prop.name = preq->name;
+	}
+	ayla_timer_init(&preq->host_timer, prop_req_get_timeout);
+	prop_req_enq_int(preq);
+	return req;
+}
+
+/*
+ * Add a property request, set up by prop_req_init(), to the end of the
+ * req_list.  The pool entry is taken in the same call to the host_proto
+ * thread that queues it.
+ * Starts the request if the list was previously empty and it need not
+ * wait for earlier GETs.
+ */
+static enum ada_err prop_req_enq(struct prop_req *req)
+{
+	if (!host_proto_call_blocking(prop_req_enq_new_int, req)) {
+		return AE_ALLOC;
+	}
+	return AE_OK;
 }
 
 /*
- * Remove a property request from the head of the list.
+ * Remove a property request from the req_list or the wait_list.
  * The entry must be on the list.
- * Entry is usually first on the list (will assert otherwise).
  */
 static void prop_req_deq(struct prop_req *preq)
 {
 	struct prop_req_state *reqs = &prop_req_state;
 	struct prop_req **prev = &reqs->req_list;
+	struct prop_req *last = NULL;
 
+	if (preq->waiting) {
+		prev = &reqs->wait_list;
+	}
 	while (*prev && *prev != preq) {
+		last = *prev;
 		prev = &(*prev)->next;
 	}
 	ASSERT(*prev);
 	*prev = preq->next;
+	if (preq->waiting) {
+		preq->waiting = 0;
+		reqs->wait_count--;
+	} else if (reqs->req_tail == preq) {
+		reqs->req_tail = last;
+	}
 }
 
-static void prop_req_done(struct prop_req *preq, struct prop *prop, int error)
+/*
+ * Move a GET just sent to the MCU from the head of the req_list to the
+ * wait_list and time its reply.  The next request may then go.
+ */
+static void prop_req_wait(struct prop_req *preq, u32 time_limit)
 {
 	struct prop_req_state *reqs = &prop_req_state;
 
-	prop_req_timeout_end(preq);
 	prop_req_deq(preq);
+	preq->next = reqs->wait_list;
+	reqs->wait_list = preq;
+	preq->waiting = 1;
+	reqs->wait_count++;
+	prop_req_timeout_start(preq, time_limit);
+	prop_req_start_next();
+}
+
+/*
+ * Find the GET waiting for the reply with a request ID.
+ */
+static struct prop_req *prop_req_wait_find(u16 req_id)
+{
+	struct prop_req *preq;
+
+	for (preq = prop_req_state.wait_list; preq; preq = preq->next) {
+		if (preq->req_id == req_id) {
+			break;
+		}
+	}
+	return preq;
+}
+
+static void prop_req_callback(struct prop_req *preq, struct prop *prop,
+		int error)
+{
 	if (preq->callback) {
 		if (!preq->prop.name) {
 			prop = NULL;	/* prop not involved in request */
 		}
 		preq->callback(prop, preq->arg, preq->continuation, error);
 	}
+}
+
+static void prop_req_done(struct prop_req *preq, struct prop *prop, int error)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+	struct prop_req_waiter *waiter;
+
+	prop_req_timeout_end(preq);
+	if (preq->waiting) {
+		data_tlv_resp_end(preq->req_id);
+	}
+	prop_req_deq(preq);
+	prop_req_callback(preq, prop, error);
 
 	/*
-	 * If the prop_req_list isn't empty AND a new entry wasn't
-	 * added by the callback then send the next prop_get cb.
+	 * The reply answers the GETs folded into this one as well.
 	 */
-	if (reqs->req_list && reqs->req_list == preq->next) {
-		prop_req_setup_cb();
+	while (preq->waiters) {
+		waiter = preq->waiters;
+		preq->waiters = waiter->next;
+		if (waiter->callback) {
+			waiter->callback(prop, waiter->arg,
+			    preq->continuation, error);
+		}
+		waiter->next = reqs->waiter_free;
+		reqs->waiter_free = waiter;
 	}
-	free(preq);
+
+	/*
+	 * The request may have made room for the next one.
+	 */
+	prop_req_start_next();
+	prop_req_free(preq);
 }
 
 /*
@@ -595,16 +945,66 @@ static void prop_req_get_timeout(struct timer *tm)
 	if (prop_req_is_busy(NULL, NULL) &&
 	    preq->busy_resets < MAX_ADS_BUSY_RESETS) {
 		preq->busy_resets++;
+		preq->halted = 1;
+		preq->time_left = prop_req_time_limit(preq);
 		reqs->get_rst_timer = 1;
 		return;
 	}
-	if (reqs->req_list != preq) {
+	if (!preq->waiting) {
 		log_put(LOG_ERR "%s: timed out request not active", __func__);
 		return;
 	}
 	prop_req_done(preq, NULL, 0);
 }
 
+/*
+ * Answer a GET from the cache, if the value is still fresh by now.
+ */
+static void prop_req_cache_answer(struct timer *tm)
+{
+	struct prop_req *preq = CONTAINER_OF(struct prop_req, host_timer, tm);
+	struct prop prop;
+
+	memset(&prop, 0, sizeof(prop));
+	ayla_timer_init(&preq->host_timer, prop_req_get_timeout);
+	if (prop_req_send_queued(preq->name) ||
+	    prop_cache_get(preq->name, &prop)) {
+		prop_req_enq_int(preq);
+		return;
+	}
+	log_put(LOG_DEBUG "prop_req_get: prop %s from cache", preq->name);
+	prop_req_callback(preq, &prop, 0);
+	prop_req_free(preq);
+}
+
+/*
+ * Return the buffer size needed by the request at the head of the list,
+ * or 0 for a full-size buffer.
+ */
+static size_t prop_req_buf_size(void)
+{
+	struct prop_req *preq = prop_req_state.req_list;
+	struct prop *prop;
+
+	if (!preq) {
+		return HP_BUF_SMALL_LEN;
+	}
+	if (preq->handler == prop_req_handle_get) {
+		return sizeof(struct ayla_cmd) + sizeof(struct ayla_tlv) +
+		    strlen(preq->name);
+	}
+	if (preq->handler == prop_req_continuation) {
+		return sizeof(struct ayla_cmd) + sizeof(struct ayla_tlv) +
+		    sizeof(u32);
+	}
+	if (preq->handler == prop_req_handle_send) {
+		prop = &preq->prop;
+		return data_tlv_send_size(prop->name, prop->len, prop->type,
+		    preq->ack_id, preq->meta);
+	}
+	return 0;
+}
+
 /*
  * Callback that is made when a buffer is available.
  * Send prop request command to MCU.
@@ -613,9 +1013,20 @@ static void prop_req_cb(struct hp_buf *bp)
 {
 	struct prop_req_state *reqs = &prop_req_state;
 	struct prop_req *preq = reqs->req_list;
+	size_t size;
 
-	if (preq == NULL) {
+	if (preq == NULL || !prop_req_may_start(preq)) {
+		hp_buf_free(bp);	/* started again as replies complete */
+		return;
+	}
+
+	/*
+	 * The request may have changed since the buffer size was chosen.
+	 */
+	size = prop_req_buf_size();
+	if (size ? size > bp->size : bp->size < hp_buf_len) {
 		hp_buf_free(bp);
+		hp_buf_callback_pend_size(prop_req_cb, size);
 		return;
 	}
 	ASSERT(preq->handler);
@@ -623,17 +1034,15 @@ static void prop_req_cb(struct hp_buf *bp)
 }
 
 /*
- * Set up a new property request for a name.
+ * Set up a new property request for a name in the caller's context.
+ * prop_req_enq() copies it to a pool entry.
+ * Returns -1 if the name is too long.
  */
-static struct prop_req *prop_req_new(const char *name)
+static int prop_req_init(struct prop_req *preq, const char *name)
 {
-	struct prop_req *preq;
 	size_t len;
 
-	preq = calloc(1, sizeof(*preq));
-	if (!preq) {
-		return NULL;
-	}
+	memset(preq, 0, sizeof(*preq));
 
 	/*
 	 * Copy name to request.
@@ -641,13 +1050,11 @@ static struct prop_req *prop_req_new(const char *name)
 	if (name) {
 		len = strlen(name);
 		if (len >= sizeof(preq->name)) {
-			free(preq);
-			return NULL;
+			return -1;
 		}
 		memcpy(preq->name, name, len + 1);
 	}
-	ayla_timer_init(&preq->host_timer, prop_req_get_timeout);
-	return preq;
+	return 0;
 }
 
 /*
@@ -655,16 +1062,14 @@ static struct prop_req *prop_req_new(const char *name)
  */
 static void prop_req_handle_get(struct hp_buf *bp, struct prop_req *req)
 {
-	struct prop_req_state *reqs = &prop_req_state;
-	u32 time_limit = HOST_PROP_REQ_TIMEOUT;
 	const char *name = req->name;
 
 	if (!name[0]) {
 		name = NULL;
-		time_limit = HOST_PROP_FEATURES_TIMEOUT;
+		prop_cache_flush();	/* the MCU may have restarted */
 	}
-	reqs->get_req_id = data_tlv_prop_req_send(bp, name);
-	prop_req_timeout_start(req, time_limit);
+	req->req_id = data_tlv_prop_req_send(bp, name);
+	prop_req_wait(req, prop_req_time_limit(req));
 }
 
 /*
@@ -675,32 +1080,56 @@ static void prop_req_handle_get(struct hp_buf *bp, struct prop_req *req)
 enum ada_err prop_req_get(const char *name,
 		void (*cb)(struct prop *, void *, u32, int), void *arg)
 {
-	struct prop_req *preq;
+	struct prop_req req;
+	enum ada_err err;
 
-	preq = prop_req_new(name);
-	if (!preq) {
+	if (prop_req_init(&req, name)) {
 		return AE_ALLOC;
 	}
-	preq->callback = cb;
-	preq->arg = arg;
-	preq->handler = prop_req_handle_get;
-	preq->prop.name = name;
+	req.callback = cb;
+	req.arg = arg;
+	req.handler = prop_req_handle_get;
+	req.prop.name = name;
 
 	log_put(LOG_DEBUG "prop_req_get: prop %s", name);
-	prop_req_enq(preq);
+	err = prop_req_enq(&req);
+	if (err) {
+		return err;
+	}
 	return AE_IN_PROGRESS;
 }
 
+void prop_req_features_get(void)
+{
+	struct prop_req_state *reqs = &prop_req_state;
+	struct prop_req *preq;
+
+	/*
+	 * An earlier feature request may have been lost with the link.
+	 * Finish it so the new one need not wait for its timeout.
+	 */
+	for (preq = reqs->wait_list; preq; preq = preq->next) {
+		if (prop_req_is_features(preq)) {
+			prop_req_done(preq, NULL, 0);
+			break;
+		}
+	}
+	preq = prop_req_alloc();
+	if (!preq) {
+		return;
+	}
+	ayla_timer_init(&preq->host_timer, prop_req_get_timeout);
+	preq->handler = prop_req_handle_get;
+	prop_req_enq_int(preq);
+}
+
 /*
  * Handle sending a continuation request.
  */
 static void prop_req_continuation(struct hp_buf *bp, struct prop_req *req)
 {
-	struct prop_req_state *reqs = &prop_req_state;
-
-	data_tlv_req_next(bp, req->continuation, &reqs->get_req_id);
-
-	prop_req_timeout_start(req, HOST_PROP_REQ_TIMEOUT);
+	data_tlv_req_next(bp, req->continuation, &req->req_id);
+	prop_req_wait(req, HOST_PROP_REQ_TIMEOUT);
 }
 
 /*
@@ -713,51 +1142,67 @@ int prop_req_get_next(u32 continuation,
 		void (*cb)(struct prop *, void *arg, u32 cont, int err),
 		void *arg)
 {
-	struct prop_req *preq;
+	struct prop_req req;
 
-	preq = prop_req_new(NULL);
-	if (!preq) {
+	prop_req_init(&req, NULL);
+	req.callback = cb;
+	req.arg = arg;
+	req.continuation = continuation;
+	req.handler = prop_req_continuation;
+
+	if (prop_req_enq(&req)) {
 		return -1;
 	}
-	preq->callback = cb;
-	preq->arg = arg;
-	preq->continuation = continuation;
-	preq->handler = prop_req_continuation;
-
-	prop_req_enq(preq);
 	return 0;
 }
 
 static void prop_req_timeout_start(struct prop_req *preq, u32 time)
 {
+	preq->halted = 0;
+	preq->deadline_ms = clock_ms() + time;
 	host_proto_timer_set(&preq->host_timer, time);
 }
 
 static void prop_req_timeout_end(struct prop_req *preq)
 {
+	preq->halted = 0;
 	host_proto_timer_cancel(&preq->host_timer);
 }
 
+/*
+ * Pause the reply timeouts of the GETs sent, as the MCU cannot answer
+ * while ADS is busy.  Each keeps the time it had left.
+ */
 void prop_req_timeout_halt(void)
 {
-	struct prop_req_state *reqs = &prop_req_state;
-	struct prop_req *preq = reqs->req_list;
+	struct prop_req *preq;
+	u32 now = clock_ms();
 
-	if (!preq) {
-		return;
+	for (preq = prop_req_state.wait_list; preq; preq = preq->next) {
+		if (preq->halted) {
+			continue;
+		}
+		preq->time_left = 0;
+		if (clock_gt(preq->deadline_ms, now)) {
+			preq->time_left = preq->deadline_ms - now;
+		}
+		host_proto_timer_cancel(&preq->host_timer);
+		preq->halted = 1;
 	}
-	prop_req_timeout_end(preq);
 }
 
+/*
+ * Resume the paused reply timeouts with the time each had left.
+ */
 void prop_req_timeout_restart(void)
 {
-	struct prop_req_state *reqs = &prop_req_state;
-	struct prop_req *preq = reqs->req_list;
+	struct prop_req *preq;
 
-	if (!preq) {
-		return;
+	for (preq = prop_req_state.wait_list; preq; preq = preq->next) {
+		if (preq->halted) {
+			prop_req_timeout_start(preq, preq->time_left);
+		}
 	}
-	prop_req_timeout_start(preq, HOST_PROP_REQ_TIMEOUT);
 }
 
 /*
@@ -766,10 +1211,11 @@ void prop_req_timeout_restart(void)
  */
 void prop_req_resp_reset_timeout(u16 req_id)
 {
-	struct prop_req_state *reqs = &prop_req_state;
+	struct prop_req *preq;
 
-	if (req_id == reqs->get_req_id) {
-		prop_req_timeout_restart();
+	preq = prop_req_wait_find(req_id);
+	if (preq) {
+		prop_req_timeout_start(preq, prop_req_time_limit(preq));
 	}
 }
 
@@ -780,16 +1226,15 @@ void prop_req_resp_reset_timeout(u16 req_id)
 int prop_req_get_resp(u16 req_id, struct prop *prop,
 			u32 continuation, int error)
 {
-	struct prop_req_state *reqs = &prop_req_state;
-	struct prop_req *preq = reqs->req_list;
+	struct prop_req *preq;
 
-	if (preq == NULL || req_id != reqs->get_req_id) {
+	preq = prop_req_wait_find(req_id);
+	if (!preq) {
 		return AERR_INTERNAL;
 	}
 	preq->continuation = continuation;
 	prop_req_done(preq, prop, error);
 	data_tlv_clear_ads(req_id, 1);
-	data_tlv_reset_offset();
 	return 0;
 }
 
@@ -831,10 +1276,11 @@ static void prop_req_handle_send(struct hp_buf *bp, struct prop_req *preq)
 	enum ada_err err;
 	int mcu_err;
 	u8 src;
+	u8 more;
 
 	err = data_tlv_send(bp, prop->name, prop->val, prop->len,
 	    prop->type, &preq->offset, prop->send_dest,
-	    preq->req_id, preq->use_req_id, preq->ack_id, prop->dp_meta);
+	    preq->req_id, preq->use_req_id, preq->ack_id, preq->meta);
 	if (err == AE_BUF) {
 		log_put(LOG_DEBUG "%s: send \"%s\" off %lu AE_BUF",
 		    __func__, prop->name, preq->offset);
@@ -850,9 +1296,23 @@ static void prop_req_handle_send(struct hp_buf *bp, struct prop_req *preq)
 		    __func__, prop->name, preq->offset);
 		mcu_err = 0;
 	}
+	prop_cache_invalidate(prop->name);	/* until the MCU reports it */
 	src = prop->send_dest;
+	more = preq->use_req_id;
 	prop_req_done(preq, NULL, mcu_err);
 	ada_prop_mgr_recv_done(src);
+
+	/*
+	 * Hold a packed update for more only while sends are queued, or
+	 * while answering an MCU request, which ends with its own confirm.
+	 */
+	preq = prop_req_state.req_list;
+	if (preq && preq->handler == prop_req_handle_send) {
+		more = 1;
+	}
+	if (!more) {
+		data_tlv_pack_flush();
+	}
 }
 
 /*
@@ -863,33 +1323,47 @@ enum ada_err prop_req_prop_send(const char *name, const void *val,
 	u8 src, u16 req_id, u8 use_req_id,
 	const char *ack_id, const struct prop_dp_meta *dp_meta)
 {
-	struct prop_req *preq;
+	struct prop_req req;
 	struct prop *prop;
+	struct data_tlv_meta *meta = NULL;
 
-	preq = prop_req_new(name);
-	if (!preq) {
+	/*
+	 * Keep the metadata with the request, since the caller's copy may
+	 * not outlast the call.
+	 */
+	if (dp_meta && dp_meta->key[0] != '\0' && dp_meta->value[0] != '\0') {
+		meta = data_tlv_meta_alloc(dp_meta);
+		if (!meta) {
+			return AE_ALLOC;
+		}
+	}
+	if (prop_req_init(&req, name)) {
+		free(meta);
 		return AE_ALLOC;
 	}
-	preq->handler = prop_req_handle_send;
-	preq->offset = *offset;
-	preq->req_id = req_id;
-	preq->use_req_id = use_req_id;
+	req.handler = prop_req_handle_send;
+	req.meta = meta;
+	req.offset = *offset;
+	req.req_id = req_id;
+	req.use_req_id = use_req_id;
 
 #ifdef AYLA_HOST_PROP_ACK_SUPPORT
-	if (snprintf(preq->ack_id, sizeof(preq->ack_id), "%s",
-	    ack_id) >= sizeof(preq->ack_id)) {
-		preq->ack_id[0] = '\0';
+	if (snprintf(req.ack_id, sizeof(req.ack_id), "%s",
+	    ack_id) >= sizeof(req.ack_id)) {
+		req.ack_id[0] = '\0';
 	}
 #endif
 
-	prop = &preq->prop;
-	prop->name = preq->name;
+	prop = &req.prop;
+	prop->name = req.name;
 	prop->val = (void *)val;	/* discards const */
 	prop->len = val_len;
 	prop->type = type;
 	prop->send_dest = src;
-	prop->dp_meta = (struct prop_dp_meta *)dp_meta;	/* discards const */
 
-	prop_req_enq(preq);
+	if (prop_req_enq(&req)) {
+		free(meta);
+		return AE_ALLOC;
+	}
 	return AE_OK;
 }
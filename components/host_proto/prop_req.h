@@ -16,6 +16,20 @@ enum ada_err prop_req_get(const char *name,
 		void (*cb)(struct prop *, void *, u32 cont, int err),
 		void *arg);
 
+/*
+ * Ask the MCU for its features again, as after a restart.
+ * Called by the transport on the host_proto thread.
+ */
+void prop_req_features_get(void);
+
+/*
+ * Set the number of GETs that may wait for MCU replies at once.
+ * Each has its own request ID and timeout.  0 restores the default,
+ * which is one GET unless the MCU gives MCU_GET_PIPELINE.
+ * No more than DATA_TLV_RESP_SLOTS are outstanding in any case.
+ */
+void prop_req_inflight_set(unsigned int count);
+
 /*
  * Issue request to the host to get next property.
  * A callback with a zero continuation will indicate the end.